@@ -107,7 +107,7 @@ static void *pkt_io_recv(void *_arg)
 						 ofp_eth_vlan_processing);
 			}
 		}
-		ofp_send_pending_pkt();
+		ofp_packet_burst_end();
 	}
 
 	/* Never reached */
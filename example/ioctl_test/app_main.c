@@ -91,7 +91,7 @@ static void *app_dispatcher_thread(void *arg)
 
 			ofp_packet_input(pkt, in_queue,
 					   ofp_eth_vlan_processing);
-			ofp_send_pending_pkt();
+			ofp_packet_burst_end();
 			continue;
 		}
 
@@ -8,7 +8,6 @@
 #include "netwrap_common.h"
 #include <sys/time.h>
 #include <sys/types.h>
-#include <unistd.h>
 #include <odp_api.h>
 #include "ofp.h"
 #include "netwrap_select.h"
@@ -23,72 +22,77 @@ void setup_select_wrappers(void)
 	LIBC_FUNCTION(select);
 }
 
+static void to_ofp_fd_set(int nfds, fd_set *set, ofp_fd_set *ofp_set)
+{
+	int i;
+
+	OFP_FD_ZERO(ofp_set);
+	if (!set)
+		return;
+
+	for (i = OFP_SOCK_NUM_OFFSET; i < nfds; i++)
+		if (FD_ISSET(i, set))
+			OFP_FD_SET(i, ofp_set);
+}
+
+static void from_ofp_fd_set(int nfds, ofp_fd_set *ofp_set, fd_set *set)
+{
+	int i;
+
+	if (!set)
+		return;
+
+	for (i = OFP_SOCK_NUM_OFFSET; i < nfds; i++)
+		if (FD_ISSET(i, set) && !OFP_FD_ISSET(i, ofp_set))
+			FD_CLR(i, set);
+}
+
 int select(int nfds, fd_set *readfds, fd_set *writefds,
 	fd_set *exceptfds, struct timeval *timeout)
 {
 	int select_value;
 
 	if (IS_OFP_SOCKET((nfds - 1))) {
-		ofp_fd_set ofp_readfds, ofp_readfds_bku;
+		ofp_fd_set ofp_readfds, ofp_writefds, ofp_exceptfds;
 		struct ofp_timeval ofp_timeout_local;
-		struct ofp_timeval *ofp_timeout;
-		int i;
-		uint32_t period_usec = 0;
-		uint32_t temp_period_usec = 0;
+		struct ofp_timeval *ofp_timeout = NULL;
 
-		(void)writefds;
-		(void)exceptfds;
+		to_ofp_fd_set(nfds, readfds, &ofp_readfds);
+		to_ofp_fd_set(nfds, writefds, &ofp_writefds);
+		to_ofp_fd_set(nfds, exceptfds, &ofp_exceptfds);
 
-		if (!readfds) {
-			errno = EBADF;
-			return -1;
+		if (timeout) {
+			ofp_timeout_local.tv_sec = timeout->tv_sec;
+			ofp_timeout_local.tv_usec = timeout->tv_usec;
+			ofp_timeout = &ofp_timeout_local;
 		}
 
-		OFP_FD_ZERO(&ofp_readfds_bku);
-		for (i = OFP_SOCK_NUM_OFFSET; i < nfds; i++)
-			if (FD_ISSET(i, readfds))
-				OFP_FD_SET(i, &ofp_readfds_bku);
-
-		ofp_timeout = &ofp_timeout_local;
-		ofp_timeout_local.tv_sec = 0;
-		ofp_timeout_local.tv_usec = 0;
-
-		if (timeout)
-			period_usec = timeout->tv_sec * 1000000UL +
-				timeout->tv_usec;
-
+		/* ofp_select() sleeps until a socket changes readiness.
+		 * Without a timeout it may return early on a change of a
+		 * socket not in the sets, so wait again. */
 		do {
-			memcpy(&ofp_readfds, &ofp_readfds_bku,
-					sizeof(ofp_readfds));
-			select_value = ofp_select(nfds, &ofp_readfds, NULL,
-				NULL, ofp_timeout);
-			if (select_value)
+			select_value = ofp_select(nfds,
+				readfds ? &ofp_readfds : NULL,
+				writefds ? &ofp_writefds : NULL,
+				exceptfds ? &ofp_exceptfds : NULL,
+				ofp_timeout);
+			if (select_value || ofp_timeout)
 				break;
-			else if (!timeout)
-				continue;
-			else {
-				usleep(100);
-				temp_period_usec += 100;
-				if (temp_period_usec > period_usec) {
-					select_value = 0;
-					break;
-				}
-			}
-
+			to_ofp_fd_set(nfds, readfds, &ofp_readfds);
+			to_ofp_fd_set(nfds, writefds, &ofp_writefds);
+			to_ofp_fd_set(nfds, exceptfds, &ofp_exceptfds);
 		} while (1);
 		errno = NETWRAP_ERRNO(ofp_errno);
 
-		if (select_value > 0) {
-			for (i = OFP_SOCK_NUM_OFFSET; i < nfds; i++)
-				if (FD_ISSET(i, readfds) &&
-					!OFP_FD_ISSET(i, &ofp_readfds))
-						FD_CLR(i, readfds);
-		} else if (select_value == 0)
-			FD_ZERO(readfds);
-
-		if (!ofp_errno && timeout) {
-			timeout->tv_sec = ofp_timeout_local.tv_sec;
-			timeout->tv_usec = ofp_timeout_local.tv_usec;
+		if (select_value >= 0) {
+			from_ofp_fd_set(nfds, &ofp_readfds, readfds);
+			from_ofp_fd_set(nfds, &ofp_writefds, writefds);
+			from_ofp_fd_set(nfds, &ofp_exceptfds, exceptfds);
+		}
+
+		if (select_value == 0 && timeout) {
+			timeout->tv_sec = 0;
+			timeout->tv_usec = 0;
 		}
 	} else if (libc_select)
 		select_value = (*libc_select)(nfds, readfds, writefds,
@@ -150,7 +150,7 @@ static void *event_dispatcher(void *arg)
 	while (likely(*is_running)) {
 		direct_recv(appl_params);
 
-		ofp_send_pending_pkt();
+		ofp_packet_burst_end();
 
 		if (((loop_cnt++)&4095) == 0) {
 			/* dpdk timer schedule */
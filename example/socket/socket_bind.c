@@ -127,6 +127,41 @@ int bind_ip4_any(int fd)
 	return 0;
 }
 
+/* Both threads bind and listen on the same port as a reuseport group. */
+int bind_ip4_reuseport(int fd)
+{
+	struct ofp_sockaddr_in addr = {0};
+	int optval = 1;
+
+	if (ofp_setsockopt(fd, OFP_SOL_SOCKET, OFP_SO_REUSEPORT, &optval,
+		sizeof(optval)) == -1) {
+		OFP_ERR("Faild to set SO_REUSEPORT (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	addr.sin_family = OFP_AF_INET;
+	addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 2);
+	addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if (ofp_bind(fd, (const struct ofp_sockaddr *)&addr,
+		sizeof(struct ofp_sockaddr_in)) == -1) {
+		OFP_ERR("Faild to bind socket (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	if (ofp_listen(fd, 10) == -1) {
+		OFP_ERR("Faild to listen (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
 #ifdef INET6
 int bind_ip6_local_ip(int fd)
 {
@@ -18,6 +18,7 @@ int init_tcp6_create_socket(int *pfd_thread1, int *pfd_thread2);
 
 int bind_ip4_local_ip(int fd);
 int bind_ip4_any(int fd);
+int bind_ip4_reuseport(int fd);
 
 #ifdef INET6
 int bind_ip6_local_ip(int fd);
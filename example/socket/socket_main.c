@@ -176,6 +176,12 @@ int main(int argc, char *argv[])
 	end_suite();
 	OFP_INFO("Test ended.\n");
 
+	OFP_INFO("\n\nSuite: IPv4 TCP socket: bind + listen with SO_REUSEPORT.\n\n");
+	if (!init_suite(init_tcp_create_socket))
+		run_suite(instance, bind_ip4_reuseport, bind_ip4_reuseport);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
 #ifdef INET6
 	OFP_INFO("\n\nSuite: IPv6 UDP socket: bind.\n\n");
 	if (!init_suite(init_udp6_create_socket))
@@ -287,6 +293,24 @@ int main(int argc, char *argv[])
 	end_suite();
 	OFP_INFO("Test ended.\n");
 
+	OFP_INFO("\n\nSuite: IPv4 UDP bind local IP: sendmmsg + recvmmsg.\n\n");
+	if (!init_suite(init_udp_local_ip))
+		run_suite(instance, sendmmsg_udp_local_ip, recvmmsg_udp);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 UDP bind local IP: send + recv burst.\n\n");
+	if (!init_suite(init_udp_local_ip))
+		run_suite(instance, send_udp_burst_local_ip, recv_udp_burst);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 UDP bind local IP: segmented send + coalesced recvmsg.\n\n");
+	if (!init_suite(init_udp_local_ip))
+		run_suite(instance, send_udp_gso_local_ip, recv_udp_gro);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
 	OFP_INFO("\n\nSuite: IPv4 UDP bind any address: sendto + recv.\n\n");
 	if (!init_suite(init_udp_any))
 		run_suite(instance, send_udp_any, recv_udp);
@@ -395,6 +419,42 @@ int main(int argc, char *argv[])
 	end_suite();
 	OFP_INFO("Test ended.\n");
 
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: send + recv_pkt.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_local_ip, receive_tcp_pkt);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: send + aio accept, recv.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_local_ip, receive_tcp_aio);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: send + busy poll recv.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_local_ip, receive_tcp_busy_poll);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: send_pkt + recv.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_pkt, receive_tcp);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: sendfile + recv.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_sendfile, receive_tcp);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
+	OFP_INFO("\n\nSuite: IPv4 TCP socket local IP: corked send + recv.\n\n");
+	if (!init_suite(init_tcp_bind_listen_local_ip))
+		run_suite(instance, send_tcp4_cork, receive_tcp);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
 	OFP_INFO("\n\nSuite: IPv4 TCP socket any IP: send + recv.\n\n");
 	if (!init_suite(init_tcp_bind_listen_any))
 		run_suite(instance, send_tcp4_any, receive_tcp);
@@ -467,6 +527,13 @@ int main(int argc, char *argv[])
 	end_suite();
 	OFP_INFO("Test ended.\n");
 
+	OFP_INFO("\n\nSuite: IPv4 UDP bind local IP: socket_sigevent batch rcv.\n\n");
+	if (!init_suite(init_udp_bind_local_ip))
+		run_suite(instance, recv_send_udp_local_ip,
+			  socket_sigevent_udp4_batch);
+	end_suite();
+	OFP_INFO("Test ended.\n");
+
 #ifdef INET6
 	OFP_INFO("\n\nSuite: IPv6 UDP bind local IP: socket_sigevent rcv.\n\n");
 	if (!init_suite(init_udp6_bind_local_ip))
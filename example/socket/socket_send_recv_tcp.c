@@ -5,6 +5,7 @@
  * SPDX-License-Identifier:	BSD-3-Clause
  */
 
+#include <stdlib.h>
 #include "ofp.h"
 #include "socket_send_recv_tcp.h"
 #include "socket_util.h"
@@ -56,6 +57,135 @@ int send_tcp4_any(int fd)
 	return _send_tcp4(fd, OFP_INADDR_ANY, 1);
 }
 
+/* Send the buffer from an application built packet, without copy. */
+int send_tcp4_pkt(int fd)
+{
+	struct ofp_sockaddr_in addr = {0};
+	odp_packet_t pkt;
+	uint32_t len = strlen(tcp_buf) + 1;
+
+	addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	addr.sin_family = OFP_AF_INET;
+	addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if ((ofp_connect(fd, (struct ofp_sockaddr *)&addr,
+			sizeof(addr)) == -1) &&
+		(ofp_errno != OFP_EINPROGRESS)) {
+		OFP_ERR("Faild to connect (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	sleep(1); /* ToFix: connect is not blocking*/
+
+	pkt = odp_packet_alloc(odp_pool_lookup(SHM_PKT_POOL_NAME), len);
+	if (pkt == ODP_PACKET_INVALID) {
+		OFP_ERR("Faild to allocate packet\n");
+		return -1;
+	}
+	odp_packet_copy_from_mem(pkt, 0, len, tcp_buf);
+
+	if (ofp_send_pkt(fd, pkt, 0) != (ofp_ssize_t)len) {
+		OFP_ERR("Faild to send (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* Send the buffer from a file with ofp_sendfile(). */
+int send_tcp4_sendfile(int fd)
+{
+	struct ofp_sockaddr_in addr = {0};
+	char path[] = "/tmp/ofp_sendfile_XXXXXX";
+	size_t len = strlen(tcp_buf) + 1;
+	ofp_off_t sbytes = 0;
+	int file_fd, ret;
+
+	file_fd = mkstemp(path);
+	if (file_fd == -1) {
+		OFP_ERR("Faild to create file\n");
+		return -1;
+	}
+	unlink(path);
+
+	if (write(file_fd, tcp_buf, len) != (ssize_t)len) {
+		OFP_ERR("Faild to write file\n");
+		close(file_fd);
+		return -1;
+	}
+
+	addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	addr.sin_family = OFP_AF_INET;
+	addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if ((ofp_connect(fd, (struct ofp_sockaddr *)&addr,
+			sizeof(addr)) == -1) &&
+		(ofp_errno != OFP_EINPROGRESS)) {
+		OFP_ERR("Faild to connect (errno = %d)\n", ofp_errno);
+		close(file_fd);
+		return -1;
+	}
+
+	sleep(1); /* ToFix: connect is not blocking*/
+
+	ret = ofp_sendfile(file_fd, fd, 0, 0, NULL, &sbytes, 0);
+	close(file_fd);
+	if (ret == -1 || sbytes != (ofp_off_t)len) {
+		OFP_ERR("Faild to sendfile (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* Send the buffer in two corked writes that go out as one segment. */
+int send_tcp4_cork(int fd)
+{
+	struct ofp_sockaddr_in addr = {0};
+	size_t len = strlen(tcp_buf) + 1, half = len / 2;
+	int optval = 1;
+
+	addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	addr.sin_family = OFP_AF_INET;
+	addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if ((ofp_connect(fd, (struct ofp_sockaddr *)&addr,
+			sizeof(addr)) == -1) &&
+		(ofp_errno != OFP_EINPROGRESS)) {
+		OFP_ERR("Faild to connect (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	sleep(1); /* ToFix: connect is not blocking*/
+
+	if (ofp_setsockopt(fd, OFP_IPPROTO_TCP, OFP_TCP_CORK, &optval,
+			   sizeof(optval)) == -1) {
+		OFP_ERR("Faild to cork (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	if (ofp_send(fd, tcp_buf, half, 0) == -1 ||
+	    ofp_send(fd, tcp_buf + half, len - half, 0) == -1) {
+		OFP_ERR("Faild to send (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	optval = 0;
+	if (ofp_setsockopt(fd, OFP_IPPROTO_TCP, OFP_TCP_CORK, &optval,
+			   sizeof(optval)) == -1) {
+		OFP_ERR("Faild to uncork (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
 /* Send two tcp buffers with a timeout between. */
 int send_tcp4_msg_waitall(int fd)
 {
@@ -214,6 +344,164 @@ int receive_multi_tcp(int fd)
 	return _receive_tcp(fd, TCP_CYCLES);
 }
 
+/* verify a receiver that busy polls gets the data. */
+int receive_tcp_busy_poll(int fd)
+{
+	int optval = 100000;
+
+	/* Inherited by the accepted socket */
+	if (ofp_setsockopt(fd, OFP_SOL_SOCKET, OFP_SO_BUSY_POLL, &optval,
+			   sizeof(optval)) == -1) {
+		OFP_ERR("FAILED to set busy poll (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	return _receive_tcp(fd, 1);
+}
+
+/* verify ofp_recv_pkt hands over the received data as packets. */
+int receive_tcp_pkt(int fd)
+{
+	char buf[1024];
+	odp_packet_t pkts[8];
+	uint32_t len = 0, pkt_len;
+	int fd_accepted = -1;
+	int i, num;
+
+	fd_accepted = ofp_accept(fd, NULL, NULL);
+
+	if (fd_accepted == -1) {
+		OFP_ERR("FAILED to accept connection (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	while (len < strlen(tcp_buf) + 1) {
+		num = ofp_recv_pkt(fd_accepted, pkts, 8, 0);
+		if (num <= 0) {
+			OFP_ERR("FAILED to recv (errno = %d)\n",
+				ofp_errno);
+			ofp_close(fd_accepted);
+			return -1;
+		}
+
+		for (i = 0; i < num; i++) {
+			pkt_len = odp_packet_len(pkts[i]);
+			if (len + pkt_len <= sizeof(buf))
+				odp_packet_copy_to_mem(pkts[i], 0, pkt_len,
+						       buf + len);
+			len += pkt_len;
+			odp_packet_free(pkts[i]);
+		}
+	}
+
+	if (len != strlen(tcp_buf) + 1 || strcmp(buf, tcp_buf) != 0) {
+		OFP_ERR("FAILED : data received is malformed:[%d]\n", len);
+		ofp_close(fd_accepted);
+		return -1;
+	}
+
+	if (ofp_close(fd_accepted) == -1) {
+		OFP_ERR("FAILED to close accepted socket (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* Wait for one completion of an asynchronous operation. */
+static int aio_wait(ofp_aio_ring_t ring, struct ofp_aio_cqe *cqe)
+{
+	int i;
+
+	for (i = 0; i < 5000; i++) {
+		if (ofp_aio_reap(ring, cqe, 1) == 1)
+			return 0;
+		usleep(1000);
+	}
+	OFP_ERR("FAILED : no completion\n");
+	return -1;
+}
+
+/* verify accept and recv submitted to an aio ring complete. */
+int receive_tcp_aio(int fd)
+{
+	char buf[1024];
+	odp_queue_param_t qparam;
+	odp_queue_t queue;
+	ofp_aio_ring_t ring;
+	struct ofp_aio_sqe sqe = {0};
+	struct ofp_aio_cqe cqe;
+	uint32_t len = 0;
+	int fd_accepted = -1;
+	int ret = -1;
+
+	odp_queue_param_init(&qparam);
+	qparam.type = ODP_QUEUE_TYPE_PLAIN;
+	queue = odp_queue_create("aio_compl", &qparam);
+	if (queue == ODP_QUEUE_INVALID) {
+		OFP_ERR("FAILED to create queue\n");
+		return -1;
+	}
+
+	ring = ofp_aio_ring_create(queue, 4);
+	if (ring == OFP_AIO_RING_INVALID) {
+		OFP_ERR("FAILED to create ring (errno = %d)\n", ofp_errno);
+		odp_queue_destroy(queue);
+		return -1;
+	}
+
+	sqe.op = OFP_AIO_ACCEPT;
+	sqe.fd = fd;
+	sqe.user_data = 1;
+	if (ofp_aio_submit(ring, &sqe, 1) != 1 || aio_wait(ring, &cqe))
+		goto out;
+	if (cqe.op != OFP_AIO_ACCEPT || cqe.user_data != 1 || cqe.res < 0) {
+		OFP_ERR("FAILED to accept connection (res = %d)\n", cqe.res);
+		goto out;
+	}
+	fd_accepted = cqe.res;
+
+	while (len < strlen(tcp_buf) + 1) {
+		sqe.op = OFP_AIO_RECV;
+		sqe.fd = fd_accepted;
+		sqe.buf = buf + len;
+		sqe.len = sizeof(buf) - len;
+		sqe.user_data = 2;
+		if (ofp_aio_submit(ring, &sqe, 1) != 1 || aio_wait(ring, &cqe))
+			goto out;
+		if (cqe.user_data != 2 || cqe.res <= 0) {
+			OFP_ERR("FAILED to recv (res = %d)\n", cqe.res);
+			goto out;
+		}
+		len += cqe.res;
+	}
+
+	if (len != strlen(tcp_buf) + 1 || strcmp(buf, tcp_buf) != 0) {
+		OFP_ERR("FAILED : data received is malformed:[%d]\n", len);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	if (fd_accepted != -1 && ofp_close(fd_accepted) == -1) {
+		OFP_ERR("FAILED to close accepted socket (errno = %d)\n",
+			ofp_errno);
+		ret = -1;
+	}
+	if (ofp_aio_ring_destroy(ring) == -1) {
+		OFP_ERR("FAILED to destroy ring (errno = %d)\n", ofp_errno);
+		ret = -1;
+	}
+	odp_queue_destroy(queue);
+
+	if (!ret)
+		OFP_INFO("SUCCESS.\n");
+	return ret;
+}
+
 /* verify OFP_MSG_WAITALL works for ofp_recv. */
 int receive_tcp4_msg_waitall(int fd)
 {
@@ -12,6 +12,9 @@ int send_tcp4_local_ip(int fd);
 int send_tcp4_any(int fd);
 int send_multi_tcp4_any(int fd);
 int send_tcp4_msg_waitall(int fd);
+int send_tcp4_pkt(int fd);
+int send_tcp4_sendfile(int fd);
+int send_tcp4_cork(int fd);
 
 #ifdef INET6
 int send_tcp6_local_ip(int fd);
@@ -20,6 +23,9 @@ int send_tcp6_any(int fd);
 
 int receive_tcp(int fd);
 int receive_multi_tcp(int fd);
+int receive_tcp_pkt(int fd);
+int receive_tcp_aio(int fd);
+int receive_tcp_busy_poll(int fd);
 int receive_tcp4_msg_waitall(int fd);
 
 #endif /* __SOCKET_SEND_RECV_TCP_H__ */
@@ -143,6 +143,235 @@ int send_udp_any(int fd)
 	return 0;
 }
 
+#define MMSG_CNT 3
+
+int sendmmsg_udp_local_ip(int fd)
+{
+	const char *buf[MMSG_CNT] = {"socket_test1", "socket_test2",
+				     "socket_test3"};
+	struct ofp_iovec iov[MMSG_CNT];
+	struct ofp_mmsghdr msgvec[MMSG_CNT];
+	struct ofp_sockaddr_in dest_addr = {0};
+	int i, ret;
+
+	dest_addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	dest_addr.sin_family = OFP_AF_INET;
+	dest_addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	dest_addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if (ofp_connect(fd, (struct ofp_sockaddr *)&dest_addr,
+		sizeof(dest_addr)) == -1) {
+		OFP_ERR("Faild to connect socket (errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	memset(msgvec, 0, sizeof(msgvec));
+	for (i = 0; i < MMSG_CNT; i++) {
+		iov[i].iov_base = (void *)(uintptr_t)buf[i];
+		iov[i].iov_len = strlen(buf[i]);
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = ofp_sendmmsg(fd, msgvec, MMSG_CNT, 0);
+	if (ret != MMSG_CNT) {
+		OFP_ERR("Faild to send data: %d (errno = %d)\n",
+			ret, ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("%d messages sent successfully.\n", ret);
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+int recvmmsg_udp(int fd)
+{
+	char buf[MMSG_CNT][20];
+	struct ofp_iovec iov[MMSG_CNT];
+	struct ofp_mmsghdr msgvec[MMSG_CNT];
+	struct ofp_sockaddr_in addr[MMSG_CNT];
+	int i, ret, received = 0;
+
+	memset(msgvec, 0, sizeof(msgvec));
+	for (i = 0; i < MMSG_CNT; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = sizeof(buf[i]) - 1;
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+		msgvec[i].msg_hdr.msg_name = &addr[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+	}
+
+	while (received < MMSG_CNT) {
+		ret = ofp_recvmmsg(fd, &msgvec[received], MMSG_CNT - received,
+				   OFP_MSG_WAITFORONE, NULL);
+		if (ret == -1) {
+			OFP_ERR("Faild to rcv data(errno = %d)\n", ofp_errno);
+			return -1;
+		}
+		received += ret;
+	}
+
+	for (i = 0; i < MMSG_CNT; i++) {
+		buf[i][msgvec[i].msg_len] = 0;
+		OFP_INFO("Data (%s, len = %d) was received.\n",
+			 buf[i], msgvec[i].msg_len);
+		if (msgvec[i].msg_hdr.msg_namelen != sizeof(addr[i])) {
+			OFP_ERR("Faild to rcv source address: %d\n",
+				msgvec[i].msg_hdr.msg_namelen);
+			return -1;
+		}
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* More datagrams than the initial socket buffer ring holds */
+#define BURST_CNT (OFP_SOCKBUF_LEN * 3)
+
+int send_udp_burst_local_ip(int fd)
+{
+	const char *buf = "socket_test";
+	struct ofp_sockaddr_in dest_addr = {0};
+	int i;
+
+	dest_addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	dest_addr.sin_family = OFP_AF_INET;
+	dest_addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	dest_addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	for (i = 0; i < BURST_CNT; i++)
+		if (ofp_sendto(fd, buf, strlen(buf), 0,
+			       (struct ofp_sockaddr *)&dest_addr,
+			       sizeof(dest_addr)) == -1) {
+			OFP_ERR("Faild to send data(errno = %d)\n",
+				ofp_errno);
+			return -1;
+		}
+
+	OFP_INFO("%d datagrams sent successfully.\n", BURST_CNT);
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* Let the burst queue up before reading it back. */
+int recv_udp_burst(int fd)
+{
+	char buf[20];
+	int i, len;
+
+	sleep(1);
+
+	for (i = 0; i < BURST_CNT; i++) {
+		len = ofp_recv(fd, buf, sizeof(buf), OFP_MSG_DONTWAIT);
+		if (len == -1) {
+			OFP_ERR("Faild to rcv datagram %d (errno = %d)\n",
+				i, ofp_errno);
+			return -1;
+		}
+	}
+
+	OFP_INFO("%d datagrams received.\n", BURST_CNT);
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+#define GSO_CNT 4
+#define GSO_SEG "socket_test"
+
+/* One send, split into GSO_CNT datagrams by the stack */
+int send_udp_gso_local_ip(int fd)
+{
+	char buf[GSO_CNT * sizeof(GSO_SEG)];
+	struct ofp_sockaddr_in dest_addr = {0};
+	int segsize = strlen(GSO_SEG);
+	int i;
+
+	for (i = 0; i < GSO_CNT; i++)
+		memcpy(buf + i * segsize, GSO_SEG, segsize);
+
+	if (ofp_setsockopt(fd, OFP_IPPROTO_UDP, OFP_UDP_SEGMENT,
+			   &segsize, sizeof(segsize)) == -1) {
+		OFP_ERR("Faild to set OFP_UDP_SEGMENT (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	dest_addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	dest_addr.sin_family = OFP_AF_INET;
+	dest_addr.sin_port = odp_cpu_to_be_16(TEST_PORT + 1);
+	dest_addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if (ofp_sendto(fd, buf, GSO_CNT * segsize, 0,
+		(struct ofp_sockaddr *)&dest_addr,
+		sizeof(dest_addr)) == -1) {
+		OFP_ERR("Faild to send data(errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	OFP_INFO("%d segments sent successfully.\n", GSO_CNT);
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
+/* Read the segments back coalesced, in as few calls as they arrive in */
+int recv_udp_gro(int fd)
+{
+	char buf[GSO_CNT * sizeof(GSO_SEG)];
+	char control[OFP_CMSG_SPACE(sizeof(int))];
+	struct ofp_iovec iov;
+	struct ofp_msghdr msg;
+	struct ofp_cmsghdr *cm;
+	int segsize = strlen(GSO_SEG);
+	int on = 1;
+	int len, received = 0;
+
+	if (ofp_setsockopt(fd, OFP_IPPROTO_UDP, OFP_UDP_GRO,
+			   &on, sizeof(on)) == -1) {
+		OFP_ERR("Faild to set OFP_UDP_GRO (errno = %d)\n",
+			ofp_errno);
+		return -1;
+	}
+
+	while (received < GSO_CNT * segsize) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf + received;
+		iov.iov_len = sizeof(buf) - received;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		len = ofp_recvmsg(fd, &msg, 0);
+		if (len == -1) {
+			OFP_ERR("Faild to rcv data(errno = %d)\n", ofp_errno);
+			return -1;
+		}
+
+		cm = OFP_CMSG_FIRSTHDR(&msg);
+		if (cm && cm->cmsg_level == OFP_IPPROTO_UDP &&
+		    cm->cmsg_type == OFP_UDP_GRO &&
+		    *(int *)OFP_CMSG_DATA(cm) != segsize) {
+			OFP_ERR("Wrong segment size %d\n",
+				*(int *)OFP_CMSG_DATA(cm));
+			return -1;
+		}
+		if (len % segsize) {
+			OFP_ERR("Partial segment received, len = %d\n", len);
+			return -1;
+		}
+
+		OFP_INFO("%d segments received in one call.\n",
+			 len / segsize);
+		received += len;
+	}
+
+	OFP_INFO("SUCCESS.\n");
+	return 0;
+}
+
 int recvfrom_udp(int fd)
 {
 	char buf[20];
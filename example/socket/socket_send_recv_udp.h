@@ -16,6 +16,12 @@ int send_udp_any(int fd);
 int recv_udp(int fd);
 int recvfrom_udp(int fd);
 int recvfrom_udp_null_addr(int fd);
+int sendmmsg_udp_local_ip(int fd);
+int recvmmsg_udp(int fd);
+int send_udp_burst_local_ip(int fd);
+int recv_udp_burst(int fd);
+int send_udp_gso_local_ip(int fd);
+int recv_udp_gro(int fd);
 
 #ifdef INET6
 int send_udp6_local_ip(int fd);
@@ -112,6 +112,65 @@ static void notify_udp_ipv4(union ofp_sigval sv)
 	OFP_INFO("SUCCESS.\n");
 }
 
+static void notify_udp_ipv4_batch(union ofp_sigval sv);
+int socket_sigevent_udp4_batch(int fd)
+{
+	struct ofp_sigevent ev;
+	struct ofp_sock_sigval ss;
+	struct ofp_sockaddr_in dest_addr = {0};
+	const char *buf = "sigevent_test";
+
+	ss.sockfd = fd;
+	ss.event = OFP_EVENT_INVALID;
+	ss.pkt = ODP_PACKET_INVALID;
+
+	ev.ofp_sigev_notify = OFP_SIGEV_BATCH;
+	ev.ofp_sigev_notify_function = notify_udp_ipv4_batch;
+	ev.ofp_sigev_value.sival_ptr = &ss;
+	ev.ofp_sigev_queue = ODP_QUEUE_INVALID;
+	if (ofp_socket_sigevent(&ev) == -1) {
+		OFP_ERR("Faild to set sigevent(errno = %d)\n", ofp_errno);
+		return -1;
+	}
+
+	dest_addr.sin_len = sizeof(struct ofp_sockaddr_in);
+	dest_addr.sin_family = OFP_AF_INET;
+	dest_addr.sin_port = odp_cpu_to_be_16(TEST_PORT);
+	dest_addr.sin_addr.s_addr = IP4(192, 168, 100, 1);
+
+	if (ofp_sendto(fd, buf, strlen(buf), 0,
+		(struct ofp_sockaddr *)&dest_addr,
+		sizeof(dest_addr)) == -1) {
+		OFP_ERR("Faild to send data(errno = %d)\n", ofp_errno);
+		return -1;
+	}
+	sleep(2);
+	return 0;
+}
+
+static void notify_udp_ipv4_batch(union ofp_sigval sv)
+{
+	struct ofp_sock_sigval_vec *vec;
+	int data_len = 0;
+	int i;
+
+	vec = (struct ofp_sock_sigval_vec *)sv.sival_ptr;
+
+	OFP_INFO("Batch of %d events.\n", vec->num);
+
+	for (i = 0; i < vec->num; i++) {
+		if (vec->sigval[i].event != OFP_EVENT_RECV)
+			continue;
+
+		ofp_udp_packet_parse(vec->sigval[i].pkt, &data_len,
+				     NULL, NULL);
+		OFP_INFO("UDP data received on socket %d: size %d.\n",
+			 vec->sigval[i].sockfd, data_len);
+		/* Left to OFP to free */
+	}
+	OFP_INFO("SUCCESS.\n");
+}
+
 #ifdef INET6
 int recv_send_udp6_local_ip(int fd)
 {
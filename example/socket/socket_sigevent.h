@@ -10,6 +10,7 @@
 
 int recv_send_udp_local_ip(int fd);
 int socket_sigevent_udp4(int fd);
+int socket_sigevent_udp4_batch(int fd);
 
 #ifdef INET6
 int recv_send_udp6_local_ip(int fd);
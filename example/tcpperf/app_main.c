@@ -262,8 +262,7 @@ static void *pktio_recv(void *arg)
 		}
 		if (pkts == PKT_BURST_SIZE) continue;
 
-		/* NOP unless OFP_PKT_TX_BURST_SIZE > 1 */
-		ofp_send_pending_pkt();
+		ofp_packet_burst_end();
 	}
 exit:
 	exit_threads = 1;
@@ -118,7 +118,7 @@ static void *pkt_io_direct_mode_recv(void *arg)
 					ofp_eth_vlan_processing);
 			}
 		}
-		ofp_send_pending_pkt();
+		ofp_packet_burst_end();
 	}
 
 	/* Never reached */
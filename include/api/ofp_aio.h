@@ -0,0 +1,162 @@
+/* Copyright (c) 2016, Nokia
+ * Copyright (c) 2016, ENEA Software AB
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:     BSD-3-Clause
+ */
+
+/**
+ * @file
+ *
+ * Asynchronous socket operations.
+ *
+ * Operations are submitted to a ring in batches and never block. An
+ * operation that cannot complete at once waits on its socket. The
+ * wakeup of the socket marks it ready, and ofp_aio_run() of the ring
+ * finishes it in the thread of the application. Each operation
+ * completes with a completion event that is enqueued to the completion
+ * queue of the ring, so that completions can be scheduled together
+ * with packets and timeouts.
+ *
+ * Operations on the same socket and in the same direction complete in
+ * the order they were submitted. The buffers and address pointers of
+ * an operation must stay valid until its completion has been received.
+ */
+
+#ifndef __OFP_AIO_H__
+#define __OFP_AIO_H__
+
+#include <stdint.h>
+#include <odp_api.h>
+
+#include "ofp_socket.h"
+
+#if __GNUC__ >= 4
+#pragma GCC visibility push(default)
+#endif
+
+/** Asynchronous operations */
+enum ofp_aio_op {
+	/** ofp_recv() into buf */
+	OFP_AIO_RECV = 1,
+	/** ofp_send() of buf */
+	OFP_AIO_SEND,
+	/** ofp_accept() of a connection; res is the new socket */
+	OFP_AIO_ACCEPT,
+	/** ofp_connect() to addr; completes when connected or failed */
+	OFP_AIO_CONNECT
+};
+
+/** Submission of one operation */
+struct ofp_aio_sqe {
+	/** Operation, enum ofp_aio_op */
+	int op;
+	/** Socket */
+	int fd;
+	/** OFP_MSG_* flags of OFP_AIO_RECV and OFP_AIO_SEND */
+	int flags;
+	/** Data buffer of OFP_AIO_RECV and OFP_AIO_SEND */
+	void *buf;
+	/** Length of buf */
+	size_t len;
+	/**
+	 * Peer address: filled in by OFP_AIO_ACCEPT if not NULL,
+	 * connected to by OFP_AIO_CONNECT
+	 */
+	struct ofp_sockaddr *addr;
+	/** Length of the address buffer of OFP_AIO_ACCEPT */
+	ofp_socklen_t *addrlen;
+	/** Passed to the completion as is */
+	uint64_t user_data;
+};
+
+/** Completion of one operation */
+struct ofp_aio_cqe {
+	/** user_data of the submission */
+	uint64_t user_data;
+	/** Operation, enum ofp_aio_op */
+	int op;
+	/** Socket */
+	int fd;
+	/**
+	 * Result: bytes received or sent, the accepted socket, 0 for
+	 * a connection, or a negative OFP_E* error code
+	 */
+	int res;
+};
+
+/** Ring handle */
+typedef struct ofp_aio_ring *ofp_aio_ring_t;
+
+#define OFP_AIO_RING_INVALID ((ofp_aio_ring_t)NULL)
+
+/**
+ * Create a ring.
+ *
+ * @param compl_queue  Queue the completion events are enqueued to. A
+ *                     scheduled queue delivers them through
+ *                     odp_schedule(), a plain queue is read with
+ *                     ofp_aio_reap().
+ * @param entries      Maximum number of operations in flight
+ *
+ * @return Ring handle, or OFP_AIO_RING_INVALID with ofp_errno set
+ */
+ofp_aio_ring_t ofp_aio_ring_create(odp_queue_t compl_queue,
+				   uint32_t entries);
+
+/**
+ * Destroy a ring. Fails with OFP_EBUSY while operations are in flight;
+ * closing their sockets completes them.
+ *
+ * @return 0 on success, -1 with ofp_errno set on failure
+ */
+int ofp_aio_ring_destroy(ofp_aio_ring_t ring);
+
+/**
+ * Submit operations. An operation completes even if it fails, e.g.
+ * on a bad socket; only running out of ring entries or completion
+ * events stops the submission.
+ *
+ * @return Number of operations submitted, 0 if num is 0, or -1 with
+ *         ofp_errno set if none was
+ */
+int ofp_aio_submit(ofp_aio_ring_t ring, const struct ofp_aio_sqe sqe[],
+		   int num);
+
+/**
+ * Run the operations of a ring whose sockets have become ready.
+ *
+ * A thread that receives the completions of a ring from a scheduled
+ * queue calls this regularly, e.g. once per schedule round.
+ * ofp_aio_reap() calls it before it reaps.
+ *
+ * @return Number of operations completed
+ */
+int ofp_aio_run(ofp_aio_ring_t ring);
+
+/**
+ * Completion carried by an event.
+ *
+ * @return Completion, or NULL if the event is not an OFP completion
+ *         event
+ */
+struct ofp_aio_cqe *ofp_aio_cqe(odp_event_t ev);
+
+/**
+ * Free a completion event.
+ */
+void ofp_aio_cqe_free(odp_event_t ev);
+
+/**
+ * Copy out and free up to num completions from a ring with a plain
+ * completion queue.
+ *
+ * @return Number of completions, 0 if there were none
+ */
+int ofp_aio_reap(ofp_aio_ring_t ring, struct ofp_aio_cqe cqe[], int num);
+
+#if __GNUC__ >= 4
+#pragma GCC visibility pop
+#endif
+
+#endif /* __OFP_AIO_H__ */
@@ -66,7 +66,9 @@
 #define SHM_PKT_POOL_NAME "packet_pool"
 
 /**Socket handle values returned are in the interval:
- * [OFP_SOCK_NUM_OFFSET, OFP_SOCK_NUM_OFFSET + OFP_NUM_SOCKETS_MAX] */
+ * [OFP_SOCK_NUM_OFFSET, OFP_SOCK_NUM_OFFSET + socket_max], where
+ * socket_max is set in ofp_global_param_t. The values below are the
+ * defaults of the runtime parameters. */
 #if defined(OFP_CONFIG_WEBSERVER)
 /**Maximum number of sockets. */
 # define OFP_NUM_SOCKETS_MAX 60000
@@ -97,9 +99,32 @@
 # define OFP_NUM_PCB_TCP_MAX 2048
 #endif /* OFP_CONFIGS*/
 
-/** Epoll set size */
+/**Number of socket handles an ofp_fd_set can hold. Sockets above
+ * this limit can be used with epoll, but not with ofp_select(). */
+#ifndef OFP_FD_SETSIZE
+# define OFP_FD_SETSIZE OFP_NUM_SOCKETS_MAX
+#endif
+
+/** Epoll set size. Deprecated: epoll sets are no longer limited per
+ * epoll socket, registrations are taken from the epoll_watches pool
+ * of the global parameters. Kept for applications that use it. */
 #define EPOLL_SET_SIZE 16
 
+/** Free sockets kept per thread */
+#define OFP_SOCKET_CACHE 32
+
+/** Socket buffer length in packets */
+#define OFP_SOCKBUF_LEN 64
+
+/** Length in packets of the larger rings socket buffers grow into */
+#define OFP_SOCKBUF_EXT_LEN 2048
+
+/** Number of larger socket buffer rings shared by all sockets */
+#define OFP_SOCKBUF_EXT_NUM 256
+
+/** Wakeup polls of a blocked socket call before it sleeps in the kernel */
+#define OFP_SLEEP_SPIN 1000
+
 /**Maximum number of fastpath interfaces used.
  * For each fastpath interface a PKTIO in opened by OFP.*/
 #define OFP_FP_INTERFACE_MAX 8
@@ -29,6 +29,16 @@ struct ofp_epoll_event {
 enum OFP_EPOLL_EVENTS {
 	OFP_EPOLLIN = 0x001,
 #define OFP_EPOLLIN OFP_EPOLLIN
+	OFP_EPOLLOUT = 0x004,
+#define OFP_EPOLLOUT OFP_EPOLLOUT
+	OFP_EPOLLERR = 0x008,
+#define OFP_EPOLLERR OFP_EPOLLERR
+	OFP_EPOLLHUP = 0x010,
+#define OFP_EPOLLHUP OFP_EPOLLHUP
+	OFP_EPOLLONESHOT = 1u << 30,
+#define OFP_EPOLLONESHOT OFP_EPOLLONESHOT
+	OFP_EPOLLET = 1u << 31
+#define OFP_EPOLLET OFP_EPOLLET
 };
 
 #define OFP_EPOLL_CTL_ADD 1
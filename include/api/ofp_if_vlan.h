@@ -53,8 +53,20 @@ struct	ofp_ether_vlan_header {
 	uint16_t evl_proto;
 } __attribute__((packed));
 
+/* 802.1ad double tagged (QinQ) header: S-tag followed by C-tag. */
+struct	ofp_ether_qinq_header {
+	uint8_t evq_dhost[OFP_ETHER_ADDR_LEN];
+	uint8_t evq_shost[OFP_ETHER_ADDR_LEN];
+	uint16_t evq_encap_proto;
+	uint16_t evq_stag;
+	uint16_t evq_inner_proto;
+	uint16_t evq_ctag;
+	uint16_t evq_proto;
+} __attribute__((packed));
+
 #define	OFP_EVL_VLID_MASK		0x0FFF
 #define	OFP_EVL_PRI_MASK		0xE000
+#define	OFP_EVL_VLID_CNT		(OFP_EVL_VLID_MASK + 1)
 #define	OFP_EVL_VLANOFTAG(tag)	((tag) & OFP_EVL_VLID_MASK)
 #define	OFP_EVL_PRIOFTAG(tag)	(((tag) >> 13) & 7)
 #define	OFP_EVL_CFIOFTAG(tag)	(((tag) >> 12) & 1)
@@ -155,6 +155,90 @@ typedef struct ofp_global_param_t {
 	 */
 	int pcb_tcp_max;
 
+	/**
+	 * Maximum number of sockets. Default value is OFP_NUM_SOCKETS_MAX
+	 */
+	int socket_max;
+
+	/**
+	 * Maximum number of free sockets each thread keeps for itself,
+	 * so that socket creation and close seldom take the global lock.
+	 * Limited to keep half of socket_max out of the thread caches.
+	 * Zero disables the caches. Default value is OFP_SOCKET_CACHE
+	 */
+	int socket_cache;
+
+	/**
+	 * Maximum number of file descriptors registered in all epoll
+	 * sets together. Zero means socket_max. Default value is 0.
+	 */
+	int epoll_watches;
+
+	/**
+	 * Maximum number of asynchronous socket operations submitted
+	 * but not yet completed, together with the completion events
+	 * not yet freed, see ofp_aio.h. Zero means socket_max.
+	 * Default value is 0.
+	 */
+	int aio_max;
+
+	/**
+	 * Length of the socket send and receive buffers in packets.
+	 * Socket buffers are accounted in bytes against SO_SNDBUF and
+	 * SO_RCVBUF; this only sizes the ring every socket starts with.
+	 * Default value is OFP_SOCKBUF_LEN
+	 */
+	int sockbuf_len;
+
+	/**
+	 * Length in packets of the larger rings a socket buffer moves to
+	 * when its own ring fills up before its byte limit is reached.
+	 * Default value is OFP_SOCKBUF_EXT_LEN
+	 */
+	int sockbuf_ext_len;
+
+	/**
+	 * Number of the larger socket buffer rings, shared by all
+	 * sockets. Zero disables growing. Default value is
+	 * OFP_SOCKBUF_EXT_NUM
+	 */
+	int sockbuf_ext_num;
+
+	/**
+	 * Number of times a thread blocked in a socket call polls for
+	 * its wakeup before it sleeps in the kernel. Zero blocks at once.
+	 * Default value is OFP_SLEEP_SPIN
+	 */
+	int sleep_spin;
+
+	/**
+	 * Number of worker threads that each own a shard of the TCP
+	 * connections. A connection belongs to the shard its addresses
+	 * and ports hash to, in either direction, and its packets are
+	 * passed to the owner if they arrive on another thread. The
+	 * connections that the owning thread itself accepts, or connects
+	 * with a port OFP chooses, are used without locks and must only
+	 * be used by that thread. The threads that dispatch events take
+	 * the shards with ofp_shard_join(). Zero disables sharding.
+	 * Default value is 0.
+	 */
+	int shards;
+
+	/**
+	 * Number of buckets in the protocol hash tables. Rounded up to
+	 * a power of two. Zero sizes the table from the expected load:
+	 * pcb_tcp_max for the TCP tables and socket_max for UDP.
+	 * Default value is 0.
+	 */
+	struct hash_size_s {
+		/** TCP PCB and port hash tables */
+		int tcp_pcb;
+		/** TCP syncache */
+		int tcp_syncache;
+		/** UDP PCB and port hash tables */
+		int udp_pcb;
+	} hash_size;
+
 	struct pkt_pool_s {
 		/** Packet pool size; Default value is SHM_PKT_POOL_NB_PKTS */
 		int nb_pkts;
@@ -185,6 +269,17 @@ typedef struct ofp_global_param_t {
 	 * Maximum number of VRFs. Default is OFP_NUM_VRF.
 	 */
 	int num_vrf;
+
+	/**
+	 * Use the packet parse results of the pktio (layer offsets,
+	 * protocol and error flags) on input instead of parsing the
+	 * headers again. IPv4 header checksum check is offloaded to
+	 * the pktio if it is capable. Packets without parse results
+	 * are still parsed in software.
+	 *
+	 * Default value is TRUE.
+	 */
+	odp_bool_t pktin_parse;
 } ofp_global_param_t;
 
 /**
@@ -226,6 +321,20 @@ typedef struct ofp_global_param_t {
  *     evt_rx_burst_size = integer
  *     pkt_tx_burst_size = integer
  *     pcb_tcp_max = integer
+ *     socket_max = integer
+ *     socket_cache = integer
+ *     epoll_watches = integer
+ *     aio_max = integer
+ *     sockbuf_len = integer
+ *     sockbuf_ext_len = integer
+ *     sockbuf_ext_num = integer
+ *     sleep_spin = integer
+ *     shards = integer
+ *     hash_size: {
+ *         tcp_pcb = integer
+ *         tcp_syncache = integer
+ *         udp_pcb = integer
+ *     }
  *     pkt_pool: {
  *         nb_pkts = integer
  *         buffer_size = integer
@@ -236,6 +345,7 @@ typedef struct ofp_global_param_t {
  *         table8_nodes = integer
  *     }
  *     num_vrf = integer
+ *     pktin_parse = boolean
  * }
  * </pre>
  *
@@ -321,6 +431,23 @@ int ofp_term_global(void);
  */
 int ofp_term_local(void);
 
+/**
+ * Take a shard of the TCP connections
+ *
+ * When ofp_global_param_t::shards is set, a worker thread that
+ * dispatches events calls this after ofp_init_local() to own the first
+ * shard that has no owner, as default_event_dispatcher() does. The
+ * thread must keep dispatching events and must not block in socket
+ * calls: only it handles the packets and timers of the shard.
+ * ofp_term_local() gives the shard back. Connections are sharded only
+ * once every shard has had an owner.
+ *
+ * @retval 0 on success, also if sharding is off or every shard
+ *           already has an owner
+ * @retval -1 on failure, e.g. if the thread is not a worker thread
+ */
+int ofp_shard_join(void);
+
 
 /**
  * Stop packet processing
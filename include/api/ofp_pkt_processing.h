@@ -21,12 +21,65 @@ struct ofp_ifnet;
 
 void *default_event_dispatcher(void *arg);
 
+/**
+ * Busy poll in the blocking socket calls of this thread.
+ *
+ * A thread that would sleep in ofp_recv(), ofp_accept(),
+ * ofp_epoll_wait() or another blocking call first runs the event
+ * dispatcher itself for up to usec microseconds, so that the packets
+ * it waits for are processed in the thread instead of being handed
+ * over from a dispatcher thread. An event that OFP does not handle
+ * stops the busy polling of the thread: its burst is held, with the
+ * schedule context of its queue, until the thread takes it with
+ * ofp_busy_poll_held(). The thread must be able to schedule the packet
+ * input queues, and must not call the blocking socket functions while
+ * holding a schedule context it relies on, e.g. from the processing of
+ * an event from an atomic queue.
+ *
+ * The OFP_SO_BUSY_POLL socket option sets the same for the reads of
+ * one socket in any thread.
+ *
+ * @param usec      Busy poll time per wait in microseconds, zero
+ *                  disables
+ * @param pkt_func  Packet processing function, NULL for
+ *                  ofp_eth_vlan_processing()
+ */
+void ofp_busy_poll_thread(uint32_t usec, ofp_pkt_processing_func pkt_func);
+
+/**
+ * Take the events a busy poll of this thread stopped at.
+ *
+ * The events are returned in the order they were scheduled, and the
+ * thread still holds the schedule context of their queue. A thread
+ * that busy polls calls this before it schedules again and processes
+ * the events as if odp_schedule_multi() had returned them; packets
+ * among them go to ofp_packet_input().
+ *
+ * @param[out] from    Queue the events came from
+ * @param[out] events  Events
+ * @param num          Maximum number of events
+ *
+ * @return Number of events, 0 if none are held
+ */
+int ofp_busy_poll_held(odp_queue_t *from, odp_event_t events[], int num);
+
 /**
  * Return the minimum size of the user area that must be present in all
  * ODP packets passed to OFP.
  */
 uint32_t ofp_packet_min_user_area(void);
 
+/**
+ * Return the sizes of the parts of the packet user area: the header
+ * that OFP clears for every received packet and the extension that
+ * is initialized only when used. The sum of the parts equals
+ * ofp_packet_min_user_area().
+ *
+ * @param[out] hdr_size  Size of the header
+ * @param[out] ext_size  Size of the extension
+ */
+void ofp_packet_user_area_parts(uint32_t *hdr_size, uint32_t *ext_size);
+
 enum ofp_return_code ofp_packet_input(odp_packet_t pkt,
 	odp_queue_t in_queue, ofp_pkt_processing_func pkt_func);
 
@@ -41,6 +94,15 @@ enum ofp_return_code ofp_tcp4_processing(odp_packet_t *pkt);
 enum ofp_return_code ofp_send_frame(struct ofp_ifnet *dev, odp_packet_t pkt);
 enum ofp_return_code ofp_send_pending_pkt(void);
 
+/**
+ * End a burst of ofp_packet_input() calls of the thread
+ *
+ * Sends the pending packets as ofp_send_pending_pkt() does and delivers
+ * the socket events batched for OFP_SIGEV_BATCH during the burst. A
+ * dispatcher calls this once after each burst of packets it inputs.
+ */
+void ofp_packet_burst_end(void);
+
 enum ofp_return_code ofp_ip_send(odp_packet_t pkt,
 				 struct ofp_nh_entry *nh_param);
 enum ofp_return_code ofp_ip6_send(odp_packet_t pkt,
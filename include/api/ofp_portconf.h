@@ -36,6 +36,10 @@ const char *ofp_config_interface_up_local(uint16_t id, uint16_t vrf,
 const char *ofp_config_interface_up_local_v6(uint16_t id,
 					     uint8_t *addr, int masklen);
 const char *ofp_config_interface_down(int port, uint16_t vlan);
+/* Set 802.1ad double tag encapsulation (S-tag, C-tag) of a VLAN
+ * sub-interface. Passing svlan 0 restores plain 802.1Q tagging. */
+const char *ofp_config_interface_qinq(int port, uint16_t vlan,
+				      uint16_t svlan, uint16_t cvlan);
 
 /* Interfaces: SHOW */
 void ofp_show_interfaces(int fd);
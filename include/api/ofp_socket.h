@@ -140,6 +140,7 @@ typedef	__ofp_uid_t		ofp_uid_t;
 #define	OFP_SO_PROTOCOL	0x1016		/* get socket protocol (Linux name) */
 #define	OFP_SO_PROTOTYPE	OFP_SO_PROTOCOL	/* alias for OFP_SO_PROTOCOL (SunOS name) */
 #define OFP_SO_L2INFO		0x1017		/* PROMISCUOUS_INET MAC addrs and tags */
+#define OFP_SO_BUSY_POLL	0x1018		/* busy poll time of reads in us */
 
 /*
  * Structure used for manipulating linger option.
@@ -221,6 +222,11 @@ struct sockproto {
  */
 #define	SOMAXCONN	128
 
+struct ofp_iovec {
+	void   *iov_base;	/* Base address. */
+	size_t	iov_len;	/* Length. */
+};
+
 /*
  * Message header for recvmsg and sendmsg calls.
  * Used value-result for recvmsg, value only for sendmsg.
@@ -250,6 +256,15 @@ struct ofp_msghdr {
 #define	OFP_MSG_SOCALLBCK	0x10000		/* for use by socket callbacks - ofp_soreceive (TCP) */
 #define	OFP_MSG_NOSIGNAL	0x20000		/* do not generate SIGPIPE on EOF */
 #define	OFP_MSG_HOLE_BREAK	0x40000		/* stop at and indicate hole boundary */
+#define	OFP_MSG_WAITFORONE	0x80000		/* recvmmsg: block for the first message only */
+
+/*
+ * Message header for recvmmsg and sendmmsg calls.
+ */
+struct ofp_mmsghdr {
+	struct ofp_msghdr msg_hdr;		/* message header */
+	unsigned int	  msg_len;		/* bytes received or sent */
+};
 
 /*
  * Header for ancillary data objects in msg_control buffer.
@@ -416,6 +431,31 @@ union ofp_sigval {          /* Data passed with notification */
 #define OFP_SIGEV_HOOK 1
 #define OFP_SIGEV_SIGNAL 2
 #define OFP_SIGEV_THREAD 3
+#define OFP_SIGEV_BATCH 4
+
+/*
+ * OFP_SIGEV_BATCH collects the events that the packets of a dispatcher
+ * burst cause and delivers them when the burst ends, in the
+ * ofp_packet_burst_end() call of the dispatcher. The events of all
+ * sockets with the same function and queue go in the same vectors
+ * of at most OFP_SIGEV_BATCH_MAX events. Events that arise outside a
+ * burst are delivered at once.
+ *
+ * If ofp_sigev_queue is a valid queue, a vector is enqueued to it as
+ * an event that ofp_sigev_vec() reads and ofp_sigev_vec_free() frees.
+ * Otherwise ofp_sigev_notify_function gets a pointer to the vector
+ * in sival_ptr.
+ *
+ * The packets of OFP_EVENT_RECV events are passed to the application
+ * and never to the socket buffer. The function takes a packet by
+ * setting its pkt to ODP_PACKET_INVALID; OFP frees those it leaves.
+ */
+#define OFP_SIGEV_BATCH_MAX 64
+
+struct ofp_sock_sigval_vec {
+	int			num;
+	struct ofp_sock_sigval	*sigval;
+};
 
 struct ofp_sigevent {
 	int          ofp_sigev_notify; /* Notification method */
@@ -430,6 +470,8 @@ struct ofp_sigevent {
 	   (SIGEV_THREAD) */
 	ofp_pid_t        ofp_sigev_notify_thread_id;
 	/* ID of thread to signal (SIGEV_THREAD_ID) */
+	odp_queue_t  ofp_sigev_queue;
+	/* Queue for OFP_SIGEV_BATCH vectors, or ODP_QUEUE_INVALID */
 };
 
 struct ofp_timeval {
@@ -437,8 +479,9 @@ struct ofp_timeval {
 	uint32_t tv_usec;    /* microseconds */
 };
 
+/* The set is kept in 64 bit words so that select can scan it word-wise */
 typedef struct {
-	uint8_t fd_set_buf[OFP_NUM_SOCKETS_MAX / 8 + 1];
+	uint64_t fd_set_buf[(OFP_FD_SETSIZE + 63) / 64];
 } ofp_fd_set;
 
 void OFP_FD_CLR(int fd, ofp_fd_set *set);
@@ -466,27 +509,68 @@ ofp_ssize_t	ofp_send(int, const void *, size_t, int);
 ofp_ssize_t	ofp_sendto(int, const void *,
 		size_t, int, const struct ofp_sockaddr *, ofp_socklen_t);
 
+ofp_ssize_t	ofp_recvmsg(int, struct ofp_msghdr *, int);
+ofp_ssize_t	ofp_sendmsg(int, const struct ofp_msghdr *, int);
+int	ofp_recvmmsg(int, struct ofp_mmsghdr *, unsigned int, int,
+		struct ofp_timeval *);
+int	ofp_sendmmsg(int, struct ofp_mmsghdr *, unsigned int, int);
+
 int	ofp_setsockopt(int, int, int, const void *, ofp_socklen_t);
 int	ofp_getsockopt(int, int, int, void *, ofp_socklen_t *);
 
 int	ofp_ioctl(int, int, ...);
 
 int	ofp_socket_sigevent(struct ofp_sigevent *);
+struct ofp_sock_sigval_vec *ofp_sigev_vec(odp_event_t);
+void	ofp_sigev_vec_free(odp_event_t);
 void	*ofp_udp_packet_parse(odp_packet_t, int *,
 				struct ofp_sockaddr *,
 				ofp_socklen_t *);
 ofp_ssize_t ofp_udp_pkt_sendto(int, odp_packet_t,
 				   const struct ofp_sockaddr *, ofp_socklen_t);
 
+/*
+ * Send nbytes of file fd from offset on stream socket s, 0 meaning up to
+ * the end of the file, framed by the optional header and trailer iovecs.
+ * The file is read straight into packets queued by reference. The bytes
+ * sent are stored to sbytes also on error, e.g. OFP_EWOULDBLOCK.
+ */
+int	ofp_sendfile(int, int, ofp_off_t, size_t, struct ofp_sf_hdtr *,
+		ofp_off_t *, int);
+
+/*
+ * Zero-copy send on a stream socket. The packet holds payload only and is
+ * queued to the send buffer; segments reference its data instead of
+ * copying it. A packet longer than the maximum segment size is split into
+ * packets of that size first, which some ODP implementations do by
+ * copying. The packet is consumed whether or not the call succeeds and
+ * must not be modified by the caller afterwards. Returns the number of
+ * bytes queued or -1 on error.
+ */
+ofp_ssize_t ofp_send_pkt(int, odp_packet_t, int);
+
+/*
+ * Zero-copy receive. Up to max received packets, trimmed to payload,
+ * are handed over to the caller, who must free them. Returns the number
+ * of packets, 0 at end of stream, or -1 on error. OFP_MSG_PEEK and
+ * OFP_MSG_WAITALL are not supported and fail with OFP_EINVAL. Stream
+ * data is handed over up to the out-of-band mark at most.
+ */
+int	ofp_recv_pkt(int, odp_packet_t *, int, int);
+
+/*
+ * ofp_recv_pkt() that also returns the sender of each datagram. from is
+ * an array of max addresses of fromlen bytes each; the address of
+ * packet i is stored to the i:th one, truncated to fromlen. Its sa_len
+ * tells the full length. Stream sockets leave from untouched.
+ */
+int	ofp_recvfrom_pkt(int, odp_packet_t *, int, int,
+			 struct ofp_sockaddr *, ofp_socklen_t);
+
 #if 0 /* Not implemented */
 int	ofp_getpeername(int, struct ofp_sockaddr * __restrict, ofp_socklen_t * __restrict);
 int	ofp_getsockname(int, struct ofp_sockaddr * __restrict, ofp_socklen_t * __restrict);
 
-ofp_ssize_t	ofp_recvmsg(int, struct ofp_msghdr *, int);
-ofp_ssize_t	ofp_sendmsg(int, const struct ofp_msghdr *, int);
-int	ofp_sendfile(int, int, ofp_off_t, size_t, struct ofp_sf_hdtr *,
-		ofp_off_t *, int);
-
 int	ofp_setfib(int);
 int	ofp_sockatmark(int);
 int	ofp_socketpair(int, int, int, int *);
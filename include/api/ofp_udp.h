@@ -61,6 +61,26 @@ struct ofp_udphdr {
  * User-settable options (used with setsockopt).
  */
 #define OFP_UDP_ENCAP			0x01
+/*
+ * Segmentation offload: a datagram sent on the socket is split into
+ * datagrams of the given payload size, the last one possibly shorter,
+ * in one call. 0 disables it. Also accepted per call as a control
+ * message of level OFP_IPPROTO_UDP carrying a uint16_t, where 0 sends
+ * that datagram unsplit. A size whose datagram would exceed the IP
+ * maximum packet size is rejected with OFP_EINVAL either way.
+ */
+#define OFP_UDP_SEGMENT			0x02
+/*
+ * Receive coalescing: ofp_recvmsg() returns consecutive datagrams of
+ * the same sender and size in one buffer, ended by a shorter one. The
+ * payload size is passed in a control message of the same type and
+ * level OFP_IPPROTO_UDP carrying an int when more than one datagram
+ * was returned.
+ */
+#define OFP_UDP_GRO			0x03
+
+/* Most datagrams one OFP_UDP_SEGMENT send is split into */
+#define OFP_UDP_MAX_SEGMENTS		64
 
 
 /*
@@ -0,0 +1,23 @@
+/* Copyright (c) 2016, Nokia
+ * Copyright (c) 2016, ENEA Software AB
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:     BSD-3-Clause
+ */
+
+#ifndef __OFPI_AIO_H__
+#define __OFPI_AIO_H__
+
+#include "ofp_aio.h"
+#include "ofpi_socketvar.h"
+
+void ofp_aio_init_prepare(void);
+int ofp_aio_init_global(void);
+int ofp_aio_term_global(void);
+int ofp_aio_lookup_shared_memory(void);
+
+void ofp_aio_init_socket(struct socket *so);
+void ofp_aio_notify(struct socket *so);
+void ofp_aio_close(struct socket *so);
+
+#endif
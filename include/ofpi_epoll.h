@@ -10,15 +10,26 @@
 
 #include "ofpi_socketvar.h"
 
+void ofp_epoll_init_prepare(void);
+int ofp_epoll_init_global(void);
+int ofp_epoll_term_global(void);
+int ofp_epoll_lookup_shared_memory(void);
+
+void ofp_epoll_init_socket(struct socket *epoll);
+void ofp_epoll_notify(struct socket *so);
+void ofp_epoll_close(struct socket *so);
+
 int _ofp_epoll_create(int size, int(*create_socket)(void));
 
 int _ofp_epoll_ctl(struct socket *epoll, int op, int fd, struct ofp_epoll_event *event);
 
 int _ofp_epoll_wait(struct socket *epoll, struct ofp_epoll_event *events, int maxevents, int timeout,
-		    int(*msleep)(int timeout));
+		    int(*msleep)(struct socket *epoll, int timeout));
 
 void ofp_set_socket_getter(struct socket*(*socket_getter)(int fd));
 
 void ofp_set_is_readable_checker(int(*is_readable_checker)(int fd));
 
+void ofp_set_is_writable_checker(int(*is_writable_checker)(int fd));
+
 #endif
@@ -135,6 +135,39 @@ struct in_conninfo {
 
 struct	icmp6_filter;
 
+/*
+ * Connection index: a second, lock-free view of the connected IPv4
+ * entries of the hash table.  A bucket is one cache line holding up to
+ * INPCBCONN_WAYS {faddr, laddr, fport:lport} keys and their inpcbs, and
+ * is read under its sequence count without taking ipi_hash_lock.  The
+ * table grows by linear hashing: each insert that brings the load above
+ * INPCBCONN_WAYS - 1 per bucket splits one more bucket, so the resize is
+ * spread over many inserts.  Connections that do not fit in their bucket
+ * are found through the hash chains only, which stay authoritative.
+ */
+#define	INPCBCONN_WAYS		3
+#define	INPCBCONN_MINBITS	6
+
+struct inpcbconn_bucket {
+	odp_atomic_u32_t	icb_seq;	/* odd while being written */
+	struct {
+		uint32_t	faddr;
+		uint32_t	laddr;
+		uint32_t	ports;
+	} icb_key[INPCBCONN_WAYS];
+	struct inpcb		*icb_inp[INPCBCONN_WAYS];
+} ODP_ALIGNED_CACHE;
+
+struct inpcbconntbl {
+	odp_atomic_u32_t	ict_state;	/* level << 24 | split */
+	uint32_t		ict_count;	/* (h) */
+	uint32_t		ict_maxbuckets;	/* (c) */
+	struct inpcbconn_bucket	*ict_buckets;	/* (c) */
+};
+
+#define	INPCBCONN_LEVEL(state)	((state) >> 24)
+#define	INPCBCONN_SPLIT(state)	((state) & 0xffffff)
+
 /*-
  * Global data structure for each high-level protocol (UDP, TCP, ...) in both
  * IPv4 and IPv6.  Holds inpcb lists and information for managing them.
@@ -211,6 +244,11 @@ struct inpcbinfo {
 	struct inpcbporthead	*ipi_porthashbase;	/* (h) */
 	uint64_t		 ipi_porthashmask;	/* (h) */
 
+	/*
+	 * Lock-free index of connected IPv4 inpcbs, NULL if not used.
+	 */
+	struct inpcbconntbl	*ipi_conntbl;		/* (h) */
+
 	/*
 	 * List of wildcard inpcbs for use with pcbgroups.  In the past, was
 	 * per-pcbgroup but is now global.  All pcbgroup locks must be held
@@ -311,6 +349,7 @@ struct inpcb {
 	uint8_t	inp_ip_p;		/* (c) protocol proto */
 	uint8_t	inp_ip_minttl;		/* (i) minimum TTL or drop */
 	uint32_t inp_flowid;		/* (x) flow id / queue id */
+	uint32_t inp_connhash;		/* (h) connection index hash */
 	odp_atomic_u32_t inp_refcount;	/* (i) refcount */
 	void	*inp_pspare[5];		/* (x) route caching / general use */
 	uint32_t	inp_ispare[6];	/* (x) route caching / user cookie /
@@ -349,7 +388,7 @@ struct inpcb {
 	struct llentry	*inp_lle;	/* cached L2 information */
 	struct rtentry	*inp_rt;	/* cached L3 information */
 	odp_rwlock_recursive_t inp_lock;
-	//int		inp_lock_cnt;
+	int		inp_lock_cnt;	/* write holds of inp_lock */
 	//int		inp_lock_owner;
 	//const char	*lockedby_file;
 	//int		lockedby_line;
@@ -388,6 +427,7 @@ struct inpcbport {
 # define INP_LOCK_INIT(inp, d, t)	do{(void)inp;(void)d;(void)t;} while (0)
 # define INP_RLOCK(inp)			do{(void)inp;} while (0)
 # define INP_WLOCK(inp)			do{(void)inp;} while (0)
+# define INP_WLOCK_ALWAYS(inp)		do{(void)inp;} while (0)
 # define INP_TRY_WLOCK(inp)		1
 # define INP_RUNLOCK(inp)		do{(void)inp;} while (0)
 # define INP_WUNLOCK(inp)		do{(void)inp;} while (0)
@@ -397,12 +437,32 @@ struct inpcbport {
 # define INP_WLOCK_ASSERT(inp)		do{(void)inp;} while (0)
 # define INP_UNLOCK_ASSERT(inp)		do{(void)inp;} while (0)
 #else
-# define INP_LOCK_INIT(inp, d, t) odp_rwlock_recursive_init(&(inp)->inp_lock)
-# define INP_RLOCK(inp)		odp_rwlock_recursive_read_lock(&(inp)->inp_lock)
-# define INP_WLOCK(inp)		odp_rwlock_recursive_write_lock(&(inp)->inp_lock)
-# define INP_TRY_WLOCK(inp)	odp_rwlock_recursive_write_trylock(&(inp)->inp_lock)
-# define INP_RUNLOCK(inp)	odp_rwlock_recursive_read_unlock(&(inp)->inp_lock)
-# define INP_WUNLOCK(inp)	odp_rwlock_recursive_write_unlock(&(inp)->inp_lock)
+/*
+ * Connections a shard has taken over are only touched by the owner.
+ * inp_lock_cnt counts the write holds of inp_lock, so that a write
+ * unlock releases a lock that was taken even if INP_NOLOCK changed in
+ * between. INP_NOLOCK itself only changes with inp_lock write held.
+ */
+# define INP_LOCKED(inp)	(!((inp)->inp_flags2 & INP_NOLOCK))
+# define INP_LOCK_INIT(inp, d, t) do { \
+		odp_rwlock_recursive_init(&(inp)->inp_lock); \
+		(inp)->inp_lock_cnt = 0; } while (0)
+# define INP_RLOCK(inp)		do { if (INP_LOCKED(inp)) \
+		odp_rwlock_recursive_read_lock(&(inp)->inp_lock); } while (0)
+# define INP_WLOCK_ALWAYS(inp)	do { \
+		odp_rwlock_recursive_write_lock(&(inp)->inp_lock); \
+		(inp)->inp_lock_cnt++; } while (0)
+# define INP_WLOCK(inp)		do { if (INP_LOCKED(inp)) \
+		INP_WLOCK_ALWAYS(inp); } while (0)
+# define INP_TRY_WLOCK(inp)	(!INP_LOCKED(inp) ? 1 : \
+		odp_rwlock_recursive_write_trylock(&(inp)->inp_lock) ? \
+		((inp)->inp_lock_cnt++, 1) : 0)
+# define INP_RUNLOCK(inp)	do { if (INP_LOCKED(inp)) \
+		odp_rwlock_recursive_read_unlock(&(inp)->inp_lock); } while (0)
+# define INP_WUNLOCK(inp)	do { if ((inp)->inp_lock_cnt) { \
+		(inp)->inp_lock_cnt--; \
+		odp_rwlock_recursive_write_unlock(&(inp)->inp_lock); } \
+		} while (0)
 /* TODO implement assert operations*/
 # define INP_LOCK_ASSERT(inp)	/*rw_assert(&(inp)->inp_lock, RA_LOCKED)*/
 # define INP_RLOCK_ASSERT(inp)	/*rw_assert(&(inp)->inp_lock, RA_RLOCKED)*/
@@ -589,6 +649,9 @@ void	inp_4tuple_get(struct inpcb *inp, uint32_t *laddr, uint16_t *lp,
 #define	INP_PASSIVE		0x00000010 /* passive inet mode enabled */
 #define	INP_PROMISC		0x00000020 /* promiscuous inet mode enabled */
 #define	INP_SYNFILTER		0x00000040 /* a SYN filter has been attached */
+#define	INP_SHARDED		0x00000080 /* owned by shard inp_flowid */
+#define	INP_CONNHASHED		0x00000100 /* in ipi_conntbl */
+#define	INP_NOLOCK		0x00000200 /* used by its shard, unlocked */
 
 /*
  * Flags passed to ofp_in_pcblookup*() functions.
@@ -647,6 +710,8 @@ VNET_DECLARE(int, ofp_ipport_tcpallocs);
 void	ofp_in_pcbinfo_destroy(struct inpcbinfo *);
 void	ofp_in_pcbinfo_init(struct inpcbinfo *, const char *, struct inpcbhead *,
 	    int, int, const char *, uma_init, uma_fini, uint32_t);
+void	ofp_in_pcbconntbl_init(struct inpcbconntbl *, struct inpcbconn_bucket *,
+	    uint32_t);
 #ifdef OFP_RSS
 void	ofp_tcp_rss_in_pcbinfo_init(int, int, uma_init, uma_fini, uint32_t);
 #endif
@@ -690,6 +755,13 @@ int	ofp_in_pcbinshash_nopcbgroup(struct inpcb *);
 struct inpcb *
 	ofp_in_pcblookup_local(struct inpcbinfo *,
 	    struct ofp_in_addr, uint16_t, int, struct ofp_ucred *);
+void	ofp_in_pcbsetreuseport(struct inpcb *);
+void	ofp_in_pcbshard(struct inpcb *);
+void	ofp_in_pcbshard_nolock(struct inpcb *);
+void	ofp_in_pcbshard_lock(struct inpcb *);
+struct inpcb *
+	ofp_in_pcblookup_reuseport(struct inpcbhead *, struct inpcb *,
+	    uint32_t);
 struct inpcb *
 	ofp_in_pcblookup(struct inpcbinfo *, struct ofp_in_addr, uint32_t,
 	    struct ofp_in_addr, uint32_t, int, struct ofp_ifnet *);
@@ -9,6 +9,7 @@
 #define _OFPI_APP_H
 
 #include <odp_api.h>
+#include <stddef.h>
 #include <string.h>
 #include "api/ofp_types.h"
 #include "api/ofp_pkt_processing.h"
@@ -35,15 +36,32 @@ struct ip_out {
  */
 #define OFP_IP_OUTPUT_MAX_RECURSION 8
 
+/*
+ * Packet user area. Only the header is cleared for every packet;
+ * the extension fields following it are initialized on first use
+ * and tracked by the flags in the header.
+ */
 struct ofp_packet_user_area {
+	/* Header */
 	uint8_t recursion_count;
+#define OFP_PKT_UA_VXLAN 0x1	/* vxlan data initialized */
+#define OFP_PKT_UA_SHARD_ICMP 0x2 /* shard_off is of an ICMP header */
+	uint8_t flags;
+	/* TCP or ICMP header offset of a packet passed to another shard */
+	uint16_t shard_off;
+
+	/* Extension */
 	struct vxlan_user_data vxlan;
 };
 
+#define OFP_PKT_UA_HDR_SIZE offsetof(struct ofp_packet_user_area, vxlan)
+#define OFP_PKT_UA_EXT_SIZE (sizeof(struct ofp_packet_user_area) - \
+			     OFP_PKT_UA_HDR_SIZE)
+
 static inline void ofp_packet_user_area_reset(odp_packet_t pkt)
 {
 	struct ofp_packet_user_area *ua = odp_packet_user_area(pkt);
-	memset(ua, 0, sizeof(*ua));
+	memset(ua, 0, OFP_PKT_UA_HDR_SIZE);
 }
 
 static inline struct ofp_packet_user_area *ofp_packet_user_area(odp_packet_t pkt)
@@ -51,6 +69,17 @@ static inline struct ofp_packet_user_area *ofp_packet_user_area(odp_packet_t pkt
 	return odp_packet_user_area(pkt);
 }
 
+static inline struct vxlan_user_data *ofp_packet_user_area_vxlan(odp_packet_t pkt)
+{
+	struct ofp_packet_user_area *ua = ofp_packet_user_area(pkt);
+
+	if (!(ua->flags & OFP_PKT_UA_VXLAN)) {
+		memset(&ua->vxlan, 0, sizeof(ua->vxlan));
+		ua->flags |= OFP_PKT_UA_VXLAN;
+	}
+	return &ua->vxlan;
+}
+
 static inline odp_packet_t ofp_packet_alloc_from_pool(odp_pool_t pool,
 						      uint32_t len)
 {
@@ -77,6 +106,17 @@ enum ofp_return_code ipv6_transport_classifier(odp_packet_t *pkt,
 
 int ofp_send_pkt_out_init_local(void);
 int ofp_send_pkt_out_term_local(void);
+uint64_t ofp_send_pkt_out_mark(void);
+int ofp_send_pkt_out_pending(uint64_t mark);
+
+/* Busy poll budget of this thread in microseconds, see ofp_busy_poll_thread() */
+extern __thread uint32_t ofp_busy_poll_usec;
+
+/* Dispatch one burst of events. Returns the number of events, -1 while
+ * events of the application are held for ofp_busy_poll_held(). */
+int ofp_busy_poll(void);
+/* Dispatch the events the scheduler holds for us, before blocking */
+void ofp_busy_poll_end(void);
 
 
 static inline int ofp_send_pkt_multi(struct ofp_ifnet *ifnet,
@@ -112,6 +152,16 @@ static inline enum ofp_return_code ofp_ip_output(odp_packet_t pkt,
 	return ofp_ip_output_common(pkt, nh, 1);
 }
 
+/*
+ * Output a burst of locally originated IPv4 packets to one destination.
+ * The route is looked up and the L2 header resolved once, with the
+ * first packet; packets that need fragmentation or tunneling take the
+ * full path. Returns the number of packets output. A dropped packet is
+ * left to the caller with the ones after it.
+ */
+int ofp_ip_output_burst(odp_packet_t pkt[], int num,
+			struct ofp_nh_entry *nh_param);
+
 enum ofp_return_code ofp_ip_output_recurse(odp_packet_t pkt,
 					   struct ofp_nh_entry *nh);
 
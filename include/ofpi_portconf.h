@@ -125,6 +125,9 @@ struct ofp_ifnet {
 #define OFP_IFT_GRE    4
 #define OFP_IFT_VXLAN  5
 	uint8_t		if_type;
+#define OFP_IF_PARSE_PKTIN	0x1	/* pktio sets layer offsets and flags */
+#define OFP_IF_PARSE_IPV4_CSUM	0x2	/* pktio verifies IPv4 header checksum */
+	uint8_t		if_parse;
 #define	OFP_IFF_UP		0x1		/* (n) interface is up */
 #define	OFP_IFF_BROADCAST	0x2		/* (i) broadcast address valid */
 #define	OFP_IFF_DEBUG		0x4		/* (n) turn on debugging */
@@ -159,6 +162,8 @@ struct ofp_ifnet {
 	uint32_t	ip_local; /* network byte order */
 	uint16_t	physport;
 	uint16_t	physvlan;
+	uint16_t	qinq_svlan; /* 802.1ad S-tag, 0 if not a QinQ sub-interface */
+	uint16_t	qinq_cvlan; /* 802.1Q C-tag of a QinQ sub-interface */
 	uint32_t	ip_remote; /* network byte order */
 	uint32_t	bcast_addr; /* network byte order */
 	uint8_t		masklen;
@@ -194,6 +199,10 @@ struct ofp_ifnet {
 #endif /*SP */
 
 	OFP_LIST_ENTRY(ofp_ifnet) ia_hash; /* entry in bucket of inet addresses */
+#ifdef INET6
+	OFP_LIST_ENTRY(ofp_ifnet) ia6_hash; /* entry in bucket of inet6 addresses */
+#endif /* INET6 */
+	OFP_LIST_ENTRY(ofp_ifnet) tun_hash; /* entry in bucket of tunnels */
 	OFP_TAILQ_ENTRY(ofp_ifnet) ia_link; /* list of internet addresses */
 #ifdef INET6
 	OFP_TAILQ_ENTRY(ofp_ifnet) ia6_link; /* list of internet addresses */
@@ -363,6 +372,8 @@ void ofp_update_ifindex_lookup_tab(struct ofp_ifnet *ifnet);
 #endif /* SP */
 
 int ofp_vlan_get_by_key(void *root, void *key, void **value_address);
+/* Finds the QinQ sub-interface of a physical port by its S-tag and C-tag */
+struct ofp_ifnet *ofp_get_ifnet_qinq(int port, uint16_t svlan, uint16_t cvlan);
 int vlan_ifnet_insert(void *root, void *elem);
 int vlan_ifnet_delete(void *root, void *elem, int (*free_key_fun)(void *arg));
 int free_key(void *key);
@@ -375,6 +386,24 @@ struct ofp_ifnet *ofp_get_ifnet_by_ip(uint32_t ip, uint16_t vrf);
 /* Finds the tunnel interface by tunnel addresses  */
 struct ofp_ifnet *ofp_get_ifnet_by_tunnel(uint32_t tun_loc,
 					      uint32_t tun_rem, uint16_t vrf);
+/* Finds any local (non tunnel) interface owning the address */
+struct ofp_ifnet *ofp_get_ifnet_local_ip(uint32_t ip, uint16_t vrf);
+#ifdef INET6
+struct ofp_ifnet *ofp_get_ifnet_local_ip6(uint8_t *addr6, uint16_t vrf);
+#endif /* INET6 */
+
+/*
+ * Address hash tables. Must be called whenever the addresses, tunnel
+ * endpoints or vrf of an interface change and before it is freed.
+ */
+void ofp_ifnet_addr_hash_update(struct ofp_ifnet *ifnet);
+void ofp_ifnet_addr_hash_remove(struct ofp_ifnet *ifnet);
+
+/* Packet was received on an interface whose pktio parse results are used */
+static inline int ofp_if_parsed(struct ofp_ifnet *ifnet, odp_packet_t pkt)
+{
+	return (ifnet->if_parse & OFP_IF_PARSE_PKTIN) && odp_packet_has_l3(pkt);
+}
 void ofp_join_device_to_multicast_group(struct ofp_ifnet *dev_root,
 				       struct ofp_ifnet *dev_vxlan,
 				       uint32_t group);
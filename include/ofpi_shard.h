@@ -0,0 +1,100 @@
+/* Copyright (c) 2016, ENEA Software AB
+ * Copyright (c) 2016, Nokia
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:	BSD-3-Clause
+ */
+
+#ifndef __OFPI_SHARD_H__
+#define __OFPI_SHARD_H__
+
+#include <odp_api.h>
+
+#include "api/ofp_types.h"
+#include "ofpi_init.h"
+#include "ofpi_hash.h"
+
+/*
+ * Shared-nothing TCP.
+ *
+ * When global_param->shards is set, that many threads that dispatch
+ * events each own a shard of the TCP connections, taken with
+ * ofp_shard_join(). The owner of a connection is
+ * chosen by a hash of its addresses and ports that is the same in both
+ * directions, so it does not depend on how the NIC or the scheduler
+ * spread the packets: a packet that arrives on any other thread is
+ * passed on to the owner through the owner's redirect queue.
+ *
+ * Connections a shard sets up for a listener, or opens itself, are
+ * marked with INP_SHARDED and their timers run on the owner. Their
+ * inpcb and socket buffer locks are skipped (INP_NOLOCK) only once the
+ * owning thread has accepted the socket or its connect is under way;
+ * from then on the application must use the socket only from that
+ * thread, e.g. from its event callbacks. ICMP errors about a connection
+ * are passed to the owner too, walks of the pcb list skip the unlocked
+ * connections of other shards, and a connection is locked again when
+ * it enters TIME_WAIT, which any thread may expire. Connections
+ * accepted by other threads, IPv6 connections, listening sockets and
+ * UDP keep their locks.
+ */
+
+/* Shard owned by this thread, -1 if none */
+extern __thread int ofp_shard_id;
+
+/*
+ * Shard owned by this thread, -1 if none or if flows are not passed on
+ * yet because some shard has had no owner.
+ */
+int ofp_shard_self(void);
+
+#define OFP_SHARDED() odp_unlikely(global_param->shards > 0)
+
+static inline int ofp_shard_of(uint32_t addr1, uint16_t port1,
+			       uint32_t addr2, uint16_t port2)
+{
+	uint32_t key[2];
+
+	key[0] = addr1 ^ addr2;
+	key[1] = (uint32_t)(port1 ^ port2);
+
+	return ofp_hashword(key, 2, 0) % global_param->shards;
+}
+
+static inline int ofp_shard_of6(const uint32_t *addr1, uint16_t port1,
+				const uint32_t *addr2, uint16_t port2)
+{
+	return ofp_shard_of(addr1[0] ^ addr1[1] ^ addr1[2] ^ addr1[3], port1,
+			    addr2[0] ^ addr2[1] ^ addr2[2] ^ addr2[3], port2);
+}
+
+/*
+ * Pass a TCP packet to the shard that owns its flow. off is the offset
+ * of the TCP header from the IP header. Returns 0 if the owner is us,
+ * otherwise the packet is consumed.
+ */
+int ofp_shard_redirect(odp_packet_t pkt, int off);
+
+/*
+ * Pass an ICMP error about a TCP connection to the shard that owns the
+ * connection. off is the offset of the ICMP header from the IP header.
+ * Returns 0 if the owner is us or the error is not about TCP,
+ * otherwise the packet is consumed.
+ */
+int ofp_shard_redirect_icmp(odp_packet_t pkt, int off);
+
+/* Whether ctx is the context of a redirect queue */
+int ofp_shard_queue_ctx(void *ctx);
+
+/* Input a packet received from a redirect queue */
+enum ofp_return_code ofp_shard_input(odp_packet_t pkt);
+
+odp_schedule_group_t ofp_shard_group(int shard);
+
+void ofp_shard_init_prepare(void);
+int ofp_shard_init_global(void);
+int ofp_shard_lookup_shared_memory(void);
+int ofp_shard_term_local(void);
+int ofp_shard_stop_global(void);
+int ofp_shard_term_global(void);
+
+#endif /* __OFPI_SHARD_H__ */
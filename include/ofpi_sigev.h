@@ -0,0 +1,31 @@
+/* Copyright (c) 2016, Nokia
+ * Copyright (c) 2016, ENEA Software AB
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:     BSD-3-Clause
+ */
+
+#ifndef __OFPI_SIGEV_H__
+#define __OFPI_SIGEV_H__
+
+#include "api/ofp_socket.h"
+
+/* Set while this thread processes a burst of packets */
+extern __thread int ofp_sigev_burst;
+
+void ofp_sigev_init_prepare(void);
+int ofp_sigev_init_global(void);
+int ofp_sigev_term_global(void);
+int ofp_sigev_lookup_shared_memory(void);
+
+/*
+ * Add an event of an OFP_SIGEV_BATCH socket to the vector of its
+ * function and queue. The packet of the event is consumed.
+ */
+void ofp_sigev_batch(const struct ofp_sigevent *ev,
+		     const struct ofp_sock_sigval *ss);
+
+/* Deliver the collected events and end the burst */
+void ofp_sigev_flush(void);
+
+#endif
@@ -39,6 +39,7 @@
 #include "ofpi_systm.h"
 #include "ofpi_util.h"
 #include "ofpi_config.h"
+#include "api/ofp_socket.h"
 
 #define	SB_MAX		(2*1024*1024)	/* default for max chars in sockbuf */
 
@@ -55,6 +56,8 @@
 #define	SB_NOCOALESCE	0x200		/* don't coalesce new data into existing mbufs */
 #define	SB_IN_TOE	0x400		/* socket buffer is in the middle of an operation */
 #define	SB_AUTOSIZE	0x800		/* automatically size socket buffer */
+#define	SB_EPOLL	0x1000		/* socket is in an epoll set */
+#define	SB_SHARDED	0x2000		/* used by the owning shard only */
 
 struct ofp_sockaddr;
 struct socket;
@@ -83,11 +86,6 @@ struct selinfo {
 #endif
 };
 
-struct ofp_iovec {
-	void   *iov_base;	/* Base address. */
-	size_t	iov_len;	/* Length. */
-};
-
 struct uio {
 	struct	ofp_iovec *uio_iov;		/* scatter/gather list */
 	int	uio_iovcnt;		/* length of scatter/gather list */
@@ -102,13 +100,15 @@ struct	sockbuf {
 	struct		selinfo sb_sel;	/* process selecting read/write */
 
 	odp_rwlock_t 	sb_mtx;		/* sockbuf lock */
+	int		sb_mtx_held;	/* sb_mtx is write locked */
 	odp_spinlock_t	sb_sx;		/* prevent I/O interlacing */
 
 	short		sb_state;	/* (c/d) socket state on sockbuf */
-#define	sb_startzero	sb_mb
-#define SOCKBUF_LEN 64
-	odp_packet_t	sb_mb[SOCKBUF_LEN];	/* (c/d) the pkt table */
+	odp_packet_t	*sb_mb;		/* (a) the pkt table */
+	int		sb_len;		/* (a) length of the pkt table */
+#define	sb_startzero	sb_put
 	int		sb_put, sb_get;
+	int		sb_ext;		/* (c/d) larger ring in use + 1, or 0 */
 	int		sb_mbtail;		/* (c/d) the last pkt in the table */
 	int		sb_lastrecord;		/* (c/d) first mbuf of last
 						 * record in socket buffer */
@@ -127,6 +127,8 @@ struct	sockbuf {
 	int		(*sb_upcall)(struct socket *, void *, int); /* (c/d) */
 	void		*sb_upcallarg;	/* (c/d) */
 	struct socket	*sb_socket;
+	uint32_t	sb_busy_poll;	/* (c/d) busy poll time of waits, us */
+	uint32_t	sb_segsize;	/* (c/d) max stream pkt length, or 0 */
 	//const char      *lockedby_file;
 	//int             lockedby_line;
 };
@@ -142,20 +144,37 @@ struct	sockbuf {
  * on the same core as the one that does udp/tcp_input() processing.
  */
 # define SOCKBUF_MTX(_sb)		(void)_sb;
+# define SOCKBUF_LOCKED(_sb)		0
 
 # define SOCKBUF_LOCK_INIT(_sb, _name)	(void)_sb; (void)_name;
 # define SOCKBUF_LOCK(_sb)		(void)_sb;
+# define SOCKBUF_LOCK_ALWAYS(_sb)	(void)_sb;
 # define SOCKBUF_UNLOCK(_sb)		(void)_sb;
 # define SOCKBUF_RLOCK(_sb)		(void)_sb;
 # define SOCKBUF_RUNLOCK(_sb)		(void)_sb;
 #else
 # define SOCKBUF_MTX(_sb)		(&(_sb)->sb_mtx)
 
+# define SOCKBUF_LOCKED(_sb)		(!((_sb)->sb_flags & SB_SHARDED))
+
 # define SOCKBUF_LOCK_INIT(_sb, _name)	odp_rwlock_init(SOCKBUF_MTX(_sb))
-# define SOCKBUF_LOCK(_sb)		odp_rwlock_write_lock(SOCKBUF_MTX(_sb))
-# define SOCKBUF_UNLOCK(_sb)		odp_rwlock_write_unlock(SOCKBUF_MTX(_sb))
-# define SOCKBUF_RLOCK(_sb)		odp_rwlock_read_lock(SOCKBUF_MTX(_sb))
-# define SOCKBUF_RUNLOCK(_sb)		odp_rwlock_read_unlock(SOCKBUF_MTX(_sb))
+/*
+ * sb_mtx_held records a write hold of sb_mtx, so that an unlock
+ * releases a lock that was taken even if SB_SHARDED changed in
+ * between. SB_SHARDED itself only changes with sb_mtx held.
+ */
+# define SOCKBUF_LOCK_ALWAYS(_sb)	do { \
+		odp_rwlock_write_lock(SOCKBUF_MTX(_sb)); \
+		(_sb)->sb_mtx_held = 1; } while (0)
+# define SOCKBUF_LOCK(_sb)		do { if (SOCKBUF_LOCKED(_sb)) \
+		SOCKBUF_LOCK_ALWAYS(_sb); } while (0)
+# define SOCKBUF_UNLOCK(_sb)		do { if ((_sb)->sb_mtx_held) { \
+		(_sb)->sb_mtx_held = 0; \
+		odp_rwlock_write_unlock(SOCKBUF_MTX(_sb)); } } while (0)
+# define SOCKBUF_RLOCK(_sb)		do { if (SOCKBUF_LOCKED(_sb)) \
+		odp_rwlock_read_lock(SOCKBUF_MTX(_sb)); } while (0)
+# define SOCKBUF_RUNLOCK(_sb)		do { if (SOCKBUF_LOCKED(_sb)) \
+		odp_rwlock_read_unlock(SOCKBUF_MTX(_sb)); } while (0)
 #endif
 #define SOCKBUF_LOCK_DESTROY(_sb)	/*mtx_destroy(SOCKBUF_MTX(_sb))*/
 #define SOCKBUF_OWNED(_sb)		/*mtx_owned(SOCKBUF_MTX(_sb))*/
@@ -211,17 +230,8 @@ void	ofp_sbunlock(struct sockbuf *sb);
  * still be negative (cc > hiwat or mbcnt > mbmax).  Should detect
  * overflow and return 0.  Should use "lmin" but it doesn't exist now.
  */
-#if 1
-#define	sbspace(sb) \
-	((long)(global_param->pkt_pool.buffer_size * \
-		((sb)->sb_put >= (sb)->sb_get ?				\
-		 (SOCKBUF_LEN - ((sb)->sb_put - (sb)->sb_get) - 1) :	\
-		 ((sb)->sb_get - (sb)->sb_put - 1))))
-#else
-#define	sbspace(sb) \
-    ((long) imin((int)((sb)->sb_hiwat - (sb)->sb_cc), \
-	 (int)((sb)->sb_mbmax - (sb)->sb_mbcnt)))
-#endif
+#define	sbspace(sb) ofp_sbspace(sb)
+long	ofp_sbspace(struct sockbuf *sb);
 
 /* adjust counters in sb reflecting allocation of m */
 #define	sballoc(sb, m) { \
@@ -266,10 +276,23 @@ void ofp_socantrcvmore_locked(struct socket *so);
 void ofp_socantrcvmore(struct socket *so);
 
 int ofp_sockbuf_put_last(struct sockbuf *sb, odp_packet_t pkt);
+int ofp_sockbuf_can_grow(struct sockbuf *sb);
+int ofp_sockbuf_grow(struct sockbuf *sb);
+void ofp_sockbuf_ring_release(struct sockbuf *sb);
+void ofp_sockbuf_ring_drained(struct sockbuf *sb);
 odp_packet_t ofp_sockbuf_get_first(struct sockbuf *);
 odp_packet_t ofp_sockbuf_remove_first(struct sockbuf *);
 odp_packet_t ofp_sockbuf_get_first_remove(struct sockbuf *);
 void ofp_sockbuf_packet_free(odp_packet_t);
 void ofp_sockbuf_copy_out(struct sockbuf *sb, int off, int len, char *dst);
 
+/* Packet references appeared in ODP API 1.13 */
+#if ((ODP_VERSION_API_GENERATION > 1) || (ODP_VERSION_API_MAJOR >= 13))
+#define OFP_SOCKBUF_PKT_REF 1
+#endif
+int ofp_sockbuf_ref_len(struct sockbuf *sb, int off, int len);
+odp_packet_t ofp_sockbuf_ref_out(struct sockbuf *sb, int off, int len,
+				 uint32_t hdrlen);
+odp_packet_t ofp_sockbuf_unshare(odp_packet_t pkt);
+
 #endif /* _SYS_SOCKBUF_H_ */
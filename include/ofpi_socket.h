@@ -16,5 +16,6 @@ int ofp_socket_lookup_shared_memory(void);
 void ofp_socket_init_prepare(void);
 int ofp_socket_init_global(odp_pool_t);
 int ofp_socket_term_global(void);
+int ofp_socket_term_local(void);
 
 #endif /* __OFPI_SOCKET_H__ */
@@ -44,6 +44,8 @@
 
 struct vnet;
 struct in_l2info;
+struct epoll_item;
+struct ofp_aio_req;
 
 /*
  * Kernel structure per socket.
@@ -63,7 +65,24 @@ typedef	uint64_t so_gen_t;
  * (f) not locked since integer reads/writes are atomic.
  * (g) used only as a sleep/wakeup address, no value.
  * (h) locked by global mutex so_global_mtx.
+ * (q) locked by so_qlock of the listening socket.
+ * (p) locked by so_acclock of the listening socket.
+ * (w) locked by so_aio.qlock.
  */
+
+/*
+ * Queue of complete connections of a listening socket, an intrusive
+ * MPSC queue linked through so_accnext of the queued sockets. Pushes
+ * are serialized by so_qlock, which also covers the incomplete queue,
+ * and pops by so_acclock, so that accept does not stop the packet path
+ * from queueing new connections.
+ */
+struct so_accq {
+	odp_atomic_u64_t	aq_tail;	/* (q) last node pushed */
+	odp_atomic_u64_t	*aq_head;	/* (p) next node to pop */
+	odp_atomic_u64_t	aq_stub;
+};
+
 struct socket {
 	struct  socket *next;           /* next in free list */
 	int	so_number;		/* file descriptor */
@@ -87,14 +106,17 @@ struct socket {
  * We allow connections to queue up based on current queue lengths
  * and limit on number of queued connections for this socket.
  */
-	struct	socket *so_head;	/* (e) back pointer to listen socket */
-	OFP_TAILQ_HEAD(, socket) so_incomp;	/* (e) queue of partial unaccepted connections */
-	OFP_TAILQ_HEAD(, socket) so_comp;	/* (e) queue of complete unaccepted connections */
-	OFP_TAILQ_ENTRY(socket) so_list;	/* (e) list of unaccepted connections */
-	uint16_t	so_qlen;		/* (e) number of unaccepted connections */
-	uint16_t	so_incqlen;		/* (e) number of unaccepted incomplete
+	struct	socket *so_head;	/* (e,q) back pointer to listen socket */
+	OFP_TAILQ_HEAD(, socket) so_incomp;	/* (q) queue of partial unaccepted connections */
+	struct	so_accq so_comp;	/* queue of complete unaccepted connections */
+	OFP_TAILQ_ENTRY(socket) so_list;	/* (q) list of unaccepted incomplete connections */
+	odp_atomic_u64_t so_accnext;	/* link in so_comp of so_head */
+	odp_atomic_u32_t so_qlen;	/* number of unaccepted connections */
+	uint16_t	so_incqlen;		/* (q) number of unaccepted incomplete
 					   connections */
 	uint16_t	so_qlimit;		/* (e) max number queued connections */
+	odp_rwlock_t	so_qlock;	/* listen queue lock */
+	odp_spinlock_t	so_acclock;	/* accept lock */
 	short	so_timeo;		/* (g) connection timeout */
 	uint16_t	so_error;		/* (f) error affecting connection */
 	struct	sigio *so_sigio;	/* [sg] information for async I/O or
@@ -145,11 +167,26 @@ struct socket {
 		struct inpcb dummy;
 	} pcb_space;
 	struct ofp_sigevent so_sigevent;
-
-	struct epoll_set {
-		int fd;
-		struct ofp_epoll_event event;
-	} epoll_set[EPOLL_SET_SIZE];
+	uint64_t	so_rgen;	/* readiness generation, see select */
+
+	/* Epoll sets this socket is registered in, see ofp_epoll.c */
+	OFP_LIST_HEAD(, epoll_item) so_epoll_items;
+	/* Interest and ready lists of an OFP_SOCK_EPOLL socket */
+	struct so_epoll {
+		OFP_LIST_HEAD(, epoll_item) items;
+		OFP_TAILQ_HEAD(, epoll_item) ready;	/* (r) */
+		odp_rwlock_t lock;			/* (r) */
+		int waiters;				/* (r) */
+	} so_epoll;
+	/* Asynchronous operations waiting on this socket, see ofp_aio.c */
+	struct so_aio {
+		OFP_TAILQ_HEAD(so_aio_list, ofp_aio_req) rcv; /* (w) recv, accept */
+		struct so_aio_list snd;			/* (w) send, connect */
+		odp_spinlock_t qlock;			/* (w) */
+		odp_spinlock_t lock;	/* held while running the requests */
+		odp_atomic_u32_t gen;	/* bumped by every wakeup */
+		int closed;				/* (w) */
+	} so_aio;
 };
 
 
@@ -221,7 +258,7 @@ struct xsocket {
  * Do we need to notify the other side when I/O is possible?
  */
 #define	sb_notify(sb)	(((sb)->sb_flags & (SB_WAIT | SB_SEL | SB_ASYNC | \
-    SB_UPCALL | SB_AIO | SB_KNOTE)) != 0)
+    SB_UPCALL | SB_AIO | SB_KNOTE | SB_EPOLL)) != 0)
 
 /* do we have to send all at once on a socket? */
 #define	sosendallatonce(so) \
@@ -230,7 +267,7 @@ struct xsocket {
 /* can we read something from so? */
 #define	soreadabledata(so) \
     ((so)->so_rcv.sb_cc >= (so)->so_rcv.sb_lowat || \
-	!OFP_TAILQ_EMPTY(&(so)->so_comp) || (so)->so_error)
+	odp_atomic_load_u32(&(so)->so_qlen) != 0 || (so)->so_error)
 #define	soreadable(so) \
 	(soreadabledata(so) || ((so)->so_rcv.sb_state & SBS_CANTRCVMORE))
 
@@ -359,6 +396,8 @@ void	ofp_sohasoutofband(struct socket *so);
 int	ofp_solisten(struct socket *so, int backlog, struct thread *td);
 void	ofp_solisten_proto(struct socket *so, int backlog);
 int	ofp_solisten_proto_check(struct socket *so);
+int	ofp_solisten_dequeue(struct socket *head, struct socket **ret,
+	    int flags);
 struct socket *
 	ofp_sonewconn(struct socket *head, int connstatus);
 struct socket *
@@ -376,6 +415,12 @@ int	soreceive_stream(struct socket *so, struct ofp_sockaddr **paddr,
 int	ofp_soreceive_dgram(struct socket *so, struct ofp_sockaddr **paddr,
 	    struct uio *uio, odp_packet_t *mp0, odp_packet_t *controlp,
 	    int *flagsp);
+int	ofp_soreceive_dgram_burst(struct socket *so, odp_packet_t *pkts,
+	    int *num, int flags);
+int	ofp_soreceive_dgram_gro(struct socket *so, odp_packet_t *pkts,
+	    int *num, size_t maxlen, int flags);
+int	ofp_soreceive_pkt(struct socket *so, odp_packet_t *pkts, int *num,
+	    int flags);
 int	ofp_soreceive_generic(struct socket *so, struct ofp_sockaddr **paddr,
 	    struct uio *uio, odp_packet_t *mp0, odp_packet_t *controlp,
 	    int *flagsp);
@@ -420,17 +465,26 @@ int	accept_filt_generic_mod_event(module_t mod, int event, void *data);
 #endif
 
 odp_packet_t ofp_socket_packet_alloc(uint32_t len);
-odp_rwlock_t *ofp_accept_mtx(void);
 void ofp_accept_lock(void);
 void ofp_accept_unlock(void);
 
 /* Emulation for BSD wakeup mechanism */
 int ofp_msleep(void *channel, odp_rwlock_t *mtx, int priority, const char *wmesg,
 		 uint32_t timeout);
+/* ofp_msleep() that busy polls for at least busy_poll us first */
+int ofp_msleep_busy(void *channel, odp_rwlock_t *mtx, int priority,
+		    const char *wmesg, uint32_t timeout, uint32_t busy_poll);
 int ofp_wakeup(void *channel);
 int ofp_wakeup_one(void *channel);
 int ofp_send_sock_event(struct socket *head, struct socket *so, int event);
 
 int is_readable(int fd);
+int is_writable(int fd);
+int is_exceptional(int fd);
+
+/* Readiness generation for select */
+void ofp_so_readiness_changed(struct socket *so, struct sockbuf *sb);
+uint64_t ofp_so_readiness_gen(void);
+odp_rwlock_t *ofp_so_readiness_mtx(void);
 
 #endif /* !_SYS_SOCKETVAR_H_ */
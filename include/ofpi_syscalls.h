@@ -13,4 +13,8 @@ int _ofp_select(int nfds, ofp_fd_set *readfds, ofp_fd_set *writefds,
 		int (*sleeper)(void *channel, odp_rwlock_t *mtx, int priority,
 			       const char *wmesg, uint32_t timeout));
 
+/* ofp_accept() with OFP_MSG_DONTWAIT in flags not to block */
+int _ofp_accept(int sockfd, struct ofp_sockaddr *addr, ofp_socklen_t *addrlen,
+		int flags);
+
 #endif
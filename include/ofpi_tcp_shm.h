@@ -26,17 +26,20 @@ struct ofp_tcp_var_mem {
 #else
 	VNET_DEFINE(struct inpcbhead, ofp_tcb);/* queue of active tcpcb's */
 	VNET_DEFINE(struct inpcbinfo, ofp_tcbinfo);
+	VNET_DEFINE(struct inpcbconntbl, ofp_conntbl);
 	VNET_DEFINE(OFP_TAILQ_HEAD(, tcptw), twq_2msl);
 	odp_timer_t ofp_tcp_slow_timer;
 #endif
 
-/* Target size of TCP PCB hash tables. Must be a power of two.*/
-#define TCBHASHSIZE			1024
-	struct inpcbhead	ofp_hashtbl[TCBHASHSIZE];
-	struct inpcbporthead	ofp_porthashtbl[TCBHASHSIZE];
-
-#define TCP_SYNCACHE_HASHSIZE		1024
-	struct syncache_head	syncache[TCP_SYNCACHE_HASHSIZE];
+/*
+ * Hash tables follow this structure in the same shared memory block.
+ * Sizes are global_param->hash_size.tcp_pcb and .tcp_syncache, both
+ * powers of two. The connection index buckets come last, cache line
+ * aligned, OFP_TCP_CONN_BUCKETS of them.
+ */
+	struct inpcbhead	*ofp_hashtbl;
+	struct inpcbporthead	*ofp_porthashtbl;
+	struct syncache_head	*syncache;
 
 	VNET_DEFINE(uma_zone_t, tcp_reass_zone);
 	VNET_DEFINE(uma_zone_t, tcp_syncache_zone);
@@ -46,6 +49,11 @@ struct ofp_tcp_var_mem {
 };
 extern __thread struct ofp_tcp_var_mem *shm_tcp;
 
+/* Connection index size at full load, two connections per bucket */
+#define OFP_TCP_CONN_BUCKETS						\
+	(global_param->hash_size.tcp_pcb / 2 > (1 << INPCBCONN_MINBITS) ?	\
+	 global_param->hash_size.tcp_pcb / 2 : (1 << INPCBCONN_MINBITS))
+
 #ifdef OFP_RSS
 #define	V_tcb			VNET(shm_tcp->ofp_tcb[odp_cpu_id()])
 #define	V_tcbinfo		VNET(shm_tcp->ofp_tcbinfo[odp_cpu_id()])
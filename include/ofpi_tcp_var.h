@@ -216,6 +216,9 @@ struct tcpcb {
 	uint32_t	t_keepintvl;		/* interval between keepalives */
 	uint32_t	t_keepcnt;		/* number of keepalives before close */
 
+	uint64_t	t_txmark;		/* output queue mark of last segment */
+	int	t_txthr;		/* thread that queued the last segment */
+
 	uint32_t t_ispare[8];		/* 5 UTO, 3 TBD */
 	void	*t_pspare2[4];		/* 4 TBD */
 	uint64_t _pad[6];		/* 6 TBD (1-2 CC/RTT?) */
@@ -238,6 +241,7 @@ struct tcpcb {
 #define	TF_NEEDFIN	0x000800	/* send FIN (implicit state) */
 #define	TF_NOPUSH	0x001000	/* don't push */
 #define	TF_PREVVALID	0x002000	/* saved values for bad rxmit valid */
+#define	TF_CORKED	0x004000	/* held back by autocork */
 #define	TF_MORETOCOME	0x010000	/* More data to be appended to sock */
 #define	TF_LQ_OVERFLOW	0x020000	/* listen queue overflow */
 #define	TF_LASTIDLE	0x040000	/* connection was previously idle */
@@ -670,6 +674,7 @@ struct inpcb *
 struct tcpcb *
 	 ofp_tcp_newtcpcb(struct inpcb *);
 int	 ofp_tcp_output(struct tcpcb *);
+int	 ofp_tcp_output_corked(void);
 void	 ofp_tcp_respond(struct tcpcb *, void *,
 	    struct ofp_tcphdr *, odp_packet_t , tcp_seq, tcp_seq, int);
 void	 ofp_tcp_tw_init(void);
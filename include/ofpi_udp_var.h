@@ -66,11 +66,19 @@ typedef void(*udp_tun_func_t)(odp_packet_t , int off, struct inpcb *);
 /*
  * UDP control block; one per udp.
  */
+struct udp_mcast;
+
 struct udpcb {
 	udp_tun_func_t	u_tun_func;	/* UDP kernel tunneling callback. */
 	uint32_t		u_flags;	/* Generic UDP flags. */
+	struct udp_mcast	*u_mcast;	/* Multicast index entries. */
+	int			u_nmcast;	/* Number of u_mcast. */
+	uint16_t		u_segsize;	/* OFP_UDP_SEGMENT size. */
 };
 
+/* u_flags */
+#define	UF_GRO		0x0001		/* OFP_UDP_GRO receive */
+
 #define	intoudpcb(ip)	((struct udpcb *)(ip)->inp_ppcb)
 #define	sotoudpcb(so)	(intoudpcb(sotoinpcb(so)))
 
@@ -131,5 +139,7 @@ void		 ofp_udp_destroy(void);
 enum ofp_return_code ofp_udp_input(odp_packet_t *, int);
 struct inpcb	*ofp_udp_notify(struct inpcb *, int);
 int		 ofp_udp_shutdown(struct socket *so);
+int		 ofp_udp_send_burst(struct socket *so, odp_packet_t *pkts,
+				    int num, int *sent);
 
 #endif
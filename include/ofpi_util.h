@@ -120,6 +120,12 @@ static inline int ilog2(unsigned long long n)
 	return 63 - __builtin_clzll(n);
 }
 
+/* Smallest power of two that is not less than n. */
+static inline uint32_t ofp_roundup_pow2(uint32_t n)
+{
+	return n <= 1 ? 1 : 1U << (ilog2(n - 1) + 1);
+}
+
 static inline odp_bool_t ofp_ip6_is_set(uint8_t *addr)
 {
 	return ((*(uint64_t *)addr | *(uint64_t *)(addr + 8)) == 0 ? 0 : 1);
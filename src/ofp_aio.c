@@ -0,0 +1,659 @@
+/* Copyright (c) 2016, Nokia
+ * Copyright (c) 2016, ENEA Software AB
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:     BSD-3-Clause
+ */
+
+#include <string.h>
+
+#include <odp_api.h>
+
+#include "ofpi_aio.h"
+#include "ofpi_in.h"
+#include "ofpi_socketvar.h"
+#include "ofpi_sockbuf.h"
+#include "ofpi_sockstate.h"
+#include "ofpi_syscalls.h"
+#include "ofpi_shared_mem.h"
+#include "ofpi_util.h"
+#include "ofpi_log.h"
+#include "ofp_errno.h"
+
+#define SHM_NAME_AIO "OfpAioShMem"
+
+#define AIO_RING_NUM 64
+#define AIO_BURST 32
+
+/*
+ * A request lives in a buffer of the AIO pool from submission until
+ * the application frees its completion: the completion is the head
+ * of the buffer and the buffer is the completion event. A request
+ * that would block is queued on its socket, in so_aio.rcv or
+ * so_aio.snd.
+ *
+ * A wakeup of the socket does not run the request: it only puts the
+ * first one of each list on the ready list of its ring. The requests
+ * are run by ofp_aio_run() of the ring, in the thread of the
+ * application, which owns the buffers. Only the holder of so_aio.lock
+ * runs the requests of a socket, which keeps them in order. Every
+ * wakeup bumps so_aio.gen, so that a request that would block is tried
+ * again if the socket was woken while it ran.
+ */
+struct ofp_aio_req {
+	struct ofp_aio_cqe cqe;
+	OFP_TAILQ_ENTRY(ofp_aio_req) link;
+	OFP_TAILQ_ENTRY(ofp_aio_req) rlink;	/* ready list of the ring */
+	struct ofp_aio_ring *ring;
+	struct ofp_aio_sqe sqe;
+	union ofp_sockaddr_store addr;	/* OFP_AIO_CONNECT */
+	int connecting;
+	int ready;			/* on the ready list, ring lock */
+	odp_buffer_t buf;
+};
+
+struct ofp_aio_ring {
+	odp_queue_t queue;
+	uint32_t entries;
+	odp_atomic_u32_t inflight;
+	odp_spinlock_t lock;
+	OFP_TAILQ_HEAD(, ofp_aio_req) ready;	/* requests to run */
+	struct ofp_aio_ring *next;	/* next in free list */
+};
+
+struct ofp_aio_mem {
+	odp_pool_t pool;
+	odp_spinlock_t lock;
+	struct ofp_aio_ring *free_rings;
+	struct ofp_aio_ring rings[AIO_RING_NUM];
+};
+
+static __thread struct ofp_aio_mem *shm_aio;
+
+static int ofp_aio_alloc_shared_memory(void)
+{
+	shm_aio = ofp_shared_memory_alloc(SHM_NAME_AIO, sizeof(*shm_aio));
+	if (shm_aio == NULL) {
+		OFP_ERR("ofp_shared_memory_alloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int ofp_aio_free_shared_memory(void)
+{
+	int rc = 0;
+
+	if (ofp_shared_memory_free(SHM_NAME_AIO) == -1) {
+		OFP_ERR("ofp_shared_memory_free failed");
+		rc = -1;
+	}
+	shm_aio = NULL;
+	return rc;
+}
+
+int ofp_aio_lookup_shared_memory(void)
+{
+	shm_aio = ofp_shared_memory_lookup(SHM_NAME_AIO);
+	if (shm_aio == NULL) {
+		OFP_ERR("ofp_shared_memory_lookup failed");
+		return -1;
+	}
+	return 0;
+}
+
+void ofp_aio_init_prepare(void)
+{
+	ofp_shared_memory_prealloc(SHM_NAME_AIO, sizeof(*shm_aio));
+}
+
+int ofp_aio_init_global(void)
+{
+	odp_pool_param_t pool_params;
+	int i;
+
+	HANDLE_ERROR(ofp_aio_alloc_shared_memory());
+
+	memset(shm_aio, 0, sizeof(*shm_aio));
+	odp_spinlock_init(&shm_aio->lock);
+
+	for (i = 0; i < AIO_RING_NUM; i++)
+		shm_aio->rings[i].next = (i == AIO_RING_NUM - 1) ?
+			NULL : &shm_aio->rings[i + 1];
+	shm_aio->free_rings = &shm_aio->rings[0];
+
+	odp_pool_param_init(&pool_params);
+	pool_params.buf.size  = sizeof(struct ofp_aio_req);
+	pool_params.buf.align = 0;
+	pool_params.buf.num   = global_param->aio_max;
+	pool_params.type      = ODP_POOL_BUFFER;
+
+	shm_aio->pool = ofp_pool_create("OfpAioPool", &pool_params);
+	if (shm_aio->pool == ODP_POOL_INVALID) {
+		OFP_ERR("odp_pool_create failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int ofp_aio_term_global(void)
+{
+	int rc = 0;
+
+	if (ofp_aio_lookup_shared_memory())
+		return -1;
+
+	if (shm_aio->pool != ODP_POOL_INVALID) {
+		CHECK_ERROR(odp_pool_destroy(shm_aio->pool), rc);
+		shm_aio->pool = ODP_POOL_INVALID;
+	}
+
+	CHECK_ERROR(ofp_aio_free_shared_memory(), rc);
+
+	return rc;
+}
+
+void ofp_aio_init_socket(struct socket *so)
+{
+	OFP_TAILQ_INIT(&so->so_aio.rcv);
+	OFP_TAILQ_INIT(&so->so_aio.snd);
+	odp_spinlock_init(&so->so_aio.qlock);
+	odp_spinlock_init(&so->so_aio.lock);
+	odp_atomic_init_u32(&so->so_aio.gen, 0);
+	so->so_aio.closed = 0;
+}
+
+
+static inline struct so_aio_list *aio_list(struct socket *so, int op)
+{
+	return (op == OFP_AIO_RECV || op == OFP_AIO_ACCEPT) ?
+		&so->so_aio.rcv : &so->so_aio.snd;
+}
+
+static inline struct sockbuf *aio_sockbuf(struct socket *so, int op)
+{
+	return (op == OFP_AIO_RECV || op == OFP_AIO_ACCEPT) ?
+		&so->so_rcv : &so->so_snd;
+}
+
+/* Enqueue completions of one ring */
+static void aio_enq(struct ofp_aio_ring *ring, odp_event_t ev[], int num)
+{
+	odp_queue_t queue = ring->queue;
+	int i, sent;
+
+	sent = odp_queue_enq_multi(queue, ev, num);
+	if (sent < 0)
+		sent = 0;
+	if (sent < num) {
+		OFP_ERR("odp_queue_enq_multi failed");
+		for (i = sent; i < num; i++)
+			odp_buffer_free(odp_buffer_from_event(ev[i]));
+	}
+
+	odp_atomic_sub_u32(&ring->inflight, num);
+}
+
+static void aio_post(struct ofp_aio_req *req)
+{
+	odp_event_t ev = odp_buffer_to_event(req->buf);
+
+	aio_enq(req->ring, &ev, 1);
+}
+
+/* Put a request on the ready list of its ring */
+static void aio_ready(struct ofp_aio_req *req)
+{
+	struct ofp_aio_ring *ring = req->ring;
+
+	odp_spinlock_lock(&ring->lock);
+	if (!req->ready) {
+		OFP_TAILQ_INSERT_TAIL(&ring->ready, req, rlink);
+		req->ready = 1;
+	}
+	odp_spinlock_unlock(&ring->lock);
+}
+
+static void aio_unready(struct ofp_aio_req *req)
+{
+	struct ofp_aio_ring *ring = req->ring;
+
+	odp_spinlock_lock(&ring->lock);
+	if (req->ready) {
+		OFP_TAILQ_REMOVE(&ring->ready, req, rlink);
+		req->ready = 0;
+	}
+	odp_spinlock_unlock(&ring->lock);
+}
+
+/*
+ * A connect is started once and then waits until the socket is no
+ * longer connecting.
+ */
+static int aio_connect(struct socket *so, struct ofp_aio_req *req)
+{
+	struct ofp_sockaddr *addr = (struct ofp_sockaddr *)&req->addr;
+	int error;
+
+	if (!req->connecting) {
+		if (ofp_connect(req->sqe.fd, addr, addr->sa_len) < 0) {
+			req->cqe.res = -ofp_errno;
+			return 1;
+		}
+		req->connecting = 1;
+	}
+
+	OFP_SOCK_LOCK(so);
+	if (so->so_error) {
+		error = so->so_error;
+		so->so_error = 0;
+	} else if (so->so_state & SS_ISCONNECTING) {
+		OFP_SOCK_UNLOCK(so);
+		return 0;
+	} else if (so->so_state & SS_ISCONNECTED)
+		error = 0;
+	else
+		error = OFP_ECONNABORTED;
+	OFP_SOCK_UNLOCK(so);
+
+	req->cqe.res = -error;
+	return 1;
+}
+
+/*
+ * Try a request without blocking. Returns 1 with the result in the
+ * completion if it is done, 0 if it would block.
+ */
+static int aio_exec(struct socket *so, struct ofp_aio_req *req)
+{
+	struct ofp_aio_sqe *sqe = &req->sqe;
+	int res;
+
+	switch (sqe->op) {
+	case OFP_AIO_RECV:
+		res = ofp_recv(sqe->fd, sqe->buf, sqe->len,
+			       sqe->flags | OFP_MSG_DONTWAIT);
+		break;
+	case OFP_AIO_SEND:
+		res = ofp_send(sqe->fd, sqe->buf, sqe->len,
+			       sqe->flags | OFP_MSG_DONTWAIT);
+		break;
+	case OFP_AIO_ACCEPT:
+		res = _ofp_accept(sqe->fd, sqe->addr, sqe->addrlen,
+				  OFP_MSG_DONTWAIT);
+		break;
+	case OFP_AIO_CONNECT:
+		return aio_connect(so, req);
+	default:
+		res = -1;
+		ofp_errno = OFP_EINVAL;
+	}
+
+	if (res < 0 && ofp_errno == OFP_EWOULDBLOCK)
+		return 0;
+
+	req->cqe.res = res < 0 ? -ofp_errno : res;
+	return 1;
+}
+
+/*
+ * Stop the wakeups of a socket from running its requests once none are
+ * left. Called with so_aio.qlock held, so that a request queued at the
+ * same time sets the flag again after this.
+ */
+static void aio_flags_clear(struct socket *so)
+{
+	if (!OFP_TAILQ_EMPTY(&so->so_aio.rcv) ||
+	    !OFP_TAILQ_EMPTY(&so->so_aio.snd))
+		return;
+
+	if (so->so_rcv.sb_flags & SB_AIO) {
+		SOCKBUF_LOCK(&so->so_rcv);
+		so->so_rcv.sb_flags &= ~SB_AIO;
+		SOCKBUF_UNLOCK(&so->so_rcv);
+	}
+	if (so->so_snd.sb_flags & SB_AIO) {
+		SOCKBUF_LOCK(&so->so_snd);
+		so->so_snd.sb_flags &= ~SB_AIO;
+		SOCKBUF_UNLOCK(&so->so_snd);
+	}
+}
+
+/*
+ * Queue a request on its socket, at the head if it was taken from
+ * there. A closed socket cancels it.
+ */
+static void aio_park(struct socket *so, struct ofp_aio_req *req, int head)
+{
+	struct so_aio_list *list = aio_list(so, req->sqe.op);
+	struct sockbuf *sb = aio_sockbuf(so, req->sqe.op);
+
+	odp_spinlock_lock(&so->so_aio.qlock);
+	if (so->so_aio.closed) {
+		odp_spinlock_unlock(&so->so_aio.qlock);
+		req->cqe.res = -OFP_ECANCELED;
+		aio_post(req);
+		return;
+	}
+	if (head)
+		OFP_TAILQ_INSERT_HEAD(list, req, link);
+	else
+		OFP_TAILQ_INSERT_TAIL(list, req, link);
+	if (!(sb->sb_flags & SB_AIO)) {
+		SOCKBUF_LOCK(sb);
+		sb->sb_flags |= SB_AIO;
+		SOCKBUF_UNLOCK(sb);
+	}
+	odp_spinlock_unlock(&so->so_aio.qlock);
+}
+
+/*
+ * Run the requests of a list from its head as long as they belong to
+ * the ring and complete. A request of another ring is handed to that
+ * ring. Called with so_aio.lock held. Returns the number of requests
+ * completed.
+ */
+static int aio_run_list(struct socket *so, struct so_aio_list *list,
+			struct ofp_aio_ring *ring)
+{
+	struct ofp_aio_req *req;
+	uint32_t gen;
+	int num = 0;
+
+	for (;;) {
+		gen = odp_atomic_load_u32(&so->so_aio.gen);
+
+		odp_spinlock_lock(&so->so_aio.qlock);
+		req = OFP_TAILQ_FIRST(list);
+		if (req && req->ring != ring) {
+			aio_ready(req);
+			req = NULL;
+		} else if (req) {
+			OFP_TAILQ_REMOVE(list, req, link);
+			aio_unready(req);
+		} else
+			aio_flags_clear(so);
+		odp_spinlock_unlock(&so->so_aio.qlock);
+
+		if (!req)
+			return num;
+
+		if (!aio_exec(so, req)) {
+			aio_park(so, req, 1);
+			/* Try again if woken meanwhile */
+			if (odp_atomic_load_u32(&so->so_aio.gen) == gen)
+				return num;
+			continue;
+		}
+		aio_post(req);
+		num++;
+	}
+}
+
+/*
+ * Called from the wakeups of the socket, possibly in another thread
+ * and with protocol locks held. The first requests are left to the
+ * owners of their rings.
+ */
+void ofp_aio_notify(struct socket *so)
+{
+	struct ofp_aio_req *req;
+
+	odp_atomic_inc_u32(&so->so_aio.gen);
+
+	odp_spinlock_lock(&so->so_aio.qlock);
+	req = OFP_TAILQ_FIRST(&so->so_aio.rcv);
+	if (req)
+		aio_ready(req);
+	req = OFP_TAILQ_FIRST(&so->so_aio.snd);
+	if (req)
+		aio_ready(req);
+	odp_spinlock_unlock(&so->so_aio.qlock);
+}
+
+void ofp_aio_close(struct socket *so)
+{
+	struct so_aio_list list;
+	struct ofp_aio_req *req;
+
+	OFP_TAILQ_INIT(&list);
+
+	odp_spinlock_lock(&so->so_aio.qlock);
+	so->so_aio.closed = 1;
+	OFP_TAILQ_CONCAT(&list, &so->so_aio.rcv, link);
+	OFP_TAILQ_CONCAT(&list, &so->so_aio.snd, link);
+	OFP_TAILQ_FOREACH(req, &list, link)
+		aio_unready(req);
+	aio_flags_clear(so);
+	odp_spinlock_unlock(&so->so_aio.qlock);
+
+	while ((req = OFP_TAILQ_FIRST(&list))) {
+		OFP_TAILQ_REMOVE(&list, req, link);
+		req->cqe.res = -OFP_ECANCELED;
+		aio_post(req);
+	}
+}
+
+/*
+ * Start a request. Returns 1 if it completed at once, 0 if it was
+ * queued on its socket. A request that finds earlier ones queued in
+ * the same direction is queued behind them.
+ */
+static int aio_start(struct ofp_aio_req *req)
+{
+	struct socket *so = ofp_get_sock_by_fd(req->sqe.fd);
+	struct so_aio_list *list;
+	uint32_t gen;
+	int done = 0;
+
+	if (!so) {
+		req->cqe.res = -OFP_EBADF;
+		return 1;
+	}
+	list = aio_list(so, req->sqe.op);
+
+	odp_spinlock_lock(&so->so_aio.lock);
+
+	odp_spinlock_lock(&so->so_aio.qlock);
+	if (OFP_TAILQ_EMPTY(list))
+		done = 1;
+	odp_spinlock_unlock(&so->so_aio.qlock);
+
+	if (done) {
+		gen = odp_atomic_load_u32(&so->so_aio.gen);
+		done = aio_exec(so, req);
+		if (!done) {
+			aio_park(so, req, 0);
+			if (odp_atomic_load_u32(&so->so_aio.gen) != gen)
+				aio_run_list(so, list, req->ring);
+		}
+	} else
+		aio_park(so, req, 0);
+
+	odp_spinlock_unlock(&so->so_aio.lock);
+
+	return done;
+}
+
+ofp_aio_ring_t ofp_aio_ring_create(odp_queue_t compl_queue, uint32_t entries)
+{
+	struct ofp_aio_ring *ring;
+
+	if (compl_queue == ODP_QUEUE_INVALID || entries == 0) {
+		ofp_errno = OFP_EINVAL;
+		return OFP_AIO_RING_INVALID;
+	}
+
+	odp_spinlock_lock(&shm_aio->lock);
+	ring = shm_aio->free_rings;
+	if (ring)
+		shm_aio->free_rings = ring->next;
+	odp_spinlock_unlock(&shm_aio->lock);
+
+	if (!ring) {
+		ofp_errno = OFP_ENOMEM;
+		return OFP_AIO_RING_INVALID;
+	}
+
+	ring->queue = compl_queue;
+	ring->entries = entries;
+	ring->next = NULL;
+	odp_atomic_init_u32(&ring->inflight, 0);
+	odp_spinlock_init(&ring->lock);
+	OFP_TAILQ_INIT(&ring->ready);
+
+	return ring;
+}
+
+int ofp_aio_ring_destroy(ofp_aio_ring_t ring)
+{
+	if (odp_atomic_load_u32(&ring->inflight)) {
+		ofp_errno = OFP_EBUSY;
+		return -1;
+	}
+
+	ring->queue = ODP_QUEUE_INVALID;
+
+	odp_spinlock_lock(&shm_aio->lock);
+	ring->next = shm_aio->free_rings;
+	shm_aio->free_rings = ring;
+	odp_spinlock_unlock(&shm_aio->lock);
+
+	return 0;
+}
+
+int ofp_aio_submit(ofp_aio_ring_t ring, const struct ofp_aio_sqe sqe[], int num)
+{
+	odp_event_t ev[AIO_BURST];
+	struct ofp_aio_req *req;
+	odp_buffer_t buf;
+	int i, n = 0;
+
+	if (num <= 0)
+		return 0;
+
+	for (i = 0; i < num; i++) {
+		if (odp_atomic_fetch_inc_u32(&ring->inflight) >= ring->entries) {
+			odp_atomic_dec_u32(&ring->inflight);
+			ofp_errno = OFP_EBUSY;
+			break;
+		}
+
+		buf = odp_buffer_alloc(shm_aio->pool);
+		if (buf == ODP_BUFFER_INVALID) {
+			odp_atomic_dec_u32(&ring->inflight);
+			ofp_errno = OFP_ENOBUFS;
+			break;
+		}
+
+		req = odp_buffer_addr(buf);
+		req->buf = buf;
+		req->ring = ring;
+		req->sqe = sqe[i];
+		req->connecting = 0;
+		req->ready = 0;
+		req->cqe.user_data = sqe[i].user_data;
+		req->cqe.op = sqe[i].op;
+		req->cqe.fd = sqe[i].fd;
+		req->cqe.res = 0;
+
+		if (sqe[i].op < OFP_AIO_RECV || sqe[i].op > OFP_AIO_CONNECT ||
+		    (sqe[i].op == OFP_AIO_CONNECT &&
+		     (!sqe[i].addr || sqe[i].addr->sa_len > sizeof(req->addr)))) {
+			req->cqe.res = -OFP_EINVAL;
+			ev[n++] = odp_buffer_to_event(buf);
+		} else {
+			if (sqe[i].op == OFP_AIO_CONNECT)
+				memcpy(&req->addr, sqe[i].addr,
+				       sqe[i].addr->sa_len);
+			if (aio_start(req))
+				ev[n++] = odp_buffer_to_event(buf);
+		}
+
+		if (n == AIO_BURST) {
+			aio_enq(ring, ev, n);
+			n = 0;
+		}
+	}
+
+	if (n)
+		aio_enq(ring, ev, n);
+
+	return i ? i : -1;
+}
+
+struct ofp_aio_cqe *ofp_aio_cqe(odp_event_t ev)
+{
+	odp_buffer_t buf;
+
+	if (odp_event_type(ev) != ODP_EVENT_BUFFER)
+		return NULL;
+
+	buf = odp_buffer_from_event(ev);
+	if (odp_buffer_pool(buf) != shm_aio->pool)
+		return NULL;
+
+	return odp_buffer_addr(buf);
+}
+
+void ofp_aio_cqe_free(odp_event_t ev)
+{
+	odp_buffer_free(odp_buffer_from_event(ev));
+}
+
+int ofp_aio_run(ofp_aio_ring_t ring)
+{
+	struct ofp_aio_req *req;
+	struct socket *so;
+	int fd, op, num = 0;
+
+	for (;;) {
+		odp_spinlock_lock(&ring->lock);
+		req = OFP_TAILQ_FIRST(&ring->ready);
+		if (req) {
+			OFP_TAILQ_REMOVE(&ring->ready, req, rlink);
+			req->ready = 0;
+			/* The request may complete once the lock is dropped */
+			fd = req->sqe.fd;
+			op = req->sqe.op;
+		}
+		odp_spinlock_unlock(&ring->lock);
+
+		if (!req)
+			break;
+
+		so = ofp_get_sock_by_fd(fd);
+		if (!so)
+			continue;
+
+		odp_spinlock_lock(&so->so_aio.lock);
+		num += aio_run_list(so, aio_list(so, op), ring);
+		odp_spinlock_unlock(&so->so_aio.lock);
+	}
+
+	return num;
+}
+
+int ofp_aio_reap(ofp_aio_ring_t ring, struct ofp_aio_cqe cqe[], int num)
+{
+	odp_event_t ev[AIO_BURST];
+	int i, n, total = 0;
+
+	ofp_aio_run(ring);
+
+	while (total < num) {
+		n = odp_queue_deq_multi(ring->queue, ev,
+					min(num - total, AIO_BURST));
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			cqe[total++] = *(struct ofp_aio_cqe *)
+				odp_buffer_addr(odp_buffer_from_event(ev[i]));
+			odp_buffer_free(odp_buffer_from_event(ev[i]));
+		}
+	}
+
+	return total;
+}
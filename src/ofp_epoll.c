@@ -5,31 +5,137 @@
  * SPDX-License-Identifier:     BSD-3-Clause
  */
 
+#include <string.h>
+
 #include "ofp_epoll.h"
 #include "ofpi_epoll.h"
 #include "ofp_errno.h"
+#include "ofpi_sockstate.h"
+#include "ofpi_shared_mem.h"
+#include "ofpi_util.h"
+#include "ofpi_log.h"
+
+#define SHM_NAME_EPOLL "OfpEpollShMem"
+
+/*
+ * An epoll item is one fd registered in one epoll set. It is linked
+ * to the interest list of the epoll socket and to the item list of
+ * the registered socket. Socket wakeups put the items of the socket
+ * to the ready lists of their epoll sets, so that ofp_epoll_wait()
+ * only looks at the fds that have seen an event.
+ *
+ * Item lists are protected by the global epoll lock; the ready list
+ * and the ready and disabled flags by the lock of the epoll socket.
+ */
+struct epoll_item {
+	OFP_LIST_ENTRY(epoll_item) ep_link;
+	OFP_LIST_ENTRY(epoll_item) so_link;
+	OFP_TAILQ_ENTRY(epoll_item) ready_link;
+	struct socket *epoll;
+	struct socket *so;
+	int fd;
+	int ready;
+	int disabled;	/* OFP_EPOLLONESHOT item has fired */
+	struct ofp_epoll_event event;
+	struct epoll_item *next;	/* next in free list */
+};
+
+struct ofp_epoll_mem {
+	odp_rwlock_t lock;
+	struct epoll_item *free_items;
+	struct epoll_item items[];
+};
+
+static __thread struct ofp_epoll_mem *shm_epoll;
+
+static uint64_t ofp_epoll_shared_memory_size(void)
+{
+	return sizeof(*shm_epoll) +
+		global_param->epoll_watches * sizeof(struct epoll_item);
+}
+
+static int ofp_epoll_alloc_shared_memory(void)
+{
+	shm_epoll = ofp_shared_memory_alloc(SHM_NAME_EPOLL,
+					    ofp_epoll_shared_memory_size());
+	if (shm_epoll == NULL) {
+		OFP_ERR("ofp_shared_memory_alloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int ofp_epoll_free_shared_memory(void)
+{
+	int rc = 0;
+
+	if (ofp_shared_memory_free(SHM_NAME_EPOLL) == -1) {
+		OFP_ERR("ofp_shared_memory_free failed");
+		rc = -1;
+	}
+	shm_epoll = NULL;
+	return rc;
+}
+
+int ofp_epoll_lookup_shared_memory(void)
+{
+	shm_epoll = ofp_shared_memory_lookup(SHM_NAME_EPOLL);
+	if (shm_epoll == NULL) {
+		OFP_ERR("ofp_shared_memory_lookup failed");
+		return -1;
+	}
+	return 0;
+}
+
+void ofp_epoll_init_prepare(void)
+{
+	ofp_shared_memory_prealloc(SHM_NAME_EPOLL,
+				   ofp_epoll_shared_memory_size());
+}
+
+int ofp_epoll_init_global(void)
+{
+	int i, num = global_param->epoll_watches;
+
+	HANDLE_ERROR(ofp_epoll_alloc_shared_memory());
 
-#define LENGTH(array) \
-	sizeof(array)/sizeof(*array)
-#define FOREACH(item, array) \
-	int i, l, breaked; \
-	for (i = 0, l = LENGTH(array), breaked = 0; i < l && !breaked; ++i, breaked = !breaked) \
-		for (item = &array[i]; !breaked; breaked = !breaked)
+	memset(shm_epoll, 0, ofp_epoll_shared_memory_size());
+	odp_rwlock_init(&shm_epoll->lock);
+
+	for (i = 0; i < num; i++)
+		shm_epoll->items[i].next = (i == num - 1) ?
+			NULL : &shm_epoll->items[i + 1];
+	shm_epoll->free_items = num ? &shm_epoll->items[0] : NULL;
+
+	return 0;
+}
+
+int ofp_epoll_term_global(void)
+{
+	int rc = 0;
+
+	CHECK_ERROR(ofp_epoll_free_shared_memory(), rc);
+
+	return rc;
+}
+
+void ofp_epoll_init_socket(struct socket *epoll)
+{
+	epoll->so_type = OFP_SOCK_EPOLL;
+	OFP_LIST_INIT(&epoll->so_epoll.items);
+	OFP_TAILQ_INIT(&epoll->so_epoll.ready);
+	odp_rwlock_init(&epoll->so_epoll.lock);
+	epoll->so_epoll.waiters = 0;
+}
 
 static int epoll_socket_creator(void)
 {
 	const int epfd = ofp_socket(OFP_AF_INET, OFP_SOCK_STREAM, 0);
-	struct socket *epoll;
-	struct epoll_set *epoll_set;
 
 	if (epfd == -1)
 		return -1;
 
-	epoll = ofp_get_sock_by_fd(epfd);
-	epoll->so_type = OFP_SOCK_EPOLL;
-
-	FOREACH(epoll_set, epoll->epoll_set)
-		epoll_set->fd = -1;
+	ofp_epoll_init_socket(ofp_get_sock_by_fd(epfd));
 
 	return epfd;
 }
@@ -68,156 +174,305 @@ static inline int is_epoll_socket(struct socket *epoll)
 	return (epoll->so_type == OFP_SOCK_EPOLL);
 }
 
-static inline int get_fd(struct epoll_set *epoll_set)
+static int (*is_fd_readable)(int fd) = is_readable;
+static int (*is_fd_writable)(int fd) = is_writable;
+
+/* Events that are pending on the item, masked by the registration. */
+static uint32_t poll_events(struct epoll_item *item)
 {
-	return epoll_set->fd;
+	const uint32_t mask = item->event.events | OFP_EPOLLERR | OFP_EPOLLHUP;
+	struct socket *so = item->so;
+	uint32_t events = 0;
+
+	if ((mask & OFP_EPOLLIN) && is_fd_readable(item->fd))
+		events |= OFP_EPOLLIN;
+	if ((mask & OFP_EPOLLOUT) && is_fd_writable(item->fd))
+		events |= OFP_EPOLLOUT;
+	if (so->so_error)
+		events |= OFP_EPOLLERR;
+	if ((so->so_rcv.sb_state & SBS_CANTRCVMORE) &&
+	    (so->so_snd.sb_state & SBS_CANTSENDMORE))
+		events |= OFP_EPOLLHUP;
+
+	return events & mask;
 }
 
-static inline int is_fd(struct epoll_set *epoll_set, int fd)
+/* Called with the epoll socket locked. */
+static inline int queue_ready(struct epoll_item *item)
 {
-	return (get_fd(epoll_set) == fd);
+	if (item->ready || item->disabled)
+		return 0;
+
+	OFP_TAILQ_INSERT_TAIL(&item->epoll->so_epoll.ready, item, ready_link);
+	item->ready = 1;
+	return 1;
 }
 
-static inline struct epoll_set *find_fd(struct socket *epoll, int fd)
+/* Called with the epoll socket locked. */
+static inline void dequeue_ready(struct epoll_item *item)
 {
-	struct epoll_set *epoll_set;
+	if (!item->ready)
+		return;
 
-	FOREACH(epoll_set, epoll->epoll_set)
-		if (is_fd(epoll_set, fd))
-			return epoll_set;
+	OFP_TAILQ_REMOVE(&item->epoll->so_epoll.ready, item, ready_link);
+	item->ready = 0;
+}
 
-	return NULL;
+static void set_sb_epoll(struct socket *so, int on)
+{
+	SOCKBUF_LOCK(&so->so_rcv);
+	if (on)
+		so->so_rcv.sb_flags |= SB_EPOLL;
+	else
+		so->so_rcv.sb_flags &= ~SB_EPOLL;
+	SOCKBUF_UNLOCK(&so->so_rcv);
+
+	SOCKBUF_LOCK(&so->so_snd);
+	if (on)
+		so->so_snd.sb_flags |= SB_EPOLL;
+	else
+		so->so_snd.sb_flags &= ~SB_EPOLL;
+	SOCKBUF_UNLOCK(&so->so_snd);
 }
 
-static inline int is_registered(struct socket *epoll, int fd)
+/* Called with the global epoll lock held for writing. */
+static struct epoll_item *find_item(struct socket *epoll, struct socket *so,
+				    int fd)
 {
-	return (find_fd(epoll, fd) != NULL);
+	struct epoll_item *item;
+
+	OFP_LIST_FOREACH(item, &so->so_epoll_items, so_link)
+		if (item->epoll == epoll && item->fd == fd)
+			return item;
+
+	return NULL;
 }
 
-static inline int set_fd(struct epoll_set *epoll_set, int fd, struct ofp_epoll_event *event)
+/* Called with the global epoll lock held for writing. */
+static void free_item(struct epoll_item *item)
 {
-	if (!epoll_set)
-		return failure(OFP_ENOSPC);
+	struct socket *epoll = item->epoll;
+	struct socket *so = item->so;
 
-	epoll_set->fd = fd;
-	epoll_set->event = *event;
-	return 0;
+	odp_rwlock_write_lock(&epoll->so_epoll.lock);
+	dequeue_ready(item);
+	odp_rwlock_write_unlock(&epoll->so_epoll.lock);
+
+	OFP_LIST_REMOVE(item, ep_link);
+	OFP_LIST_REMOVE(item, so_link);
+	if (OFP_LIST_EMPTY(&so->so_epoll_items))
+		set_sb_epoll(so, 0);
+
+	item->next = shm_epoll->free_items;
+	shm_epoll->free_items = item;
 }
 
-static inline int modify_epoll_set(struct socket *epoll, int old_fd, int new_fd, struct ofp_epoll_event *event)
+/* Called with the global epoll lock held for writing. */
+static void set_event(struct epoll_item *item, struct ofp_epoll_event *event)
 {
-	return set_fd(find_fd(epoll, old_fd), new_fd, event);
+	struct socket *epoll = item->epoll;
+
+	odp_rwlock_write_lock(&epoll->so_epoll.lock);
+	item->event = *event;
+	item->disabled = 0;
+	if (poll_events(item))
+		queue_ready(item);
+	odp_rwlock_write_unlock(&epoll->so_epoll.lock);
 }
 
-static int ofp_epoll_ctl_add(struct socket *epoll, int fd, struct ofp_epoll_event *event)
+static int ofp_epoll_ctl_add(struct socket *epoll, struct socket *so, int fd,
+			     struct ofp_epoll_event *event)
 {
-	if (is_registered(epoll, fd))
+	struct epoll_item *item;
+
+	if (find_item(epoll, so, fd))
 		return failure(OFP_EEXIST);
 
-	return modify_epoll_set(epoll, -1, fd, event);
+	item = shm_epoll->free_items;
+	if (!item)
+		return failure(OFP_ENOSPC);
+	shm_epoll->free_items = item->next;
+
+	item->epoll = epoll;
+	item->so = so;
+	item->fd = fd;
+	item->ready = 0;
+	OFP_LIST_INSERT_HEAD(&epoll->so_epoll.items, item, ep_link);
+	if (OFP_LIST_EMPTY(&so->so_epoll_items))
+		set_sb_epoll(so, 1);
+	OFP_LIST_INSERT_HEAD(&so->so_epoll_items, item, so_link);
+
+	set_event(item, event);
+	return 0;
 }
 
-static int ofp_epoll_ctl_del(struct socket *epoll, int fd)
+static int ofp_epoll_ctl_del(struct socket *epoll, struct socket *so, int fd)
 {
-	struct ofp_epoll_event event = { 0 };
+	struct epoll_item *item = find_item(epoll, so, fd);
 
-	if (!is_registered(epoll, fd))
+	if (!item)
 		return failure(OFP_ENOENT);
 
-	return modify_epoll_set(epoll, fd, -1, &event);
+	free_item(item);
+	return 0;
 }
 
-static int ofp_epoll_ctl_mod(struct socket *epoll, int fd, struct ofp_epoll_event *event)
+static int ofp_epoll_ctl_mod(struct socket *epoll, struct socket *so, int fd,
+			     struct ofp_epoll_event *event)
 {
-	if (!is_registered(epoll, fd))
+	struct epoll_item *item = find_item(epoll, so, fd);
+
+	if (!item)
 		return failure(OFP_ENOENT);
 
-	return modify_epoll_set(epoll, fd, fd, event);
+	set_event(item, event);
+	return 0;
 }
 
 int _ofp_epoll_ctl(struct socket *epoll, int op, int fd, struct ofp_epoll_event *event)
 {
-	if (!epoll || !get_socket(fd))
+	struct socket *so = get_socket(fd);
+	int ret;
+
+	if (!epoll || !so)
 		return failure(OFP_EBADF);
 
 	if (!is_epoll_socket(epoll))
 		return failure(OFP_EINVAL);
 
+	if (op != OFP_EPOLL_CTL_DEL && !event)
+		return failure(OFP_EFAULT);
+
+	odp_rwlock_write_lock(&shm_epoll->lock);
+
 	switch (op) {
 	case OFP_EPOLL_CTL_ADD:
-		return ofp_epoll_ctl_add(epoll, fd, event);
+		ret = ofp_epoll_ctl_add(epoll, so, fd, event);
+		break;
 	case OFP_EPOLL_CTL_DEL:
-		return ofp_epoll_ctl_del(epoll, fd);
+		ret = ofp_epoll_ctl_del(epoll, so, fd);
+		break;
 	case OFP_EPOLL_CTL_MOD:
-		return ofp_epoll_ctl_mod(epoll, fd, event);
+		ret = ofp_epoll_ctl_mod(epoll, so, fd, event);
+		break;
 	default:
-		ofp_errno = OFP_EINVAL;
+		ret = failure(OFP_EINVAL);
 	}
 
-	return -1;
-}
+	odp_rwlock_write_unlock(&shm_epoll->lock);
 
-static int sleeper(int timeout)
-{
-	return ofp_msleep(NULL, NULL, 0, "epoll", timeout * 1000);
+	return ret;
 }
 
-int ofp_epoll_wait(int epfd, struct ofp_epoll_event *events, int maxevents, int timeout)
+/*
+ * Socket wakeup callback. Queue the items of the socket to the ready
+ * lists. Readiness is checked in ofp_epoll_wait(), so that spurious
+ * wakeups cost only a list insertion.
+ */
+void ofp_epoll_notify(struct socket *so)
 {
-	return _ofp_epoll_wait(get_socket(epfd), events, maxevents, timeout, sleeper);
-}
+	struct epoll_item *item;
 
-static inline int is_fd_set(struct epoll_set *epoll_set)
-{
-	return !is_fd(epoll_set, -1);
-}
+	if (OFP_LIST_EMPTY(&so->so_epoll_items))
+		return;
 
-static int (*is_fd_readable)(int fd) = is_readable;
+	odp_rwlock_read_lock(&shm_epoll->lock);
 
-static inline struct ofp_epoll_event get_event(struct epoll_set *epoll_set)
-{
-	return epoll_set->event;
-}
+	OFP_LIST_FOREACH(item, &so->so_epoll_items, so_link) {
+		struct socket *epoll = item->epoll;
+		int wakeup;
 
-static inline int is_waiting_read_event(struct epoll_set *epoll_set)
-{
-	return (get_event(epoll_set).events & OFP_EPOLLIN);
+		odp_rwlock_write_lock(&epoll->so_epoll.lock);
+		wakeup = queue_ready(item) && epoll->so_epoll.waiters;
+		odp_rwlock_write_unlock(&epoll->so_epoll.lock);
+
+		if (wakeup)
+			ofp_wakeup(&epoll->so_epoll);
+	}
+
+	odp_rwlock_read_unlock(&shm_epoll->lock);
 }
 
-static int is_ready(struct epoll_set *epoll_set)
+/*
+ * Remove all registrations of a closing socket, and all registrations
+ * in the set if the socket is an epoll socket.
+ */
+void ofp_epoll_close(struct socket *so)
 {
-	if (!is_fd_set(epoll_set))
-		return 0;
+	struct epoll_item *item, *next;
+
+	if (OFP_LIST_EMPTY(&so->so_epoll_items) &&
+	    (!is_epoll_socket(so) || OFP_LIST_EMPTY(&so->so_epoll.items)))
+		return;
+
+	odp_rwlock_write_lock(&shm_epoll->lock);
+
+	OFP_LIST_FOREACH_SAFE(item, &so->so_epoll_items, so_link, next)
+		free_item(item);
+
+	if (is_epoll_socket(so))
+		OFP_LIST_FOREACH_SAFE(item, &so->so_epoll.items, ep_link, next)
+			free_item(item);
 
-	return (is_waiting_read_event(epoll_set) && is_fd_readable(get_fd(epoll_set)));
+	odp_rwlock_write_unlock(&shm_epoll->lock);
 }
 
-static int none_of_ready(struct socket *epoll)
+static int sleeper(struct socket *epoll, int timeout)
 {
-	struct epoll_set *epoll_set;
-
-	FOREACH(epoll_set, epoll->epoll_set)
-		if (is_ready(epoll_set))
-			return 0;
+	return ofp_msleep_busy(&epoll->so_epoll, &epoll->so_epoll.lock, 0,
+			       "epoll", timeout * 1000,
+			       epoll->so_rcv.sb_busy_poll);
+}
 
-	return 1;
+int ofp_epoll_wait(int epfd, struct ofp_epoll_event *events, int maxevents, int timeout)
+{
+	return _ofp_epoll_wait(get_socket(epfd), events, maxevents, timeout, sleeper);
 }
 
+/*
+ * Move the pending events of the ready list to events. Level-triggered
+ * items stay on the ready list behind the items not looked at yet.
+ * Items with no pending events are dropped until the next wakeup.
+ * Called with the epoll socket locked.
+ */
 static int available_events(struct socket *epoll, struct ofp_epoll_event *events, int maxevents)
 {
-	struct epoll_set *epoll_set;
+	OFP_TAILQ_HEAD(, epoll_item) again = OFP_TAILQ_HEAD_INITIALIZER(again);
+	struct epoll_item *item;
 	int ready = 0;
 
-	FOREACH(epoll_set, epoll->epoll_set)
-		if (ready < maxevents && is_ready(epoll_set))
-			events[ready++] = get_event(epoll_set);
+	while (ready < maxevents &&
+	       (item = OFP_TAILQ_FIRST(&epoll->so_epoll.ready))) {
+		uint32_t revents = poll_events(item);
+
+		OFP_TAILQ_REMOVE(&epoll->so_epoll.ready, item, ready_link);
+		item->ready = 0;
+
+		if (!revents)
+			continue;
+
+		events[ready].events = revents;
+		events[ready].data = item->event.data;
+		ready++;
+
+		if (item->event.events & OFP_EPOLLONESHOT) {
+			item->disabled = 1;
+		} else if (!(item->event.events & OFP_EPOLLET)) {
+			OFP_TAILQ_INSERT_TAIL(&again, item, ready_link);
+			item->ready = 1;
+		}
+	}
+
+	OFP_TAILQ_CONCAT(&epoll->so_epoll.ready, &again, ready_link);
 
 	return ready;
 }
 
 int _ofp_epoll_wait(struct socket *epoll, struct ofp_epoll_event *events, int maxevents, int timeout,
-		    int(*msleep)(int timeout))
+		    int(*msleep)(struct socket *epoll, int timeout))
 {
+	int ready;
+
 	if (!epoll)
 		return failure(OFP_EBADF);
 
@@ -230,13 +485,24 @@ int _ofp_epoll_wait(struct socket *epoll, struct ofp_epoll_event *events, int ma
 	if (timeout < 0 && timeout != -1)
 		return failure(OFP_EINVAL);
 
-	if (timeout && none_of_ready(epoll)) {
+	odp_rwlock_write_lock(&epoll->so_epoll.lock);
+
+	ready = available_events(epoll, events, maxevents);
+
+	if (!ready && timeout) {
 		if (timeout == -1)
 			timeout = 0; /* wait forver */
-		msleep(timeout);
+		/* The lock is released while sleeping. A wakeup queued
+		 * after the check above will wake us up. */
+		epoll->so_epoll.waiters++;
+		msleep(epoll, timeout);
+		epoll->so_epoll.waiters--;
+		ready = available_events(epoll, events, maxevents);
 	}
 
-	return available_events(epoll, events, maxevents);
+	odp_rwlock_write_unlock(&epoll->so_epoll.lock);
+
+	return ready;
 }
 
 void ofp_set_socket_getter(struct socket*(*socket_getter)(int fd))
@@ -248,3 +514,8 @@ void ofp_set_is_readable_checker(int(*is_readable_checker)(int fd))
 {
 	is_fd_readable = is_readable_checker;
 }
+
+void ofp_set_is_writable_checker(int(*is_writable_checker)(int fd))
+{
+	is_fd_writable = is_writable_checker;
+}
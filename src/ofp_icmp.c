@@ -36,6 +36,7 @@
 #include "ofpi_portconf.h"
 #include "ofpi_log.h"
 #include "ofpi_util.h"
+#include "ofpi_shard.h"
 /* ODP should have support to get time and date like gettimeofday from Linux*/
 #include <sys/time.h>
 /*
@@ -311,6 +312,10 @@ ofp_icmp_input(odp_packet_t *pkt, int off)
 	if (ofp_cksum(*pkt, odp_packet_l3_offset(*pkt) + off, icmplen - (ip->ip_hl << 2)))
 		return OFP_PKT_DROP;
 
+	/* Errors about a TCP connection are handled by its shard */
+	if (OFP_SHARDED() && ofp_shard_redirect_icmp(*pkt, off))
+		return OFP_PKT_PROCESSED;
+
 	return _ofp_icmp_input(*pkt, ip, icp, icmp_reflect);
 }
 
@@ -215,6 +215,8 @@ int ofp_ifnet_create2(odp_instance_t instance,
 	odp_pktio_param_t pktio_param_local;
 	odp_pktin_queue_param_t pktin_param_local;
 	odp_pktout_queue_param_t pktout_param_local;
+	odp_pktio_config_t pktio_config_local;
+	odp_pktio_capability_t pktio_capa;
 #ifdef SP
 	odph_linux_thr_params_t thr_params;
 #endif /* SP */
@@ -291,6 +293,15 @@ int ofp_ifnet_create2(odp_instance_t instance,
 
 #endif /* SP */
 
+	/* Let the pktio verify IPv4 header checksums when it can */
+	if (global_param->pktin_parse && !pktio_config &&
+	    !odp_pktio_capability(ifnet->pktio, &pktio_capa) &&
+	    pktio_capa.config.pktin.bit.ipv4_chksum) {
+		odp_pktio_config_init(&pktio_config_local);
+		pktio_config_local.pktin.bit.ipv4_chksum = 1;
+		pktio_config = &pktio_config_local;
+	}
+
 	/* Configure pktio */
 	if (pktio_config &&
 	    (odp_pktio_config(ifnet->pktio, pktio_config) != 0)) {
@@ -298,6 +309,12 @@ int ofp_ifnet_create2(odp_instance_t instance,
 		return -1;
 	}
 
+	if (global_param->pktin_parse) {
+		ifnet->if_parse = OFP_IF_PARSE_PKTIN;
+		if (pktio_config && pktio_config->pktin.bit.ipv4_chksum)
+			ifnet->if_parse |= OFP_IF_PARSE_IPV4_CSUM;
+	}
+
 	/* Start packet receiver or transmitter */
 	if (odp_pktio_start(ifnet->pktio) != 0) {
 		OFP_ERR("Failed to start pktio.");
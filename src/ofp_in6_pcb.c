@@ -68,6 +68,7 @@
 #include "ofpi_in.h"
 #include "ofpi_in_pcb.h"
 #include "ofpi_in6_pcb.h"
+#include "ofpi_hash.h"
 #include "ofpi_ip6.h"
 #include "ofpi_systm.h"
 #include "ofpi_socket.h"
@@ -326,6 +327,7 @@ ofp_in6_pcbbind(register struct inpcb *inp, struct ofp_sockaddr *nam,
 			return (OFP_EAGAIN);
 		}
 	}
+	ofp_in_pcbsetreuseport(inp);
 
 	return (0);
 }
@@ -1191,10 +1193,16 @@ ofp_in6_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct ofp_in6_addr *fa
 
 		if (jail_wild != NULL)
 			return (jail_wild);
-		if (local_exact != NULL)
-			return (local_exact);
-		if (local_wild != NULL)
-			return (local_wild);
+		if (local_exact == NULL)
+			local_exact = local_wild;
+		if (local_exact != NULL) {
+			uint32_t key[5];
+
+			memcpy(key, faddr, sizeof(*faddr));
+			key[4] = ((uint32_t)fport << 16) | lport;
+			return (ofp_in_pcblookup_reuseport(head, local_exact,
+				ofp_hashword(key, 5, 0)));
+		}
 	} /* if ((lookupflags & INPLOOKUP_WILDCARD) != 0) */
 
 	/*
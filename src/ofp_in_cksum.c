@@ -67,12 +67,13 @@ static int __ofp_cksum(const odp_packet_t pkt, unsigned int off,
 
 		if (off >= seglen) {
 			off -= seglen;
+			seg = odp_packet_next_seg(pkt, seg);
 			continue;
 		}
 
 		cksum_len = seglen - off;
-		if (cksum_len > len)
-			cksum_len = len;
+		if (cksum_len > len - done)
+			cksum_len = len - done;
 
 		cksum_data = (uint8_t *)odp_packet_seg_data(pkt, seg) + off;
 		tmp = ~ofp_cksum_buffer((uint16_t *)cksum_data, cksum_len);
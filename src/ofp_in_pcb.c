@@ -57,6 +57,8 @@
 #endif /*INET6*/
 
 #include "ofpi_pkt_processing.h"
+#include "ofpi_hash.h"
+#include "ofpi_shard.h"
 
 #include "ofpi_log.h"
 #include "ofpi_util.h"
@@ -74,6 +76,7 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct ofp_in_addr faddr,
 			 uint32_t fport_arg, struct ofp_in_addr laddr,
 			 uint32_t lport_arg, int lookupflags,
 			 struct ofp_ifnet *ifp);
+static void	in_pcbconn_remove(struct inpcbinfo *, struct inpcb *);
 
 static __inline void
 refcount_init(odp_atomic_u32_t *count, uint32_t value)
@@ -87,6 +90,17 @@ refcount_acquire(odp_atomic_u32_t *count)
 	odp_atomic_inc_u32(count);
 }
 
+static __inline int
+refcount_acquire_if_not_zero(odp_atomic_u32_t *count)
+{
+	uint32_t old = odp_atomic_load_u32(count);
+
+	while (old != 0)
+		if (odp_atomic_cas_u32(count, &old, old + 1))
+			return (1);
+	return (0);
+}
+
 static __inline int
 refcount_release(odp_atomic_u32_t *count)
 {
@@ -157,7 +171,7 @@ ofp_in_pcbinfo_init(struct inpcbinfo *pcbinfo, const char *name,
     const char *inpcbzone_name, uma_init inpcbzone_init, uma_fini inpcbzone_fini,
     uint32_t inpcbzone_flags)
 {
-	int pcb_size = OFP_NUM_SOCKETS_MAX;
+	int pcb_size = global_param->socket_max;
 
 	/* make compiler happy */
 	(void)inpcbzone_init;
@@ -170,7 +184,12 @@ ofp_in_pcbinfo_init(struct inpcbinfo *pcbinfo, const char *name,
 	OFP_LIST_INIT(pcbinfo->ipi_listhead);
 	pcbinfo->ipi_count = 0;
 
+	pcbinfo->ipi_conntbl = NULL;
+
 	if (strcmp(name, "tcp") == 0) {
+#ifndef OFP_RSS
+		pcbinfo->ipi_conntbl = &shm_tcp->ofp_conntbl;
+#endif
 		pcbinfo->ipi_hashbase = shm_tcp->ofp_hashtbl;
 		ofp_tcp_hashinit(hash_nelements, &pcbinfo->ipi_hashmask,
 			pcbinfo->ipi_hashbase);
@@ -287,6 +306,10 @@ ofp_in_pcballoc(struct socket *so, struct inpcbinfo *pcbinfo)
 	if (V_ip6_auto_flowlabel)
 		inp->inp_flags |= IN6P_AUTOFLOWLABEL;
 #endif
+	/* Connections a shard sets up for a listener belong to it. */
+	if (OFP_SHARDED() && ofp_shard_self() >= 0 && so->so_head &&
+	    so->so_type == OFP_SOCK_STREAM)
+		ofp_in_pcbshard(inp);
 	INP_WLOCK(inp);
 	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
 	refcount_init(&inp->inp_refcount, 1);	/* Reference from inpcbinfo */
@@ -317,9 +340,148 @@ ofp_in_pcbbind(struct inpcb *inp, struct ofp_sockaddr *nam, struct ofp_ucred *cr
 	}
 	if (anonport)
 		inp->inp_flags |= INP_ANONPORT;
+	ofp_in_pcbsetreuseport(inp);
 	return (0);
 }
 
+/*
+ * Give a TCP connection to the shard of the calling thread. Its timers
+ * run on the shard from now on, but it stays locked: any thread may
+ * still use it until ofp_in_pcbshard_nolock().
+ */
+void
+ofp_in_pcbshard(struct inpcb *inp)
+{
+	inp->inp_flowid = ofp_shard_id;
+	inp->inp_flags2 |= INP_SHARDED;
+}
+
+/*
+ * Stop locking a connection of the calling thread's shard, once the
+ * socket has been handed to that thread. Input and timers of the
+ * connection already run there, and walks of the pcb list skip the
+ * connections of other shards under the pcbinfo lock, so with that
+ * held only a thread that still holds the pcb lock is waited for. The
+ * flags are changed under the locks they replace: a hold of the
+ * caller itself, e.g. from input in an event callback, is released by
+ * its own unlock. If the pcbinfo lock is busy, the connection just
+ * stays locked.
+ */
+void
+ofp_in_pcbshard_nolock(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct socket *so = inp->inp_socket;
+
+	if (!(inp->inp_flags2 & INP_SHARDED) ||
+	    (int)inp->inp_flowid != ofp_shard_id ||
+	    (inp->inp_flags2 & INP_NOLOCK))
+		return;
+
+	if (!INP_INFO_TRY_WLOCK(pcbinfo))
+		return;
+	INP_WLOCK(inp);
+	SOCKBUF_LOCK(&so->so_rcv);
+	so->so_rcv.sb_flags |= SB_SHARDED;
+	SOCKBUF_UNLOCK(&so->so_rcv);
+	SOCKBUF_LOCK(&so->so_snd);
+	so->so_snd.sb_flags |= SB_SHARDED;
+	SOCKBUF_UNLOCK(&so->so_snd);
+	inp->inp_flags2 |= INP_NOLOCK;
+	INP_WUNLOCK(inp);
+	INP_INFO_WUNLOCK(pcbinfo);
+}
+
+/*
+ * Lock a connection of the calling thread's shard again, e.g. when it
+ * enters TIME_WAIT, where the slow timer of any thread expires it.
+ * Called with the pcbinfo lock, and the connection as write locked by
+ * the caller, whose unlock then releases the pcb lock taken here.
+ */
+void
+ofp_in_pcbshard_lock(struct inpcb *inp)
+{
+	struct socket *so = inp->inp_socket;
+
+	INP_INFO_WLOCK_ASSERT(inp->inp_pcbinfo);
+
+	if (!(inp->inp_flags2 & INP_NOLOCK))
+		return;
+
+	INP_WLOCK_ALWAYS(inp);
+	inp->inp_flags2 &= ~INP_NOLOCK;
+	if (so == NULL)
+		return;
+	SOCKBUF_LOCK_ALWAYS(&so->so_rcv);
+	so->so_rcv.sb_flags &= ~SB_SHARDED;
+	SOCKBUF_UNLOCK(&so->so_rcv);
+	SOCKBUF_LOCK_ALWAYS(&so->so_snd);
+	so->so_snd.sb_flags &= ~SB_SHARDED;
+	SOCKBUF_UNLOCK(&so->so_snd);
+}
+
+/*
+ * Record OFP_SO_REUSEPORT of the socket in the pcb when it is bound.
+ * Later binds to the same address and port are allowed only if both
+ * sockets have the option, and the wildcard lookup spreads flows over
+ * such a group of sockets.
+ */
+void
+ofp_in_pcbsetreuseport(struct inpcb *inp)
+{
+	if (inp->inp_socket->so_options & OFP_SO_REUSEPORT)
+		inp->inp_flags2 |= INP_REUSEPORT;
+	else
+		inp->inp_flags2 &= ~INP_REUSEPORT;
+}
+
+/*
+ * Pick the member of a reuseport group to pass a new flow to. inp is
+ * the wildcard match found in the hash chain head; the group consists
+ * of all the sockets in the chain that are bound with OFP_SO_REUSEPORT
+ * to the same local address and port, and listen if inp listens. The
+ * flow hash keeps all the packets of a flow on the same member.
+ */
+struct inpcb *
+ofp_in_pcblookup_reuseport(struct inpcbhead *head, struct inpcb *inp,
+			   uint32_t hash)
+{
+	struct inpcb *t;
+	int n = 0, acceptconn;
+
+	if ((inp->inp_flags2 & INP_REUSEPORT) == 0)
+		return (inp);
+
+	acceptconn = inp->inp_socket->so_options & OFP_SO_ACCEPTCONN;
+
+#define REUSEPORT_MEMBER(t) \
+	(((t)->inp_flags2 & INP_REUSEPORT) && \
+	 ((t)->inp_flags & INP_TIMEWAIT) == 0 && \
+	 (t)->inp_lport == inp->inp_lport && \
+	 ((t)->inp_vflag & (INP_IPV4 | INP_IPV6)) == \
+	 (inp->inp_vflag & (INP_IPV4 | INP_IPV6)) && \
+	 !memcmp(&(t)->in6p_laddr, &inp->in6p_laddr, \
+		 sizeof(inp->in6p_laddr)) && \
+	 !memcmp(&(t)->in6p_faddr, &inp->in6p_faddr, \
+		 sizeof(inp->in6p_faddr)) && \
+	 ((t)->inp_socket->so_options & OFP_SO_ACCEPTCONN) == acceptconn)
+
+	OFP_LIST_FOREACH(t, head, inp_hash)
+		if (REUSEPORT_MEMBER(t))
+			n++;
+
+	if (n < 2)
+		return (inp);
+
+	n = hash % n;
+	OFP_LIST_FOREACH(t, head, inp_hash)
+		if (REUSEPORT_MEMBER(t) && n-- == 0)
+			return (t);
+#undef REUSEPORT_MEMBER
+
+	return (inp);
+}
+
 /* HJo: FIX: sysctl variables */
 int ofp_ipport_hifirstauto = 1200;	/* sysctl */
 int ofp_ipport_hilastauto = 40000;
@@ -343,6 +505,15 @@ VNET_DEFINE(int, ofp_ipport_randomtime) = 45;	/* user controlled via sysctl */
 VNET_DEFINE(int, ofp_ipport_stoprandom);		/* toggled by ipport_tick */
 VNET_DEFINE(int, ofp_ipport_tcpallocs);
 
+/* Connect time port allocation, see in_pcb_lport_conn(). */
+#define	IPPORT_PERTURB		256
+static uint16_t ipport_perturb[IPPORT_PERTURB];
+static uint32_t ipport_secret;
+VNET_DEFINE(int, ofp_ipport_connprobes);
+VNET_DEFINE(int, ofp_ipport_connexhausted);
+#define	V_ipport_connprobes		VNET(ofp_ipport_connprobes)
+#define	V_ipport_connexhausted		VNET(ofp_ipport_connexhausted)
+
 #define	V_ipport_tcplastcount		VNET(ipport_tcplastcount)
 
 #define RANGECHK(var, min, max) \
@@ -404,6 +575,47 @@ SYSCTL_VNET_INT(_net_inet_ip_portrange, OFP_OID_AUTO, randomtime, OFP_CTLFLAG_RW
 	&VNET_NAME(ofp_ipport_randomtime), 0,
 	"Minimum time to keep sequental port "
 	"allocation before switching to a random one");
+SYSCTL_VNET_INT(_net_inet_ip_portrange, OFP_OID_AUTO, connprobes,
+	OFP_CTLFLAG_RD, &VNET_NAME(ofp_ipport_connprobes), 0,
+	"Ports found in use while connecting");
+SYSCTL_VNET_INT(_net_inet_ip_portrange, OFP_OID_AUTO, connexhausted,
+	OFP_CTLFLAG_RD, &VNET_NAME(ofp_ipport_connexhausted), 0,
+	"Connects that found no free port");
+
+static unsigned short *
+in_pcb_lport_range(struct inpcb *inp, uint16_t *firstp, uint16_t *lastp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	unsigned short *lastport;
+	uint16_t aux;
+
+	if (inp->inp_flags & INP_HIGHPORT) {
+		*firstp = ofp_ipport_hifirstauto;	/* sysctl */
+		*lastp  = ofp_ipport_hilastauto;
+		lastport = &pcbinfo->ipi_lasthi;
+	} else if (inp->inp_flags & INP_LOWPORT) {
+		*firstp = ofp_ipport_lowfirstauto;	/* 1023 */
+		*lastp  = ofp_ipport_lowlastauto;	/* 600 */
+		lastport = &pcbinfo->ipi_lastlow;
+	} else {
+		*firstp = ofp_ipport_firstauto;	/* sysctl */
+		*lastp  = ofp_ipport_lastauto;
+		lastport = &pcbinfo->ipi_lastport;
+	}
+
+	/*
+	 * Instead of having two loops further down counting up or down
+	 * make sure that first is always <= last and go with only one
+	 * code path implementing all logic.
+	 */
+	if (*firstp > *lastp) {
+		aux = *firstp;
+		*firstp = *lastp;
+		*lastp = aux;
+	}
+
+	return (lastport);
+}
 
 
 int
@@ -414,7 +626,7 @@ ofp_in_pcb_lport(struct inpcb *inp, struct ofp_in_addr *laddrp, uint16_t *lportp
 	struct inpcb *tmpinp;
 	unsigned short *lastport;
 	int count, dorandom;
-	uint16_t aux, first, last, lport;
+	uint16_t first, last, lport;
 	struct ofp_in_addr laddr;
 
 	/* make compiler happy */
@@ -430,19 +642,8 @@ ofp_in_pcb_lport(struct inpcb *inp, struct ofp_in_addr *laddrp, uint16_t *lportp
 	INP_LOCK_ASSERT(inp);
 	INP_HASH_LOCK_ASSERT(pcbinfo);
 
-	if (inp->inp_flags & INP_HIGHPORT) {
-		first = ofp_ipport_hifirstauto;	/* sysctl */
-		last  = ofp_ipport_hilastauto;
-		lastport = &pcbinfo->ipi_lasthi;
-	} else if (inp->inp_flags & INP_LOWPORT) {
-		first = ofp_ipport_lowfirstauto;	/* 1023 */
-		last  = ofp_ipport_lowlastauto;	/* 600 */
-		lastport = &pcbinfo->ipi_lastlow;
-	} else {
-		first = ofp_ipport_firstauto;	/* sysctl */
-		last  = ofp_ipport_lastauto;
-		lastport = &pcbinfo->ipi_lastport;
-	}
+	lastport = in_pcb_lport_range(inp, &first, &last);
+
 	/*
 	 * For UDP, use random port allocation as long as the user
 	 * allows it.  For TCP (and as of yet unknown) connections,
@@ -462,17 +663,6 @@ ofp_in_pcb_lport(struct inpcb *inp, struct ofp_in_addr *laddrp, uint16_t *lportp
 	if (first == last)
 		dorandom = 0;
 
-	/*
-	 * Instead of having two loops further down counting up or down
-	 * make sure that first is always <= last and go with only one
-	 * code path implementing all logic.
-	 */
-	if (first > last) {
-		aux = first;
-		first = last;
-		last = aux;
-	}
-
 	/* Make the compiler happy. */
 	laddr.s_addr = 0;
 	if ((inp->inp_vflag & (INP_IPV4|INP_IPV6)) == INP_IPV4) {
@@ -516,6 +706,98 @@ ofp_in_pcb_lport(struct inpcb *inp, struct ofp_in_addr *laddrp, uint16_t *lportp
 	return (0);
 }
 
+/*
+ * Whether lport is taken for a connection from laddr to faddr:fport.
+ * Ports chosen for other connections may be shared as long as the
+ * 4-tuples differ; a port bound by the user is never shared.
+ */
+static int
+in_pcb_lport_conflict(struct inpcbinfo *pcbinfo, struct ofp_in_addr laddr,
+		      struct ofp_in_addr faddr, uint16_t fport, uint16_t lport)
+{
+	struct inpcbporthead *porthash;
+	struct inpcbport *phd;
+	struct inpcb *t;
+
+	porthash = &pcbinfo->ipi_porthashbase[INP_PCBPORTHASH(lport,
+	    pcbinfo->ipi_porthashmask)];
+	OFP_LIST_FOREACH(phd, porthash, phd_hash) {
+		if (phd->phd_port == lport)
+			break;
+	}
+	if (phd == NULL)
+		return (0);
+
+	OFP_LIST_FOREACH(t, &phd->phd_pcblist, inp_portlist) {
+		if ((t->inp_vflag & INP_IPV4) == 0)
+			continue;
+		if (t->inp_laddr.s_addr != OFP_INADDR_ANY &&
+		    t->inp_laddr.s_addr != laddr.s_addr)
+			continue;
+		if (t->inp_faddr.s_addr == OFP_INADDR_ANY ||
+		    (t->inp_flags & INP_ANONPORT) == 0)
+			return (1);
+		if (t->inp_faddr.s_addr == faddr.s_addr &&
+		    t->inp_fport == fport)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Choose a local port for an IPv4 connection, RFC 6056 algorithm 4.
+ * The search starts at an offset hashed from the destination plus a
+ * per-destination counter that moves past the ports already handed
+ * out, so that the expected number of probes stays small however many
+ * connections there are in total. A sharded connection takes only the
+ * ports that make its flow hash to the shard.
+ */
+static int
+in_pcb_lport_conn(struct inpcb *inp, struct ofp_in_addr laddr,
+		  struct ofp_in_addr faddr, uint16_t fport, uint16_t *lportp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	uint16_t first, last, lport, *perturb;
+	uint32_t key[3], offset, num, i;
+
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
+
+	(void)in_pcb_lport_range(inp, &first, &last);
+	num = last - first + 1;
+
+	if (ipport_secret == 0)
+		ipport_secret = random() | 1;
+
+	key[0] = laddr.s_addr;
+	key[1] = faddr.s_addr;
+	key[2] = fport;
+	offset = ofp_hashword(key, 3, ipport_secret);
+	perturb = &ipport_perturb[ofp_hashword(key, 3, ~ipport_secret) %
+				  IPPORT_PERTURB];
+
+	for (i = 0; i < num; i++) {
+		lport = odp_cpu_to_be_16(first + (offset + *perturb + i) % num);
+
+		if ((inp->inp_flags2 & INP_SHARDED) &&
+		    ofp_shard_of(faddr.s_addr, fport, laddr.s_addr,
+				 lport) != (int)inp->inp_flowid)
+			continue;
+
+		if (in_pcb_lport_conflict(pcbinfo, laddr, faddr, fport,
+					  lport)) {
+			V_ipport_connprobes++;
+			continue;
+		}
+
+		*perturb += i + 1;
+		*lportp = lport;
+		return (0);
+	}
+
+	V_ipport_connexhausted++;
+	return (OFP_EADDRNOTAVAIL);
+}
+
 /*
  * Set up a bind operation on a PCB, performing port allocation
  * as required, but do not actually modify the PCB. Callers can
@@ -888,11 +1170,34 @@ ofp_in_pcbconnect_setup(struct inpcb *inp, struct ofp_sockaddr *nam,
 			*oinpp = oinp;
 		return (OFP_EADDRINUSE);
 	}
-	if (lport == 0) {
-		error = ofp_in_pcbbind_setup(inp, NULL, &laddr.s_addr, &lport,
-		    cred);
+	/*
+	 * A port chosen here for UDP stays bound to the socket as a
+	 * wildcard, so only TCP may share ports between connections.
+	 */
+	if (lport == 0 && (inp->inp_vflag & INP_IPV6) == 0 &&
+	    inp->inp_socket->so_type == OFP_SOCK_STREAM) {
+		error = in_pcb_lport_conn(inp, laddr, faddr, fport, &lport);
 		if (error)
 			return (error);
+	} else if (lport == 0) {
+		/*
+		 * A sharded connection needs a port that makes the flow
+		 * hash to its own shard. About one port in shards does.
+		 */
+		int tries = 16 * global_param->shards + 1;
+
+		do {
+			lport = 0;
+			error = ofp_in_pcbbind_setup(inp, NULL, &laddr.s_addr,
+			    &lport, cred);
+			if (error)
+				return (error);
+		} while ((inp->inp_flags2 & INP_SHARDED) &&
+			 ofp_shard_of(faddr.s_addr, fport, laddr.s_addr,
+				      lport) != (int)inp->inp_flowid &&
+			 --tries > 0);
+		if (tries == 0)
+			return (OFP_EADDRNOTAVAIL);
 	}
 	*laddrp = laddr.s_addr;
 	*lportp = lport;
@@ -1079,6 +1384,7 @@ ofp_in_pcbdrop(struct inpcb *inp)
 		struct inpcbport *phd = inp->inp_phd;
 
 		INP_HASH_WLOCK(inp->inp_pcbinfo);
+		in_pcbconn_remove(inp->inp_pcbinfo, inp);
 		OFP_LIST_REMOVE(inp, inp_hash);
 		OFP_LIST_REMOVE(inp, inp_portlist);
 		if (OFP_LIST_FIRST(&phd->phd_pcblist) == NULL) {
@@ -1152,6 +1458,10 @@ void ofp_in_pcbnotifyall(struct inpcbinfo *pcbinfo,
 
 	INP_INFO_WLOCK(pcbinfo);
 	OFP_LIST_FOREACH_SAFE(inp, pcbinfo->ipi_listhead, inp_list, inp_temp) {
+		/* Used by its own shard only */
+		if ((inp->inp_flags2 & INP_NOLOCK) &&
+		    (int)inp->inp_flowid != ofp_shard_id)
+			continue;
 		INP_WLOCK(inp);
 #ifdef INET6
 		if ((inp->inp_vflag & INP_IPV4) == 0) {
@@ -1287,6 +1597,214 @@ ofp_in_pcblookup_local(struct inpcbinfo *pcbinfo, struct ofp_in_addr laddr,
 	}
 }
 
+/*
+ * Connection index.  Writers hold ipi_hash_lock and bracket each bucket
+ * update with an odd sequence count; readers take no lock and retry if
+ * the count moved.  A reader may still see a stale entry, or miss one
+ * being moved by a split, so lookups revalidate the inpcb and fall back
+ * to the hash chains on a miss.
+ */
+void
+ofp_in_pcbconntbl_init(struct inpcbconntbl *tbl,
+		       struct inpcbconn_bucket *buckets, uint32_t maxbuckets)
+{
+	uint32_t level = INPCBCONN_MINBITS;
+
+	while ((1U << level) > maxbuckets)
+		level--;
+
+	memset(buckets, 0, maxbuckets * sizeof(*buckets));
+	tbl->ict_buckets = buckets;
+	tbl->ict_maxbuckets = maxbuckets;
+	tbl->ict_count = 0;
+	odp_atomic_init_u32(&tbl->ict_state, level << 24);
+}
+
+static __inline uint32_t
+in_pcbconn_hash(uint32_t faddr, uint32_t laddr, uint32_t ports)
+{
+	uint32_t key[3];
+
+	key[0] = faddr;
+	key[1] = laddr;
+	key[2] = ports;
+
+	return (ofp_hashword(key, 3, 0));
+}
+
+static __inline struct inpcbconn_bucket *
+in_pcbconn_bucket(struct inpcbconntbl *tbl, uint32_t state, uint32_t hash)
+{
+	uint32_t level = INPCBCONN_LEVEL(state);
+	uint32_t idx = hash & ((1U << level) - 1);
+
+	if (idx < INPCBCONN_SPLIT(state))
+		idx = hash & ((2U << level) - 1);
+
+	return (&tbl->ict_buckets[idx]);
+}
+
+static __inline void
+in_pcbconn_write_begin(struct inpcbconn_bucket *b)
+{
+	odp_atomic_store_u32(&b->icb_seq, odp_atomic_load_u32(&b->icb_seq) + 1);
+	odp_mb_release();
+}
+
+static __inline void
+in_pcbconn_write_end(struct inpcbconn_bucket *b)
+{
+	odp_atomic_store_rel_u32(&b->icb_seq,
+				 odp_atomic_load_u32(&b->icb_seq) + 1);
+}
+
+/*
+ * Split the next bucket in line, moving the entries that now hash to
+ * its buddy.  The buddy is filled before the new state is published and
+ * the entries are removed from the old bucket only after that.
+ */
+static void
+in_pcbconn_split(struct inpcbconntbl *tbl)
+{
+	uint32_t state = odp_atomic_load_u32(&tbl->ict_state);
+	uint32_t level = INPCBCONN_LEVEL(state);
+	uint32_t split = INPCBCONN_SPLIT(state);
+	struct inpcbconn_bucket *old = &tbl->ict_buckets[split];
+	struct inpcbconn_bucket *new = &tbl->ict_buckets[split + (1U << level)];
+	int moved[INPCBCONN_WAYS];
+	int i, j = 0;
+
+	in_pcbconn_write_begin(new);
+	for (i = 0; i < INPCBCONN_WAYS; i++) {
+		struct inpcb *inp = old->icb_inp[i];
+
+		moved[i] = inp != NULL &&
+			(inp->inp_connhash & (1U << level)) != 0;
+		if (!moved[i])
+			continue;
+		new->icb_key[j].faddr = old->icb_key[i].faddr;
+		new->icb_key[j].laddr = old->icb_key[i].laddr;
+		new->icb_key[j].ports = old->icb_key[i].ports;
+		new->icb_inp[j++] = inp;
+	}
+	in_pcbconn_write_end(new);
+
+	if (++split == (1U << level)) {
+		level++;
+		split = 0;
+	}
+	odp_atomic_store_rel_u32(&tbl->ict_state, level << 24 | split);
+
+	in_pcbconn_write_begin(old);
+	for (i = 0; i < INPCBCONN_WAYS; i++)
+		if (moved[i])
+			old->icb_inp[i] = NULL;
+	in_pcbconn_write_end(old);
+}
+
+static void
+in_pcbconn_insert(struct inpcbinfo *pcbinfo, struct inpcb *inp)
+{
+	struct inpcbconntbl *tbl = pcbinfo->ipi_conntbl;
+	struct inpcbconn_bucket *b;
+	uint32_t state, ports;
+	int i;
+
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
+
+	if (tbl == NULL || (inp->inp_vflag & INP_IPV4) == 0 ||
+	    inp->inp_faddr.s_addr == OFP_INADDR_ANY)
+		return;
+
+	ports = (uint32_t)inp->inp_fport << 16 | inp->inp_lport;
+	inp->inp_connhash = in_pcbconn_hash(inp->inp_faddr.s_addr,
+					    inp->inp_laddr.s_addr, ports);
+
+	state = odp_atomic_load_u32(&tbl->ict_state);
+	b = in_pcbconn_bucket(tbl, state, inp->inp_connhash);
+	for (i = 0; i < INPCBCONN_WAYS; i++)
+		if (b->icb_inp[i] == NULL)
+			break;
+	if (i == INPCBCONN_WAYS)
+		return;		/* Bucket full, chains only */
+
+	in_pcbconn_write_begin(b);
+	b->icb_key[i].faddr = inp->inp_faddr.s_addr;
+	b->icb_key[i].laddr = inp->inp_laddr.s_addr;
+	b->icb_key[i].ports = ports;
+	b->icb_inp[i] = inp;
+	in_pcbconn_write_end(b);
+	inp->inp_flags2 |= INP_CONNHASHED;
+
+	if (++tbl->ict_count > (INPCBCONN_WAYS - 1) *
+	    ((1U << INPCBCONN_LEVEL(state)) + INPCBCONN_SPLIT(state)) &&
+	    (2U << INPCBCONN_LEVEL(state)) <= tbl->ict_maxbuckets)
+		in_pcbconn_split(tbl);
+}
+
+static void
+in_pcbconn_remove(struct inpcbinfo *pcbinfo, struct inpcb *inp)
+{
+	struct inpcbconntbl *tbl = pcbinfo->ipi_conntbl;
+	struct inpcbconn_bucket *b;
+	int i;
+
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
+
+	if ((inp->inp_flags2 & INP_CONNHASHED) == 0)
+		return;
+
+	b = in_pcbconn_bucket(tbl, odp_atomic_load_u32(&tbl->ict_state),
+			      inp->inp_connhash);
+	for (i = 0; i < INPCBCONN_WAYS; i++) {
+		if (b->icb_inp[i] != inp)
+			continue;
+		in_pcbconn_write_begin(b);
+		b->icb_inp[i] = NULL;
+		in_pcbconn_write_end(b);
+		break;
+	}
+	KASSERT(i < INPCBCONN_WAYS, ("%s: inp %p not found", __func__, inp));
+
+	tbl->ict_count--;
+	inp->inp_flags2 &= ~INP_CONNHASHED;
+}
+
+/*
+ * Lock-free lookup of a connection.  The result is only a candidate: it
+ * carries no reference and may have been freed or reused since.
+ */
+static struct inpcb *
+in_pcbconn_lookup(struct inpcbconntbl *tbl, uint32_t faddr, uint32_t laddr,
+		  uint32_t ports)
+{
+	struct inpcbconn_bucket *b;
+	struct inpcb *inp;
+	uint32_t seq;
+	int i;
+
+	b = in_pcbconn_bucket(tbl, odp_atomic_load_acq_u32(&tbl->ict_state),
+			      in_pcbconn_hash(faddr, laddr, ports));
+	do {
+		seq = odp_atomic_load_acq_u32(&b->icb_seq);
+		if (seq & 1)
+			return (NULL);
+		inp = NULL;
+		for (i = 0; i < INPCBCONN_WAYS; i++) {
+			if (b->icb_key[i].faddr == faddr &&
+			    b->icb_key[i].laddr == laddr &&
+			    b->icb_key[i].ports == ports) {
+				inp = b->icb_inp[i];
+				if (inp != NULL)
+					break;
+			}
+		}
+		odp_mb_acquire();
+	} while (seq != odp_atomic_load_u32(&b->icb_seq));
+
+	return (inp);
+}
+
 /*
  * Insert PCB onto various hash lists.
  */
@@ -1346,6 +1864,7 @@ in_pcbinshash_internal(struct inpcb *inp, int do_pcbgroup_update)
 	OFP_LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
 	OFP_LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
 	inp->inp_flags |= INP_INHASHLIST;
+	in_pcbconn_insert(pcbinfo, inp);
 
 	return (0);
 }
@@ -1492,11 +2011,14 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct ofp_in_addr faddr,
 		if (jail_wild != NULL) {
 			return (jail_wild);
 		}
+		if (local_exact == NULL)
+			local_exact = local_wild;
 		if (local_exact != NULL) {
-			return (local_exact);
-		}
-		if (local_wild != NULL) {
-			return (local_wild);
+			uint32_t key[2] = { faddr.s_addr,
+					    ((uint32_t)fport << 16) | lport };
+
+			return (ofp_in_pcblookup_reuseport(head, local_exact,
+				ofp_hashword(key, 2, 0)));
 		}
 #ifdef _INET6
 		if (local_wild_mapped != NULL) {
@@ -1515,6 +2037,44 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct ofp_in_addr faddr,
 {
 	struct inpcb *inp;
 
+	/*
+	 * Try the connection index first.  A candidate found there is
+	 * referenced and locked as below, then checked to still be the
+	 * connection that was asked for.
+	 */
+	if (pcbinfo->ipi_conntbl != NULL) {
+		inp = in_pcbconn_lookup(pcbinfo->ipi_conntbl, faddr.s_addr,
+					laddr.s_addr, fport << 16 | lport);
+		if (inp != NULL &&
+		    refcount_acquire_if_not_zero(&inp->inp_refcount)) {
+			if (lookupflags & INPLOOKUP_WLOCKPCB) {
+				INP_WLOCK(inp);
+				if (ofp_in_pcbrele_wlocked(inp))
+					inp = NULL;
+			} else if (lookupflags & INPLOOKUP_RLOCKPCB) {
+				INP_RLOCK(inp);
+				if (ofp_in_pcbrele_rlocked(inp))
+					inp = NULL;
+			} else
+				panic("locking bug");
+
+			if (inp != NULL &&
+			    (inp->inp_flags2 & INP_CONNHASHED) &&
+			    inp->inp_faddr.s_addr == faddr.s_addr &&
+			    inp->inp_laddr.s_addr == laddr.s_addr &&
+			    inp->inp_fport == fport &&
+			    inp->inp_lport == lport)
+				return (inp);
+
+			if (inp != NULL) {
+				if (lookupflags & INPLOOKUP_WLOCKPCB)
+					INP_WUNLOCK(inp);
+				else
+					INP_RUNLOCK(inp);
+			}
+		}
+	}
+
 	INP_HASH_RLOCK(pcbinfo);
 
 	inp = in_pcblookup_hash_locked(pcbinfo, faddr, fport, laddr, lport,
@@ -1611,6 +2171,8 @@ ofp_in_pcbrehash_mbuf(struct inpcb *inp, odp_packet_t m)
 
 	OFP_LIST_REMOVE(inp, inp_hash);
 	OFP_LIST_INSERT_HEAD(head, inp, inp_hash);
+	in_pcbconn_remove(pcbinfo, inp);
+	in_pcbconn_insert(pcbinfo, inp);
 
 }
 
@@ -1648,6 +2210,8 @@ ofp_in_pcbrehash(struct inpcb *inp)
 
 	OFP_LIST_REMOVE(inp, inp_hash);
 	OFP_LIST_INSERT_HEAD(head, inp, inp_hash);
+	in_pcbconn_remove(pcbinfo, inp);
+	in_pcbconn_insert(pcbinfo, inp);
 }
 
 /*
@@ -1666,6 +2230,7 @@ in_pcbremlists(struct inpcb *inp)
 		struct inpcbport *phd = inp->inp_phd;
 
 		INP_HASH_WLOCK(pcbinfo);
+		in_pcbconn_remove(pcbinfo, inp);
 		OFP_LIST_REMOVE(inp, inp_hash);
 		OFP_LIST_REMOVE(inp, inp_portlist);
 		if (OFP_LIST_FIRST(&phd->phd_pcblist) == NULL) {
@@ -35,6 +35,10 @@
 #include "ofpi_tcp_var.h"
 #include "ofpi_socketvar.h"
 #include "ofpi_socket.h"
+#include "ofpi_shard.h"
+#include "ofpi_epoll.h"
+#include "ofpi_aio.h"
+#include "ofpi_sigev.h"
 #include "ofpi_reass.h"
 #include "ofpi_inet.h"
 #include "ofpi_igmp_var.h"
@@ -232,12 +236,25 @@ static void read_conf_file(ofp_global_param_t *params, const char *filename)
 	GET_CONF_INT(int, evt_rx_burst_size);
 	GET_CONF_INT(int, pkt_tx_burst_size);
 	GET_CONF_INT(int, pcb_tcp_max);
+	GET_CONF_INT(int, socket_max);
+	GET_CONF_INT(int, socket_cache);
+	GET_CONF_INT(int, epoll_watches);
+	GET_CONF_INT(int, aio_max);
+	GET_CONF_INT(int, sockbuf_len);
+	GET_CONF_INT(int, sockbuf_ext_len);
+	GET_CONF_INT(int, sockbuf_ext_num);
+	GET_CONF_INT(int, sleep_spin);
+	GET_CONF_INT(int, shards);
+	GET_CONF_INT(int, hash_size.tcp_pcb);
+	GET_CONF_INT(int, hash_size.tcp_syncache);
+	GET_CONF_INT(int, hash_size.udp_pcb);
 	GET_CONF_INT(int, pkt_pool.nb_pkts);
 	GET_CONF_INT(int, pkt_pool.buffer_size);
 	GET_CONF_INT(int, num_vlan);
 	GET_CONF_INT(int, mtrie.routes);
 	GET_CONF_INT(int, mtrie.table8_nodes);
 	GET_CONF_INT(int, num_vrf);
+	GET_CONF_INT(bool, pktin_parse);
 
 done:
 	config_destroy(&conf);
@@ -263,6 +280,12 @@ void ofp_init_global_param_from_file(ofp_global_param_t *params, const char *fil
 	params->arp.saved_pkt_timeout = OFP_ARP_SAVED_PKT_TIMEOUT;
 	params->evt_rx_burst_size = OFP_EVT_RX_BURST_SIZE;
 	params->pcb_tcp_max = OFP_NUM_PCB_TCP_MAX;
+	params->socket_max = OFP_NUM_SOCKETS_MAX;
+	params->socket_cache = OFP_SOCKET_CACHE;
+	params->sockbuf_len = OFP_SOCKBUF_LEN;
+	params->sockbuf_ext_len = OFP_SOCKBUF_EXT_LEN;
+	params->sockbuf_ext_num = OFP_SOCKBUF_EXT_NUM;
+	params->sleep_spin = OFP_SLEEP_SPIN;
 	params->pkt_pool.nb_pkts = SHM_PKT_POOL_NB_PKTS;
 	params->pkt_pool.buffer_size = SHM_PKT_POOL_BUFFER_SIZE;
 	params->pkt_tx_burst_size = OFP_PKT_TX_BURST_SIZE;
@@ -270,6 +293,7 @@ void ofp_init_global_param_from_file(ofp_global_param_t *params, const char *fil
 	params->mtrie.routes = OFP_ROUTES;
 	params->mtrie.table8_nodes = OFP_MTRIE_TABLE8_NODES;
 	params->num_vrf = OFP_NUM_VRF;
+	params->pktin_parse = 1;
 	read_conf_file(params, filename);
 }
 
@@ -278,6 +302,47 @@ void ofp_init_global_param(ofp_global_param_t *params)
 	ofp_init_global_param_from_file(params, NULL);
 }
 
+static uint32_t hash_size(int size, int load)
+{
+	return ofp_roundup_pow2(size > 0 ? size : load);
+}
+
+/*
+ * Derive the values left for OFP to decide. Everything sized from
+ * global_param must be resolved here, before the preallocations.
+ */
+static void ofp_init_resolve_param(ofp_global_param_t *params)
+{
+	if (params->socket_max < 1)
+		params->socket_max = OFP_NUM_SOCKETS_MAX;
+	if (params->socket_cache < 0)
+		params->socket_cache = 0;
+	if (params->epoll_watches < 1)
+		params->epoll_watches = params->socket_max;
+	if (params->aio_max < 1)
+		params->aio_max = params->socket_max;
+	/* One slot of the ring is always left empty. */
+	if (params->sockbuf_len < 2)
+		params->sockbuf_len = OFP_SOCKBUF_LEN;
+	/* Growing only makes sense into longer rings. */
+	if (params->sockbuf_ext_len <= params->sockbuf_len)
+		params->sockbuf_ext_num = 0;
+	if (params->sockbuf_ext_num < 0)
+		params->sockbuf_ext_num = 0;
+	if (params->shards < 0)
+		params->shards = 0;
+	if (params->shards > OFP_MAX_NUM_CPU)
+		params->shards = OFP_MAX_NUM_CPU;
+
+	params->hash_size.tcp_pcb = hash_size(params->hash_size.tcp_pcb,
+					      params->pcb_tcp_max);
+	params->hash_size.tcp_syncache =
+		hash_size(params->hash_size.tcp_syncache,
+			  params->pcb_tcp_max);
+	params->hash_size.udp_pcb = hash_size(params->hash_size.udp_pcb,
+					      params->socket_max);
+}
+
 static void ofp_init_prepare(void)
 {
 	/*
@@ -293,6 +358,7 @@ static void ofp_init_prepare(void)
 	ofp_reassembly_init_prepare();
 	ofp_pcap_init_prepare();
 	ofp_stat_init_prepare();
+	ofp_shard_init_prepare();
 	ofp_timer_init_prepare();
 	ofp_hook_init_prepare();
 	ofp_arp_init_prepare();
@@ -301,6 +367,9 @@ static void ofp_init_prepare(void)
 	ofp_vlan_init_prepare();
 	ofp_vxlan_init_prepare();
 	ofp_socket_init_prepare();
+	ofp_epoll_init_prepare();
+	ofp_aio_init_prepare();
+	ofp_sigev_init_prepare();
 	ofp_tcp_var_init_prepare();
 	ofp_ip_init_prepare();
 }
@@ -320,6 +389,7 @@ static int ofp_init_pre_global(ofp_global_param_t *params)
 	shm->cli_thread_is_running = 0;
 
 	*global_param = *params;
+	ofp_init_resolve_param(global_param);
 
 	/* Initialize shared memory infra before preallocations */
 	HANDLE_ERROR(ofp_shared_memory_init_global());
@@ -341,6 +411,8 @@ static int ofp_init_pre_global(ofp_global_param_t *params)
 
 	HANDLE_ERROR(ofp_stat_init_global());
 
+	HANDLE_ERROR(ofp_shard_init_global());
+
 	HANDLE_ERROR(ofp_timer_init_global(OFP_TIMER_RESOLUTION_US,
 			OFP_TIMER_MIN_US,
 			OFP_TIMER_MAX_US,
@@ -375,6 +447,9 @@ static int ofp_init_pre_global(ofp_global_param_t *params)
 	}
 
 	HANDLE_ERROR(ofp_socket_init_global(ofp_packet_pool));
+	HANDLE_ERROR(ofp_epoll_init_global());
+	HANDLE_ERROR(ofp_aio_init_global());
+	HANDLE_ERROR(ofp_sigev_init_global());
 	HANDLE_ERROR(ofp_tcp_var_init_global());
 	HANDLE_ERROR(ofp_inet_init());
 	HANDLE_ERROR(ofp_ip_init_global());
@@ -456,6 +531,10 @@ int ofp_init_local(void)
 	HANDLE_ERROR(ofp_pcap_lookup_shared_memory());
 	HANDLE_ERROR(ofp_stat_lookup_shared_memory());
 	HANDLE_ERROR(ofp_socket_lookup_shared_memory());
+	HANDLE_ERROR(ofp_epoll_lookup_shared_memory());
+	HANDLE_ERROR(ofp_aio_lookup_shared_memory());
+	HANDLE_ERROR(ofp_sigev_lookup_shared_memory());
+	HANDLE_ERROR(ofp_shard_lookup_shared_memory());
 	HANDLE_ERROR(ofp_timer_lookup_shared_memory());
 	HANDLE_ERROR(ofp_hook_lookup_shared_memory());
 	HANDLE_ERROR(ofp_arp_lookup_shared_memory());
@@ -584,6 +663,7 @@ int ofp_term_post_global(const char *pool_name)
 
 	/* Cleanup sockets */
 	CHECK_ERROR(ofp_socket_term_global(), rc);
+	CHECK_ERROR(ofp_epoll_term_global(), rc);
 
 	/* Cleanup of TCP content */
 	CHECK_ERROR(ofp_tcp_var_term_global(), rc);
@@ -620,11 +700,20 @@ int ofp_term_post_global(const char *pool_name)
 	CHECK_ERROR(ofp_timer_stop_global(), rc);
 
 	/* Cleanup pending events */
+	CHECK_ERROR(ofp_shard_stop_global(), rc);
 	schedule_shutdown();
 
 	/* Cleanup timers - phase 2*/
 	CHECK_ERROR(ofp_timer_term_global(), rc);
 
+	/* Cleanup the asynchronous socket operations and event vectors
+	 * after their events */
+	CHECK_ERROR(ofp_aio_term_global(), rc);
+	CHECK_ERROR(ofp_sigev_term_global(), rc);
+
+	/* Cleanup shard queues after the timer queues in their groups */
+	CHECK_ERROR(ofp_shard_term_global(), rc);
+
 	/* Cleanup packet pool */
 	pool = odp_pool_lookup(pool_name);
 	if (pool == ODP_POOL_INVALID) {
@@ -650,6 +739,8 @@ int ofp_term_local(void)
 
 	CHECK_ERROR(ofp_ip_term_local(), rc);
 	CHECK_ERROR(ofp_send_pkt_out_term_local(), rc);
+	CHECK_ERROR(ofp_socket_term_local(), rc);
+	CHECK_ERROR(ofp_shard_term_local(), rc);
 
 	return rc;
 }
@@ -259,6 +259,7 @@ static int add_ipv4v6_addr(struct ifaddrmsg *if_entry, struct ofp_ifnet *dev,
 		dev->sp_status = OFP_SP_UP;
 		/* update quick access table */
 		ofp_update_ifindex_lookup_tab(dev);
+		ofp_ifnet_addr_hash_update(dev);
 
 		if (dev->port == VXLAN_PORTS) {
 			struct ofp_ifnet *dev_root =
@@ -299,6 +300,7 @@ static int add_ipv4v6_addr(struct ifaddrmsg *if_entry, struct ofp_ifnet *dev,
 		}
 		/* update quick access table */
 		ofp_update_ifindex_lookup_tab(dev);
+		ofp_ifnet_addr_hash_update(dev);
 	}
 #endif /* INET6 */
 
@@ -322,6 +324,7 @@ static int del_ipv4v6_addr(struct ifaddrmsg *if_entry, struct ofp_ifnet *dev,
 			dev->ip_p2p = 0;
 		else if (dev->vlan == 0 || dev->port == VXLAN_PORTS)
 			ofp_ifaddr_elem_del(dev);
+		ofp_ifnet_addr_hash_update(dev);
 	}
 #ifdef INET6
 	else if (if_entry->ifa_family == AF_INET6) {
@@ -336,6 +339,7 @@ static int del_ipv4v6_addr(struct ifaddrmsg *if_entry, struct ofp_ifnet *dev,
 
 		if (dev->vlan == 0)
 			ofp_ifaddr6_elem_del(dev);
+		ofp_ifnet_addr_hash_update(dev);
 	}
 #endif /* INET6 */
 	return 0;
@@ -502,6 +506,7 @@ static int add_link(struct ifinfomsg *ifinfo_entry, int vlan, int link,
 			dev->vlan = vlan;
 			dev->vrf = vrf;
 			memcpy(dev->mac, dev_root->mac, 6);
+			dev->if_parse = dev_root->if_parse;
 			dev->sp_status = OFP_SP_UP;
 #ifdef INET6
 			memcpy(dev->link_local, dev_root->link_local, 16);
@@ -538,6 +543,7 @@ static int add_link(struct ifinfomsg *ifinfo_entry, int vlan, int link,
 				dev->ip_local = tun_loc;
 			if (tun_rem)
 				dev->ip_remote = tun_rem;
+			ofp_ifnet_addr_hash_update(dev);
 		}
 	} else {
 		dev = ofp_get_ifnet_by_linux_ifindex(ifinfo_entry->ifi_index);
@@ -52,19 +52,64 @@
 #include "ofpi_vxlan.h"
 #include "ofpi_gre.h"
 #include "ofpi_ip.h"
+#include "ofpi_shard.h"
+#include "ofpi_sigev.h"
 #include "api/ofp_init.h"
 
 static enum ofp_return_code ofp_ip_output_continue(odp_packet_t pkt,
 						   struct ip_out *odata);
+static enum ofp_return_code ofp_ip_output_routed(odp_packet_t pkt,
+						 struct ip_out *odata);
 
 extern odp_pool_t ofp_packet_pool;
 
 __thread struct ofp_global_ip_state *ofp_ip_shm;
 
+__thread uint32_t ofp_busy_poll_usec;
+static __thread ofp_pkt_processing_func busy_poll_func;
+
+/* Handle an event of OFP. Returns -1 if it is not one. */
+static inline int event_dispatch(odp_event_t ev, odp_queue_t in_queue,
+				 ofp_pkt_processing_func pkt_func)
+{
+	odp_packet_t pkt;
+
+	if (odp_event_type(ev) == ODP_EVENT_TIMEOUT) {
+		ofp_timer_handle(ev);
+		return 0;
+	}
+
+	if (odp_event_type(ev) == ODP_EVENT_PACKET) {
+		pkt = odp_packet_from_event(ev);
+#if 0
+		if (odp_unlikely(odp_packet_has_error(pkt))) {
+			OFP_DBG("Dropping packet with error");
+			odp_packet_free(pkt);
+			return 0;
+		}
+#endif
+		ofp_packet_input(pkt, in_queue, pkt_func);
+		return 0;
+	}
+
+	return -1;
+}
+
+/* Free events by type */
+static void event_free(odp_event_t ev)
+{
+	if (odp_event_type(ev) == ODP_EVENT_BUFFER) {
+		odp_buffer_free(odp_buffer_from_event(ev));
+		return;
+	}
+
+	if (odp_event_type(ev) == ODP_EVENT_CRYPTO_COMPL)
+		odp_crypto_compl_free(odp_crypto_compl_from_event(ev));
+}
+
 void *default_event_dispatcher(void *arg)
 {
 	odp_event_t ev;
-	odp_packet_t pkt;
 	odp_queue_t in_queue;
 	int event_idx = 0;
 	int event_cnt = 0;
@@ -76,6 +121,12 @@ void *default_event_dispatcher(void *arg)
 		return NULL;
 	}
 
+	if (ofp_shard_join()) {
+		OFP_ERR("ofp_shard_join failed");
+		ofp_term_local();
+		return NULL;
+	}
+
 	odp_event_t events[global_param->evt_rx_burst_size];
 
 	is_running = ofp_get_processing_state();
@@ -95,40 +146,13 @@ void *default_event_dispatcher(void *arg)
 			if (ev == ODP_EVENT_INVALID)
 				continue;
 
-			if (odp_event_type(ev) == ODP_EVENT_TIMEOUT) {
-				ofp_timer_handle(ev);
+			if (!event_dispatch(ev, in_queue, pkt_func))
 				continue;
-			}
-
-			if (odp_event_type(ev) == ODP_EVENT_PACKET) {
-				pkt = odp_packet_from_event(ev);
-#if 0
-				if (odp_unlikely(odp_packet_has_error(pkt))) {
-					OFP_DBG("Dropping packet with error");
-					odp_packet_free(pkt);
-					continue;
-				}
-#endif
-				ofp_packet_input(pkt, in_queue, pkt_func);
-				continue;
-			}
 
 			OFP_ERR("Unexpected event type: %u", odp_event_type(ev));
-
-			/* Free events by type */
-			if (odp_event_type(ev) == ODP_EVENT_BUFFER) {
-				odp_buffer_free(odp_buffer_from_event(ev));
-				continue;
-			}
-
-			if (odp_event_type(ev) == ODP_EVENT_CRYPTO_COMPL) {
-				odp_crypto_compl_free(
-					odp_crypto_compl_from_event(ev));
-				continue;
-			}
-
+			event_free(ev);
 		}
-		ofp_send_pending_pkt();
+		ofp_packet_burst_end();
 	}
 
 	if (ofp_term_local())
@@ -137,16 +161,131 @@ void *default_event_dispatcher(void *arg)
 	return NULL;
 }
 
+/*
+ * Only the dispatchers end a burst. Packets sent within a burst, e.g.
+ * by ofp_send_frame(), flush the pending packets but not the events.
+ */
+void ofp_packet_burst_end(void)
+{
+	ofp_send_pending_pkt();
+	if (ofp_sigev_burst)
+		ofp_sigev_flush();
+}
+
+void ofp_busy_poll_thread(uint32_t usec, ofp_pkt_processing_func pkt_func)
+{
+	ofp_busy_poll_usec = usec;
+	busy_poll_func = pkt_func;
+}
+
+/*
+ * Events of the application met by a busy poll, in the order they were
+ * scheduled, until the thread takes them with ofp_busy_poll_held().
+ */
+#define BUSY_POLL_BURST 64
+
+static __thread struct {
+	odp_queue_t queue;
+	odp_event_t ev[BUSY_POLL_BURST];
+	int num;
+} busy_poll_held;
+
+/*
+ * Run one burst of the dispatcher in a thread waiting in a socket
+ * call. The atomic or ordered context of the burst is released, so the
+ * queue is not held while the thread waits. A burst with an event that
+ * is not for OFP is held, context and all, and busy polling stops until
+ * the thread has taken it: putting the event back on its queue would
+ * reorder it. Returns -1 while events are held.
+ */
+int ofp_busy_poll(void)
+{
+	odp_event_t events[BUSY_POLL_BURST];
+	ofp_pkt_processing_func pkt_func = busy_poll_func ?
+		busy_poll_func : ofp_eth_vlan_processing;
+	odp_queue_t in_queue;
+	int i, num;
+
+	if (busy_poll_held.num)
+		return -1;
+
+	num = odp_schedule_multi(&in_queue, ODP_SCHED_NO_WAIT, events,
+				 min(global_param->evt_rx_burst_size,
+				     BUSY_POLL_BURST));
+
+	for (i = 0; i < num; i++)
+		if (event_dispatch(events[i], in_queue, pkt_func))
+			break;
+
+	if (i < num) {
+		busy_poll_held.queue = in_queue;
+		busy_poll_held.num = num - i;
+		memcpy(busy_poll_held.ev, &events[i],
+		       busy_poll_held.num * sizeof(odp_event_t));
+	}
+
+	if (num > 0)
+		ofp_packet_burst_end();
+
+	if (busy_poll_held.num)
+		return -1;
+
+	if (num > 0) {
+		odp_schedule_release_atomic();
+		odp_schedule_release_ordered();
+	}
+
+	return num;
+}
+
+int ofp_busy_poll_held(odp_queue_t *from, odp_event_t events[], int num)
+{
+	int n = busy_poll_held.num;
+
+	if (n == 0)
+		return 0;
+	if (n > num)
+		n = num;
+
+	*from = busy_poll_held.queue;
+	memcpy(events, busy_poll_held.ev, n * sizeof(odp_event_t));
+	busy_poll_held.num -= n;
+	memmove(busy_poll_held.ev, &busy_poll_held.ev[n],
+		busy_poll_held.num * sizeof(odp_event_t));
+
+	return n;
+}
+
+/*
+ * The scheduler may keep events of the last queue for the next call,
+ * and the thread keeps the queue's context as long as it has them.
+ * Dispatch those before blocking.
+ */
+void ofp_busy_poll_end(void)
+{
+	odp_schedule_pause();
+	while (ofp_busy_poll() > 0)
+		;
+	odp_schedule_resume();
+}
+
 uint32_t ofp_packet_min_user_area(void)
 {
 	return sizeof(struct ofp_packet_user_area);
 }
 
+void ofp_packet_user_area_parts(uint32_t *hdr_size, uint32_t *ext_size)
+{
+	*hdr_size = OFP_PKT_UA_HDR_SIZE;
+	*ext_size = OFP_PKT_UA_EXT_SIZE;
+}
+
 enum ofp_return_code ofp_eth_vlan_processing(odp_packet_t *pkt)
 {
 	uint16_t vlan = 0, ethtype;
 	struct ofp_ether_header *eth;
 	struct ofp_ifnet *ifnet = odp_packet_user_ptr(*pkt);
+	int parsed = ofp_if_parsed(ifnet, *pkt);
 
 	eth = (struct ofp_ether_header *)odp_packet_l2_ptr(*pkt, NULL);
 #ifndef OFP_PERFORMANCE
@@ -155,7 +294,10 @@ enum ofp_return_code ofp_eth_vlan_processing(odp_packet_t *pkt)
 		return OFP_PKT_DROP;
 	}
 
-	if (odp_unlikely(odp_packet_l3_ptr(*pkt, NULL) == NULL ||
+	if (parsed) {
+		if (odp_unlikely(odp_packet_has_l2_error(*pkt)))
+			return OFP_PKT_DROP;
+	} else if (odp_unlikely(odp_packet_l3_ptr(*pkt, NULL) == NULL ||
 		(uintptr_t) odp_packet_l3_ptr(*pkt, NULL) !=
 			(uintptr_t)odp_packet_l2_ptr(*pkt, NULL) +
 				sizeof(struct ofp_ether_header))) {
@@ -172,13 +314,35 @@ enum ofp_return_code ofp_eth_vlan_processing(odp_packet_t *pkt)
 		vlan = OFP_EVL_VLANOFTAG(odp_be_to_cpu_16(vlan_hdr->evl_tag));
 		ethtype = odp_be_to_cpu_16(vlan_hdr->evl_proto);
 		ifnet = ofp_get_ifnet(ifnet->port, vlan);
-		if (!ifnet)
+		/* QinQ sub-interfaces accept only double tagged frames */
+		if (!ifnet || ifnet->qinq_svlan)
 			return OFP_PKT_DROP;
 		if (odp_likely(ifnet->port != VXLAN_PORTS))
 			odp_packet_user_ptr_set(*pkt, ifnet);
 #ifndef OFP_PERFORMANCE
-		odp_packet_l3_offset_set(*pkt, sizeof(struct ofp_ether_vlan_header));
+		if (!parsed)
+			odp_packet_l3_offset_set(*pkt,
+				sizeof(struct ofp_ether_vlan_header));
 #endif
+	} else if (ethtype == OFP_ETHERTYPE_QINQ_STD ||
+		   ethtype == OFP_ETHERTYPE_QINQ_VENDOR1) {
+		struct ofp_ether_qinq_header *qinq_hdr;
+		uint16_t svlan;
+
+		qinq_hdr = (struct ofp_ether_qinq_header *)eth;
+		if (odp_be_to_cpu_16(qinq_hdr->evq_inner_proto) !=
+		    OFP_ETHERTYPE_VLAN)
+			return OFP_PKT_DROP;
+		svlan = OFP_EVL_VLANOFTAG(odp_be_to_cpu_16(qinq_hdr->evq_stag));
+		vlan = OFP_EVL_VLANOFTAG(odp_be_to_cpu_16(qinq_hdr->evq_ctag));
+		ethtype = odp_be_to_cpu_16(qinq_hdr->evq_proto);
+		ifnet = ofp_get_ifnet_qinq(ifnet->port, svlan, vlan);
+		if (!ifnet)
+			return OFP_PKT_DROP;
+		odp_packet_user_ptr_set(*pkt, ifnet);
+		if (!parsed || !odp_packet_has_vlan_qinq(*pkt))
+			odp_packet_l3_offset_set(*pkt,
+				sizeof(struct ofp_ether_qinq_header));
 	}
 
 	//OFP_DBG("ETH TYPE = %04x", ethtype);
@@ -254,12 +418,30 @@ static enum ofp_return_code pkt_reassembly(odp_packet_t *pkt)
 	return OFP_PKT_PROCESSED;
 }
 
+/*
+ * Validate the IPv4 header. Parse results and the checksum check of
+ * the pktio are used when the receiving interface provides them.
+ */
+static inline int ipv4_header_bad(struct ofp_ifnet *dev, odp_packet_t pkt,
+				  struct ofp_ip *ip)
+{
+	if (ofp_if_parsed(dev, pkt) && odp_packet_has_ipv4(pkt)) {
+		if (odp_unlikely(odp_packet_has_l3_error(pkt)))
+			return 1;
+		if (dev->if_parse & OFP_IF_PARSE_IPV4_CSUM)
+			return 0;
+	} else if (odp_unlikely(ip->ip_v != OFP_IPVERSION))
+		return 1;
+
+	return ofp_cksum_buffer((uint16_t *)ip, ip->ip_hl<<2) != 0;
+}
+
 enum ofp_return_code ofp_udp4_processing(odp_packet_t *pkt)
 {
 	struct ofp_ip *ip = (struct ofp_ip *)odp_packet_l3_ptr(*pkt, NULL);
 	int frag_res = 0;
 
-	if (odp_unlikely(ofp_cksum_buffer((uint16_t *) ip, ip->ip_hl<<2)))
+	if (odp_unlikely(ipv4_header_bad(odp_packet_user_ptr(*pkt), *pkt, ip)))
 		return OFP_PKT_DROP;
 
 	if (odp_be_to_cpu_16(ip->ip_off) & 0x3fff) {
@@ -278,7 +460,7 @@ enum ofp_return_code ofp_tcp4_processing(odp_packet_t *pkt)
 	struct ofp_ip *ip = (struct ofp_ip *)odp_packet_l3_ptr(*pkt, NULL);
 	int frag_res = 0;
 
-	if (odp_unlikely(ofp_cksum_buffer((uint16_t *) ip, ip->ip_hl<<2)))
+	if (odp_unlikely(ipv4_header_bad(odp_packet_user_ptr(*pkt), *pkt, ip)))
 		return OFP_PKT_DROP;
 
 	if (odp_be_to_cpu_16(ip->ip_off) & 0x3fff) {
@@ -316,11 +498,11 @@ enum ofp_return_code ofp_ipv4_processing(odp_packet_t *pkt)
 			/* Doesn't happen. */
 			break;
 		case VXLAN_PORTS: {
-			struct ofp_packet_user_area *ua;
+			struct vxlan_user_data *vxlan;
 
 			/* Look for the correct device. */
-			ua = ofp_packet_user_area(*pkt);
-			dev = ofp_get_ifnet(VXLAN_PORTS, ua->vxlan.vni);
+			vxlan = ofp_packet_user_area_vxlan(*pkt);
+			dev = ofp_get_ifnet(VXLAN_PORTS, vxlan->vni);
 			if (!dev)
 				return OFP_PKT_DROP;
 			break;
@@ -329,9 +511,7 @@ enum ofp_return_code ofp_ipv4_processing(odp_packet_t *pkt)
 	}
 
 #ifndef OFP_PERFORMANCE
-	if (odp_unlikely(ip->ip_v != OFP_IPVERSION))
-		return OFP_PKT_DROP;
-	if (odp_unlikely(ofp_cksum_buffer((uint16_t *) ip, ip->ip_hl<<2)))
+	if (odp_unlikely(ipv4_header_bad(dev, *pkt, ip)))
 		return OFP_PKT_DROP;
 
 	/* TODO: handle broadcast */
@@ -350,7 +530,8 @@ enum ofp_return_code ofp_ipv4_processing(odp_packet_t *pkt)
 	}
 
 	is_ours = dev->ip_addr == ip->ip_dst.s_addr ||
-		OFP_IN_MULTICAST(odp_be_to_cpu_32(ip->ip_dst.s_addr));
+		OFP_IN_MULTICAST(odp_be_to_cpu_32(ip->ip_dst.s_addr)) ||
+		ofp_get_ifnet_local_ip(ip->ip_dst.s_addr, dev->vrf);
 
 	if (!is_ours) {
 		/* This may be for some other local interface. */
@@ -461,6 +642,9 @@ enum ofp_return_code ofp_ipv6_processing(odp_packet_t *pkt)
 			is_ours = 1;
 	}
 	/* check if it's ours for another ipv6 address */
+	if (!is_ours &&
+	    ofp_get_ifnet_local_ip6(ipv6->ip6_dst.ofp_s6_addr, dev->vrf))
+		is_ours = 1;
 	if (!is_ours) {
 		nh = ofp_get_next_hop6(dev->vrf, ipv6->ip6_dst.ofp_s6_addr, &flags);
 		if (nh && (nh->flags & OFP_RTF_LOCAL))
@@ -648,15 +832,42 @@ enum ofp_return_code ofp_arp_processing(odp_packet_t *pkt)
 
 #define ETH_WITH_VLAN(_dev) (_dev->vlan && _dev->port != VXLAN_PORTS)
 #define ETH_WITHOUT_VLAN(_vlan, _port) (_vlan == 0 || _port == VXLAN_PORTS)
+#define ETH_WITH_QINQ(_dev) (_dev->qinq_svlan != 0)
+
+/*
+ * Fill in the tag(s) of a 802.1Q or 802.1ad header following the
+ * MAC addresses. Returns the size of the ethernet header.
+ */
+static inline uint32_t ofp_eth_vlan_encap(void *l2_addr,
+					  struct ofp_ifnet *dev,
+					  uint16_t vlan, uint16_t ethtype)
+{
+	if (ETH_WITH_QINQ(dev)) {
+		struct ofp_ether_qinq_header *eth_qinq = l2_addr;
+
+		eth_qinq->evq_encap_proto =
+			odp_cpu_to_be_16(OFP_ETHERTYPE_QINQ_STD);
+		eth_qinq->evq_stag = odp_cpu_to_be_16(dev->qinq_svlan);
+		eth_qinq->evq_inner_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_VLAN);
+		eth_qinq->evq_ctag = odp_cpu_to_be_16(dev->qinq_cvlan);
+		eth_qinq->evq_proto = odp_cpu_to_be_16(ethtype);
+		return sizeof(*eth_qinq);
+	} else {
+		struct ofp_ether_vlan_header *eth_vlan = l2_addr;
+
+		eth_vlan->evl_encap_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_VLAN);
+		eth_vlan->evl_tag = odp_cpu_to_be_16(vlan);
+		eth_vlan->evl_proto = odp_cpu_to_be_16(ethtype);
+		return sizeof(*eth_vlan);
+	}
+}
 
 static void send_arp_request(struct ofp_ifnet *dev, uint32_t gw)
 {
-	char buf[sizeof(struct ofp_ether_vlan_header) +
+	char buf[sizeof(struct ofp_ether_qinq_header) +
 		sizeof(struct ofp_arphdr)];
 	struct ofp_arphdr *arp;
 	struct ofp_ether_header *e1 = (struct ofp_ether_header *)buf;
-	struct ofp_ether_vlan_header *e2 =
-					(struct ofp_ether_vlan_header *)buf;
 	size_t size;
 	odp_packet_t pkt;
 
@@ -665,11 +876,10 @@ static void send_arp_request(struct ofp_ifnet *dev, uint32_t gw)
 	memcpy(e1->ether_shost, dev->mac, OFP_ETHER_ADDR_LEN);
 
 	if (ETH_WITH_VLAN(dev)) {
-		arp = (struct ofp_arphdr *) (e2 + 1);
-		e2->evl_encap_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_VLAN);
-		e2->evl_tag = odp_cpu_to_be_16(dev->vlan);
-		e2->evl_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_ARP);
-		size = sizeof(*arp) + sizeof(*e2);
+		size = ofp_eth_vlan_encap(buf, dev, dev->vlan,
+					  OFP_ETHERTYPE_ARP);
+		arp = (struct ofp_arphdr *)(buf + size);
+		size += sizeof(*arp);
 	} else {
 		arp = (struct ofp_arphdr *) (e1 + 1);
 		e1->ether_type = odp_cpu_to_be_16(OFP_ETHERTYPE_ARP);
@@ -915,6 +1125,8 @@ static enum ofp_return_code ofp_ip_output_add_eth(odp_packet_t pkt,
 
 	if (ETH_WITHOUT_VLAN(odata->vlan, odata->out_port))
 		l2_size = sizeof(struct ofp_ether_header);
+	else if (ETH_WITH_QINQ(odata->dev_out))
+		l2_size = sizeof(struct ofp_ether_qinq_header);
 	else
 		l2_size = sizeof(struct ofp_ether_vlan_header);
 
@@ -985,10 +1197,8 @@ static enum ofp_return_code ofp_ip_output_add_eth(odp_packet_t pkt,
 		}
 
 		ofp_copy_mac(eth_vlan->evl_shost, odata->dev_out->mac);
-		eth_vlan->evl_encap_proto = odp_cpu_to_be_16(
-							OFP_ETHERTYPE_VLAN);
-		eth_vlan->evl_tag = odp_cpu_to_be_16(odata->vlan);
-		eth_vlan->evl_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_IP);
+		ofp_eth_vlan_encap(l2_addr, odata->dev_out, odata->vlan,
+				   OFP_ETHERTYPE_IP);
 	}
 
 	return OFP_PKT_CONTINUE;
@@ -1042,6 +1252,132 @@ static enum ofp_return_code ofp_ip_output_find_route(odp_packet_t pkt,
 	return OFP_PKT_CONTINUE;
 }
 
+static enum ofp_return_code ofp_ip_output_routed(odp_packet_t pkt,
+						 struct ip_out *odata)
+{
+	/* Fragmentation */
+	if (odp_be_to_cpu_16(odata->ip->ip_len) > odata->dev_out->if_mtu) {
+		OFP_DBG("Fragmentation required");
+		if (odp_be_to_cpu_16(odata->ip->ip_off) & OFP_IP_DF) {
+			ofp_icmp_error(pkt, OFP_ICMP_UNREACH,
+				       OFP_ICMP_UNREACH_NEEDFRAG,
+				       0, odata->dev_out->if_mtu);
+			return OFP_PKT_DROP;
+		}
+		return ofp_fragment_pkt(pkt, odata);
+	}
+	return ofp_ip_output_continue(pkt, odata);
+}
+
+/*
+ * Put a copy of an L2 header resolved for an earlier packet in front of
+ * the IP header, making room for it like ofp_ip_output_add_eth().
+ */
+static enum ofp_return_code ofp_ip_output_copy_eth(odp_packet_t pkt,
+						   struct ip_out *odata,
+						   const uint8_t *l2,
+						   uint32_t l2_size)
+{
+	void *l2_addr;
+
+	if (odp_packet_l3_offset(pkt) >= l2_size) {
+		odp_packet_l2_offset_set(pkt,
+					odp_packet_l3_offset(pkt) - l2_size);
+		l2_addr = odp_packet_l2_ptr(pkt, NULL);
+	} else {
+		l2_addr = odp_packet_push_head(pkt,
+					l2_size - odp_packet_l3_offset(pkt));
+		odp_packet_l2_offset_set(pkt, 0);
+		odp_packet_l3_offset_set(pkt, l2_size);
+		odp_packet_l4_offset_set(pkt, l2_size + (odata->ip->ip_hl<<2));
+	}
+
+	if (odp_unlikely(l2_addr == NULL)) {
+		OFP_DBG("l2_addr == NULL");
+		return OFP_PKT_DROP;
+	}
+
+	memcpy(l2_addr, l2, l2_size);
+	return OFP_PKT_CONTINUE;
+}
+
+/*
+ * Output a routed packet of a burst. The L2 header of the first packet
+ * that resolves one is saved to l2 and copied to the packets after it.
+ */
+static enum ofp_return_code ofp_ip_output_l2_cached(odp_packet_t pkt,
+						    struct ip_out *odata,
+						    uint8_t *l2,
+						    uint32_t *l2_size)
+{
+	enum ofp_return_code ret;
+
+	odata->ip->ip_sum = 0;
+	odata->ip->ip_sum = ofp_cksum_buffer((uint16_t *) odata->ip,
+					     odata->ip->ip_hl * 4);
+
+	if (*l2_size)
+		ret = ofp_ip_output_copy_eth(pkt, odata, l2, *l2_size);
+	else {
+		ret = ofp_ip_output_add_eth(pkt, odata);
+		if (ret == OFP_PKT_CONTINUE) {
+			*l2_size = odp_packet_l3_offset(pkt) -
+				odp_packet_l2_offset(pkt);
+			memcpy(l2, odp_packet_l2_ptr(pkt, NULL), *l2_size);
+		}
+	}
+	if (ret != OFP_PKT_CONTINUE)
+		return ret;
+
+	return ofp_ip_output_send(pkt, odata);
+}
+
+int ofp_ip_output_burst(odp_packet_t pkt[], int num,
+			struct ofp_nh_entry *nh_param)
+{
+	struct ofp_ifnet *send_ctx;
+	struct ip_out odata;
+	uint8_t l2[sizeof(struct ofp_ether_qinq_header)];
+	uint32_t l2_size = 0;
+	enum ofp_return_code ret;
+	int i;
+
+	if (num <= 0)
+		return 0;
+
+	send_ctx = odp_packet_user_ptr(pkt[0]);
+	odata.dev_out = NULL;
+	odata.vrf = send_ctx ? send_ctx->vrf : 0;
+	odata.is_local_address = 0;
+	odata.nh = nh_param;
+	odata.insert_checksum = 1;
+
+	for (i = 0; i < num; i++) {
+		OFP_HOOK(OFP_HOOK_OUT_IPv4, pkt[i], NULL, &ret);
+		if (ret == OFP_PKT_CONTINUE)
+			ret = ofp_ip_output_find_route(pkt[i], &odata);
+		if (ret != OFP_PKT_CONTINUE) {
+			if (ret == OFP_PKT_DROP)
+				return i;
+			continue;
+		}
+
+		/* The first lookup is kept in odata.nh for the rest */
+		if (odp_be_to_cpu_16(odata.ip->ip_len) >
+		    odata.dev_out->if_mtu ||
+		    odata.out_port == GRE_PORTS ||
+		    odata.out_port == VXLAN_PORTS)
+			ret = ofp_ip_output_routed(pkt[i], &odata);
+		else
+			ret = ofp_ip_output_l2_cached(pkt[i], &odata, l2,
+						      &l2_size);
+		if (ret == OFP_PKT_DROP)
+			return i;
+	}
+
+	return num;
+}
+
 enum ofp_return_code ofp_ip_send(odp_packet_t pkt,
 				 struct ofp_nh_entry *nh_param)
 {
@@ -1091,18 +1427,7 @@ enum ofp_return_code ofp_ip_output_common(odp_packet_t pkt,
 		//ofp_ip_id_assign(odata.ip);
         }
 
-	/* Fragmentation */
-	if (odp_be_to_cpu_16(odata.ip->ip_len) > odata.dev_out->if_mtu) {
-		OFP_DBG("Fragmentation required");
-		if (odp_be_to_cpu_16(odata.ip->ip_off) & OFP_IP_DF) {
-			ofp_icmp_error(pkt, OFP_ICMP_UNREACH,
-				       OFP_ICMP_UNREACH_NEEDFRAG,
-				       0, odata.dev_out->if_mtu);
-			return OFP_PKT_DROP;
-		}
-		return ofp_fragment_pkt(pkt, &odata);
-	}
-	return ofp_ip_output_continue(pkt, &odata);
+	return ofp_ip_output_routed(pkt, &odata);
 }
 
 static enum ofp_return_code ofp_ip_output_continue(odp_packet_t pkt,
@@ -1258,6 +1583,8 @@ enum ofp_return_code ofp_ip6_output(odp_packet_t pkt,
 
 	if (!vlan)
 		l2_size = sizeof(struct ofp_ether_header);
+	else if (ETH_WITH_QINQ(dev_out))
+		l2_size = sizeof(struct ofp_ether_qinq_header);
 	else
 		l2_size = sizeof(struct ofp_ether_vlan_header);
 
@@ -1323,10 +1650,7 @@ enum ofp_return_code ofp_ip6_output(odp_packet_t pkt,
 
 		memcpy(eth_vlan->evl_dhost, mac, OFP_ETHER_ADDR_LEN);
 		memcpy(eth_vlan->evl_shost, dev_out->mac, OFP_ETHER_ADDR_LEN);
-		eth_vlan->evl_encap_proto =
-				odp_cpu_to_be_16(OFP_ETHERTYPE_VLAN);
-		eth_vlan->evl_tag = odp_cpu_to_be_16(vlan);
-		eth_vlan->evl_proto = odp_cpu_to_be_16(OFP_ETHERTYPE_IPV6);
+		ofp_eth_vlan_encap(l2_addr, dev_out, vlan, OFP_ETHERTYPE_IPV6);
 	}
 
 	if (is_local_address) {
@@ -1344,10 +1668,17 @@ enum ofp_return_code ofp_packet_input(odp_packet_t pkt,
 	odp_pktio_t pktio;
 	int res;
 
+	/* Socket events are batched until ofp_packet_burst_end() */
+	ofp_sigev_burst = 1;
+
 	/* Packets from VXLAN interfaces do not have an outq even
 	 * they have a valid pktio. Use loopback context instead. */
-	if (in_queue != ODP_QUEUE_INVALID)
+	if (in_queue != ODP_QUEUE_INVALID) {
 		ifnet = (struct ofp_ifnet *)odp_queue_context(in_queue);
+		/* TCP packets passed on by another shard */
+		if (OFP_SHARDED() && ofp_shard_queue_ctx(ifnet))
+			return ofp_shard_input(pkt);
+	}
 
 	if (odp_likely(ifnet == NULL)) {
 		pktio = odp_packet_input(pkt);
@@ -11,6 +11,8 @@
 #include "ofpi_log.h"
 #include "ofpi_debug.h"
 #include "ofpi_stat.h"
+#include "ofpi_sysctl.h"
+#include "ofpi_tcp_var.h"
 
 
 static __thread struct burst_send {
@@ -18,6 +20,10 @@ static __thread struct burst_send {
 	uint32_t pkt_tbl_cnt;
 } send_pkt_tbl[NUM_PORTS] __attribute__((__aligned__(ODP_CACHE_LINE_SIZE)));
 
+/* Packets queued by this thread, and their count at the last flush */
+static __thread uint64_t send_pkt_queued;
+static __thread uint64_t send_pkt_flushed;
+
 
 static inline void
 send_table(struct ofp_ifnet *ifnet, odp_packet_t *pkt_tbl,
@@ -44,6 +50,7 @@ send_table(struct ofp_ifnet *ifnet, odp_packet_t *pkt_tbl,
 	}
 
 	*pkt_tbl_cnt = 0;
+	send_pkt_flushed = send_pkt_queued;
 }
 
 enum ofp_return_code send_pkt_out(struct ofp_ifnet *dev,
@@ -53,6 +60,7 @@ enum ofp_return_code send_pkt_out(struct ofp_ifnet *dev,
 	odp_packet_t *pkt_tbl = (odp_packet_t *)send_pkt_tbl[dev->port].pkt_tbl;
 
 	pkt_tbl[(*pkt_tbl_cnt)++] = pkt;
+	send_pkt_queued++;
 
 	OFP_DEBUG_PACKET(OFP_DEBUG_PKT_SEND_NIC, pkt, dev->port);
 
@@ -82,13 +90,35 @@ static void ofp_send_pending_pkt_nocheck(void)
 	}
 }
 
+/*
+ * Connections that autocork held back behind the flushed packets are
+ * run again, and what they send is flushed as well.
+ */
 enum ofp_return_code ofp_send_pending_pkt(void)
 {
-	if (global_param->pkt_tx_burst_size > 1)
+	if (global_param->pkt_tx_burst_size > 1) {
 		ofp_send_pending_pkt_nocheck();
+		while (ofp_tcp_output_corked())
+			ofp_send_pending_pkt_nocheck();
+	}
 	return OFP_PKT_PROCESSED;
 }
 
+/*
+ * The queued packet count of this thread serves as a mark. A packet
+ * queued under a mark is still waiting in the output tables as long as
+ * ofp_send_pkt_out_pending() says so.
+ */
+uint64_t ofp_send_pkt_out_mark(void)
+{
+	return send_pkt_queued;
+}
+
+int ofp_send_pkt_out_pending(uint64_t mark)
+{
+	return mark > send_pkt_flushed;
+}
+
 int ofp_send_pkt_out_init_local(void)
 {
 	uint32_t i, j;
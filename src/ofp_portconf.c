@@ -27,10 +27,12 @@
 #include "ofpi_log.h"
 #include "ofpi_netlink.h"
 #include "ofpi_igmp_var.h"
+#include "ofpi_hash.h"
 
 #define SHM_NAME_PORTS "OfpPortconfShMem"
 #define SHM_NAME_PORT_LOCKS "OfpPortconfLocksShMem"
 #define SHM_NAME_VLAN "OfpVlanconfShMem"
+#define SHM_NAME_IFADDR_HASH "OfpIfaddrHashShMem"
 
 
 #ifdef SP
@@ -39,6 +41,16 @@
 
 #define PORT_UNDEF 0xFFFF
 
+/* QinQ lookup key: port in the top byte, S-tag and C-tag below it. */
+#define QINQ_KEY(_port, _svlan, _cvlan) \
+	(((uint32_t)(_port) << 24) | \
+	 ((uint32_t)((_svlan) & OFP_EVL_VLID_MASK) << 12) | \
+	 ((_cvlan) & OFP_EVL_VLID_MASK))
+#define QINQ_KEY_FREE 0
+#define QINQ_KEY_DELETED 0xFFFFFFFF
+#define QINQ_TBL_SIZE (ofp_roundup_pow2(2 * global_param->num_vlan) < 16 ? \
+		       16 : ofp_roundup_pow2(2 * global_param->num_vlan))
+
 /*
  * Shared data
  */
@@ -52,6 +64,10 @@ struct ofp_portconf_mem {
 	struct ofp_in_ifaddrhead in_ifaddr6head;
 #endif /* INET6 */
 
+	/* VLAN sub-interfaces of the physical ports indexed by VLAN id.
+	 * Updated under vlan_mtx, read without locks. */
+	struct ofp_ifnet *vlan_index[OFP_FP_INTERFACE_MAX][OFP_EVL_VLID_CNT];
+
 #ifdef SP
 	struct {
 		uint16_t port;
@@ -60,16 +76,51 @@ struct ofp_portconf_mem {
 #endif /* SP */
 };
 
+/*
+ * Open addressing table of QinQ sub-interfaces keyed by
+ * (port, S-tag, C-tag). Updated under vlan_mtx, read without locks.
+ */
+struct ofp_qinq_entry {
+	odp_atomic_u32_t key;
+	struct ofp_ifnet *ifnet;
+};
+
 struct ofp_vlan_mem {
 	struct ofp_ifnet *free_ifnet_list;
 	odp_rwlock_t vlan_mtx;
+	struct ofp_qinq_entry *qinq_tbl;
+	uint32_t qinq_mask;
 	struct ofp_ifnet vlan_ifnet[0];
 };
 
+/*
+ * Hash tables of local addresses and tunnel endpoints. Updated under
+ * lock, read without locks.
+ */
+OFP_LIST_HEAD(ofp_ifnet_bucket, ofp_ifnet);
+
+struct ofp_ifaddr_hash_mem {
+	odp_spinlock_t lock;
+	odp_atomic_u32_t seq;
+	uint32_t mask;
+	struct ofp_ifnet_bucket *ip_hash;
+#ifdef INET6
+	struct ofp_ifnet_bucket *ip6_hash;
+#endif /* INET6 */
+	struct ofp_ifnet_bucket *tun_hash;
+	struct ofp_ifnet_bucket buckets[0];
+};
+
+#define IFADDR_HASH_SIZE ofp_roundup_pow2(NUM_PORTS + global_param->num_vlan)
+#define SHM_SIZE_IFADDR_HASH (sizeof(struct ofp_ifaddr_hash_mem) + \
+			      3 * IFADDR_HASH_SIZE * \
+			      sizeof(struct ofp_ifnet_bucket))
+
 /*
  * Data per core
  */
 static __thread struct ofp_portconf_mem *shm;
+static __thread struct ofp_ifaddr_hash_mem *ifaddr_hash_shm;
 struct ofp_ifnet_locks_str  *ofp_ifnet_locks_shm;
 
 static __thread struct ofp_vlan_mem *vlan_shm;
@@ -94,14 +145,101 @@ static int vlan_iterate_inorder(void *root,
 	return avl_iterate_inorder(root, iterate_fun, iter_arg);
 }
 
+static inline uint32_t qinq_hash(uint32_t key)
+{
+	key ^= key >> 13;
+	key *= 0x9E3779B1;
+	return key ^ (key >> 16);
+}
+
+static struct ofp_qinq_entry *qinq_find(uint32_t key)
+{
+	struct ofp_qinq_entry *entry;
+	uint32_t i, k, n;
+
+	i = qinq_hash(key) & vlan_shm->qinq_mask;
+	for (n = 0; n <= vlan_shm->qinq_mask; n++) {
+		entry = &vlan_shm->qinq_tbl[i];
+		k = odp_atomic_load_acq_u32(&entry->key);
+		if (k == key)
+			return entry;
+		if (k == QINQ_KEY_FREE)
+			break;
+		i = (i + 1) & vlan_shm->qinq_mask;
+	}
+	return NULL;
+}
+
+/* Called with vlan_mtx held for writing */
+static int qinq_insert(struct ofp_ifnet *ifnet)
+{
+	struct ofp_qinq_entry *entry;
+	uint32_t key, i, k, n;
+
+	key = QINQ_KEY(ifnet->port, ifnet->qinq_svlan, ifnet->qinq_cvlan);
+	i = qinq_hash(key) & vlan_shm->qinq_mask;
+	for (n = 0; n <= vlan_shm->qinq_mask; n++) {
+		entry = &vlan_shm->qinq_tbl[i];
+		k = odp_atomic_load_u32(&entry->key);
+		if (k == QINQ_KEY_FREE || k == QINQ_KEY_DELETED) {
+			entry->ifnet = ifnet;
+			odp_atomic_store_rel_u32(&entry->key, key);
+			return 0;
+		}
+		i = (i + 1) & vlan_shm->qinq_mask;
+	}
+	return -1;
+}
+
+/* Called with vlan_mtx held for writing */
+static void qinq_remove(struct ofp_ifnet *ifnet)
+{
+	struct ofp_qinq_entry *entry;
+
+	entry = qinq_find(QINQ_KEY(ifnet->port, ifnet->qinq_svlan,
+				   ifnet->qinq_cvlan));
+	if (entry && entry->ifnet == ifnet)
+		odp_atomic_store_rel_u32(&entry->key, QINQ_KEY_DELETED);
+}
+
 int vlan_ifnet_insert(void *root, void *elem)
 {
-	return avl_insert((avl_tree *)root, elem);
+	struct ofp_ifnet *ifnet = elem;
+	int ret;
+
+	ret = avl_insert((avl_tree *)root, elem);
+	if (ret)
+		return ret;
+
+	if (PHYS_PORT(ifnet->port) && ifnet->vlan < OFP_EVL_VLID_CNT) {
+		/* Publish only fully initialized interfaces */
+		odp_mb_release();
+		shm->vlan_index[ifnet->port][ifnet->vlan] = ifnet;
+	}
+	return 0;
 }
 
 int vlan_ifnet_delete(void *root, void *elem,
 					int (*free_key_fun)(void *arg))
 {
+	struct ofp_ifnet *ifnet;
+
+	if (avl_get_by_key(root, elem, (void **)&ifnet))
+		return avl_delete(root, elem, free_key_fun);
+
+	ofp_ifnet_addr_hash_remove(ifnet);
+
+	if (PHYS_PORT(ifnet->port)) {
+		if (ifnet->vlan < OFP_EVL_VLID_CNT &&
+		    shm->vlan_index[ifnet->port][ifnet->vlan] == ifnet)
+			shm->vlan_index[ifnet->port][ifnet->vlan] = NULL;
+		if (ifnet->qinq_svlan) {
+			odp_rwlock_write_lock(&vlan_shm->vlan_mtx);
+			qinq_remove(ifnet);
+			odp_rwlock_write_unlock(&vlan_shm->vlan_mtx);
+		}
+	}
+
 	return avl_delete(root, elem, free_key_fun);
 }
 
@@ -351,6 +489,11 @@ static int iter_vlan(void *key, void *iter_arg)
 			"	Link encap:Ethernet	HWaddr: %s\r\n",
 			ofp_print_mac(iface->mac));
 
+		if (iface->qinq_svlan)
+			ofp_sendf(fd,
+				"	QinQ S-VLAN:%d	C-VLAN:%d\r\n",
+				iface->qinq_svlan, iface->qinq_cvlan);
+
 		if (iface->ip_addr)
 			ofp_sendf(fd,
 				"	inet addr:%s	Bcast:%s	Mask:%s\r\n",
@@ -537,6 +680,7 @@ const char *ofp_config_interface_up_v4(int port, uint16_t vlan, uint16_t vrf,
 		data->ip_addr = addr;
 		data->masklen = masklen;
 		data->bcast_addr = addr | ~mask;
+		ofp_ifnet_addr_hash_update(data);
 		ofp_set_route_params(OFP_ROUTE_ADD, data->vrf, vlan, port,
 				     data->ip_addr, 32, 0,
 				     OFP_RTF_LOCAL);
@@ -576,6 +720,7 @@ const char *ofp_config_interface_up_v4(int port, uint16_t vlan, uint16_t vrf,
 
 		/* Add interface to the if_addr v4 queue */
 		ofp_ifaddr_elem_add(data);
+		ofp_ifnet_addr_hash_update(data);
 #ifdef INET6
 		ofp_mac_to_link_local(data->mac, data->link_local);
 #endif /* INET6 */
@@ -661,6 +806,7 @@ const char *ofp_config_interface_up_tun(int port, uint16_t greid,
 	data->ip_addr = addr;
 	data->masklen = mlen;
 	data->if_mtu = dev_root->if_mtu - sizeof(struct ofp_greip);
+	ofp_ifnet_addr_hash_update(data);
 
 	ofp_set_route_params(OFP_ROUTE_ADD, data->vrf, greid, port,
 			     data->ip_p2p, data->masklen, 0,
@@ -763,6 +909,7 @@ const char *ofp_config_interface_up_vxlan(uint16_t vrf, uint32_t addr, int mlen,
 	data->physport = physport;
 	data->physvlan = physvlan;
 	data->pkt_pool = ofp_packet_pool;
+	ofp_ifnet_addr_hash_update(data);
 
 	shm->ofp_ifnet_data[VXLAN_PORTS].pkt_pool = ofp_packet_pool;
 	ofp_set_route_params(OFP_ROUTE_ADD, data->vrf, vni, VXLAN_PORTS,
@@ -832,6 +979,7 @@ const char *ofp_config_interface_up_local(uint16_t id, uint16_t vrf,
 	data->bcast_addr = addr | ~mask;
 	data->if_type = OFP_IFT_LOOP;
 	data->if_flags = OFP_IFF_LOOPBACK;
+	ofp_ifnet_addr_hash_update(data);
 
 	ofp_set_route_params(OFP_ROUTE_ADD, data->vrf, id, LOCAL_PORTS,
 			     data->ip_addr, data->masklen, 0,
@@ -894,6 +1042,7 @@ const char *ofp_config_interface_up_v6(int port, uint16_t vlan,
 
 		memcpy(data->ip6_addr, addr, 16);
 		data->ip6_prefix = masklen;
+		ofp_ifnet_addr_hash_update(data);
 		ofp_set_route6_params(OFP_ROUTE6_ADD, 0 /*vrf*/, vlan, port,
 				      data->ip6_addr, data->ip6_prefix, gw6,
 				      OFP_RTF_NET);
@@ -925,6 +1074,7 @@ const char *ofp_config_interface_up_v6(int port, uint16_t vlan,
 
 		/* Add interface to the if_addr v6 queue */
 		ofp_ifaddr6_elem_add(data);
+		ofp_ifnet_addr_hash_update(data);
 
 		ofp_set_route6_params(OFP_ROUTE6_ADD, 0 /*vrf*/, 0 /*vlan*/, port,
 				      data->ip6_addr, 128, gw6,
@@ -988,6 +1138,7 @@ const char *ofp_config_interface_up_local_v6(uint16_t id,
 
 	memcpy(data->ip6_addr, addr, 16);
 	data->ip6_prefix = masklen;
+	ofp_ifnet_addr_hash_update(data);
 	ofp_set_route6_params(OFP_ROUTE6_ADD, data->vrf, id, LOCAL_PORTS,
 			      data->ip6_addr, data->ip6_prefix, gw6, 0);
 	ofp_set_route6_params(OFP_ROUTE6_ADD, data->vrf, id, LOCAL_PORTS,
@@ -1194,11 +1345,70 @@ const char *ofp_config_interface_down(int port, uint16_t vlan)
 			memset(data->ip6_addr, 0, 16);
 		}
 #endif /* INET6 */
+		ofp_ifnet_addr_hash_update(data);
 	}
 
 	return NULL;
 }
 
+const char *ofp_config_interface_qinq(int port, uint16_t vlan,
+				      uint16_t svlan, uint16_t cvlan)
+{
+	struct ofp_ifnet *data, *other;
+	const char *err = NULL;
+
+	if (port < 0 || port >= OFP_FP_INTERFACE_MAX)
+		return "Wrong port number";
+
+	if (vlan == 0)
+		return "QinQ requires a VLAN sub-interface";
+
+	if (svlan > OFP_EVL_VLID_MASK || cvlan > OFP_EVL_VLID_MASK ||
+	    (svlan && cvlan == 0))
+		return "Wrong QinQ tags";
+
+	data = ofp_get_create_ifnet(port, vlan);
+	if (data == NULL)
+		return "Cannot create interface";
+
+	odp_rwlock_write_lock(&vlan_shm->vlan_mtx);
+
+	if (svlan) {
+		other = ofp_get_ifnet_qinq(port, svlan, cvlan);
+		if (other && other != data) {
+			err = "QinQ tags already in use";
+			goto out;
+		}
+	}
+
+	if (data->qinq_svlan)
+		qinq_remove(data);
+
+	data->qinq_svlan = svlan;
+	data->qinq_cvlan = svlan ? cvlan : 0;
+
+	if (svlan && qinq_insert(data)) {
+		data->qinq_svlan = 0;
+		data->qinq_cvlan = 0;
+		err = "QinQ table full";
+	}
+out:
+	odp_rwlock_write_unlock(&vlan_shm->vlan_mtx);
+	return err;
+}
+
+struct ofp_ifnet *ofp_get_ifnet_qinq(int port, uint16_t svlan, uint16_t cvlan)
+{
+	struct ofp_qinq_entry *entry;
+
+	if (odp_unlikely(!PHYS_PORT(port)))
+		return NULL;
+
+	entry = qinq_find(QINQ_KEY(port, svlan, cvlan));
+
+	return entry ? entry->ifnet : NULL;
+}
+
 struct ofp_ifnet *ofp_get_ifnet(int port, uint16_t vlan)
 {
 	if (port < 0 || port >= shm->ofp_num_ports) {
@@ -1206,6 +1416,9 @@ struct ofp_ifnet *ofp_get_ifnet(int port, uint16_t vlan)
 		return NULL;
 	}
 
+	if (PHYS_PORT(port) && vlan && vlan < OFP_EVL_VLID_CNT)
+		return shm->vlan_index[port][vlan];
+
 	if (vlan || port == LOCAL_PORTS) {
 		struct ofp_ifnet key, *data;
 
@@ -1241,6 +1454,7 @@ struct ofp_ifnet *ofp_get_create_ifnet(int port, uint16_t vlan)
 			data->vlan = vlan;
 			memcpy(data->mac, shm->ofp_ifnet_data[port].mac, 6);
 			data->if_mtu = shm->ofp_ifnet_data[port].if_mtu;
+			data->if_parse = shm->ofp_ifnet_data[port].if_parse;
 #ifdef INET6
 			memcpy(data->link_local,
 				shm->ofp_ifnet_data[port].link_local, 16);
@@ -1437,86 +1651,196 @@ void ofp_get_interfaces(struct ofp_ifconf *ifc)
 	ifc->ifc_len = ifc->ifc_current_len;
 }
 
-struct iter_ip {
-	uint32_t addr;
-	uint16_t vrf;
-};
+static inline struct ofp_ifnet_bucket *ifaddr_bucket(uint32_t ip)
+{
+	return &ifaddr_hash_shm->ip_hash[ofp_hashword(&ip, 1, 0) &
+					 ifaddr_hash_shm->mask];
+}
 
-static int vlan_match_ip_vrf(void *key, void *iter_arg)
+#ifdef INET6
+static inline struct ofp_ifnet_bucket *ifaddr6_bucket(const uint8_t *addr6)
 {
-	struct ofp_ifnet *iface = key;
-	struct iter_ip *iterdata = (struct iter_ip *)iter_arg;
+	return &ifaddr_hash_shm->ip6_hash[ofp_hashlittle(addr6, 16, 0) &
+					  ifaddr_hash_shm->mask];
+}
+#endif /* INET6 */
 
-	if (iface->ip_addr == iterdata->addr &&
-	    iface->vrf == iterdata->vrf)
-		return iface->vlan;
-	else
-		return 0;
+static inline struct ofp_ifnet_bucket *tun_bucket(uint32_t tun_loc,
+						  uint32_t tun_rem)
+{
+	uint32_t key[2] = {tun_loc, tun_rem};
+
+	return &ifaddr_hash_shm->tun_hash[ofp_hashword(key, 2, 0) &
+					  ifaddr_hash_shm->mask];
+}
+
+/*
+ * Readers walk the buckets without locks. An element relinked to another
+ * bucket, or unlinked and recycled by ofp_get_create_ifnet(), can take a
+ * concurrent reader off its chain. The sequence is odd while an update
+ * is in progress; a reader that misses walks again if it moved.
+ */
+static inline void ifaddr_hash_write_begin(void)
+{
+	odp_atomic_store_u32(&ifaddr_hash_shm->seq,
+			     odp_atomic_load_u32(&ifaddr_hash_shm->seq) + 1);
+	odp_mb_release();
+}
+
+static inline void ifaddr_hash_write_end(void)
+{
+	uint32_t seq = odp_atomic_load_u32(&ifaddr_hash_shm->seq);
+
+	odp_atomic_store_rel_u32(&ifaddr_hash_shm->seq, seq + 1);
+}
+
+static inline uint32_t ifaddr_hash_read_begin(void)
+{
+	uint32_t seq;
+
+	while ((seq = odp_atomic_load_acq_u32(&ifaddr_hash_shm->seq)) & 1)
+		odp_cpu_pause();
+
+	return seq;
+}
+
+static inline int ifaddr_hash_read_retry(uint32_t seq)
+{
+	odp_mb_acquire();
+	return seq != odp_atomic_load_u32(&ifaddr_hash_shm->seq);
+}
+
+#define IFADDR_HASH_INSERT(head, elm, field) do {			\
+	(elm)->field.le_next = (head)->lh_first;			\
+	if ((elm)->field.le_next)					\
+		(elm)->field.le_next->field.le_prev =			\
+			&(elm)->field.le_next;				\
+	(elm)->field.le_prev = &(head)->lh_first;			\
+	odp_mb_release();						\
+	(head)->lh_first = (elm);					\
+} while (0)
+
+#define IFADDR_HASH_REMOVE(elm, field) do {				\
+	if ((elm)->field.le_prev) {					\
+		if ((elm)->field.le_next)				\
+			(elm)->field.le_next->field.le_prev =		\
+				(elm)->field.le_prev;			\
+		*(elm)->field.le_prev = (elm)->field.le_next;		\
+		(elm)->field.le_prev = NULL;				\
+	}								\
+} while (0)
+
+static void ifnet_addr_hash_unlink(struct ofp_ifnet *ifnet)
+{
+	IFADDR_HASH_REMOVE(ifnet, ia_hash);
+#ifdef INET6
+	IFADDR_HASH_REMOVE(ifnet, ia6_hash);
+#endif /* INET6 */
+	IFADDR_HASH_REMOVE(ifnet, tun_hash);
+}
+
+void ofp_ifnet_addr_hash_update(struct ofp_ifnet *ifnet)
+{
+	odp_spinlock_lock(&ifaddr_hash_shm->lock);
+	ifaddr_hash_write_begin();
+
+	ifnet_addr_hash_unlink(ifnet);
+
+	if (ifnet->ip_addr)
+		IFADDR_HASH_INSERT(ifaddr_bucket(ifnet->ip_addr), ifnet,
+				   ia_hash);
+#ifdef INET6
+	if (ofp_ip6_is_set(ifnet->ip6_addr))
+		IFADDR_HASH_INSERT(ifaddr6_bucket(ifnet->ip6_addr), ifnet,
+				   ia6_hash);
+#endif /* INET6 */
+	if (ifnet->port == GRE_PORTS && ifnet->ip_local)
+		IFADDR_HASH_INSERT(tun_bucket(ifnet->ip_local,
+					      ifnet->ip_remote),
+				   ifnet, tun_hash);
+
+	ifaddr_hash_write_end();
+	odp_spinlock_unlock(&ifaddr_hash_shm->lock);
+}
+
+void ofp_ifnet_addr_hash_remove(struct ofp_ifnet *ifnet)
+{
+	odp_spinlock_lock(&ifaddr_hash_shm->lock);
+	ifaddr_hash_write_begin();
+	ifnet_addr_hash_unlink(ifnet);
+	ifaddr_hash_write_end();
+	odp_spinlock_unlock(&ifaddr_hash_shm->lock);
 }
 
 struct ofp_ifnet *ofp_get_ifnet_by_ip(uint32_t ip, uint16_t vrf)
 {
-	uint16_t port;
 	struct ofp_ifnet *ifnet;
-	uint16_t vlan;
-	struct iter_ip iterdata;
+	uint32_t seq;
 
-	for (port = 0; port < OFP_FP_INTERFACE_MAX; ++port) {
-		ifnet = &shm->ofp_ifnet_data[port];
-		if (ifnet->ip_addr == ip && ifnet->vrf == vrf)
-			return ifnet;
-	}
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifnet, ifaddr_bucket(ip), ia_hash) {
+			if (ifnet->ip_addr == ip && ifnet->vrf == vrf &&
+			    PHYS_PORT(ifnet->port))
+				return ifnet;
+		}
+	} while (ifaddr_hash_read_retry(seq));
+
+	return NULL;
+}
 
-	iterdata.addr = ip;
-	iterdata.vrf = vrf;
+struct ofp_ifnet *ofp_get_ifnet_local_ip(uint32_t ip, uint16_t vrf)
+{
+	struct ofp_ifnet *ifnet;
+	uint32_t seq;
 
-	for (port = 0; port < OFP_FP_INTERFACE_MAX; ++port) {
-		vlan = vlan_iterate_inorder(
-			shm->ofp_ifnet_data[port].vlan_structs,
-			vlan_match_ip_vrf, &iterdata);
-		if (vlan)
-			return ofp_get_ifnet(port, vlan);
-	}
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifnet, ifaddr_bucket(ip), ia_hash) {
+			if (ifnet->ip_addr == ip && ifnet->vrf == vrf &&
+			    ifnet->port != GRE_PORTS)
+				return ifnet;
+		}
+	} while (ifaddr_hash_read_retry(seq));
 
 	return NULL;
 }
 
-struct iter_tun {
-	uint32_t tun_loc;
-	uint32_t tun_rem;
-	uint16_t vrf;
-};
-
-static int vlan_match_tun(void *key, void *iter_arg)
+#ifdef INET6
+struct ofp_ifnet *ofp_get_ifnet_local_ip6(uint8_t *addr6, uint16_t vrf)
 {
-	struct ofp_ifnet *iface = key;
-	struct iter_tun *tundata = iter_arg;
+	struct ofp_ifnet *ifnet;
+	uint32_t seq;
 
-	if (iface->ip_local == tundata->tun_loc &&
-	    iface->ip_remote == tundata->tun_rem &&
-	    iface->vrf == tundata->vrf)
-		return iface->vlan;
-	else
-		return 0;
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifnet, ifaddr6_bucket(addr6), ia6_hash) {
+			if (!memcmp(ifnet->ip6_addr, addr6, 16) &&
+			    ifnet->vrf == vrf && ifnet->port != GRE_PORTS)
+				return ifnet;
+		}
+	} while (ifaddr_hash_read_retry(seq));
+
+	return NULL;
 }
+#endif /* INET6 */
 
 struct ofp_ifnet *ofp_get_ifnet_by_tunnel(uint32_t tun_loc,
 					  uint32_t tun_rem, uint16_t vrf)
 {
-	uint16_t port = GRE_PORTS;
-	uint16_t greid;
-	struct iter_tun tundata;
-
-	tundata.tun_loc = tun_loc;
-	tundata.tun_rem = tun_rem;
-	tundata.vrf = vrf;
-
-	greid = vlan_iterate_inorder(
-		shm->ofp_ifnet_data[port].vlan_structs,
-		vlan_match_tun, &tundata);
-
-	if (greid)
-		return ofp_get_ifnet(port, greid);
+	struct ofp_ifnet *ifnet;
+	uint32_t seq;
+
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifnet, tun_bucket(tun_loc, tun_rem),
+				 tun_hash) {
+			if (ifnet->ip_local == tun_loc &&
+			    ifnet->ip_remote == tun_rem &&
+			    ifnet->vrf == vrf)
+				return ifnet;
+		}
+	} while (ifaddr_hash_read_retry(seq));
 
 	return NULL;
 }
@@ -1566,6 +1890,8 @@ void ofp_portconf_init_prepare(void)
 	ofp_shared_memory_prealloc(SHM_NAME_PORTS, sizeof(*shm));
 	ofp_shared_memory_prealloc(SHM_NAME_PORT_LOCKS,
 				   sizeof(*ofp_ifnet_locks_shm));
+	ofp_shared_memory_prealloc(SHM_NAME_IFADDR_HASH,
+				   SHM_SIZE_IFADDR_HASH);
 }
 
 static int ofp_portconf_alloc_shared_memory(void)
@@ -1583,11 +1909,19 @@ static int ofp_portconf_alloc_shared_memory(void)
 		return -1;
 	}
 
+	ifaddr_hash_shm = ofp_shared_memory_alloc(SHM_NAME_IFADDR_HASH,
+						  SHM_SIZE_IFADDR_HASH);
+	if (ifaddr_hash_shm == NULL) {
+		OFP_ERR("ofp_shared_memory_alloc failed");
+		return -1;
+	}
+
 	return 0;
 }
 
 #define SHM_SIZE_VLAN (sizeof(struct ofp_vlan_mem) + \
-		       sizeof(struct ofp_ifnet) * global_param->num_vlan)
+		       sizeof(struct ofp_ifnet) * global_param->num_vlan + \
+		       sizeof(struct ofp_qinq_entry) * QINQ_TBL_SIZE)
 
 static int ofp_vlan_alloc_shared_memory(void)
 {
@@ -1619,6 +1953,12 @@ static int ofp_portconf_free_shared_memory(void)
 		rc = -1;
 	}
 	ofp_ifnet_locks_shm = NULL;
+
+	if (ofp_shared_memory_free(SHM_NAME_IFADDR_HASH) == -1) {
+		OFP_ERR("ofp_shared_memory_free failed");
+		rc = -1;
+	}
+	ifaddr_hash_shm = NULL;
 	return rc;
 }
 
@@ -1650,6 +1990,12 @@ int ofp_portconf_lookup_shared_memory(void)
 		return -1;
 	}
 
+	ifaddr_hash_shm = ofp_shared_memory_lookup(SHM_NAME_IFADDR_HASH);
+	if (ifaddr_hash_shm == NULL) {
+		OFP_ERR("ofp_shared_memory_lookup failed");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1743,6 +2089,18 @@ int ofp_portconf_init_global(void)
 	odp_rwlock_init(&ofp_ifnet_locks_shm->lock_ifaddr6_list_rw);
 #endif /* INET6 */
 
+	memset(ifaddr_hash_shm, 0, SHM_SIZE_IFADDR_HASH);
+	odp_spinlock_init(&ifaddr_hash_shm->lock);
+	odp_atomic_init_u32(&ifaddr_hash_shm->seq, 0);
+	ifaddr_hash_shm->mask = IFADDR_HASH_SIZE - 1;
+	ifaddr_hash_shm->ip_hash = &ifaddr_hash_shm->buckets[0];
+#ifdef INET6
+	ifaddr_hash_shm->ip6_hash =
+		&ifaddr_hash_shm->buckets[IFADDR_HASH_SIZE];
+#endif /* INET6 */
+	ifaddr_hash_shm->tun_hash =
+		&ifaddr_hash_shm->buckets[2 * IFADDR_HASH_SIZE];
+
 	return 0;
 }
 
@@ -1760,6 +2118,14 @@ int ofp_vlan_init_global(void)
 	vlan_shm->free_ifnet_list = &(vlan_shm->vlan_ifnet[0]);
 	odp_rwlock_init(&vlan_shm->vlan_mtx);
 
+	vlan_shm->qinq_tbl = (struct ofp_qinq_entry *)
+		&vlan_shm->vlan_ifnet[global_param->num_vlan];
+	vlan_shm->qinq_mask = QINQ_TBL_SIZE - 1;
+	for (i = 0; i <= (int)vlan_shm->qinq_mask; i++) {
+		odp_atomic_init_u32(&vlan_shm->qinq_tbl[i].key, QINQ_KEY_FREE);
+		vlan_shm->qinq_tbl[i].ifnet = NULL;
+	}
+
 	return 0;
 }
 
@@ -1841,17 +2207,18 @@ void ofp_ifaddr_elem_del(struct ofp_ifnet *ifnet)
 struct ofp_ifnet *ofp_ifaddr_elem_get(int vrf, uint8_t *addr)
 {
 	struct ofp_ifnet *ifa;
+	uint32_t ip = *(uint32_t *)addr;
+	uint32_t seq;
+
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifa, ifaddr_bucket(ip), ia_hash) {
+			if (ifa->ip_addr == ip && ifa->vrf == vrf)
+				return ifa;
+		}
+	} while (ifaddr_hash_read_retry(seq));
 
-	OFP_IFNET_LOCK_WRITE(ifaddr_list);
-
-	OFP_TAILQ_FOREACH(ifa, ofp_get_ifaddrhead(), ia_link) {
-		if (ifa->ip_addr == *(uint32_t *)addr &&
-		    ifa->vrf == vrf)
-			break;
-	}
-
-	OFP_IFNET_UNLOCK_WRITE(ifaddr_list);
-	return ifa;
+	return NULL;
 }
 
 uint32_t ofp_port_get_ipv4_addr(int port, uint16_t vlan,
@@ -1923,16 +2290,17 @@ void ofp_ifaddr6_elem_del(struct ofp_ifnet *ifnet)
 
 struct ofp_ifnet *ofp_ifaddr6_elem_get(uint8_t *addr6)
 {
-	struct ofp_ifnet *ifa6 = NULL;
-
-	OFP_IFNET_LOCK_WRITE(ifaddr6_list);
+	struct ofp_ifnet *ifa6;
+	uint32_t seq;
 
-	OFP_TAILQ_FOREACH(ifa6, ofp_get_ifaddr6head(), ia6_link) {
-		if (!memcmp(ifa6->ip6_addr, addr6, 16))
-			break;
-	}
+	do {
+		seq = ifaddr_hash_read_begin();
+		OFP_LIST_FOREACH(ifa6, ifaddr6_bucket(addr6), ia6_hash) {
+			if (!memcmp(ifa6->ip6_addr, addr6, 16))
+				return ifa6;
+		}
+	} while (ifaddr_hash_read_retry(seq));
 
-	OFP_IFNET_UNLOCK_WRITE(ifaddr6_list);
-	return ifa6;
+	return NULL;
 }
 #endif /* INET6 */
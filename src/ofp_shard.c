@@ -0,0 +1,350 @@
+/* Copyright (c) 2016, ENEA Software AB
+ * Copyright (c) 2016, Nokia
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:	BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <odp_api.h>
+
+#include "ofpi_log.h"
+#include "ofpi_util.h"
+#include "ofpi_shard.h"
+#include "ofpi_ip.h"
+#include "ofpi_ip6.h"
+#include "ofpi_icmp.h"
+#include "ofpi_sysctl.h"
+#include "ofpi_tcp.h"
+#include "ofpi_tcp_var.h"
+#include "ofpi_pkt_processing.h"
+
+#define SHM_NAME_SHARD "OfpShardShMem"
+
+struct ofp_shard_mem {
+	odp_spinlock_t lock;
+	int owner[OFP_MAX_NUM_CPU];	/* thread id, -1 if none */
+	int owned;
+	odp_atomic_u32_t ready;		/* every shard has had an owner */
+	odp_schedule_group_t group[OFP_MAX_NUM_CPU];
+	odp_queue_t queue[OFP_MAX_NUM_CPU];
+};
+
+static __thread struct ofp_shard_mem *shm;
+
+__thread int ofp_shard_id = -1;
+
+static int ofp_shard_alloc_shared_memory(void)
+{
+	shm = ofp_shared_memory_alloc(SHM_NAME_SHARD, sizeof(*shm));
+	if (shm == NULL) {
+		OFP_ERR("ofp_shared_memory_alloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int ofp_shard_free_shared_memory(void)
+{
+	int rc = 0;
+
+	if (ofp_shared_memory_free(SHM_NAME_SHARD) == -1) {
+		OFP_ERR("ofp_shared_memory_free failed");
+		rc = -1;
+	}
+	shm = NULL;
+	return rc;
+}
+
+int ofp_shard_lookup_shared_memory(void)
+{
+	shm = ofp_shared_memory_lookup(SHM_NAME_SHARD);
+	if (shm == NULL) {
+		OFP_ERR("ofp_shared_memory_lookup failed");
+		return -1;
+	}
+	return 0;
+}
+
+void ofp_shard_init_prepare(void)
+{
+	ofp_shared_memory_prealloc(SHM_NAME_SHARD, sizeof(*shm));
+}
+
+int ofp_shard_init_global(void)
+{
+	odp_queue_param_t param;
+	odp_thrmask_t thrmask;
+	char name[32];
+	int i;
+
+	HANDLE_ERROR(ofp_shard_alloc_shared_memory());
+
+	odp_spinlock_init(&shm->lock);
+	shm->owned = 0;
+	odp_atomic_init_u32(&shm->ready, 0);
+	for (i = 0; i < OFP_MAX_NUM_CPU; i++) {
+		shm->owner[i] = -1;
+		shm->group[i] = ODP_SCHED_GROUP_INVALID;
+		shm->queue[i] = ODP_QUEUE_INVALID;
+	}
+
+	/*
+	 * Each shard gets a schedule group of its own, joined by the
+	 * owning thread only. The redirect queue and the TCP timer
+	 * queue of the shard are scheduled in that group.
+	 */
+	odp_thrmask_zero(&thrmask);
+	for (i = 0; i < global_param->shards; i++) {
+		sprintf(name, "OfpShard_%d", i);
+		shm->group[i] = odp_schedule_group_create(name, &thrmask);
+		if (shm->group[i] == ODP_SCHED_GROUP_INVALID) {
+			OFP_ERR("odp_schedule_group_create failed");
+			return -1;
+		}
+
+		odp_queue_param_init(&param);
+		param.type = ODP_QUEUE_TYPE_SCHED;
+		param.enq_mode = ODP_QUEUE_OP_MT;
+		param.sched.prio = ODP_SCHED_PRIO_DEFAULT;
+		param.sched.sync = ODP_SCHED_SYNC_PARALLEL;
+		param.sched.group = shm->group[i];
+		param.context = shm;
+
+		sprintf(name, "OfpShardQueue_%d", i);
+		shm->queue[i] = odp_queue_create(name, &param);
+		if (shm->queue[i] == ODP_QUEUE_INVALID) {
+			OFP_ERR("odp_queue_create failed");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A thread that dispatches events takes the first shard without an
+ * owner. Flows are passed on only once every shard has an owner, so
+ * none is sent to a queue that nobody schedules. A shard given back by
+ * ofp_shard_term_local() keeps its queued packets and timers for the
+ * next owner.
+ */
+int ofp_shard_join(void)
+{
+	odp_thrmask_t thrmask;
+	int shard;
+
+	if (!OFP_SHARDED() || ofp_shard_id >= 0)
+		return 0;
+
+	if (odp_thread_type() != ODP_THREAD_WORKER) {
+		OFP_ERR("Only worker threads can own a TCP shard");
+		return -1;
+	}
+
+	odp_spinlock_lock(&shm->lock);
+	for (shard = 0; shard < global_param->shards; shard++)
+		if (shm->owner[shard] < 0)
+			break;
+	if (shard == global_param->shards) {
+		odp_spinlock_unlock(&shm->lock);
+		return 0;
+	}
+
+	odp_thrmask_zero(&thrmask);
+	odp_thrmask_set(&thrmask, odp_thread_id());
+	if (odp_schedule_group_join(shm->group[shard], &thrmask)) {
+		odp_spinlock_unlock(&shm->lock);
+		OFP_ERR("odp_schedule_group_join failed");
+		return -1;
+	}
+
+	shm->owner[shard] = odp_thread_id();
+	ofp_shard_id = shard;
+	if (++shm->owned == global_param->shards &&
+	    !odp_atomic_load_u32(&shm->ready)) {
+		odp_atomic_store_u32(&shm->ready, 1);
+		OFP_INFO("All %d TCP shards have an owner",
+			 global_param->shards);
+	}
+	odp_spinlock_unlock(&shm->lock);
+
+	OFP_INFO("Thread %d owns TCP shard %d", odp_thread_id(), shard);
+	return 0;
+}
+
+int ofp_shard_term_local(void)
+{
+	odp_thrmask_t thrmask;
+	int rc = 0;
+
+	if (ofp_shard_id < 0)
+		return 0;
+
+	odp_thrmask_zero(&thrmask);
+	odp_thrmask_set(&thrmask, odp_thread_id());
+	CHECK_ERROR(odp_schedule_group_leave(shm->group[ofp_shard_id],
+					     &thrmask), rc);
+
+	odp_spinlock_lock(&shm->lock);
+	shm->owner[ofp_shard_id] = -1;
+	shm->owned--;
+	odp_spinlock_unlock(&shm->lock);
+
+	ofp_shard_id = -1;
+	return rc;
+}
+
+int ofp_shard_self(void)
+{
+	if (ofp_shard_id < 0 || !odp_atomic_load_u32(&shm->ready))
+		return -1;
+	return ofp_shard_id;
+}
+
+odp_schedule_group_t ofp_shard_group(int shard)
+{
+	return shm->group[shard];
+}
+
+int ofp_shard_queue_ctx(void *ctx)
+{
+	return ctx == (void *)shm;
+}
+
+static int shard_pass(odp_packet_t pkt, int shard, int off, uint8_t flag)
+{
+	struct ofp_packet_user_area *ua;
+
+	if (shard == ofp_shard_id || !odp_atomic_load_u32(&shm->ready))
+		return 0;
+
+	ua = ofp_packet_user_area(pkt);
+	ua->shard_off = off;
+	ua->flags = (ua->flags & ~OFP_PKT_UA_SHARD_ICMP) | flag;
+	if (odp_queue_enq(shm->queue[shard], odp_packet_to_event(pkt)) < 0)
+		odp_packet_free(pkt);
+
+	return 1;
+}
+
+int ofp_shard_redirect(odp_packet_t pkt, int off)
+{
+	struct ofp_ip *ip = (struct ofp_ip *)odp_packet_l3_ptr(pkt, NULL);
+	struct ofp_tcphdr *th = (struct ofp_tcphdr *)((uint8_t *)ip + off);
+	int shard;
+
+#ifdef INET6
+	if (ip->ip_v == 6) {
+		struct ofp_ip6_hdr *ip6 = (struct ofp_ip6_hdr *)ip;
+
+		shard = ofp_shard_of6(ip6->ip6_src.ofp_s6_addr32, th->th_sport,
+				      ip6->ip6_dst.ofp_s6_addr32, th->th_dport);
+	} else
+#endif
+		shard = ofp_shard_of(ip->ip_src.s_addr, th->th_sport,
+				     ip->ip_dst.s_addr, th->th_dport);
+
+	return shard_pass(pkt, shard, off, 0);
+}
+
+/*
+ * The errors that ofp_tcp_ctlinput() acts on, passed on by the TCP
+ * connection in the quoted header.
+ */
+int ofp_shard_redirect_icmp(odp_packet_t pkt, int off)
+{
+	struct ofp_ip *ip = (struct ofp_ip *)odp_packet_l3_ptr(pkt, NULL);
+	struct ofp_icmp *icp = (struct ofp_icmp *)((uint8_t *)ip + off);
+	struct ofp_ip *oip = &icp->ofp_icmp_ip;
+	int icmplen = odp_be_to_cpu_16(ip->ip_len) - off;
+	struct ofp_tcphdr *th;
+
+	switch (icp->icmp_type) {
+	case OFP_ICMP_UNREACH:
+	case OFP_ICMP_TIMXCEED:
+	case OFP_ICMP_PARAMPROB:
+	case OFP_ICMP_SOURCEQUENCH:
+		break;
+	default:
+		return 0;
+	}
+
+	if (icmplen < (int)OFP_ICMP_ADVLENMIN ||
+	    icmplen < (int)OFP_ICMP_ADVLEN(icp) ||
+	    oip->ip_hl < (sizeof(struct ofp_ip) >> 2) ||
+	    oip->ip_p != OFP_IPPROTO_TCP)
+		return 0;
+
+	th = (struct ofp_tcphdr *)((uint8_t *)oip + (oip->ip_hl << 2));
+
+	return shard_pass(pkt, ofp_shard_of(oip->ip_src.s_addr, th->th_sport,
+					    oip->ip_dst.s_addr, th->th_dport),
+			  off, OFP_PKT_UA_SHARD_ICMP);
+}
+
+enum ofp_return_code ofp_shard_input(odp_packet_t pkt)
+{
+	struct ofp_packet_user_area *ua = ofp_packet_user_area(pkt);
+	enum ofp_return_code res;
+
+	if (ua->flags & OFP_PKT_UA_SHARD_ICMP)
+		res = ofp_icmp_input(&pkt, ua->shard_off);
+	else
+		res = ofp_tcp_input(&pkt, ua->shard_off);
+
+	if (res == OFP_PKT_DROP)
+		odp_packet_free(pkt);
+
+	if (res != OFP_PKT_CONTINUE)
+		return res;
+
+	return ofp_sp_input(pkt, odp_packet_user_ptr(pkt));
+}
+
+/*
+ * Let this thread see the shard queues so that the final
+ * schedule_shutdown() drains them.
+ */
+int ofp_shard_stop_global(void)
+{
+	odp_thrmask_t thrmask;
+	int i, rc = 0;
+
+	if (ofp_shard_lookup_shared_memory())
+		return -1;
+
+	odp_thrmask_zero(&thrmask);
+	odp_thrmask_set(&thrmask, odp_thread_id());
+	for (i = 0; i < OFP_MAX_NUM_CPU; i++)
+		if (shm->group[i] != ODP_SCHED_GROUP_INVALID)
+			CHECK_ERROR(odp_schedule_group_join(shm->group[i],
+							    &thrmask), rc);
+	return rc;
+}
+
+int ofp_shard_term_global(void)
+{
+	int i, rc = 0;
+
+	if (ofp_shard_lookup_shared_memory())
+		return -1;
+
+	for (i = 0; i < OFP_MAX_NUM_CPU; i++) {
+		if (shm->queue[i] != ODP_QUEUE_INVALID) {
+			CHECK_ERROR(odp_queue_destroy(shm->queue[i]), rc);
+			shm->queue[i] = ODP_QUEUE_INVALID;
+		}
+		if (shm->group[i] != ODP_SCHED_GROUP_INVALID) {
+			CHECK_ERROR(odp_schedule_group_destroy(shm->group[i]),
+				    rc);
+			shm->group[i] = ODP_SCHED_GROUP_INVALID;
+		}
+	}
+
+	CHECK_ERROR(ofp_shard_free_shared_memory(), rc);
+
+	return rc;
+}
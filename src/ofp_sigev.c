@@ -0,0 +1,271 @@
+/* Copyright (c) 2016, Nokia
+ * Copyright (c) 2016, ENEA Software AB
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier:     BSD-3-Clause
+ */
+
+#include <string.h>
+
+#include <odp_api.h>
+
+#include "ofpi_sigev.h"
+#include "ofpi_shared_mem.h"
+#include "ofpi_util.h"
+#include "ofpi_log.h"
+
+#define SHM_NAME_SIGEV "OfpSigevShMem"
+
+#define SIGEV_TARGETS 4
+#define SIGEV_BUFS 256
+
+/*
+ * Events of a burst are collected per thread, one vector for each
+ * function and queue they go to. A thread has few of them, so they
+ * are looked up linearly.
+ */
+struct sigev_target {
+	void (*func)(union ofp_sigval);
+	odp_queue_t queue;
+	int num;
+	struct ofp_sock_sigval sigval[OFP_SIGEV_BATCH_MAX];
+};
+
+/* A vector delivered to a queue */
+struct sigev_buf {
+	struct ofp_sock_sigval_vec vec;
+	struct ofp_sock_sigval sigval[OFP_SIGEV_BATCH_MAX];
+};
+
+struct ofp_sigev_mem {
+	odp_pool_t pool;
+};
+
+static __thread struct ofp_sigev_mem *shm_sigev;
+
+static __thread struct sigev_target targets[SIGEV_TARGETS];
+static __thread int num_targets;
+
+__thread int ofp_sigev_burst;
+
+static int ofp_sigev_alloc_shared_memory(void)
+{
+	shm_sigev = ofp_shared_memory_alloc(SHM_NAME_SIGEV,
+					    sizeof(*shm_sigev));
+	if (shm_sigev == NULL) {
+		OFP_ERR("ofp_shared_memory_alloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int ofp_sigev_free_shared_memory(void)
+{
+	int rc = 0;
+
+	if (ofp_shared_memory_free(SHM_NAME_SIGEV) == -1) {
+		OFP_ERR("ofp_shared_memory_free failed");
+		rc = -1;
+	}
+	shm_sigev = NULL;
+	return rc;
+}
+
+int ofp_sigev_lookup_shared_memory(void)
+{
+	shm_sigev = ofp_shared_memory_lookup(SHM_NAME_SIGEV);
+	if (shm_sigev == NULL) {
+		OFP_ERR("ofp_shared_memory_lookup failed");
+		return -1;
+	}
+	return 0;
+}
+
+void ofp_sigev_init_prepare(void)
+{
+	ofp_shared_memory_prealloc(SHM_NAME_SIGEV, sizeof(*shm_sigev));
+}
+
+int ofp_sigev_init_global(void)
+{
+	odp_pool_param_t pool_params;
+
+	HANDLE_ERROR(ofp_sigev_alloc_shared_memory());
+
+	odp_pool_param_init(&pool_params);
+	pool_params.buf.size  = sizeof(struct sigev_buf);
+	pool_params.buf.align = 0;
+	pool_params.buf.num   = SIGEV_BUFS;
+	pool_params.type      = ODP_POOL_BUFFER;
+
+	shm_sigev->pool = ofp_pool_create("OfpSigevPool", &pool_params);
+	if (shm_sigev->pool == ODP_POOL_INVALID) {
+		OFP_ERR("odp_pool_create failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int ofp_sigev_term_global(void)
+{
+	int rc = 0;
+
+	if (ofp_sigev_lookup_shared_memory())
+		return -1;
+
+	if (shm_sigev->pool != ODP_POOL_INVALID) {
+		CHECK_ERROR(odp_pool_destroy(shm_sigev->pool), rc);
+		shm_sigev->pool = ODP_POOL_INVALID;
+	}
+
+	CHECK_ERROR(ofp_sigev_free_shared_memory(), rc);
+
+	return rc;
+}
+
+static void sigev_free_packets(struct ofp_sock_sigval *sigval, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		if (sigval[i].pkt != ODP_PACKET_INVALID)
+			odp_packet_free(sigval[i].pkt);
+}
+
+static int sigev_enqueue(odp_queue_t queue, struct ofp_sock_sigval *sigval,
+			 int num)
+{
+	struct sigev_buf *b;
+	odp_buffer_t buf;
+
+	buf = odp_buffer_alloc(shm_sigev->pool);
+	if (buf == ODP_BUFFER_INVALID)
+		return -1;
+
+	b = odp_buffer_addr(buf);
+	memcpy(b->sigval, sigval, num * sizeof(*sigval));
+	b->vec.num = num;
+	b->vec.sigval = b->sigval;
+
+	if (odp_queue_enq(queue, odp_buffer_to_event(buf)) < 0) {
+		odp_buffer_free(buf);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Deliver a vector to its queue, or to its function if there is no
+ * queue or the queue cannot take it.
+ */
+static void sigev_deliver(void (*func)(union ofp_sigval), odp_queue_t queue,
+			  struct ofp_sock_sigval *sigval, int num)
+{
+	struct ofp_sock_sigval_vec vec;
+	union ofp_sigval sv;
+
+	if (queue != ODP_QUEUE_INVALID) {
+		if (!sigev_enqueue(queue, sigval, num))
+			return;
+		OFP_ERR("Socket events lost from queue delivery");
+		if (!func) {
+			sigev_free_packets(sigval, num);
+			return;
+		}
+	}
+
+	vec.num = num;
+	vec.sigval = sigval;
+	sv.sival_ptr = &vec;
+	func(sv);
+
+	sigev_free_packets(sigval, num);
+}
+
+/*
+ * Events that the functions cause are delivered at once, the vectors
+ * are not touched while they are delivered.
+ */
+static void sigev_flush_targets(void)
+{
+	int burst = ofp_sigev_burst;
+	int i;
+
+	ofp_sigev_burst = 0;
+	for (i = 0; i < num_targets; i++) {
+		sigev_deliver(targets[i].func, targets[i].queue,
+			      targets[i].sigval, targets[i].num);
+		targets[i].num = 0;
+	}
+	num_targets = 0;
+	ofp_sigev_burst = burst;
+}
+
+void ofp_sigev_flush(void)
+{
+	if (num_targets)
+		sigev_flush_targets();
+	ofp_sigev_burst = 0;
+}
+
+void ofp_sigev_batch(const struct ofp_sigevent *ev,
+		     const struct ofp_sock_sigval *ss)
+{
+	struct ofp_sock_sigval sigval;
+	struct sigev_target *t = NULL;
+	int i;
+
+	if (!ofp_sigev_burst) {
+		sigval = *ss;
+		sigev_deliver(ev->ofp_sigev_notify_function,
+			      ev->ofp_sigev_queue, &sigval, 1);
+		return;
+	}
+
+	for (i = 0; i < num_targets; i++)
+		if (targets[i].func == ev->ofp_sigev_notify_function &&
+		    targets[i].queue == ev->ofp_sigev_queue) {
+			t = &targets[i];
+			break;
+		}
+
+	if (!t) {
+		if (num_targets == SIGEV_TARGETS)
+			sigev_flush_targets();
+		t = &targets[num_targets++];
+		t->func = ev->ofp_sigev_notify_function;
+		t->queue = ev->ofp_sigev_queue;
+		t->num = 0;
+	} else if (t->num == OFP_SIGEV_BATCH_MAX) {
+		ofp_sigev_burst = 0;
+		sigev_deliver(t->func, t->queue, t->sigval, t->num);
+		ofp_sigev_burst = 1;
+		t->num = 0;
+	}
+
+	t->sigval[t->num++] = *ss;
+}
+
+struct ofp_sock_sigval_vec *ofp_sigev_vec(odp_event_t ev)
+{
+	odp_buffer_t buf;
+
+	if (odp_event_type(ev) != ODP_EVENT_BUFFER)
+		return NULL;
+
+	buf = odp_buffer_from_event(ev);
+	if (odp_buffer_pool(buf) != shm_sigev->pool)
+		return NULL;
+
+	return &((struct sigev_buf *)odp_buffer_addr(buf))->vec;
+}
+
+void ofp_sigev_vec_free(odp_event_t ev)
+{
+	odp_buffer_t buf = odp_buffer_from_event(ev);
+	struct sigev_buf *b = odp_buffer_addr(buf);
+
+	sigev_free_packets(b->sigval, b->vec.num);
+	odp_buffer_free(buf);
+}
@@ -9,6 +9,9 @@
 #include <strings.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include <odp_api.h>
 
@@ -27,12 +30,14 @@
 #include "ofpi_sockstate.h"
 #include "ofpi_in_pcb.h"
 #include "ofpi_udp_var.h"
+#include "ofpi_tcp_var.h"
 #include "ofpi_protosw.h"
 #include "ofpi_ioctl.h"
 #include "ofpi_route.h"
 #include "api/ofp_types.h"
 #include "ofpi_syscalls.h"
 #include "ofpi_pkt_processing.h"
+#include "ofpi_init.h"
 
 int
 ofp_socket(int domain, int type, int protocol)
@@ -170,6 +175,39 @@ ofp_send(int sockfd, const void *buf, size_t len, int flags)
 	return ofp_sendto(sockfd, buf, len, flags, NULL, 0);
 }
 
+ofp_ssize_t
+ofp_send_pkt(int sockfd, odp_packet_t pkt, int flags)
+{
+	struct thread   td;
+	struct socket  *so = ofp_get_sock_by_fd(sockfd);
+	ofp_ssize_t len;
+
+	if (!so) {
+		odp_packet_free(pkt);
+		ofp_errno = OFP_EBADF;
+		return -1;
+	}
+
+	if (so->so_type != OFP_SOCK_STREAM) {
+		odp_packet_free(pkt);
+		ofp_errno = OFP_EOPNOTSUPP;
+		return -1;
+	}
+
+	len = odp_packet_len(pkt);
+	odp_packet_user_ptr_set(pkt, NULL);
+
+	td.td_proc.p_fibnum = so->so_fibnum;
+	td.td_ucred = NULL;
+
+	/* The packet is queued by reference, ofp_sosend() frees it on error */
+	ofp_errno = ofp_sosend(so, NULL, NULL, pkt, ODP_PACKET_INVALID,
+			       flags, &td);
+	if (ofp_errno)
+		return -1;
+	return len;
+}
+
 ofp_ssize_t
 ofp_recvfrom(int sockfd, void *buf, size_t len, int flags,
 	       struct ofp_sockaddr *src_addr, ofp_socklen_t *addrlen)
@@ -202,86 +240,742 @@ ofp_recv(int sockfd, void *buf, size_t len, int flags)
 	return ofp_recvfrom(sockfd, buf, len, flags, NULL, 0);
 }
 
-int
-ofp_listen(int sockfd, int backlog)
+/* Number of datagrams moved per socket buffer lock in recvmmsg/sendmmsg */
+#define MMSG_BURST 32
+
+static inline int
+so_is_dgram(struct socket *so)
 {
-	struct thread   td;
-	struct socket  *so = ofp_get_sock_by_fd(sockfd);
+	return so->so_proto->pr_usrreqs->pru_soreceive == ofp_soreceive_dgram;
+}
+
+/* UDP socket that coalesces received datagrams */
+static inline int
+so_is_udp_gro(struct socket *so)
+{
+	return so->so_proto->pr_protocol == OFP_IPPROTO_UDP &&
+		(sotoudpcb(so)->u_flags & UF_GRO);
+}
+
+/*
+ * Copy up to len bytes of a packet from offset pkt_off on to the
+ * iovecs of a message from offset off on. The packet may be segmented.
+ */
+static size_t
+iov_copy_in(const struct ofp_msghdr *msg, size_t off, odp_packet_t pkt,
+	    uint32_t pkt_off, size_t len)
+{
+	size_t n, copied = 0;
+	int i;
+
+	for (i = 0; i < msg->msg_iovlen && copied < len; i++) {
+		n = msg->msg_iov[i].iov_len;
+		if (off >= n) {
+			off -= n;
+			continue;
+		}
+		n -= off;
+		if (n > len - copied)
+			n = len - copied;
+		odp_packet_copy_to_mem(pkt, pkt_off + copied, n,
+				       (uint8_t *)msg->msg_iov[i].iov_base +
+				       off);
+		copied += n;
+		off = 0;
+	}
+	return copied;
+}
+
+/* Total length of the iovecs of a message */
+static size_t
+iov_len(const struct ofp_msghdr *msg)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+	return len;
+}
+
+/* Copy a received datagram to a message header and free the packet. */
+static size_t
+dgram_to_msghdr(struct socket *so, odp_packet_t pkt, struct ofp_msghdr *msg)
+{
+	struct ofp_udphdr *uh =
+		(struct ofp_udphdr *)odp_packet_l4_ptr(pkt, NULL);
+	size_t len, copied;
+
+	msg->msg_flags = 0;
+	msg->msg_controllen = 0;
+
+	if (!uh) {
+		OFP_ERR("UDP HDR == NULL!");
+		odp_packet_free(pkt);
+		msg->msg_namelen = 0;
+		return 0;
+	}
+	len = odp_be_to_cpu_16(uh->uh_ulen) - sizeof(*uh);
+
+	copied = iov_copy_in(msg, 0, pkt,
+			     odp_packet_l4_offset(pkt) + sizeof(*uh), len);
+	if (copied < len)
+		msg->msg_flags |= OFP_MSG_TRUNC;
+
+	if (msg->msg_name) {
+		if (so->so_proto->pr_flags & PR_ADDR) {
+			/* address is saved on L2 & L3 */
+			struct ofp_sockaddr *sa =
+				(struct ofp_sockaddr *)odp_packet_l2_ptr(pkt,
+									 NULL);
+
+			memcpy(msg->msg_name, sa,
+			       min(msg->msg_namelen, sa->sa_len));
+			msg->msg_namelen = sa->sa_len;
+		} else
+			msg->msg_namelen = 0;
+	}
+
+	odp_packet_free(pkt);
+	return copied;
+}
+
+/*
+ * Copy datagrams dequeued by ofp_soreceive_dgram_gro() one after the
+ * other to a message header and free the packets. They all fit, and
+ * more than one is described by an OFP_UDP_GRO control message with
+ * the payload size of the first.
+ */
+static size_t
+dgram_gro_to_msghdr(struct socket *so, odp_packet_t *pkts, int num,
+		    struct ofp_msghdr *msg)
+{
+	ofp_socklen_t controllen = msg->msg_controllen;
+	struct ofp_cmsghdr *cm;
+	struct ofp_udphdr *uh;
+	size_t len, copied;
+	int segsize = 0;
+	int i;
+
+	if (num > 1) {
+		uh = (struct ofp_udphdr *)odp_packet_l4_ptr(pkts[0], NULL);
+		segsize = odp_be_to_cpu_16(uh->uh_ulen) - sizeof(*uh);
+	}
+
+	copied = dgram_to_msghdr(so, pkts[0], msg);
+
+	for (i = 1; i < num; i++) {
+		uh = (struct ofp_udphdr *)odp_packet_l4_ptr(pkts[i], NULL);
+		len = odp_be_to_cpu_16(uh->uh_ulen) - sizeof(*uh);
+		copied += iov_copy_in(msg, copied, pkts[i],
+				      odp_packet_l4_offset(pkts[i]) +
+				      sizeof(*uh), len);
+		odp_packet_free(pkts[i]);
+	}
+
+	if (num > 1) {
+		if (msg->msg_control &&
+		    controllen >= OFP_CMSG_SPACE(sizeof(int))) {
+			cm = (struct ofp_cmsghdr *)msg->msg_control;
+			cm->cmsg_len = OFP_CMSG_LEN(sizeof(int));
+			cm->cmsg_level = OFP_IPPROTO_UDP;
+			cm->cmsg_type = OFP_UDP_GRO;
+			*(int *)OFP_CMSG_DATA(cm) = segsize;
+			msg->msg_controllen = OFP_CMSG_SPACE(sizeof(int));
+		} else
+			msg->msg_flags |= OFP_MSG_CTRUNC;
+	}
+
+	return copied;
+}
+
+/* Gather a message to be sent into one packet. */
+static odp_packet_t
+msghdr_to_packet(const struct ofp_msghdr *msg)
+{
+	odp_packet_t pkt;
+	uint32_t off = 0;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+
+	pkt = ofp_socket_packet_alloc(len);
+	if (pkt == ODP_PACKET_INVALID)
+		return pkt;
+
+	odp_packet_user_ptr_set(pkt, NULL);
+
+	/* A large datagram may span packet segments */
+	for (i = 0; i < msg->msg_iovlen; i++) {
+		odp_packet_copy_from_mem(pkt, off, msg->msg_iov[i].iov_len,
+					 msg->msg_iov[i].iov_base);
+		off += msg->msg_iov[i].iov_len;
+	}
+
+	return pkt;
+}
+
+ofp_ssize_t
+ofp_recvmsg(int sockfd, struct ofp_msghdr *msg, int flags)
+{
+	struct socket *so = ofp_get_sock_by_fd(sockfd);
+	union ofp_sockaddr_store ss;
+	struct ofp_sockaddr *sa;
+	struct uio uio;
+	ofp_ssize_t copied = 0;
+	int i;
+
+	if (!so) {
+		ofp_errno = OFP_EBADF;
+		return -1;
+	}
+
+	if (so_is_dgram(so)) {
+		odp_packet_t pkts[OFP_UDP_MAX_SEGMENTS];
+		int num = 1;
+
+		if (so_is_udp_gro(so)) {
+			num = OFP_UDP_MAX_SEGMENTS;
+			ofp_errno = ofp_soreceive_dgram_gro(so, pkts, &num,
+							    iov_len(msg),
+							    flags);
+		} else
+			ofp_errno = ofp_soreceive_dgram_burst(so, pkts, &num,
+							      flags);
+		if (ofp_errno)
+			return -1;
+		if (num == 0) {
+			msg->msg_flags = 0;
+			return 0;
+		}
+		return dgram_gro_to_msghdr(so, pkts, num, msg);
+	}
+
+	/* The stream receive path fills one iovec per call */
+	msg->msg_flags = 0;
+	for (i = 0; i < msg->msg_iovlen; i++) {
+		int rflags = copied ? flags | OFP_MSG_DONTWAIT : flags;
+		ofp_ssize_t len = msg->msg_iov[i].iov_len;
+
+		uio.uio_iov = &msg->msg_iov[i];
+		uio.uio_iovcnt = 1;
+		uio.uio_resid = len;
+		sa = (i == 0 && msg->msg_name) ?
+			(struct ofp_sockaddr *)&ss : NULL;
+
+		ofp_errno = ofp_soreceive(so, &sa, &uio, NULL, NULL, &rflags);
+		if (ofp_errno) {
+			if (copied == 0)
+				return -1;
+			ofp_errno = 0;
+			break;
+		}
+		copied += len - uio.uio_resid;
+		if (uio.uio_resid)
+			break;
+	}
+
+	if (msg->msg_name)
+		msg->msg_namelen = 0;
+	return copied;
+}
+
+/*
+ * The stream send path takes one iovec per call. Sent is updated with the
+ * bytes queued, which can be short of the total on error or non-blocking
+ * sockets.
+ */
+static int
+sosend_iov(struct socket *so, struct ofp_sockaddr *addr,
+	   const struct ofp_iovec *iov, int iovcnt, int flags,
+	   struct thread *td, ofp_ssize_t *sent)
+{
+	struct uio uio;
+	int i, error = 0;
+
+	*sent = 0;
+	for (i = 0; i < iovcnt; i++) {
+		ofp_ssize_t len = iov[i].iov_len;
+		struct ofp_iovec iovec = iov[i];
+
+		uio.uio_iov = &iovec;
+		uio.uio_iovcnt = 1;
+		uio.uio_resid = len;
+		uio.uio_offset = 0;
+
+		error = ofp_sosend(so, addr, &uio, ODP_PACKET_INVALID,
+				   ODP_PACKET_INVALID, flags, td);
+		*sent += len - uio.uio_resid;
+		if (error || uio.uio_resid)
+			break;
+	}
+
+	return error;
+}
+
+ofp_ssize_t
+ofp_sendmsg(int sockfd, const struct ofp_msghdr *msg, int flags)
+{
+	struct socket *so = ofp_get_sock_by_fd(sockfd);
+	union ofp_sockaddr_store nonconstaddr;
+	struct ofp_sockaddr *addr = NULL;
+	odp_packet_t control = ODP_PACKET_INVALID;
+	struct thread td;
+	ofp_ssize_t sent = 0;
 
 	if (!so) {
 		ofp_errno = OFP_EBADF;
 		return -1;
 	}
 
+	if (msg->msg_name && msg->msg_namelen) {
+		if (msg->msg_namelen > sizeof(nonconstaddr)) {
+			ofp_errno = OFP_EINVAL;
+			return -1;
+		}
+		memcpy(&nonconstaddr, msg->msg_name, msg->msg_namelen);
+		addr = (struct ofp_sockaddr *)&nonconstaddr;
+	}
+
 	td.td_proc.p_fibnum = so->so_fibnum;
 	td.td_ucred = NULL;
 
-	ofp_errno = ofp_solisten(so, backlog, &td);
-	if (ofp_errno)
-		return -1;
+	if (so->so_type == OFP_SOCK_DGRAM) {
+		odp_packet_t pkt = msghdr_to_packet(msg);
+
+		if (pkt == ODP_PACKET_INVALID) {
+			ofp_errno = OFP_ENOBUFS;
+			return -1;
+		}
+		sent = odp_packet_len(pkt);
+
+		if (msg->msg_control && msg->msg_controllen) {
+			control = ofp_socket_packet_alloc(msg->msg_controllen);
+			if (control == ODP_PACKET_INVALID) {
+				odp_packet_free(pkt);
+				ofp_errno = OFP_ENOBUFS;
+				return -1;
+			}
+			memcpy(odp_packet_data(control), msg->msg_control,
+			       msg->msg_controllen);
+		}
+
+		ofp_errno = ofp_sosend(so, addr, NULL, pkt, control, flags,
+				       &td);
+		return ofp_errno ? -1 : sent;
+	}
+
+	ofp_errno = sosend_iov(so, addr, msg->msg_iov, msg->msg_iovlen, flags,
+			       &td, &sent);
+	if (sent)
+		ofp_errno = 0;
+	return ofp_errno ? -1 : sent;
+}
+
+/* Packets read from the file per preadv() in ofp_sendfile() */
+#define SENDFILE_BURST 16
+
+/*
+ * Read up to len bytes of the file at offset straight into the data of
+ * freshly allocated packets of chunk bytes, one packet segment each. On
+ * return num holds the number of packets filled, 0 at end of file.
+ */
+static int
+sendfile_read(int fd, ofp_off_t offset, size_t len, uint32_t chunk,
+	      odp_packet_t *pkts, int *num)
+{
+	struct iovec iov[SENDFILE_BURST];
+	ssize_t got;
+	int i, n = 0, filled = 0;
+
+	while (len && n < *num && n < SENDFILE_BURST) {
+		uint32_t plen = len < chunk ? len : chunk;
+		odp_packet_t pkt = ofp_socket_packet_alloc(plen);
+
+		if (pkt == ODP_PACKET_INVALID)
+			break;
+		odp_packet_user_ptr_set(pkt, NULL);
+		if (odp_packet_seg_len(pkt) < plen) {
+			odp_packet_pull_tail(pkt,
+					     plen - odp_packet_seg_len(pkt));
+			plen = odp_packet_len(pkt);
+		}
+		iov[n].iov_base = odp_packet_data(pkt);
+		iov[n].iov_len = plen;
+		pkts[n++] = pkt;
+		len -= plen;
+	}
+
+	if (n == 0)
+		return OFP_ENOBUFS;
+
+	got = preadv(fd, iov, n, offset);
+	if (got < 0) {
+		for (i = 0; i < n; i++)
+			odp_packet_free(pkts[i]);
+		return errno == EBADF ? OFP_EBADF : OFP_EIO;
+	}
+
+	/* Trim the packets to a short read at the end of file */
+	for (i = 0; i < n; i++) {
+		if (got == 0) {
+			odp_packet_free(pkts[i]);
+			continue;
+		}
+		if ((size_t)got < iov[i].iov_len)
+			odp_packet_pull_tail(pkts[i], iov[i].iov_len - got);
+		got -= odp_packet_len(pkts[i]);
+		filled++;
+	}
+
+	*num = filled;
 	return 0;
 }
 
 int
-ofp_accept(int sockfd, struct ofp_sockaddr *addr, ofp_socklen_t *addrlen)
+ofp_sendfile(int fd, int s, ofp_off_t offset, size_t nbytes,
+	     struct ofp_sf_hdtr *hdtr, ofp_off_t *sbytes, int flags)
 {
-	struct ofp_sockaddr *sa = NULL;
-	struct socket *so, *head = ofp_get_sock_by_fd(sockfd);
-	if (!head) {
+	struct socket *so = ofp_get_sock_by_fd(s);
+	odp_packet_t pkts[SENDFILE_BURST];
+	struct thread td;
+	ofp_ssize_t sent = 0, hdtr_sent = 0;
+	size_t fsent = 0;
+	uint32_t chunk;
+	int i, num;
+
+	/* The disk I/O flags have no meaning without a kernel page cache */
+	(void)flags;
+
+	if (sbytes)
+		*sbytes = 0;
+
+	if (!so) {
 		ofp_errno = OFP_EBADF;
 		return -1;
 	}
 
-	if ((head->so_options & OFP_SO_ACCEPTCONN) == 0) {
+	if (so->so_type != OFP_SOCK_STREAM || offset < 0) {
 		ofp_errno = OFP_EINVAL;
 		return -1;
 	}
 
-	ACCEPT_LOCK();
-	if ((head->so_state & SS_NBIO) && OFP_TAILQ_EMPTY(&head->so_comp)) {
-		ACCEPT_UNLOCK();
-		ofp_errno = OFP_EWOULDBLOCK;
+	td.td_proc.p_fibnum = so->so_fibnum;
+	td.td_ucred = NULL;
+
+	/*
+	 * Read one TCP segment per packet, so that the segments sent end
+	 * at packet boundaries and reference the packets (see
+	 * ofp_sockbuf_ref_len()). Larger packets would be split first.
+	 */
+	chunk = global_param->pkt_pool.buffer_size;
+	if (sotoinpcb(so) && sototcpcb(so) &&
+	    sototcpcb(so)->t_maxseg < chunk)
+		chunk = sototcpcb(so)->t_maxseg;
+
+	if (hdtr && hdtr->headers) {
+		ofp_errno = sosend_iov(so, NULL, hdtr->headers,
+				       hdtr->hdr_cnt, 0, &td, &hdtr_sent);
+		sent += hdtr_sent;
+		if (ofp_errno)
+			goto out;
+	}
+
+	/*
+	 * The file is read directly into packets which are then queued to
+	 * the send buffer by reference, as in ofp_send_pkt(). Nbytes of 0
+	 * means up to the end of the file.
+	 */
+	while (!nbytes || fsent < nbytes) {
+		size_t len = nbytes ? nbytes - fsent : SIZE_MAX;
+
+		/*
+		 * A packet refused by a non-blocking send is lost, so only
+		 * read what fits in the send buffer right now.
+		 */
+		if (so->so_state & SS_NBIO) {
+			long space = sbspace(&so->so_snd);
+
+			if (space <= 0) {
+				ofp_errno = OFP_EWOULDBLOCK;
+				goto out;
+			}
+			if ((size_t)space < len)
+				len = space;
+		}
+
+		num = SENDFILE_BURST;
+		ofp_errno = sendfile_read(fd, offset + fsent, len, chunk,
+					  pkts, &num);
+		if (ofp_errno)
+			goto out;
+		if (num == 0)
+			break;
+
+		for (i = 0; i < num; i++) {
+			uint32_t plen = odp_packet_len(pkts[i]);
+
+			ofp_errno = ofp_sosend(so, NULL, NULL, pkts[i],
+					       ODP_PACKET_INVALID, 0, &td);
+			if (ofp_errno) {
+				while (++i < num)
+					odp_packet_free(pkts[i]);
+				goto out;
+			}
+			fsent += plen;
+		}
+	}
+
+	if (hdtr && hdtr->trailers) {
+		ofp_errno = sosend_iov(so, NULL, hdtr->trailers,
+				       hdtr->trl_cnt, 0, &td, &hdtr_sent);
+		sent += hdtr_sent;
+	}
+
+out:
+	sent += fsent;
+	if (sbytes)
+		*sbytes = sent;
+	return ofp_errno ? -1 : 0;
+}
+
+static inline uint64_t
+to_nsec(struct ofp_timeval *timeout)
+{
+	return (uint64_t)timeout->tv_sec * NS_PER_SEC +
+		(uint64_t)timeout->tv_usec * 1000;
+}
+
+int
+ofp_recvmmsg(int sockfd, struct ofp_mmsghdr *msgvec, unsigned int vlen,
+	     int flags, struct ofp_timeval *timeout)
+{
+	struct socket *so = ofp_get_sock_by_fd(sockfd);
+	odp_packet_t pkts[MMSG_BURST];
+	odp_time_t start = odp_time_local();
+	unsigned int received = 0;
+	int i, num;
+
+	if (!so) {
+		ofp_errno = OFP_EBADF;
+		return -1;
+	}
+
+	while (received < vlen) {
+		/* Like Linux, the timeout is only checked between datagrams */
+		if (received && timeout &&
+		    odp_time_to_ns(odp_time_diff(odp_time_local(), start)) >=
+		    to_nsec(timeout))
+			break;
+
+		if (!so_is_dgram(so)) {
+			ofp_ssize_t len = ofp_recvmsg(sockfd,
+						      &msgvec[received].msg_hdr,
+						      flags);
+			if (len < 0)
+				break;
+			msgvec[received++].msg_len = len;
+		} else {
+			num = vlen - received;
+			if (num > MMSG_BURST)
+				num = MMSG_BURST;
+
+			ofp_errno = ofp_soreceive_dgram_burst(so, pkts, &num,
+							      flags);
+			if (ofp_errno || num == 0)
+				break;
+
+			for (i = 0; i < num; i++, received++)
+				msgvec[received].msg_len =
+					dgram_to_msghdr(so, pkts[i],
+						&msgvec[received].msg_hdr);
+		}
+
+		if (flags & OFP_MSG_WAITFORONE)
+			flags |= OFP_MSG_DONTWAIT;
+	}
+
+	/* An error after some datagrams is left for the next call */
+	if (received) {
+		ofp_errno = 0;
+		return received;
+	}
+	return ofp_errno ? -1 : 0;
+}
+
+/* A connected UDP socket that can take the burst send path */
+static inline int
+so_is_udp_connected(struct socket *so)
+{
+	return so->so_proto->pr_protocol == OFP_IPPROTO_UDP &&
+		so->so_proto->pr_domain->dom_family == OFP_AF_INET &&
+		(so->so_state & SS_ISCONNECTED) &&
+		sotoudpcb(so)->u_segsize == 0;
+}
+
+int
+ofp_sendmmsg(int sockfd, struct ofp_mmsghdr *msgvec, unsigned int vlen,
+	     int flags)
+{
+	struct socket *so = ofp_get_sock_by_fd(sockfd);
+	odp_packet_t pkts[MMSG_BURST];
+	unsigned int sent = 0;
+	int i, num, done;
+
+	if (!so) {
+		ofp_errno = OFP_EBADF;
 		return -1;
 	}
 
-	while (OFP_TAILQ_EMPTY(&head->so_comp) && head->so_error == 0) {
-		if (head->so_rcv.sb_state & SBS_CANTRCVMORE) {
-			head->so_error = OFP_ECONNABORTED;
+	ofp_errno = 0;
+	while (sent < vlen) {
+		struct ofp_msghdr *msg = &msgvec[sent].msg_hdr;
+
+		if (!so_is_udp_connected(so) || msg->msg_name ||
+		    msg->msg_control) {
+			ofp_ssize_t len = ofp_sendmsg(sockfd, msg, flags);
+
+			if (len < 0)
+				break;
+			msgvec[sent++].msg_len = len;
+			continue;
+		}
+
+		/* Collect a burst of plain datagrams */
+		for (num = 0; num < MMSG_BURST && sent + num < vlen; num++) {
+			msg = &msgvec[sent + num].msg_hdr;
+			if (msg->msg_name || msg->msg_control)
+				break;
+			pkts[num] = msghdr_to_packet(msg);
+			if (pkts[num] == ODP_PACKET_INVALID) {
+				ofp_errno = OFP_ENOBUFS;
+				break;
+			}
+			msgvec[sent + num].msg_len = odp_packet_len(pkts[num]);
+		}
+		if (num == 0)
+			break;
+
+		ofp_errno = ofp_udp_send_burst(so, pkts, num, &done);
+		sent += done;
+		if (ofp_errno) {
+			for (i = done + 1; i < num; i++)
+				odp_packet_free(pkts[i]);
 			break;
 		}
-		if (ofp_msleep(&head->so_timeo, ofp_accept_mtx(), 0,
-				 "accept", 0)) {
-			ACCEPT_UNLOCK();
+	}
+
+	if (sent) {
+		ofp_errno = 0;
+		return sent;
+	}
+	return ofp_errno ? -1 : 0;
+}
+
+int
+ofp_recv_pkt(int sockfd, odp_packet_t *pkts, int max, int flags)
+{
+	return ofp_recvfrom_pkt(sockfd, pkts, max, flags, NULL, 0);
+}
+
+int
+ofp_recvfrom_pkt(int sockfd, odp_packet_t *pkts, int max, int flags,
+		 struct ofp_sockaddr *from, ofp_socklen_t fromlen)
+{
+	struct socket *so = ofp_get_sock_by_fd(sockfd);
+	struct ofp_sockaddr *sa;
+	ofp_socklen_t salen;
+	int i, n, num = max;
+
+	if (!so) {
+		ofp_errno = OFP_EBADF;
+		return -1;
+	}
+
+	if (!pkts || max < 0 ||
+	    (flags & (OFP_MSG_PEEK | OFP_MSG_WAITALL))) {
+		ofp_errno = OFP_EINVAL;
+		return -1;
+	}
+
+	if (so_is_dgram(so)) {
+		ofp_errno = ofp_soreceive_dgram_burst(so, pkts, &num, flags);
+		if (ofp_errno)
+			return -1;
+		/*
+		 * Trim the datagrams to their payload, copies of those
+		 * shared with other sockets
+		 */
+		for (i = 0, n = 0; i < num; i++) {
+			pkts[n] = ofp_sockbuf_unshare(pkts[i]);
+			if (pkts[n] == ODP_PACKET_INVALID)
+				continue;
+			sa = from ? (struct ofp_sockaddr *)
+				((uint8_t *)from + n * fromlen) : NULL;
+			salen = fromlen;
+			ofp_udp_packet_parse(pkts[n++], NULL, sa, &salen);
+		}
+		if (n == 0 && num) {
+			ofp_errno = OFP_ENOBUFS;
 			return -1;
 		}
+		return n;
 	}
 
-	if (head->so_error) {
-		ofp_errno = head->so_error;
-		head->so_error = 0;
-		ACCEPT_UNLOCK();
+	ofp_errno = ofp_soreceive_pkt(so, pkts, &num, flags);
+	if (ofp_errno && num == 0)
+		return -1;
+	ofp_errno = 0;
+	return num;
+}
+
+int
+ofp_listen(int sockfd, int backlog)
+{
+	struct thread   td;
+	struct socket  *so = ofp_get_sock_by_fd(sockfd);
+
+	if (!so) {
+		ofp_errno = OFP_EBADF;
 		return -1;
 	}
-	so = OFP_TAILQ_FIRST(&head->so_comp);
-	KASSERT(!(so->so_qstate & SQ_INCOMP), ("accept1: so SQ_INCOMP"));
-	KASSERT(so->so_qstate & SQ_COMP, ("accept1: so not SQ_COMP"));
 
-	/*
-	 * Before changing the flags on the socket, we have to bump the
-	 * reference count.  Otherwise, if the protocol calls ofp_sofree(),
-	 * the socket will be released due to a zero refcount.
-	 */
-	OFP_SOCK_LOCK(so);			/* soref() and so_state update */
-	soref(so);			/* file descriptor reference */
+	td.td_proc.p_fibnum = so->so_fibnum;
+	td.td_ucred = NULL;
+
+	ofp_errno = ofp_solisten(so, backlog, &td);
+	if (ofp_errno)
+		return -1;
+	return 0;
+}
+
+int
+ofp_accept(int sockfd, struct ofp_sockaddr *addr, ofp_socklen_t *addrlen)
+{
+	return _ofp_accept(sockfd, addr, addrlen, 0);
+}
+
+int
+_ofp_accept(int sockfd, struct ofp_sockaddr *addr, ofp_socklen_t *addrlen,
+	    int flags)
+{
+	struct ofp_sockaddr *sa = NULL;
+	struct socket *so, *head = ofp_get_sock_by_fd(sockfd);
+	if (!head) {
+		ofp_errno = OFP_EBADF;
+		return -1;
+	}
 
-	OFP_TAILQ_REMOVE(&head->so_comp, so, so_list);
-	head->so_qlen--;
-	so->so_state |= (head->so_state & SS_NBIO);
-	so->so_qstate &= ~SQ_COMP;
-	so->so_head = NULL;
+	if ((head->so_options & OFP_SO_ACCEPTCONN) == 0) {
+		ofp_errno = OFP_EINVAL;
+		return -1;
+	}
 
-	OFP_SOCK_UNLOCK(so);
-	ACCEPT_UNLOCK();
+	ofp_errno = ofp_solisten_dequeue(head, &so, flags);
+	if (ofp_errno)
+		return -1;
 
 	/* connection has been removed from the listen queue */
 	/*KNOTE_UNLOCKED(&head->so_rcv.sb_sel.si_note, 0);*/
@@ -328,44 +1022,91 @@ to_usec(struct ofp_timeval *timeout)
 	return timeout ? timeout->tv_sec * US_PER_SEC + timeout->tv_usec : 0;
 }
 
-static int
-set_ready_fd(int fd, ofp_fd_set *fd_set, int(*is_ready)(int fd))
+static inline int
+is_blocking(struct ofp_timeval *timeout)
 {
-	if (OFP_FD_ISSET(fd, fd_set) && is_ready(fd))
-		return 1;
+	return (timeout == NULL || to_usec(timeout) > 0);
+}
 
-	OFP_FD_CLR(fd, fd_set);
-	return 0;
+#define FD_WORD_BITS 64
+
+static inline int
+to_word_index(int fd)
+{
+	return (fd - OFP_SOCK_NUM_OFFSET) / FD_WORD_BITS;
 }
 
-static int
-set_ready_fds(int nfds, ofp_fd_set *fd_set, int (*is_ready)(int fd))
+static inline uint64_t
+to_bit(int fd)
 {
-	int fd;
-	int ready = 0;
+	return 1ULL << ((fd - OFP_SOCK_NUM_OFFSET) % FD_WORD_BITS);
+}
 
-	for (fd = OFP_SOCK_NUM_OFFSET; fd < nfds && fd_set; ++fd)
-		ready += set_ready_fd(fd, fd_set, is_ready);
+/*
+ * Ask ofp_sowakeup() to stamp this socket with a readiness generation.
+ * The next readiness change clears the flag again.
+ */
+static void
+select_register(int nfds, ofp_fd_set *set, int rcv)
+{
+	int words = to_word_index(nfds - 1) + 1;
+	int w;
 
-	return ready;
+	for (w = 0; w < words; w++) {
+		uint64_t bits = set->fd_set_buf[w];
+
+		while (bits) {
+			int fd = OFP_SOCK_NUM_OFFSET + w * FD_WORD_BITS +
+				__builtin_ctzll(bits);
+			struct socket *so;
+			struct sockbuf *sb;
+
+			bits &= bits - 1;
+			if (fd >= nfds)
+				break;
+			so = ofp_get_sock_by_fd(fd);
+			sb = rcv ? &so->so_rcv : &so->so_snd;
+			if (!(sb->sb_flags & SB_SEL)) {
+				SOCKBUF_LOCK(sb);
+				sb->sb_flags |= SB_SEL;
+				SOCKBUF_UNLOCK(sb);
+			}
+		}
+	}
 }
 
+/*
+ * Add the ready fds of 'in' to 'out' and return how many were added.
+ * Only sockets whose readiness generation is at least 'since' are
+ * checked.
+ */
 static int
-none_of_ready(int nfds, ofp_fd_set *fd_set, int (*is_ready)(int fd))
+select_scan(int nfds, ofp_fd_set *in, ofp_fd_set *out,
+	    int (*is_ready)(int fd), uint64_t since)
 {
-	int fd;
+	int words = to_word_index(nfds - 1) + 1;
+	int ready = 0;
+	int w;
 
-	for (fd = OFP_SOCK_NUM_OFFSET; fd < nfds && fd_set; ++fd)
-		if (OFP_FD_ISSET(fd, fd_set) && is_ready(fd))
-			return 0;
+	for (w = 0; w < words; w++) {
+		uint64_t bits = in->fd_set_buf[w] & ~out->fd_set_buf[w];
 
-	return 1;
-}
+		while (bits) {
+			int bit = __builtin_ctzll(bits);
+			int fd = OFP_SOCK_NUM_OFFSET + w * FD_WORD_BITS + bit;
 
-static inline int
-is_blocking(struct ofp_timeval *timeout)
-{
-	return (timeout == NULL || to_usec(timeout) > 0);
+			bits &= bits - 1;
+			if (fd >= nfds)
+				break;
+			if (ofp_get_sock_by_fd(fd)->so_rgen < since ||
+			    !is_ready(fd))
+				continue;
+			out->fd_set_buf[w] |= 1ULL << bit;
+			ready++;
+		}
+	}
+
+	return ready;
 }
 
 int
@@ -374,45 +1115,81 @@ _ofp_select(int nfds, ofp_fd_set *readfds, ofp_fd_set *writefds,
 	    int (*sleeper)(void *channel, odp_rwlock_t *mtx, int priority,
 			   const char *wmesg, uint32_t timeout))
 {
-	(void)writefds;
-	(void)exceptfds;
+	ofp_fd_set *in[3] = { readfds, writefds, exceptfds };
+	int (*is_ready[3])(int fd) = { is_readable, is_writable,
+				       is_exceptional };
+	ofp_fd_set want[3], ready_set[3];
+	uint64_t gen, since;
+	int ready = 0;
+	int i;
 
-	if (is_blocking(timeout) && none_of_ready(nfds, readfds, is_readable))
-		sleeper(NULL, NULL, 0, "select", to_usec(timeout));
+	if (nfds > OFP_SOCK_NUM_OFFSET + global_param->socket_max)
+		nfds = OFP_SOCK_NUM_OFFSET + global_param->socket_max;
+	if (nfds > OFP_SOCK_NUM_OFFSET + OFP_FD_SETSIZE)
+		nfds = OFP_SOCK_NUM_OFFSET + OFP_FD_SETSIZE;
 
-	return set_ready_fds(nfds, readfds, is_readable);
-}
+	for (i = 0; i < 3; i++) {
+		OFP_FD_ZERO(&ready_set[i]);
+		if (in[i] && nfds > OFP_SOCK_NUM_OFFSET)
+			want[i] = *in[i];
+		else
+			OFP_FD_ZERO(&want[i]);
+	}
 
-static inline int
-to_bit_index(int fd)
-{
-	return ((fd - OFP_SOCK_NUM_OFFSET) / 8);
-}
+	/* Register before taking the generation, and take it before the
+	 * scan, so that no change between the scan and the sleep goes
+	 * unnoticed. */
+	if (is_blocking(timeout)) {
+		for (i = 0; i < 3; i++)
+			select_register(nfds, &want[i], i != 1);
+		odp_mb_full();
+	}
+	gen = ofp_so_readiness_gen();
+	for (i = 0; i < 3; i++)
+		ready += select_scan(nfds, &want[i], &ready_set[i],
+				     is_ready[i], 0);
+
+	if (!ready && is_blocking(timeout)) {
+		odp_rwlock_t *mtx = ofp_so_readiness_mtx();
+
+		odp_rwlock_write_lock(mtx);
+		if (ofp_so_readiness_gen() == gen)
+			sleeper(NULL, mtx, 0, "select", to_usec(timeout));
+		odp_rwlock_write_unlock(mtx);
+
+		/* Re-check only the sockets that changed meanwhile. If
+		 * nothing was signalled, e.g. on timeout, check them all. */
+		since = ofp_so_readiness_gen() == gen ? 0 : gen + 1;
+		for (i = 0; i < 3; i++)
+			ready += select_scan(nfds, &want[i], &ready_set[i],
+					     is_ready[i], since);
+	}
 
-static inline uint8_t
-to_bit(int fd)
-{
-	return (1 << (fd - OFP_SOCK_NUM_OFFSET) % 8);
+	for (i = 0; i < 3; i++)
+		if (in[i])
+			*in[i] = ready_set[i];
+
+	return ready;
 }
 
 void
 OFP_FD_CLR(int fd, ofp_fd_set *set)
 {
 	if (set)
-		set->fd_set_buf[to_bit_index(fd)] &= ~to_bit(fd);
+		set->fd_set_buf[to_word_index(fd)] &= ~to_bit(fd);
 }
 
 int
 OFP_FD_ISSET(int fd, ofp_fd_set *set)
 {
-	return set ? set->fd_set_buf[to_bit_index(fd)] & to_bit(fd) : 0;
+	return set ? (set->fd_set_buf[to_word_index(fd)] & to_bit(fd)) != 0 : 0;
 }
 
 void
 OFP_FD_SET(int fd, ofp_fd_set *set)
 {
 	if (set)
-		set->fd_set_buf[to_bit_index(fd)] |= to_bit(fd);
+		set->fd_set_buf[to_word_index(fd)] |= to_bit(fd);
 }
 
 void
@@ -503,14 +1280,19 @@ int ofp_socket_sigevent(struct ofp_sigevent *ev)
 		return 0;
 	case OFP_SIGEV_HOOK:
 		break;
+	case OFP_SIGEV_BATCH:
+		if (!ev->ofp_sigev_notify_function &&
+		    ev->ofp_sigev_queue == ODP_QUEUE_INVALID) {
+			ofp_errno = OFP_EINVAL;
+			return -1;
+		}
+		break;
 	default:
 		ofp_errno = OFP_EINVAL;
 		return -1;
 	};
 
 	so->so_sigevent = *ev;
-	so->so_rcv.sb_socket = so;
-	so->so_snd.sb_socket = so;
 
 	return 0;
 }
@@ -73,6 +73,7 @@
 #include "ofpi_tcp_seq.h"
 #include "ofpi_tcp_timer.h"
 #include "ofpi_tcp_var.h"
+#include "ofpi_shard.h"
 #include "ofpi_tcp_shm.h"
 #include "ofpi_tcp6_var.h"
 #include "ofpi_tcp.h"
@@ -579,6 +580,9 @@ ofp_tcp_input(odp_packet_t *m, int off0)
 	struct ofp_tcphdr tcp_savetcp;
 	short ostate = 0;
 #endif
+	if (OFP_SHARDED() && ofp_shard_redirect(*m, off0))
+		return OFP_PKT_PROCESSED;
+
 	/* HJo: remove vlan hdr */
 	l2off = odp_packet_l2_offset(*m);
 	l3off = odp_packet_l3_offset(*m);
@@ -3665,9 +3669,23 @@ tcp_newreno_partial_ack(struct tcpcb *tp, struct ofp_tcphdr *th)
 	tp->snd_cwnd += tp->t_maxseg;
 }
 
+static uint64_t ofp_tcp_var_shared_memory_size(void)
+{
+	uint64_t pcb_buckets = global_param->hash_size.tcp_pcb;
+	uint64_t syncache_buckets = global_param->hash_size.tcp_syncache;
+
+	return sizeof(*shm_tcp) +
+		syncache_buckets * sizeof(struct syncache_head) +
+		pcb_buckets * (sizeof(struct inpcbhead) +
+			       sizeof(struct inpcbporthead)) +
+		ODP_CACHE_LINE_SIZE +
+		OFP_TCP_CONN_BUCKETS * sizeof(struct inpcbconn_bucket);
+}
+
 static int ofp_tcp_var_alloc_shared_memory(void)
 {
-	shm_tcp = ofp_shared_memory_alloc(SHM_NAME_TCP_VAR, sizeof(*shm_tcp));
+	shm_tcp = ofp_shared_memory_alloc(SHM_NAME_TCP_VAR,
+					  ofp_tcp_var_shared_memory_size());
 	if (shm_tcp == NULL) {
 		OFP_ERR("ofp_shared_memory_alloc failed");
 		return -1;
@@ -3702,13 +3720,28 @@ int ofp_tcp_var_lookup_shared_memory(void)
 
 void ofp_tcp_var_init_prepare(void)
 {
-	ofp_shared_memory_prealloc(SHM_NAME_TCP_VAR, sizeof(*shm_tcp));
+	ofp_shared_memory_prealloc(SHM_NAME_TCP_VAR,
+				   ofp_tcp_var_shared_memory_size());
 }
 
 int ofp_tcp_var_init_global(void)
 {
 	HANDLE_ERROR(ofp_tcp_var_alloc_shared_memory());
 
+	shm_tcp->syncache = (struct syncache_head *)(shm_tcp + 1);
+	shm_tcp->ofp_hashtbl = (struct inpcbhead *)
+		&shm_tcp->syncache[global_param->hash_size.tcp_syncache];
+	shm_tcp->ofp_porthashtbl = (struct inpcbporthead *)
+		&shm_tcp->ofp_hashtbl[global_param->hash_size.tcp_pcb];
+#ifndef OFP_RSS
+	ofp_in_pcbconntbl_init(&shm_tcp->ofp_conntbl,
+		(struct inpcbconn_bucket *)
+		(((uintptr_t)&shm_tcp->ofp_porthashtbl[
+			  global_param->hash_size.tcp_pcb] +
+		  ODP_CACHE_LINE_SIZE - 1) & ~(uintptr_t)(ODP_CACHE_LINE_SIZE - 1)),
+		OFP_TCP_CONN_BUCKETS);
+#endif
+
 	return 0;
 }
 
@@ -106,6 +106,20 @@ OFP_SYSCTL_INT(_net_inet_tcp, OFP_OID_AUTO, sendbuf_max, OFP_CTLFLAG_RW,
 	   &ofp_tcp_autosndbuf_max, 0,
 	   "Max size of automatic send buffer");
 
+VNET_DEFINE(int, ofp_tcp_do_autocork) = 1;
+#define	V_tcp_do_autocork	VNET(ofp_tcp_do_autocork)
+OFP_SYSCTL_INT(_net_inet_tcp, OFP_OID_AUTO, autocork, OFP_CTLFLAG_RW,
+	   &ofp_tcp_do_autocork, 0,
+	   "Hold small segments while the previous one waits for output");
+
+/*
+ * Connections holding back a segment for autocork. The output flush of
+ * the thread, ofp_send_pending_pkt(), runs them again.
+ */
+#define TCP_CORKED_MAX 64
+static __thread struct inpcb *tcp_corked[TCP_CORKED_MAX];
+static __thread int tcp_corked_num;
+
 /*
 static inline void	hhook_run_tcp_est_out(struct tcpcb *tp,
 			    struct ofp_tcphdr *th, struct tcpopt *to,
@@ -150,6 +164,62 @@ cc_after_idle(struct tcpcb *tp)
 #endif
 }
 
+/*
+ * Autocork: with Nagle off, a small segment still waits while the
+ * previous one of the connection sits unsent in the output tables of
+ * this thread, so that writes made meanwhile go out together. The
+ * connection is queued to run again once the tables are flushed. With
+ * a pkt_tx_burst_size of 1 every segment goes out at once and nothing
+ * is held.
+ */
+static int
+tcp_autocork(struct tcpcb *tp)
+{
+	if (!V_tcp_do_autocork || tp->t_txthr != odp_thread_id() ||
+	    !ofp_send_pkt_out_pending(tp->t_txmark))
+		return 0;
+	if (tp->t_flags & TF_CORKED)
+		return 1;
+	if (tcp_corked_num == TCP_CORKED_MAX)
+		return 0;
+
+	t_flags_or(tp->t_flags, TF_CORKED);
+	ofp_in_pcbref(tp->t_inpcb);
+	tcp_corked[tcp_corked_num++] = tp->t_inpcb;
+	return 1;
+}
+
+/*
+ * Run the connections corked by this thread. Called with no inpcb
+ * locked after the output tables have been flushed. Returns the number
+ * of connections run.
+ */
+int
+ofp_tcp_output_corked(void)
+{
+	struct inpcb *corked[TCP_CORKED_MAX];
+	struct inpcb *inp;
+	struct tcpcb *tp;
+	int i, num = tcp_corked_num;
+
+	memcpy(corked, tcp_corked, num * sizeof(corked[0]));
+	tcp_corked_num = 0;
+
+	for (i = 0; i < num; i++) {
+		inp = corked[i];
+		INP_WLOCK(inp);
+		tp = intotcpcb(inp);
+		if (!(inp->inp_flags & (INP_TIMEWAIT | INP_DROPPED)) && tp) {
+			t_flags_and(tp->t_flags, ~TF_CORKED);
+			ofp_tcp_output(tp);
+		}
+		if (!ofp_in_pcbrele_wlocked(inp))
+			INP_WUNLOCK(inp);
+	}
+
+	return num;
+}
+
 /*
  * Tcp output routine: figure out what should be sent and send it.
  */
@@ -158,6 +228,7 @@ ofp_tcp_output(struct tcpcb *tp)
 {
 	struct socket *so = tp->t_inpcb->inp_socket;
 	long len, recwin, sendwin;
+	uint64_t txmark;
 	int off, flags, error = 0;	/* Keep compiler happy */
 	odp_packet_t m;
 	struct ofp_ip *ip = NULL;
@@ -447,19 +518,18 @@ after_sack_rexmit:
 	 * with congestion window.  Requires another timer.  Has to
 	 * wait for upcoming tcp timer rewrite.
 	 */
-#if 0 /* HJo: FIX */
 	if (V_tcp_do_autosndbuf && so->so_snd.sb_flags & SB_AUTOSIZE) {
 		if ((tp->snd_wnd / 4 * 5) >= so->so_snd.sb_hiwat &&
 		    so->so_snd.sb_cc >= (so->so_snd.sb_hiwat / 8 * 7) &&
-		    so->so_snd.sb_cc < V_tcp_autosndbuf_max &&
-		    sendwin >= (so->so_snd.sb_cc - (tp->snd_nxt - tp->snd_una))) {
+		    so->so_snd.sb_cc < (uint32_t)V_tcp_autosndbuf_max &&
+		    sendwin >= (long)(so->so_snd.sb_cc -
+				      (tp->snd_nxt - tp->snd_una))) {
 			if (!ofp_sbreserve_locked(&so->so_snd,
 			    min(so->so_snd.sb_hiwat + V_tcp_autosndbuf_inc,
-			     V_tcp_autosndbuf_max), so, curthread))
+			     V_tcp_autosndbuf_max), so, NULL))
 				so->so_snd.sb_flags &= ~SB_AUTOSIZE;
 		}
 	}
-#endif
 	/*
 	 * Decide if we can use TCP Segmentation Offloading (if supported by
 	 * hardware).
@@ -511,7 +581,8 @@ after_sack_rexmit:
 		 * note: the len + off check is almost certainly unnecessary.
 		 */
 		if (!(tp->t_flags & TF_MORETOCOME) &&	/* normal case */
-		    (idle || (tp->t_flags & TF_NODELAY)) &&
+		    (idle || ((tp->t_flags & TF_NODELAY) &&
+			      !tcp_autocork(tp))) &&
 		    len + off >= so->so_snd.sb_cc &&
 		    (tp->t_flags & TF_NOPUSH) == 0) {
 			goto send;
@@ -768,6 +839,20 @@ send:
 	} else
 		tso = 0;
 
+	/*
+	 * End the segment where the queued packet holding its first byte
+	 * ends, so that it references the data instead of copying it.
+	 */
+	if (len && !tso) {
+		long reflen = ofp_sockbuf_ref_len(&so->so_snd, off, len);
+
+		if (reflen < len) {
+			len = reflen;
+			flags &= ~OFP_TH_FIN;
+			sendalot = 1;
+		}
+	}
+
 	KASSERT(len + hdrlen + ipoptlen <= OFP_IP_MAXPACKET,
 	    ("%s: len > OFP_IP_MAXPACKET", __func__));
 
@@ -806,12 +891,22 @@ send:
 			TCPSTAT_ADD(tcps_sndbyte, len);
 		}
 
-		m = ofp_socket_packet_alloc(hdrlen + len);
-
+		/*
+		 * Prefer referencing the queued data over copying it,
+		 * the sockbuf keeps its own handle for retransmits.
+		 */
+		m = ofp_sockbuf_ref_out(&so->so_snd, off, len, hdrlen);
 		if (m == ODP_PACKET_INVALID) {
-			SOCKBUF_UNLOCK(&so->so_snd);
-			error = OFP_ENOBUFS;
-			goto out;
+			m = ofp_socket_packet_alloc(hdrlen + len);
+
+			if (m == ODP_PACKET_INVALID) {
+				SOCKBUF_UNLOCK(&so->so_snd);
+				error = OFP_ENOBUFS;
+				goto out;
+			}
+			ofp_sockbuf_copy_out(&so->so_snd, off, len,
+					     (char *)odp_packet_data(m) +
+					     hdrlen);
 		}
 
 #if 0
@@ -833,8 +928,6 @@ send:
 #endif /*INET6*/
 			sizeof(struct ofp_ip));
 
-		ofp_sockbuf_copy_out(&so->so_snd, off, len,
-				       (char *)odp_packet_data(m) + hdrlen);
 		/*
 		odp_packet_t src = so->so_snd.sb_mb[so->so_snd.sb_get];
 		memcpy((uint8_t *)odp_packet_data(m) + hdrlen,
@@ -1185,6 +1278,7 @@ timer:
 	}
 #endif /* TCPDEBUG */
 	SOCKBUF_UNLOCK(&so->so_snd);
+	txmark = ofp_send_pkt_out_mark();
 
 	/*
 	 * Fill in IP length and desired time to live and
@@ -1321,6 +1415,13 @@ out:
 	}
 	TCPSTAT_INC(tcps_sndtotal);
 
+	/* Remember where the segment waits for output, for autocork */
+	if (ofp_send_pkt_out_mark() != txmark) {
+		tp->t_txmark = ofp_send_pkt_out_mark();
+		tp->t_txthr = odp_thread_id();
+	} else
+		tp->t_txmark = 0;
+
 	/*
 	 * Data sent (as far as we can tell).
 	 * If this advertises a larger window than any other segment,
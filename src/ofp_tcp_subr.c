@@ -269,7 +269,7 @@ ofp_tcp_init(void)
 	    &V_tcp_hhh[HHOOK_TCP_EST_OUT], HHOOK_NOWAIT|HHOOK_HEADISINVNET) != 0)
 		OFP_WARN("unable to register helper hook");
 #endif
-	hashsize = TCBHASHSIZE;
+	hashsize = global_param->hash_size.tcp_pcb;
 #if 0 /* We trust size is power of 2. */
 	TUNABLE_INT_FETCH("net.inet.tcp.tcbhashsize", &hashsize);
 	if (!powerof2(hashsize)) {
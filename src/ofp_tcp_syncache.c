@@ -198,7 +198,7 @@ ofp_syncache_init(void)
 	int i;
 
 	V_tcp_syncache.cache_count = 0;
-	V_tcp_syncache.hashsize = TCP_SYNCACHE_HASHSIZE;
+	V_tcp_syncache.hashsize = global_param->hash_size.tcp_syncache;
 	V_tcp_syncache.bucket_limit = TCP_SYNCACHE_BUCKETLIMIT;
 	V_tcp_syncache.rexmt_limit = SYNCACHE_MAXREXMTS;
 	V_tcp_syncache.hash_secret = 11235 /*arc4random()*/;
@@ -110,7 +110,9 @@ int	ofp_tcp_maxpersistidle;
 #if (defined OFP_RSS) || (defined OFP_TCP_MULTICORE_TIMERS)
 #define	INP_CPU(inp) odp_cpu_id()
 #else
-#define	INP_CPU(inp) -1
+/* Timers of a sharded connection run on its shard. */
+#define	INP_CPU(inp) (((inp)->inp_flags2 & INP_SHARDED) ? \
+		      (int)(inp)->inp_flowid : -1)
 #endif
 
 /*
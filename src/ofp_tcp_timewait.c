@@ -174,6 +174,9 @@ ofp_tcp_twstart(struct tcpcb *tp)
 	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);	/* tcp_tw_2msl_reset(). */
 	INP_WLOCK_ASSERT(inp);
 
+	/* ofp_tcp_tw_2msl_scan() runs on any thread. */
+	ofp_in_pcbshard_lock(inp);
+
 	if (V_nolocaltimewait) {
 		int error = 0;
 #ifdef INET6
@@ -54,6 +54,7 @@
 #include "ofpi_in_pcb.h"
 #include "ofpi_tcp.h"
 #include "ofpi_tcp_var.h"
+#include "ofpi_shard.h"
 #include "ofpi_tcp_shm.h"
 #include "ofpi_socketvar.h"
 #include "ofpi_ip_var.h"
@@ -440,7 +441,7 @@ out:
 static int
 tcp_usr_connect(struct socket *so, struct ofp_sockaddr *nam, struct thread *td)
 {
-	int error = 0;
+	int error = 0, shard = 0;
 	struct inpcb *inp;
 	struct tcpcb *tp = NULL;
 	struct ofp_sockaddr_in *sinp;
@@ -466,6 +467,15 @@ tcp_usr_connect(struct socket *so, struct ofp_sockaddr *nam, struct thread *td)
 		error = OFP_EINVAL;
 		goto out;
 	}
+	/*
+	 * A shard keeps the connections it opens if it can still choose
+	 * the local port; ofp_in_pcbconnect_setup() picks one that hashes
+	 * back to the shard.
+	 */
+	if (OFP_SHARDED() && ofp_shard_self() >= 0 && inp->inp_lport == 0) {
+		ofp_in_pcbshard(inp);
+		shard = 1;
+	}
 	tp = intotcpcb(inp);
 	TCPDEBUG1();
 	if ((error = tcp_connect(tp, nam, td)) != 0)
@@ -475,7 +485,12 @@ tcp_usr_connect(struct socket *so, struct ofp_sockaddr *nam, struct thread *td)
 	error = OFP_EINPROGRESS;
 out:
 	TCPDEBUG2(OFP_PRU_CONNECT);
+	if (shard && error != OFP_EINPROGRESS)
+		inp->inp_flags2 &= ~INP_SHARDED;
 	INP_WUNLOCK(inp);
+	/* Only a connect that got under way goes without locks. */
+	if (shard && error == OFP_EINPROGRESS)
+		ofp_in_pcbshard_nolock(inp);
 	return (error);
 }
 #endif /* INET */
@@ -648,8 +663,11 @@ out:
 	TCPDEBUG2(OFP_PRU_ACCEPT);
 	INP_WUNLOCK(inp);
 	INP_INFO_RUNLOCK(&V_tcbinfo);
-	if (error == 0)
+	if (error == 0) {
 		*nam = ofp_in_sockaddr(port, &addr);
+		/* Unlocked if the owning shard is the one accepting it */
+		ofp_in_pcbshard_nolock(inp);
+	}
 	return error;
 }
 #endif /* INET */
@@ -707,6 +725,13 @@ out:
 			*nam = ofp_in6_v4mapsin6_sockaddr(port, &addr);
 		else
 			*nam = ofp_in6_sockaddr(port, &addr6);
+		/*
+		 * Unlocked if the owning shard is the one accepting it.
+		 * ICMPv6 errors are not passed to the shard, so IPv6
+		 * connections keep their locks.
+		 */
+		if (v4)
+			ofp_in_pcbshard_nolock(inp);
 	}
 	return error;
 }
@@ -830,6 +855,8 @@ tcp_usr_send(struct socket *so, int flags, odp_packet_t m,
 		}
 		odp_packet_free(control);	/* empty control, just free it */
 	}
+	/* Queue stream data in packets that segments can reference */
+	so->so_snd.sb_segsize = tp->t_maxseg;
 	if (!(flags & PRUS_OOB)) {
 		ofp_sbappendstream(&so->so_snd, m);
 		if (nam && tp->t_state < TCPS_SYN_SENT) {
@@ -1624,30 +1651,52 @@ ofp_tcp_ctloutput(struct socket *so, struct sockopt *sopt)
 	return (error);
 #else
 	int error, optval;
+	uint32_t flag;
 	struct inpcb *inp = sotoinpcb(so);
+	struct tcpcb *tp;
 
 	if (sopt->sopt_level != OFP_IPPROTO_TCP)
 		return 0;
 
+	switch (sopt->sopt_name) {
+	case OFP_TCP_NODELAY:
+		flag = TF_NODELAY;
+		break;
+	case OFP_TCP_CORK:
+	case OFP_TCP_NOPUSH:
+		flag = TF_NOPUSH;
+		break;
+	default:
+		return 0;
+	}
+
 	switch (sopt->sopt_dir) {
 	case SOPT_SET:
-		switch (sopt->sopt_name) {
-		case OFP_TCP_CORK:
-			error = ofp_sooptcopyin(sopt, &optval, sizeof(optval), sizeof(optval));
-			if (error) return error;
-
-			if (!optval) {
-				INP_WLOCK(inp);
-				struct tcpcb *tp = intotcpcb(inp);
-				if (TCPS_HAVEESTABLISHED(tp->t_state)) {
-					t_flags_or(tp->t_flags, TF_FORCEDATA);
-					ofp_tcp_output(tp);
-					t_flags_and(tp->t_flags, ~TF_FORCEDATA);
-				}
-				INP_WUNLOCK(inp);
+		error = ofp_sooptcopyin(sopt, &optval, sizeof(optval), sizeof(optval));
+		if (error) return error;
+
+		INP_WLOCK(inp);
+		tp = intotcpcb(inp);
+		if (optval)
+			t_flags_or(tp->t_flags, flag);
+		else {
+			t_flags_and(tp->t_flags, ~flag);
+			/* Uncorking pushes out what was held back */
+			if (flag == TF_NOPUSH &&
+			    TCPS_HAVEESTABLISHED(tp->t_state)) {
+				t_flags_or(tp->t_flags, TF_FORCEDATA);
+				ofp_tcp_output(tp);
+				t_flags_and(tp->t_flags, ~TF_FORCEDATA);
 			}
 		}
+		INP_WUNLOCK(inp);
 		break;
+	case SOPT_GET:
+		INP_WLOCK(inp);
+		tp = intotcpcb(inp);
+		optval = (tp->t_flags & flag) != 0;
+		INP_WUNLOCK(inp);
+		return ofp_sooptcopyout(sopt, &optval, sizeof(optval));
 	default:
 		break;
 	}
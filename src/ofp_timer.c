@@ -15,6 +15,7 @@
 
 
 #include "ofpi_timer.h"
+#include "ofpi_shard.h"
 
 #define SHM_NAME_TIMER "OfpTimerShMem"
 
@@ -144,9 +145,17 @@ static int ofp_timer_create_queues(odp_schedule_group_t sched_group)
 		char queue_name_cpu[32];
 		odp_queue_param_init(&param);
 
-		param.type = ODP_QUEUE_TYPE_PLAIN;
-		param.enq_mode = ODP_QUEUE_OP_MT_UNSAFE;
-		param.deq_mode = ODP_QUEUE_OP_MT_UNSAFE;
+		if ((int)cpu_id < global_param->shards) {
+			/* Scheduled to the owner of the shard only */
+			param.type = ODP_QUEUE_TYPE_SCHED;
+			param.sched.prio  = ODP_SCHED_PRIO_DEFAULT;
+			param.sched.sync  = ODP_SCHED_SYNC_PARALLEL;
+			param.sched.group = ofp_shard_group(cpu_id);
+		} else {
+			param.type = ODP_QUEUE_TYPE_PLAIN;
+			param.enq_mode = ODP_QUEUE_OP_MT_UNSAFE;
+			param.deq_mode = ODP_QUEUE_OP_MT_UNSAFE;
+		}
 
 		sprintf(queue_name_cpu,"TimerQueue_cpu_%u", cpu_id);
 
@@ -368,7 +377,8 @@ odp_timer_t ofp_timer_start_cpu_id(uint64_t tmo_us, ofp_timer_callback callback,
 	}
 
 #if !((defined OFP_RSS) || (defined OFP_TCP_MULTICORE_TIMERS))
-	cpu_id = -1;
+	if (!OFP_SHARDED())
+		cpu_id = -1;
 #endif
 
 	bufdata = (struct ofp_timer_internal *)odp_buffer_addr(buf);
@@ -551,7 +561,8 @@ odp_timer_pool_t ofp_timer(int timer_num)
 odp_queue_t ofp_timer_queue_cpu(int cpu_id)
 {
 #if !((defined OFP_RSS) || (defined OFP_TCP_MULTICORE_TIMERS))
-	cpu_id = -1;
+	if (!OFP_SHARDED())
+		cpu_id = -1;
 #endif
 
 	if (!shm || cpu_id > OFP_MAX_NUM_CPU)
@@ -899,12 +899,12 @@ udp6_attach(struct socket *so, int proto, struct thread *td)
 	inp = sotoinpcb(so);
 	KASSERT(inp == NULL, ("udp6_attach: inp != NULL"));
 
-	/* Constant space reserved. ??
 	if (so->so_snd.sb_hiwat == 0 || so->so_rcv.sb_hiwat == 0) {
-		error = soreserve(so, udp_sendspace, udp_recvspace);
+		error = ofp_soreserve(so, ofp_udp_sendspace,
+				      ofp_udp_recvspace);
 		if (error)
 			return (error);
-	}*/
+	}
 
 	INP_INFO_WLOCK(&ofp_udbinfo);
 
@@ -69,6 +69,7 @@
 #include "ofpi_vxlan.h"
 
 #include "ofpi_pkt_processing.h"
+#include "ofpi_route.h"
 #include "ofpi_log.h"
 #include "ofpi_debug.h"
 #include "ofpi_hook.h"
@@ -78,10 +79,6 @@ extern odp_pool_t ofp_packet_pool;
 
 #define UDPSTAT_INC(x)
 
-#ifndef UDBHASHSIZE
-#define	UDBHASHSIZE	128
-#endif
-
 #define	CSUM_DATA_VALID		0x0400		/* csum_data field is valid */
 #define	CSUM_PSEUDO_HDR		0x0800		/* csum_data has pseudo hdr */
 
@@ -101,6 +98,27 @@ struct inpcbhead ofp_udb;		/* from udp_var.h */
 struct inpcbinfo ofp_udbinfo;
 struct ofp_udpstat ofp_udpstat;		/* from udp_var.h */
 
+/*
+ * Multicast receivers are indexed by (group, local port), so that a
+ * datagram to a group only visits the sockets that are members of it.
+ * An inpcb has one entry per group once it has a local port. The index
+ * is written under the pcbinfo write lock and read under its read lock.
+ */
+struct udp_mcast {
+	OFP_LIST_ENTRY(udp_mcast) um_hash;
+	struct inpcb		*um_inp;
+	struct ofp_in_addr	 um_group;
+	uint16_t		 um_lport;
+};
+
+OFP_LIST_HEAD(udp_mcast_head, udp_mcast);
+
+static struct udp_mcast_head	*udp_mcast_hashbase;
+static uint64_t			 udp_mcast_hashmask;
+
+#define UDP_MCAST_HASH(group, lport) \
+	INP_PCBHASH((group).s_addr, (lport), 0, udp_mcast_hashmask)
+
 static void	udp_detach(struct socket *so);
 static int	udp_output(struct inpcb *, odp_packet_t , struct ofp_sockaddr *,
 		    odp_packet_t , struct thread *);
@@ -140,8 +158,166 @@ ofp_udp_init(void)
 {
 	INP_INFO_LOCK_INIT(&ofp_udbinfo, 0);
 
-	ofp_in_pcbinfo_init(&ofp_udbinfo, "udp", &ofp_udb, UDBHASHSIZE, UDBHASHSIZE,
+	ofp_in_pcbinfo_init(&ofp_udbinfo, "udp", &ofp_udb,
+			global_param->hash_size.udp_pcb,
+			global_param->hash_size.udp_pcb,
 			"udp_inpcb", udp_inpcb_init, NULL, 0);
+
+	udp_mcast_hashbase = ofp_hashinit(global_param->hash_size.udp_pcb, 0,
+					  &udp_mcast_hashmask);
+}
+
+static void
+udp_mcast_remove(struct udpcb *up)
+{
+	int i;
+
+	for (i = 0; i < up->u_nmcast; i++)
+		OFP_LIST_REMOVE(&up->u_mcast[i], um_hash);
+	free(up->u_mcast);
+	up->u_mcast = NULL;
+	up->u_nmcast = 0;
+}
+
+/*
+ * Re-index the multicast memberships of an inpcb under its local port.
+ * Called without the inpcb lock after either of them may have changed.
+ */
+static void
+udp_mcast_update(struct inpcb *inp)
+{
+	struct ofp_ip_moptions *imo;
+	struct udp_mcast *um = NULL;
+	struct udpcb *up;
+	int i, j, n = 0;
+
+	INP_INFO_WLOCK(&ofp_udbinfo);
+	INP_WLOCK(inp);
+
+	up = intoudpcb(inp);
+	imo = inp->inp_moptions;
+	if (up == NULL || (up->u_mcast == NULL &&
+	    (imo == NULL || imo->imo_num_memberships == 0)))
+		goto out;
+
+	if (inp->inp_lport != 0 && imo != NULL &&
+	    imo->imo_num_memberships > 0) {
+		um = malloc(imo->imo_num_memberships * sizeof(*um));
+		if (um == NULL)
+			OFP_ERR("Multicast index entries not allocated");
+	}
+
+	/* A group joined on several interfaces is indexed once */
+	for (i = 0; um != NULL && i < imo->imo_num_memberships; i++) {
+		struct ofp_in_multi *inm = imo->imo_membership[i];
+
+		if (inm == NULL)
+			continue;
+		for (j = 0; j < n; j++)
+			if (um[j].um_group.s_addr == inm->inm_addr.s_addr)
+				break;
+		if (j < n)
+			continue;
+		um[n].um_inp = inp;
+		um[n].um_group = inm->inm_addr;
+		um[n].um_lport = inp->inp_lport;
+		n++;
+	}
+
+	udp_mcast_remove(up);
+	for (i = 0; i < n; i++)
+		OFP_LIST_INSERT_HEAD(&udp_mcast_hashbase[UDP_MCAST_HASH(
+			um[i].um_group, um[i].um_lport)], &um[i], um_hash);
+	if (n) {
+		up->u_mcast = um;
+		up->u_nmcast = n;
+	} else
+		free(um);
+out:
+	INP_WUNLOCK(inp);
+	INP_INFO_WUNLOCK(&ofp_udbinfo);
+}
+
+/*
+ * Return the inpcb of the first index entry from *um on that is a
+ * member of group on lport, and advance *um past it.
+ */
+static inline struct inpcb *
+udp_mcast_next(struct udp_mcast **um, struct ofp_in_addr group,
+	       uint16_t lport)
+{
+	struct udp_mcast *e;
+
+	for (e = *um; e != NULL; e = OFP_LIST_NEXT(e, um_hash))
+		if (e->um_group.s_addr == group.s_addr &&
+		    e->um_lport == lport) {
+			*um = OFP_LIST_NEXT(e, um_hash);
+			return e->um_inp;
+		}
+	*um = NULL;
+	return NULL;
+}
+
+#define UDP_BCAST_STACK 16
+
+/*
+ * Collect the inpcbs bound to a local port, for broadcast delivery.
+ * The port lists change under the hash lock, which must not be held
+ * while an inpcb is locked, so they are copied out first: into *inps
+ * if max is enough, else into an array the caller frees. The pcbinfo
+ * read lock of the caller keeps the inpcbs from being freed. Returns
+ * the count.
+ */
+static int
+udp_bcast_collect(uint16_t lport, struct inpcb ***inps, int max)
+{
+	struct inpcbport *phd;
+	struct inpcb *inp, **arr = *inps;
+	int n = 0;
+
+	INP_HASH_RLOCK(&ofp_udbinfo);
+	OFP_LIST_FOREACH(phd, &ofp_udbinfo.ipi_porthashbase[
+		INP_PCBPORTHASH(lport, ofp_udbinfo.ipi_porthashmask)],
+		phd_hash)
+		if (phd->phd_port == lport)
+			break;
+	if (phd != NULL) {
+		OFP_LIST_FOREACH(inp, &phd->phd_pcblist, inp_portlist)
+			n++;
+		if (n > max) {
+			arr = malloc(n * sizeof(*arr));
+			if (arr == NULL) {
+				OFP_ERR("Broadcast receivers not allocated");
+				arr = *inps;
+			} else
+				max = n;
+		}
+		n = 0;
+		OFP_LIST_FOREACH(inp, &phd->phd_pcblist, inp_portlist) {
+			if (n == max)
+				break;
+			arr[n++] = inp;
+		}
+	}
+	INP_HASH_RUNLOCK(&ofp_udbinfo);
+
+	*inps = arr;
+	return n;
+}
+
+/*
+ * Another handle to a datagram that goes to several sockets. A static
+ * reference shares the data instead of copying it; the receivers only
+ * read it, the sender address is already in place.
+ */
+static inline odp_packet_t
+udp_mcast_dup(odp_packet_t pkt)
+{
+#ifdef OFP_SOCKBUF_PKT_REF
+	return odp_packet_ref_static(pkt);
+#else
+	return odp_packet_copy(pkt, ofp_packet_pool);
+#endif
 }
 
 void
@@ -151,6 +327,8 @@ ofp_udp_destroy(void)
 
 	OFP_LIST_FOREACH_SAFE(inp, ofp_udbinfo.ipi_listhead, inp_list,
 			inp_temp) {
+		if (intoudpcb(inp))
+			udp_mcast_remove(intoudpcb(inp));
 		if (inp->inp_socket) {
 			ofp_sbdestroy(&inp->inp_socket->so_snd,
 					inp->inp_socket);
@@ -163,6 +341,7 @@ ofp_udp_destroy(void)
 
 	ofp_in_pcbinfo_destroy(&ofp_udbinfo);
 	uma_zdestroy(ofp_udbinfo.ipi_zone);
+	ofp_hashdestroy(udp_mcast_hashbase, 0, udp_mcast_hashmask);
 }
 
 /*
@@ -227,10 +406,24 @@ udp_append(struct inpcb *inp, struct ofp_ip *ip, odp_packet_t n, int off,
 
 	so = inp->inp_socket;
 
-	/* save sender data where L2 & L3 headers used to be */
-	memcpy(odp_packet_l2_ptr(n, NULL), append_sa, append_sa->sa_len);
-
-	/* Offer to event function */
+	/*
+	 * save sender data where L2 & L3 headers used to be, unless the
+	 * datagram is shared and already carries it
+	 */
+#ifdef OFP_SOCKBUF_PKT_REF
+	if (!odp_packet_has_ref(n))
+#endif
+		memcpy(odp_packet_l2_ptr(n, NULL), append_sa,
+		       append_sa->sa_len);
+
+	/* Offer to event function, which may change the packet */
+	if (so->so_sigevent.ofp_sigev_notify) {
+		n = ofp_sockbuf_unshare(n);
+		if (n == ODP_PACKET_INVALID) {
+			UDPSTAT_INC(udps_fullsock);
+			return;
+		}
+	}
 	if (packet_accepted_as_event(so, n))
 		return;
 
@@ -416,10 +609,44 @@ ofp_udp_input(odp_packet_t *m, int off)
 	    ofp_in_broadcast(ip->ip_dst, ifp)) {
 		struct inpcb *last;
 		struct ofp_ip_moptions *imo;
+		struct udp_mcast *um = NULL;
+		struct inpcb *bcast_stack[UDP_BCAST_STACK];
+		struct inpcb **bcast = bcast_stack;
+		int nbcast = 0, ibcast = 0;
+		int mcast = OFP_IN_MULTICAST(odp_be_to_cpu_32(
+						     ip->ip_dst.s_addr));
 
 		INP_INFO_RLOCK(&ofp_udbinfo);
 		last = NULL;
-		OFP_LIST_FOREACH(inp, &ofp_udb, inp_list) {
+
+		/*
+		 * Members of a multicast group come from the multicast
+		 * index, broadcast goes to every inpcb on the port. The
+		 * index is stable under the pcbinfo read lock, the port
+		 * lists are not.
+		 */
+		if (mcast) {
+			um = OFP_LIST_FIRST(&udp_mcast_hashbase[
+				UDP_MCAST_HASH(ip->ip_dst, uh->uh_dport)]);
+			inp = udp_mcast_next(&um, ip->ip_dst, uh->uh_dport);
+		} else {
+			nbcast = udp_bcast_collect(uh->uh_dport, &bcast,
+						   UDP_BCAST_STACK);
+			inp = ibcast < nbcast ? bcast[ibcast++] : NULL;
+		}
+
+		/*
+		 * The sender address goes where the L2 & L3 headers used to
+		 * be once for all the receivers of the datagram.
+		 */
+		if (inp != NULL)
+			memcpy(odp_packet_l2_ptr(*m, NULL), &udp_in,
+			       sizeof(udp_in));
+
+		for (; inp != NULL;
+		     inp = mcast ?
+		     udp_mcast_next(&um, ip->ip_dst, uh->uh_dport) :
+		     (ibcast < nbcast ? bcast[ibcast++] : NULL)) {
 			if (inp->inp_lport != uh->uh_dport)
 				continue;
 #ifdef _INET6
@@ -450,7 +677,7 @@ ofp_udp_input(odp_packet_t *m, int off)
 			 * and source-specific multicast. [RFC3678]
 			 */
 			imo = inp->inp_moptions;
-			if (OFP_IN_MULTICAST(odp_be_to_cpu_32(ip->ip_dst.s_addr))) {
+			if (mcast) {
 				struct ofp_sockaddr_in	 group;
 				int			 blocked;
 				if (imo == NULL) {
@@ -480,7 +707,7 @@ ofp_udp_input(odp_packet_t *m, int off)
 			if (last != NULL) {
 				odp_packet_t n;
 
-				n = odp_packet_copy(*m, ofp_packet_pool);
+				n = udp_mcast_dup(*m);
 				udp_append(last, ip, n, iphlen, &udp_in);
 				INP_RUNLOCK(last);
 			}
@@ -497,6 +724,8 @@ ofp_udp_input(odp_packet_t *m, int off)
 			    (OFP_SO_REUSEPORT|OFP_SO_REUSEADDR)) == 0)
 				break;
 		}
+		if (bcast != bcast_stack)
+			free(bcast);
 
 		if (last == NULL) {
 			/*
@@ -799,10 +1028,9 @@ int
 ofp_udp_ctloutput(struct socket *so, struct sockopt *sopt)
 {
 	int error = 0;
-	(void)so;
-	(void)sopt;
-	//int optval;
+	int optval;
 	struct inpcb *inp;
+	struct udpcb *up;
 
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
@@ -818,31 +1046,36 @@ ofp_udp_ctloutput(struct socket *so, struct sockopt *sopt)
 		{
 			INP_WUNLOCK(inp);
 			error = ofp_ip_ctloutput(so, sopt);
+			if (!error && sopt->sopt_dir == SOPT_SET)
+				udp_mcast_update(inp);
 		}
 		return (error);
 	}
 
-#if 0
 	switch (sopt->sopt_dir) {
 	case SOPT_SET:
 		switch (sopt->sopt_name) {
-		case OFP_UDP_ENCAP:
+		case OFP_UDP_SEGMENT:
+		case OFP_UDP_GRO:
 			INP_WUNLOCK(inp);
-			error = sooptcopyin(sopt, &optval, sizeof optval,
+			error = ofp_sooptcopyin(sopt, &optval, sizeof optval,
 					    sizeof optval);
 			if (error)
 				break;
 			inp = sotoinpcb(so);
 			KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
 			INP_WLOCK(inp);
-			switch (optval) {
-			case 0:
-				/* Clear all UDP encap. */
-				break;
-			default:
-				error = OFP_EINVAL;
-				break;
-			}
+			up = intoudpcb(inp);
+			if (sopt->sopt_name == OFP_UDP_SEGMENT) {
+				if (optval < 0 || optval + sizeof(struct udpiphdr)
+				    > OFP_IP_MAXPACKET)
+					error = OFP_EINVAL;
+				else
+					up->u_segsize = optval;
+			} else if (optval)
+				up->u_flags |= UF_GRO;
+			else
+				up->u_flags &= ~UF_GRO;
 			INP_WUNLOCK(inp);
 			break;
 		default:
@@ -853,6 +1086,16 @@ ofp_udp_ctloutput(struct socket *so, struct sockopt *sopt)
 		break;
 	case SOPT_GET:
 		switch (sopt->sopt_name) {
+		case OFP_UDP_SEGMENT:
+		case OFP_UDP_GRO:
+			up = intoudpcb(inp);
+			if (sopt->sopt_name == OFP_UDP_SEGMENT)
+				optval = up->u_segsize;
+			else
+				optval = (up->u_flags & UF_GRO) ? 1 : 0;
+			INP_WUNLOCK(inp);
+			error = ofp_sooptcopyout(sopt, &optval, sizeof optval);
+			break;
 		default:
 			INP_WUNLOCK(inp);
 			error = OFP_ENOPROTOOPT;
@@ -860,7 +1103,6 @@ ofp_udp_ctloutput(struct socket *so, struct sockopt *sopt)
 		}
 		break;
 	}
-#endif
 	return (error);
 }
 
@@ -869,6 +1111,131 @@ ofp_udp_ctloutput(struct socket *so, struct sockopt *sopt)
 #define	UH_WLOCKED	2
 #define	UH_RLOCKED	1
 #define	UH_UNLOCKED	0
+/*
+ * Prepend the IP and UDP headers to a datagram and compute the UDP
+ * checksum.
+ */
+static int
+udp_push_hdr(struct inpcb *inp, odp_packet_t m, int len,
+	     struct ofp_in_addr laddr, struct ofp_in_addr faddr,
+	     uint16_t lport, uint16_t fport, uint8_t tos)
+{
+	/*
+	 * Calculate data length and get a mbuf for UDP, IP, and possible
+	 * link-layer headers.  Immediate slide the data pointer back forward
+	 * since we won't use that space at this layer.
+	 */
+	struct ofp_ip *ip = odp_packet_push_head(m, sizeof(struct udpiphdr));
+	if (!ip)
+		return OFP_ENOBUFS;
+
+	odp_packet_l3_offset_set(m, 0);
+	odp_packet_l4_offset_set(m, sizeof(struct ofp_ip));
+
+	struct ofp_udphdr *udp = (struct ofp_udphdr *) (ip + 1);
+
+	ip->ip_hl = 5;
+	ip->ip_v = OFP_IPVERSION;
+	ip->ip_tos = tos;
+	ip->ip_len = odp_cpu_to_be_16(len + sizeof(struct ofp_ip) +
+				      sizeof(struct ofp_udphdr));
+	ip->ip_off = 0;
+	ip->ip_ttl = inp->inp_ip_ttl;
+	ip->ip_p = OFP_IPPROTO_UDP;
+	ip->ip_src.s_addr = laddr.s_addr;
+	ip->ip_dst.s_addr = faddr.s_addr;
+	ip->ip_sum = 0;
+
+	udp->uh_sport = lport;
+	udp->uh_dport = fport;
+	udp->uh_ulen = odp_cpu_to_be_16(len + sizeof(struct ofp_udphdr));
+	udp->uh_sum = 0;
+
+	/*
+	 * Set the Don't Fragment bit in the IP header.
+	 */
+	if (inp->inp_flags & INP_DONTFRAG)
+		ip->ip_off |= OFP_IP_DF;
+
+	/*
+	 * Set up UDP checksum.
+	 */
+#ifdef OFP_IPv4_UDP_CSUM_COMPUTE
+	if (ofp_udp_cksum) {
+#if 1
+		udp->uh_sum = 0;
+		udp->uh_sum = ofp_in4_cksum(m);
+		if (udp->uh_sum == 0)
+			udp->uh_sum = 0xffff;
+#else
+		if (inp->inp_flags & INP_ONESBCAST)
+			faddr.s_addr = OFP_INADDR_BROADCAST;
+		ui->ui_sum = in_pseudo(ui->ui_src.s_addr, faddr.s_addr,
+		    odp_cpu_to_be_16((uint16_t)len + sizeof(struct ofp_udphdr) + OFP_IPPROTO_UDP));
+
+		odp_packet_csum_flags(m) = CSUM_UDP;
+		odp_packet_set_csum_data(m, offsetof(struct ofp_udphdr, uh_sum));
+#endif
+	} else
+#endif /*OFP_IPv4_UDP_CSUM_COMPUTE*/
+	{
+		udp->uh_sum = 0;
+		UDPSTAT_INC(udps_opackets);
+	}
+
+	return 0;
+}
+
+/*
+ * Send the payload of m as datagrams of segsize bytes, the last one
+ * possibly shorter, all to the same addresses. The segments are output
+ * as one burst, so the route and L2 header are resolved once. Segments
+ * built before an error are still sent. m is freed.
+ */
+static int
+udp_output_segments(struct inpcb *inp, odp_packet_t m, int len, int segsize,
+		    struct ofp_in_addr laddr, struct ofp_in_addr faddr,
+		    uint16_t lport, uint16_t fport, uint8_t tos)
+{
+	odp_packet_t seg[OFP_UDP_MAX_SEGMENTS];
+	odp_packet_t n;
+	int off, seglen, num = 0, sent, error = 0;
+
+	for (off = 0; off < len && num < OFP_UDP_MAX_SEGMENTS;
+	     off += seglen) {
+		seglen = len - off < segsize ? len - off : segsize;
+
+		n = ofp_socket_packet_alloc(seglen);
+		if (n == ODP_PACKET_INVALID) {
+			error = OFP_ENOBUFS;
+			break;
+		}
+		odp_packet_user_ptr_set(n, odp_packet_user_ptr(m));
+
+		if (odp_packet_copy_from_pkt(n, 0, m, off, seglen) < 0)
+			error = OFP_ENOBUFS;
+		else
+			error = udp_push_hdr(inp, n, seglen, laddr, faddr,
+					     lport, fport, tos);
+		if (error) {
+			odp_packet_free(n);
+			break;
+		}
+		seg[num++] = n;
+	}
+
+	odp_packet_free(m);
+
+	sent = ofp_ip_output_burst(seg, num, NULL);
+	if (sent < num) {
+		OFP_WARN("packet dropped, returning OFP_EIO");
+		for (; sent < num; sent++)
+			odp_packet_free(seg[sent]);
+		error = OFP_EIO;
+	}
+	return error;
+}
+
 static int
 udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 	   odp_packet_t control, struct thread *td)
@@ -882,6 +1249,7 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 	uint16_t fport, lport;
 	int unlock_udbinfo;
 	uint8_t tos;
+	int segsize;
 
 	/*
 	 * udp_output() may need to temporarily bind or connect the current
@@ -899,6 +1267,7 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 	src.sin_family = 0;
 	INP_RLOCK(inp);
 	tos = inp->inp_ip_tos;
+	segsize = intoudpcb(inp)->u_segsize;
 	if (control != ODP_PACKET_INVALID) {
 		/*
 		 * XXX: Currently, we assume all the optional information is
@@ -917,6 +1286,25 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 				error = OFP_EINVAL;
 				break;
 			}
+			if (cm->cmsg_level == OFP_IPPROTO_UDP &&
+			    cm->cmsg_type == OFP_UDP_SEGMENT) {
+				if (cm->cmsg_len !=
+				    OFP_CMSG_LEN(sizeof(uint16_t))) {
+					error = OFP_EINVAL;
+					break;
+				}
+				/*
+				 * Bounded as the socket option. Zero sends
+				 * this datagram whole, whatever the option.
+				 */
+				segsize = *(uint16_t *)OFP_CMSG_DATA(cm);
+				if (segsize + sizeof(struct udpiphdr) >
+				    OFP_IP_MAXPACKET) {
+					error = OFP_EINVAL;
+					break;
+				}
+				continue;
+			}
 			if (cm->cmsg_level != OFP_IPPROTO_IP)
 				continue;
 
@@ -953,6 +1341,9 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 
 		odp_packet_free(control);
 	}
+	if (!error && segsize && len > segsize &&
+	    (len + segsize - 1) / segsize > OFP_UDP_MAX_SEGMENTS)
+		error = OFP_EINVAL;
 	if (error) {
 		INP_RUNLOCK(inp);
 		odp_packet_free(m);
@@ -1090,45 +1481,6 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 		}
 	}
 
-	/*
-	 * Calculate data length and get a mbuf for UDP, IP, and possible
-	 * link-layer headers.  Immediate slide the data pointer back forward
-	 * since we won't use that space at this layer.
-	 */
-	struct ofp_ip *ip = odp_packet_push_head(m, sizeof(struct udpiphdr));
-	if (!ip) {
-		error = OFP_ENOBUFS;
-		goto release;
-	}
-
-	odp_packet_l3_offset_set(m, 0);
-	odp_packet_l4_offset_set(m, sizeof(struct ofp_ip));
-
-	struct ofp_udphdr *udp = (struct ofp_udphdr *) (ip + 1);
-
-	ip->ip_hl = 5;
-	ip->ip_v = OFP_IPVERSION;
-	ip->ip_tos = tos;
-	ip->ip_len = odp_cpu_to_be_16(len + sizeof(struct ofp_ip) +
-				      sizeof(struct ofp_udphdr));
-	ip->ip_off = 0;
-	ip->ip_ttl = inp->inp_ip_ttl;
-	ip->ip_p = OFP_IPPROTO_UDP;
-	ip->ip_src.s_addr = laddr.s_addr;
-	ip->ip_dst.s_addr = faddr.s_addr;
-	ip->ip_sum = 0;
-
-	udp->uh_sport = lport;
-	udp->uh_dport = fport;
-	udp->uh_ulen = odp_cpu_to_be_16(len + sizeof(struct ofp_udphdr));
-	udp->uh_sum = 0;
-
-	/*
-	 * Set the Don't Fragment bit in the IP header.
-	 */
-	if (inp->inp_flags & INP_DONTFRAG)
-		ip->ip_off |= OFP_IP_DF;
-
 	ipflags = 0;
 
 	if (inp->inp_socket->so_options & OFP_SO_DONTROUTE)
@@ -1138,30 +1490,12 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 	if (inp->inp_flags & INP_ONESBCAST)
 		ipflags |= IP_SENDONES;
 
-	/*
-	 * Set up UDP checksum.
-	 */
-#ifdef OFP_IPv4_UDP_CSUM_COMPUTE
-	if (ofp_udp_cksum) {
-#if 1
-		udp->uh_sum = 0;
-		udp->uh_sum = ofp_in4_cksum(m);
-		if (udp->uh_sum == 0)
-			udp->uh_sum = 0xffff;
-#else
-		if (inp->inp_flags & INP_ONESBCAST)
-			faddr.s_addr = OFP_INADDR_BROADCAST;
-		ui->ui_sum = in_pseudo(ui->ui_src.s_addr, faddr.s_addr,
-		    odp_cpu_to_be_16((uint16_t)len + sizeof(struct ofp_udphdr) + OFP_IPPROTO_UDP));
-
-		odp_packet_csum_flags(m) = CSUM_UDP;
-		odp_packet_set_csum_data(m, offsetof(struct ofp_udphdr, uh_sum));
-#endif
-	} else
-#endif /*OFP_IPv4_UDP_CSUM_COMPUTE*/
-	{
-		udp->uh_sum = 0;
-		UDPSTAT_INC(udps_opackets);
+	/* A segmented send builds the headers for each segment */
+	if (segsize == 0 || len <= segsize) {
+		error = udp_push_hdr(inp, m, len, laddr, faddr, lport, fport,
+				     tos);
+		if (error)
+			goto release;
 	}
 
 	if (unlock_udbinfo == UH_WLOCKED)
@@ -1174,7 +1508,10 @@ udp_output(struct inpcb *inp, odp_packet_t m, struct ofp_sockaddr *addr,
 	error = ofp_ip_output(m, inp->inp_options, NULL, ipflags,
 				inp->inp_moptions, inp);
 #else
-	if (ofp_ip_output(m, NULL) == OFP_PKT_DROP) {
+	if (segsize && len > segsize)
+		error = udp_output_segments(inp, m, len, segsize, laddr,
+					    faddr, lport, fport, tos);
+	else if (ofp_ip_output(m, NULL) == OFP_PKT_DROP) {
 		OFP_WARN("packet dropped, returning OFP_EIO");
 		odp_packet_free(m);
 		error = OFP_EIO;
@@ -1201,6 +1538,76 @@ release:
 	return (error);
 }
 
+/*
+ * Send a burst of datagrams on a connected IPv4 socket. The route is
+ * looked up once for the whole burst and the packets are flushed to
+ * the interface together. A packet that fails is freed and the ones
+ * after it are left to the caller.
+ */
+int
+ofp_udp_send_burst(struct socket *so, odp_packet_t *pkts, int num, int *sent)
+{
+	struct inpcb *inp = sotoinpcb(so);
+	struct ofp_nh_entry *nh;
+	struct ofp_ifnet *send_ctx;
+	uint32_t flags;
+	int error = 0;
+	int n;
+
+	*sent = 0;
+
+	SOCKBUF_LOCK(&so->so_snd);
+	if (so->so_snd.sb_state & SBS_CANTSENDMORE)
+		error = OFP_EPIPE;
+	else if (so->so_error) {
+		error = so->so_error;
+		so->so_error = 0;
+	}
+	SOCKBUF_UNLOCK(&so->so_snd);
+	if (error)
+		return error;
+
+	INP_RLOCK(inp);
+	if (inp->inp_faddr.s_addr == OFP_INADDR_ANY) {
+		INP_RUNLOCK(inp);
+		return OFP_ENOTCONN;
+	}
+
+	for (n = 0; n < num; n++) {
+		odp_packet_t m = pkts[n];
+		int len = odp_packet_len(m);
+
+		if (len + sizeof(struct udpiphdr) > OFP_IP_MAXPACKET)
+			error = OFP_EMSGSIZE;
+		else
+			error = udp_push_hdr(inp, m, len, inp->inp_laddr,
+					     inp->inp_faddr, inp->inp_lport,
+					     inp->inp_fport, inp->inp_ip_tos);
+		if (error)
+			break;
+	}
+
+	/* One route lookup and L2 resolution for the whole burst */
+	if (n) {
+		send_ctx = odp_packet_user_ptr(pkts[0]);
+		nh = ofp_get_next_hop(send_ctx ? send_ctx->vrf : 0,
+				      inp->inp_faddr.s_addr, &flags);
+		*sent = ofp_ip_output_burst(pkts, n, nh);
+	}
+	INP_RUNLOCK(inp);
+
+	if (*sent < n) {
+		OFP_WARN("packet dropped, returning OFP_EIO");
+		odp_packet_free(pkts[*sent]);
+		error = OFP_EIO;
+	} else if (error)
+		odp_packet_free(pkts[n]);
+
+	ofp_send_pending_pkt();
+
+	return error;
+}
+
 static void
 udp_abort(struct socket *so)
 {
@@ -1231,11 +1638,9 @@ udp_attach(struct socket *so, int proto, struct thread *td)
 	inp = sotoinpcb(so);
 	KASSERT(inp == NULL, ("udp_attach: inp != NULL"));
 
-	/* HJo: Constant space reserved.
 	error = ofp_soreserve(so, ofp_udp_sendspace, ofp_udp_recvspace);
 	if (error)
 		return (error);
-	*/
 
 	INP_INFO_WLOCK(&ofp_udbinfo);
 
@@ -1300,6 +1705,8 @@ udp_bind(struct socket *so, struct ofp_sockaddr *nam, struct thread *td)
 	error = ofp_in_pcbbind(inp, nam, td->td_ucred);
 	INP_HASH_WUNLOCK(&ofp_udbinfo);
 	INP_WUNLOCK(inp);
+	if (!error)
+		udp_mcast_update(inp);
 	return (error);
 }
 
@@ -1348,6 +1755,8 @@ udp_connect(struct socket *so, struct ofp_sockaddr *nam, struct thread *td)
 	if (error == 0)
 		ofp_soisconnected(so);
 	INP_WUNLOCK(inp);
+	if (!error)
+		udp_mcast_update(inp);
 	return (error);
 }
 
@@ -1365,6 +1774,7 @@ udp_detach(struct socket *so)
 	INP_WLOCK(inp);
 	up = intoudpcb(inp);
 	KASSERT(up != NULL, ("%s: up == NULL", __func__));
+	udp_mcast_remove(up);
 	inp->inp_ppcb = NULL;
 	ofp_in_pcbdetach(inp);
 	ofp_in_pcbfree(inp);
@@ -1401,12 +1811,19 @@ udp_send(struct socket *so, int flags, odp_packet_t m, struct ofp_sockaddr *addr
     odp_packet_t control, struct thread *td)
 {
 	struct inpcb *inp;
+	uint16_t lport;
+	int error;
 
 	(void)flags;
 
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("udp_send: inp == NULL"));
-	return (udp_output(inp, m, addr, control, td));
+	lport = inp->inp_lport;
+	error = udp_output(inp, m, addr, control, td);
+	/* The first send binds a local port for the memberships */
+	if (lport == 0 && inp->inp_lport != 0)
+		udp_mcast_update(inp);
+	return (error);
 }
 
 int
@@ -40,6 +40,9 @@
 #include "ofpi_in_pcb.h"
 #include "ofpi_in.h"
 #include "ofpi_log.h"
+#include "ofpi_epoll.h"
+#include "ofpi_aio.h"
+#include "ofpi_sigev.h"
 
 
 /*
@@ -75,7 +78,16 @@ int packet_accepted_as_event(struct socket *so, odp_packet_t pkt)
 
 	ev = &so->so_sigevent;
 
-	if (ev->ofp_sigev_notify) {
+	if (ev->ofp_sigev_notify == OFP_SIGEV_BATCH) {
+		struct ofp_sock_sigval ss;
+
+		ss.pkt = pkt;
+		ss.event = OFP_EVENT_RECV;
+		ss.sockfd = so->so_number;
+		ss.sockfd2 = so->so_number;
+		ofp_sigev_batch(ev, &ss);
+		return 1;
+	} else if (ev->ofp_sigev_notify) {
 		union ofp_sigval sv;
 		struct ofp_sock_sigval ss;
 
@@ -99,25 +111,60 @@ static int packet_accepted_as_event_locked(struct sockbuf *sb, odp_packet_t pkt)
 {
 	struct socket *so = sb->sb_socket;
 
+	/* Only received packets are offered */
+	if (so && sb != &so->so_rcv)
+		return 0;
+
 	return packet_accepted_as_event(so, pkt);
 }
 
+static inline int sockbuf_full(struct sockbuf *sb)
+{
+	int next = sb->sb_put + 1;
+
+	if (next >= sb->sb_len)
+		next = 0;
+	return next == sb->sb_get;
+}
+
+/*
+ * Socket buffers are accounted in bytes. The packet ring limits the
+ * space only once it cannot grow any more, as every packet takes a slot
+ * whatever its length. Whether a larger ring is still free is read
+ * without the pool lock, so the space is a hint: the ring may be taken
+ * by another socket before this one fills, and the append then fails.
+ */
+long ofp_sbspace(struct sockbuf *sb)
+{
+	long space = imin((int)(sb->sb_hiwat - sb->sb_cc),
+			  (int)(sb->sb_mbmax - sb->sb_mbcnt));
+	long slots;
+
+	if (ofp_sockbuf_can_grow(sb))
+		return space;
+
+	slots = sb->sb_put >= sb->sb_get ?
+		sb->sb_len - (sb->sb_put - sb->sb_get) - 1 :
+		sb->sb_get - sb->sb_put - 1;
+	return lmin(space, slots * global_param->pkt_pool.buffer_size);
+}
+
 int ofp_sockbuf_put_last(struct sockbuf *sb, odp_packet_t pkt)
 {
 	/* Offer to event function */
 	if (packet_accepted_as_event_locked(sb, pkt))
 		return 0;
 
-	int next = sb->sb_put + 1;
-	if (next >= SOCKBUF_LEN)
-		next = 0;
-
-	if (next == sb->sb_get) {
+	if (sockbuf_full(sb) && ofp_sockbuf_grow(sb)) {
 		ofp_sockbuf_packet_free(pkt);
-		OFP_ERR("No more room, next=%d", next);
+		OFP_ERR("No more room, len=%d", sb->sb_len);
 		return -1;
 	}
 
+	int next = sb->sb_put + 1;
+	if (next >= sb->sb_len)
+		next = 0;
+
 	sb->sb_mb[sb->sb_put] = pkt;
 	sb->sb_put = next;
 	sballoc(sb, pkt);
@@ -138,8 +185,9 @@ odp_packet_t ofp_sockbuf_remove_first(struct sockbuf *sb)
 
 	if (sb->sb_get != sb->sb_put) {
 		pkt = sb->sb_mb[sb->sb_get];
-		if (++sb->sb_get >= SOCKBUF_LEN)
+		if (++sb->sb_get >= sb->sb_len)
 			sb->sb_get = 0;
+		ofp_sockbuf_ring_drained(sb);
 	}
 	return pkt;
 }
@@ -157,7 +205,7 @@ void ofp_sockbuf_copy_out(struct sockbuf *sb, int off, int len, char *dst)
 		int plen = odp_packet_len(sb->sb_mb[i]);
 		if (off >= plen) {
 			off -= plen;
-			if (++i >= SOCKBUF_LEN)
+			if (++i >= sb->sb_len)
 				i = 0;
 		} else
 			break;
@@ -172,9 +220,108 @@ void ofp_sockbuf_copy_out(struct sockbuf *sb, int off, int len, char *dst)
 		len -= plen;
 		dstoff += plen;
 
-		if (++i >= SOCKBUF_LEN)
+		if (++i >= sb->sb_len)
+			i = 0;
+	}
+}
+
+/*
+ * Shorten a segment of len bytes at off to end where the packet holding
+ * its first byte ends, so that ofp_sockbuf_ref_out() can reference it.
+ * Short remainders, e.g. of small writes, are not worth a segment of
+ * their own and are left to be copied.
+ */
+int ofp_sockbuf_ref_len(struct sockbuf *sb, int off, int len)
+{
+#ifdef OFP_SOCKBUF_PKT_REF
+	int i = sb->sb_get;
+	int plen;
+
+	while (i != sb->sb_put) {
+		plen = odp_packet_len(sb->sb_mb[i]);
+		if (off < plen) {
+			if (off + len > plen && plen - off >= len / 2)
+				return plen - off;
+			break;
+		}
+		off -= plen;
+		if (++i >= sb->sb_len)
 			i = 0;
 	}
+#else
+	(void)sb;
+	(void)off;
+#endif
+	return len;
+}
+
+/*
+ * Return a packet with hdrlen bytes of fresh headroom followed by a
+ * reference to len bytes of sockbuf data at off, so that the payload is
+ * sent without copying and the original stays queued for retransmit.
+ * Only a range that ends at a packet boundary can be referenced, as the
+ * shared tail of a reference cannot be trimmed. Returns
+ * ODP_PACKET_INVALID when the caller has to copy instead.
+ */
+odp_packet_t ofp_sockbuf_ref_out(struct sockbuf *sb, int off, int len,
+				 uint32_t hdrlen)
+{
+#ifdef OFP_SOCKBUF_PKT_REF
+	int i = sb->sb_get;
+	odp_packet_t hdr, ref;
+
+	while (i != sb->sb_put) {
+		int plen = odp_packet_len(sb->sb_mb[i]);
+		if (off >= plen) {
+			off -= plen;
+			if (++i >= sb->sb_len)
+				i = 0;
+		} else
+			break;
+	}
+
+	if (i == sb->sb_put ||
+	    off + len != (int)odp_packet_len(sb->sb_mb[i]))
+		return ODP_PACKET_INVALID;
+
+	hdr = ofp_socket_packet_alloc(hdrlen);
+	if (hdr == ODP_PACKET_INVALID)
+		return ODP_PACKET_INVALID;
+
+	ref = odp_packet_ref_pkt(sb->sb_mb[i], off, hdr);
+	if (ref == ODP_PACKET_INVALID)
+		odp_packet_free(hdr);
+
+	return ref;
+#else
+	(void)sb;
+	(void)off;
+	(void)len;
+	(void)hdrlen;
+	return ODP_PACKET_INVALID;
+#endif
+}
+
+/*
+ * Return a packet that can be handed to the application, which may
+ * change it: the packet itself, or a copy of it if its data is shared
+ * with other handles. The shared handle is freed. Returns
+ * ODP_PACKET_INVALID if the copy fails.
+ */
+odp_packet_t ofp_sockbuf_unshare(odp_packet_t pkt)
+{
+#ifdef OFP_SOCKBUF_PKT_REF
+	odp_packet_t copy;
+
+	if (!odp_packet_has_ref(pkt))
+		return pkt;
+
+	copy = odp_packet_copy(pkt, odp_packet_pool(pkt));
+	odp_packet_free(pkt);
+	return copy;
+#else
+	return pkt;
+#endif
 }
 
 /*
@@ -192,19 +339,19 @@ ofp_sbappendaddr_locked(struct sockbuf *sb,
 	if (control != ODP_PACKET_INVALID)
 		odp_packet_free(control);
 
-	sb->sb_mb[sb->sb_put++] = pkt;
-	if (sb->sb_put >= SOCKBUF_LEN)
-		sb->sb_put = 0;
+	if (sbspace(sb) < (long)odp_packet_len(pkt))
+		return 0;
 
-	if (sb->sb_put == sb->sb_get) {
-		sb->sb_put--;
-		if (sb->sb_put < 0)
-			sb->sb_put = SOCKBUF_LEN-1;
+	if (sockbuf_full(sb) && ofp_sockbuf_grow(sb)) {
 		OFP_ERR("Buffers full, sb_get=%d max_num=%d",
-			  sb->sb_get, SOCKBUF_LEN);
+			  sb->sb_get, sb->sb_len);
 		return 0;
 	}
 
+	sb->sb_mb[sb->sb_put++] = pkt;
+	if (sb->sb_put >= sb->sb_len)
+		sb->sb_put = 0;
+
 	sballoc(sb, pkt);
 	return (1);
 }
@@ -217,7 +364,7 @@ sbflush_internal(struct sockbuf *sb)
 {
 	while (sb->sb_get != sb->sb_put) {
 		odp_packet_free(sb->sb_mb[sb->sb_get]);
-		if (++sb->sb_get >= SOCKBUF_LEN)
+		if (++sb->sb_get >= sb->sb_len)
 			sb->sb_get = 0;
 	}
 }
@@ -227,6 +374,7 @@ ofp_sbflush_locked(struct sockbuf *sb)
 {
 	SOCKBUF_LOCK_ASSERT(sb);
 	sbflush_internal(sb);
+	ofp_sockbuf_ring_drained(sb);
 }
 
 void
@@ -237,6 +385,47 @@ ofp_sbflush(struct sockbuf *sb)
 	SOCKBUF_UNLOCK(sb);
 }
 
+#define SB_SPLIT_MAX 64
+
+/*
+ * Queue a stream packet as packets of at most sb_segsize bytes, so that
+ * the segments sent of it end at packet boundaries and reference its
+ * data (see ofp_sockbuf_ref_len()). Pieces are split off the tail, at
+ * most SB_SPLIT_MAX at a time, so that data is moved at most once by
+ * implementations that copy on split. What cannot be split is queued
+ * as is and copied when sent.
+ */
+static void
+sbappend_split(struct sockbuf *sb, odp_packet_t m)
+{
+	uint32_t segsize = sb->sb_segsize;
+	odp_packet_t piece[SB_SPLIT_MAX];
+	odp_packet_t rest;
+	int i, n;
+
+	while (m != ODP_PACKET_INVALID) {
+		rest = ODP_PACKET_INVALID;
+		n = (odp_packet_len(m) + segsize - 1) / segsize;
+		if (n > SB_SPLIT_MAX) {
+			if (odp_packet_split(&m, SB_SPLIT_MAX * segsize,
+					     &rest) < 0)
+				n = 1;
+			else
+				n = SB_SPLIT_MAX;
+		}
+
+		for (i = n - 1; i > 0; i--)
+			if (odp_packet_split(&m, i * segsize, &piece[i]) < 0)
+				break;
+
+		ofp_sbcompress(sb, m, sb->sb_mbtail);
+		for (i++; i < n; i++)
+			ofp_sbcompress(sb, piece[i], sb->sb_mbtail);
+
+		m = rest;
+	}
+}
+
 /*
  * This version of sbappend() should only be used when the caller absolutely
  * knows that there will never be more than one record in the socket buffer,
@@ -250,7 +439,10 @@ ofp_sbappendstream_locked(struct sockbuf *sb, odp_packet_t m)
 	SBLASTMBUFCHK(sb);
 
 	sb->sb_lastrecord = sb->sb_put;
-	ofp_sbcompress(sb, m, sb->sb_mbtail);
+	if (sb->sb_segsize && odp_packet_len(m) > sb->sb_segsize)
+		sbappend_split(sb, m);
+	else
+		ofp_sbcompress(sb, m, sb->sb_mbtail);
 
 	SBLASTRECORDCHK(sb);
 }
@@ -291,9 +483,48 @@ ofp_sbappendstream(struct sockbuf *sb, odp_packet_t m)
 void
 ofp_sbcompress(struct sockbuf *sb, odp_packet_t pkt, int n)
 {
+	uint32_t len = odp_packet_len(pkt);
+	odp_packet_t last;
+	int i;
+
 	(void)n;
 	SOCKBUF_LOCK_ASSERT(sb);
-	ofp_sockbuf_put_last(sb, pkt);
+
+	/* Packets offered to the event function are never merged */
+	if ((sb->sb_flags & SB_NOCOALESCE) || sb->sb_get == sb->sb_put ||
+	    (sb->sb_socket && sb == &sb->sb_socket->so_rcv &&
+	     sb->sb_socket->so_sigevent.ofp_sigev_notify)) {
+		ofp_sockbuf_put_last(sb, pkt);
+		return;
+	}
+
+	if (len == 0) {
+		ofp_sockbuf_packet_free(pkt);
+		return;
+	}
+
+	i = (sb->sb_put == 0 ? sb->sb_len : sb->sb_put) - 1;
+	last = sb->sb_mb[i];
+
+	/*
+	 * Copy small writes into the tailroom of the last packet, as long
+	 * as no segment in flight still references its data.
+	 */
+	if (len > global_param->pkt_pool.buffer_size / 4 ||
+	    len > odp_packet_tailroom(last) ||
+	    (sb->sb_segsize &&
+	     odp_packet_len(last) + len > sb->sb_segsize) ||
+#ifdef OFP_SOCKBUF_PKT_REF
+	    odp_packet_has_ref(last) ||
+#endif
+	    odp_packet_seg_len(last) != odp_packet_len(last)) {
+		ofp_sockbuf_put_last(sb, pkt);
+		return;
+	}
+
+	odp_packet_copy_to_mem(pkt, 0, len, odp_packet_push_tail(last, len));
+	sb->sb_cc += len;
+	ofp_sockbuf_packet_free(pkt);
 }
 
 /*
@@ -401,13 +632,28 @@ extern unsigned int sleep(unsigned int seconds);
 int
 ofp_sbwait(struct sockbuf *sb)
 {
+	int held = sb->sb_mtx_held;
+	int error;
+
 	SOCKBUF_LOCK_ASSERT(sb);
 
+	/*
+	 * Only the owner of its shard uses the sockbuf, and the data
+	 * waited for comes from input that only the owner runs.
+	 */
+	if (sb->sb_flags & SB_SHARDED)
+		return (OFP_EWOULDBLOCK);
+
 	sb->sb_flags |= SB_WAIT;
-	return (ofp_msleep(&sb->sb_cc, &sb->sb_mtx,
+	/* The sleep releases sb_mtx and takes it again */
+	sb->sb_mtx_held = 0;
+	error = ofp_msleep_busy(&sb->sb_cc,
+			     held ? &sb->sb_mtx : NULL,
 			     0 /*HJo (sb->sb_flags & SB_NOINTR) ? PSOCK : PSOCK | PCATCH*/,
 			     "sbwait",
-			     1000000UL/HZ*sb->sb_timeo));
+			     1000000UL/HZ*sb->sb_timeo, sb->sb_busy_poll);
+	sb->sb_mtx_held = held;
+	return (error);
 }
 
 int
@@ -442,13 +688,19 @@ ofp_sbunlock(struct sockbuf *sb)
 void
 ofp_sowakeup(struct socket *so, struct sockbuf *sb)
 {
-	(void)so;
-	SOCKBUF_UNLOCK(sb);
-
 	SOCKBUF_LOCK_ASSERT(sb);
 
 	/*HJo selwakeuppri(&sb->sb_sel, PSOCK);*/
+	ofp_so_readiness_changed(so, sb);
+
+	SOCKBUF_UNLOCK(sb);
+
 	ofp_wakeup(NULL);
+
+	if (sb->sb_flags & SB_EPOLL)
+		ofp_epoll_notify(so);
+	if (sb->sb_flags & SB_AIO)
+		ofp_aio_notify(so);
 #if 0
 	if (!SEL_WAITING(&sb->sb_sel))
 		sb->sb_flags &= ~SB_SEL;
@@ -593,6 +845,7 @@ ofp_sbrelease_internal(struct sockbuf *sb, struct socket *so)
 	(void)so;
 
 	sbflush_internal(sb);
+	ofp_sockbuf_ring_release(sb);
 #if 0 /* HJo */
 	(void)chgsbsize(so->so_cred->cr_uidinfo, &sb->sb_hiwat, 0,
 	    RLIM_INFINITY);
@@ -106,6 +106,8 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <odp_api.h>
 
@@ -133,16 +135,42 @@
 #include "ofpi_callout.h"
 #include "ofpi_log.h"
 #include "ofpi_pkt_processing.h"
+#include "ofpi_epoll.h"
+#include "ofpi_aio.h"
+#include "ofpi_sigev.h"
+#include "ofpi_shard.h"
 
 #define SHM_NAME_SOCKET "OfpSocketShMem"
 
+struct sleeper {
+	struct sleeper *next;
+	void *channel;
+	const char *wmesg;
+	uint32_t go;		/* futex word, set to 1 on wakeup */
+	uint32_t blocked;	/* about to block or blocked in futex */
+	uint32_t seq;		/* use count, tells stale timeouts apart */
+	odp_timer_t tmo;
+	int woke_by_timer;
+};
+
+/* Wait queue of the channels hashing to the same bucket */
+struct sleep_queue {
+	odp_spinlock_t lock;
+	struct sleeper *head;
+};
+
 /*
  * Shared data
+ *
+ * The per socket arrays follow this structure in the same shared
+ * memory block. They are sized by global_param at init.
  */
 struct ofp_socket_mem {
-	struct socket socket_list[OFP_NUM_SOCKETS_MAX];
+	struct socket *socket_list;	/* socket_max sockets */
 	struct socket *free_sockets;
+	/* Sockets out of free_sockets, including the thread caches */
 	int sockets_allocated, max_sockets_allocated;
+	int socket_cache;		/* max free sockets cached per thread */
 	int socket_zone;
 
 	odp_rwlock_t so_global_mtx;
@@ -150,17 +178,22 @@ struct ofp_socket_mem {
 	int somaxconn;
 	odp_pool_t pool;
 
-	struct sleeper {
-		struct sleeper *next;
-		void *channel;
-		const char *wmesg;
-		int   go;
-		odp_timer_t tmo;
-		int woke_by_timer;
-	} *sleep_list;
-	struct sleeper sleeper_list[OFP_NUM_SOCKETS_MAX];
+	struct sleeper *sleeper_list;	/* socket_max sleepers */
 	struct sleeper *free_sleepers;
-	odp_spinlock_t sleep_lock;
+	odp_spinlock_t sleep_lock;	/* protects free_sleepers */
+	struct sleep_queue *sleep_queues; /* sleep_queue_mask + 1 queues */
+	uint32_t sleep_queue_mask;
+
+	odp_packet_t *sockbufs;		/* 2 * sockbuf_len per socket */
+
+	odp_packet_t *sockbuf_ext;	/* sockbuf_ext_num rings to grow into */
+	uint32_t *sockbuf_ext_free;	/* stack of free sockbuf_ext rings */
+	int sockbuf_ext_free_num;
+	odp_spinlock_t sockbuf_ext_lock;
+
+	/* Bumped on every readiness change, copied to so_rgen */
+	odp_atomic_u64_t so_rgen;
+	odp_rwlock_t so_rgen_mtx;	/* interlock of select sleep */
 };
 
 /*
@@ -176,7 +209,7 @@ void ofp_print_long_counters(void);
 void ofp_print_sockets(void)
 {
 	int i;
-	for (i = 0; i < OFP_NUM_SOCKETS_MAX; i++) {
+	for (i = 0; i < global_param->socket_max; i++) {
 		struct socket *so = &shm->socket_list[i];
 		if (!so->so_proto)
 			continue;
@@ -185,11 +218,13 @@ void ofp_print_sockets(void)
 			  so->so_snd.sb_put, so->so_snd.sb_get);
 	}
 
-	struct sleeper *s = shm->sleep_list;
-	while (s) {
-		OFP_INFO("Sleeper %s, tmo=%x go=%d timer=%d",
-			  s->wmesg, s->tmo, s->go, s->woke_by_timer);
-		s = s->next;
+	for (i = 0; i <= (int)shm->sleep_queue_mask; i++) {
+		struct sleeper *s = shm->sleep_queues[i].head;
+		while (s) {
+			OFP_INFO("Sleeper %s, tmo=%x go=%d timer=%d",
+				  s->wmesg, s->tmo, s->go, s->woke_by_timer);
+			s = s->next;
+		}
 	}
 	print_open_conns();
 }
@@ -207,11 +242,6 @@ odp_packet_t ofp_socket_packet_alloc(uint32_t len)
 	return ofp_packet_alloc_from_pool(shm->pool, len);
 }
 
-odp_rwlock_t *ofp_accept_mtx(void)
-{
-	return &shm->ofp_accept_mtx;
-}
-
 void ofp_accept_lock(void)
 {
 	odp_rwlock_write_lock(&shm->ofp_accept_mtx);
@@ -222,9 +252,28 @@ void ofp_accept_unlock(void)
 	odp_rwlock_write_unlock(&shm->ofp_accept_mtx);
 }
 
+static uint32_t sleep_queue_count(void)
+{
+	return ofp_roundup_pow2(global_param->socket_max);
+}
+
+static uint64_t ofp_socket_shared_memory_size(void)
+{
+	uint64_t per_socket = sizeof(struct socket) + sizeof(struct sleeper) +
+		2 * global_param->sockbuf_len * sizeof(odp_packet_t);
+
+	uint64_t per_ext = global_param->sockbuf_ext_len * sizeof(odp_packet_t) +
+		sizeof(uint32_t);
+
+	return sizeof(*shm) + global_param->socket_max * per_socket +
+		sleep_queue_count() * sizeof(struct sleep_queue) +
+		global_param->sockbuf_ext_num * per_ext;
+}
+
 static int ofp_socket_alloc_shared_memory(void)
 {
-	shm = ofp_shared_memory_alloc(SHM_NAME_SOCKET, sizeof(*shm));
+	shm = ofp_shared_memory_alloc(SHM_NAME_SOCKET,
+				      ofp_socket_shared_memory_size());
 	if (shm == NULL) {
 		OFP_ERR("ofp_shared_memory_alloc failed");
 		return -1;
@@ -257,55 +306,196 @@ int ofp_socket_lookup_shared_memory(void)
 
 void ofp_socket_init_prepare(void)
 {
-	ofp_shared_memory_prealloc(SHM_NAME_SOCKET, sizeof(*shm));
+	ofp_shared_memory_prealloc(SHM_NAME_SOCKET,
+				   ofp_socket_shared_memory_size());
+}
+
+/* Point a sockbuf of socket i back to its own ring. */
+static void sockbuf_attach_storage(struct sockbuf *sb, int i, int snd)
+{
+	int sb_len = global_param->sockbuf_len;
+
+	sb->sb_mb = &shm->sockbufs[(2 * i + snd) * sb_len];
+	sb->sb_len = sb_len;
+}
+
+/* Point the socket to its slices of the per socket arrays. */
+static void socket_attach_storage(struct socket *so)
+{
+	int i = so->so_number - OFP_SOCK_NUM_OFFSET;
+
+	sockbuf_attach_storage(&so->so_rcv, i, 0);
+	sockbuf_attach_storage(&so->so_snd, i, 1);
+}
+
+int ofp_sockbuf_can_grow(struct sockbuf *sb)
+{
+	return sb->sb_ext == 0 && shm->sockbuf_ext_free_num > 0;
+}
+
+/*
+ * Move a full sockbuf to one of the larger shared rings, if the byte
+ * limit still allows more data. Called with the sockbuf locked.
+ */
+int ofp_sockbuf_grow(struct sockbuf *sb)
+{
+	int ext_len = global_param->sockbuf_ext_len;
+	odp_packet_t *ring;
+	uint32_t ext;
+	int i, n = 0;
+
+	if (sb->sb_ext || sb->sb_cc >= sb->sb_hiwat)
+		return -1;
+
+	odp_spinlock_lock(&shm->sockbuf_ext_lock);
+	if (shm->sockbuf_ext_free_num == 0) {
+		odp_spinlock_unlock(&shm->sockbuf_ext_lock);
+		return -1;
+	}
+	ext = shm->sockbuf_ext_free[--shm->sockbuf_ext_free_num];
+	odp_spinlock_unlock(&shm->sockbuf_ext_lock);
+
+	ring = &shm->sockbuf_ext[(uint64_t)ext * ext_len];
+	for (i = sb->sb_get; i != sb->sb_put; ) {
+		ring[n++] = sb->sb_mb[i];
+		if (++i >= sb->sb_len)
+			i = 0;
+	}
+
+	sb->sb_mb = ring;
+	sb->sb_len = ext_len;
+	sb->sb_get = 0;
+	sb->sb_put = n;
+	sb->sb_ext = ext + 1;
+	sb->sb_sndptr = -1;
+	sb->sb_sndptroff = 0;
+	return 0;
+}
+
+/*
+ * Give a larger ring back once the sockbuf has been flushed. A sockbuf
+ * of a socket is pointed back to its own ring, a detached copy (see
+ * sorflush()) is left alone.
+ */
+void ofp_sockbuf_ring_release(struct sockbuf *sb)
+{
+	struct socket *so = sb->sb_socket;
+
+	if (sb->sb_ext == 0)
+		return;
+
+	odp_spinlock_lock(&shm->sockbuf_ext_lock);
+	shm->sockbuf_ext_free[shm->sockbuf_ext_free_num++] = sb->sb_ext - 1;
+	odp_spinlock_unlock(&shm->sockbuf_ext_lock);
+	sb->sb_ext = 0;
+
+	if (so == NULL || (sb != &so->so_rcv && sb != &so->so_snd))
+		return;
+
+	sockbuf_attach_storage(sb, so->so_number - OFP_SOCK_NUM_OFFSET,
+			       sb == &so->so_snd);
+	sb->sb_get = sb->sb_put = 0;
+}
+
+/*
+ * Give a larger ring back as soon as the sockbuf has drained, so that a
+ * burst does not hold it for the life of the socket. Called with the
+ * sockbuf locked.
+ */
+void ofp_sockbuf_ring_drained(struct sockbuf *sb)
+{
+	if (sb->sb_ext == 0 || sb->sb_get != sb->sb_put)
+		return;
+
+	ofp_sockbuf_ring_release(sb);
+	sb->sb_sndptr = -1;
+	sb->sb_sndptroff = 0;
 }
 
 int ofp_socket_init_global(odp_pool_t pool)
 {
-	uint32_t i;
+	uint32_t i, socket_max = global_param->socket_max;
 
 	HANDLE_ERROR(ofp_socket_alloc_shared_memory());
 
-	memset(shm, 0, sizeof(*shm));
+	memset(shm, 0, ofp_socket_shared_memory_size());
 	shm->pool = ODP_POOL_INVALID;
 
-	for (i = 0; i < OFP_NUM_SOCKETS_MAX; i++) {
-		shm->socket_list[i].next = (i == OFP_NUM_SOCKETS_MAX - 1) ?
+	shm->socket_list = (struct socket *)(shm + 1);
+	shm->sleeper_list = (struct sleeper *)&shm->socket_list[socket_max];
+	shm->sleep_queues =
+		(struct sleep_queue *)&shm->sleeper_list[socket_max];
+	shm->sleep_queue_mask = sleep_queue_count() - 1;
+	shm->sockbufs =
+		(odp_packet_t *)&shm->sleep_queues[shm->sleep_queue_mask + 1];
+	shm->sockbuf_ext = &shm->sockbufs[2 * (uint64_t)socket_max *
+					  global_param->sockbuf_len];
+	shm->sockbuf_ext_free =
+		(uint32_t *)&shm->sockbuf_ext[(uint64_t)global_param->sockbuf_ext_num *
+					      global_param->sockbuf_ext_len];
+	for (i = 0; i < (uint32_t)global_param->sockbuf_ext_num; i++)
+		shm->sockbuf_ext_free[i] = i;
+	shm->sockbuf_ext_free_num = global_param->sockbuf_ext_num;
+	odp_spinlock_init(&shm->sockbuf_ext_lock);
+
+	for (i = 0; i < socket_max; i++) {
+		shm->socket_list[i].next = (i == socket_max - 1) ?
 			NULL : &(shm->socket_list[i+1]);
 		shm->socket_list[i].so_number = i + OFP_SOCK_NUM_OFFSET;
+		socket_attach_storage(&shm->socket_list[i]);
 	}
 	shm->free_sockets = &(shm->socket_list[0]);
 
-	for (i = 0; i < OFP_NUM_SOCKETS_MAX; i++) {
-		shm->sleeper_list[i].next = (i == OFP_NUM_SOCKETS_MAX - 1) ?
+	/* Keep at least half of the sockets out of the thread caches */
+	shm->socket_cache = global_param->socket_cache;
+	if (shm->socket_cache >
+	    (int)(socket_max / (2 * odp_thread_count_max())))
+		shm->socket_cache = socket_max / (2 * odp_thread_count_max());
+
+	for (i = 0; i < socket_max; i++) {
+		shm->sleeper_list[i].next = (i == socket_max - 1) ?
 			NULL : &(shm->sleeper_list[i+1]);
 	}
 	shm->free_sleepers = &(shm->sleeper_list[0]);
 
+	for (i = 0; i <= shm->sleep_queue_mask; i++)
+		odp_spinlock_init(&shm->sleep_queues[i].lock);
+
 	shm->somaxconn = SOMAXCONN;
 	shm->pool = pool;
 	odp_rwlock_init(&shm->so_global_mtx);
 	odp_rwlock_init(&shm->ofp_accept_mtx);
 	odp_spinlock_init(&shm->sleep_lock);
+	odp_atomic_init_u64(&shm->so_rgen, 0);
+	odp_rwlock_init(&shm->so_rgen_mtx);
 
 	return 0;
 }
 
+static void sleeper_go(struct sleeper *sleepy);
+
 int ofp_socket_term_global(void)
 {
 	struct sleeper *p, *next;
+	uint32_t i;
 	int rc = 0;
 
-	p = shm->sleep_list;
-	while (p) {
-		next = p->next;
-		if (p->tmo != ODP_TIMER_INVALID) {
-			CHECK_ERROR(ofp_timer_cancel(p->tmo), rc);
-			p->tmo = ODP_TIMER_INVALID;
-		}
-		p->go = 1;
-		p = next;
+	for (i = 0; i <= shm->sleep_queue_mask; i++) {
+		struct sleep_queue *sq = &shm->sleep_queues[i];
 
+		odp_spinlock_lock(&sq->lock);
+		p = sq->head;
+		sq->head = NULL;
+		while (p) {
+			next = p->next;
+			if (p->tmo != ODP_TIMER_INVALID) {
+				CHECK_ERROR(ofp_timer_cancel(p->tmo), rc);
+				p->tmo = ODP_TIMER_INVALID;
+			}
+			sleeper_go(p);
+			p = next;
+		}
+		odp_spinlock_unlock(&sq->lock);
 	}
 
 	ofp_inet_term();
@@ -320,6 +510,112 @@ struct socket *ofp_get_sock_by_fd(int fd)
 	return &shm->socket_list[fd - OFP_SOCK_NUM_OFFSET];
 }
 
+/*
+ * Free sockets cached by this thread. They move from and to the global
+ * free list a batch at a time, so that accept and close rarely need
+ * so_global_mtx.
+ */
+static __thread struct {
+	struct socket *head;
+	int num;
+} so_cache;
+
+static void socket_cache_refill(int n)
+{
+	struct socket *so;
+
+	odp_rwlock_write_lock(&shm->so_global_mtx);
+	while (n-- > 0 && shm->free_sockets) {
+		so = shm->free_sockets;
+		shm->free_sockets = so->next;
+		so->next = so_cache.head;
+		so_cache.head = so;
+		so_cache.num++;
+		shm->sockets_allocated++;
+	}
+	if (shm->sockets_allocated > shm->max_sockets_allocated)
+		shm->max_sockets_allocated = shm->sockets_allocated;
+	odp_rwlock_write_unlock(&shm->so_global_mtx);
+}
+
+static void socket_cache_drain(int n)
+{
+	struct socket *so;
+
+	odp_rwlock_write_lock(&shm->so_global_mtx);
+	while (n-- > 0 && so_cache.head) {
+		so = so_cache.head;
+		so_cache.head = so->next;
+		so_cache.num--;
+		so->next = shm->free_sockets;
+		shm->free_sockets = so;
+		shm->sockets_allocated--;
+	}
+	odp_rwlock_write_unlock(&shm->so_global_mtx);
+}
+
+#define	SOACCQ_SOCKET(node) \
+	((struct socket *)((char *)(node) - offsetof(struct socket, so_accnext)))
+
+static void soaccq_init(struct so_accq *q)
+{
+	odp_atomic_init_u64(&q->aq_stub, 0);
+	odp_atomic_init_u64(&q->aq_tail, (uintptr_t)&q->aq_stub);
+	q->aq_head = &q->aq_stub;
+}
+
+static void soaccq_push_node(struct so_accq *q, odp_atomic_u64_t *node)
+{
+	odp_atomic_u64_t *prev;
+
+	odp_atomic_store_u64(node, 0);
+	odp_mb_release();
+	prev = (odp_atomic_u64_t *)(uintptr_t)
+		odp_atomic_xchg_u64(&q->aq_tail, (uintptr_t)node);
+	odp_atomic_store_rel_u64(prev, (uintptr_t)node);
+}
+
+/*
+ * Append a complete connection to the accept queue of head.
+ * Called with so_qlock of head held.
+ */
+static void soaccq_push(struct socket *head, struct socket *so)
+{
+	so->so_qstate |= SQ_COMP;
+	odp_atomic_inc_u32(&head->so_qlen);
+	soaccq_push_node(&head->so_comp, &so->so_accnext);
+}
+
+/*
+ * Take the oldest connection off the queue, NULL if the queue is empty
+ * or the last push has not finished yet. Called with so_acclock held.
+ */
+static struct socket *soaccq_pop(struct so_accq *q)
+{
+	odp_atomic_u64_t *node = q->aq_head, *next;
+
+	next = (odp_atomic_u64_t *)(uintptr_t)odp_atomic_load_acq_u64(node);
+	if (node == &q->aq_stub) {
+		if (next == NULL)
+			return NULL;
+		q->aq_head = node = next;
+		next = (odp_atomic_u64_t *)(uintptr_t)
+			odp_atomic_load_acq_u64(node);
+	}
+	if (next == NULL) {
+		if ((uintptr_t)node != odp_atomic_load_acq_u64(&q->aq_tail))
+			return NULL;
+		/* Last node: put the stub behind it to be able to unlink it */
+		soaccq_push_node(q, &q->aq_stub);
+		next = (odp_atomic_u64_t *)(uintptr_t)
+			odp_atomic_load_acq_u64(node);
+		if (next == NULL)
+			return NULL;
+	}
+	q->aq_head = next;
+	return SOACCQ_SOCKET(node);
+}
+
 /*
  * Get a socket structure from our zone, and initialize it.
  * Allocate socket and PCB at the same time.
@@ -329,15 +625,16 @@ struct socket *ofp_get_sock_by_fd(int fd)
 static struct socket *soalloc(void)
 {
 #if 1
-	odp_rwlock_write_lock(&shm->so_global_mtx);
-	struct socket *so = shm->free_sockets;
-	if (shm->free_sockets) {
-		shm->free_sockets = shm->free_sockets->next;
-		shm->sockets_allocated++;
-		if (shm->sockets_allocated > shm->max_sockets_allocated)
-			shm->max_sockets_allocated = shm->sockets_allocated;
+	struct socket *so;
+
+	if (!so_cache.head)
+		socket_cache_refill(shm->socket_cache > 1 ?
+				    shm->socket_cache / 2 : 1);
+	so = so_cache.head;
+	if (so) {
+		so_cache.head = so->next;
+		so_cache.num--;
 	}
-	odp_rwlock_write_unlock(&shm->so_global_mtx);
 #else
 	struct socket *so = ofp_socket_pool_alloc(shm->socket_zone);
 #endif
@@ -351,11 +648,19 @@ static struct socket *soalloc(void)
 	int	number = so->so_number;
 	memset(so, 0, sizeof(*so));
 	so->so_number = number;
+	socket_attach_storage(so);
+	so->so_rcv.sb_socket = so;
+	so->so_snd.sb_socket = so;
 
 	SOCKBUF_LOCK_INIT(&so->so_snd, "so_snd");
 	SOCKBUF_LOCK_INIT(&so->so_rcv, "so_rcv");
 	odp_spinlock_init(&so->so_snd.sb_sx);
 	odp_spinlock_init(&so->so_rcv.sb_sx);
+	odp_rwlock_init(&so->so_qlock);
+	odp_spinlock_init(&so->so_acclock);
+	odp_atomic_init_u32(&so->so_qlen, 0);
+	soaccq_init(&so->so_comp);
+	ofp_aio_init_socket(so);
 
 	return (so);
 }
@@ -373,11 +678,17 @@ sodealloc(struct socket *so)
 	KASSERT(so->so_pcb == NULL, ("sodealloc(): so_pcb != NULL"));
 
 	so->so_proto = 0;
-	odp_rwlock_write_lock(&shm->so_global_mtx);
-	so->next = shm->free_sockets;
-	shm->free_sockets = so;
-	shm->sockets_allocated--;
-	odp_rwlock_write_unlock(&shm->so_global_mtx);
+	so->next = so_cache.head;
+	so_cache.head = so;
+	if (++so_cache.num > shm->socket_cache)
+		socket_cache_drain(so_cache.num - shm->socket_cache / 2);
+}
+
+int ofp_socket_term_local(void)
+{
+	if (so_cache.num)
+		socket_cache_drain(so_cache.num);
+	return 0;
 }
 
 /*
@@ -409,7 +720,6 @@ ofp_socreate(int dom, struct socket **aso, int type, int proto, struct thread *t
 		return (OFP_ENOBUFS);
 
 	OFP_TAILQ_INIT(&so->so_incomp);
-	OFP_TAILQ_INIT(&so->so_comp);
 	so->so_type = type;
 	// HJo: FIX: so->so_cred = crhold(cred);
 	so->so_cred = &so->so_cred_space;
@@ -450,9 +760,8 @@ ofp_sonewconn(struct socket *head, int connstatus)
 	struct socket *so;
 	int over;
 
-	ACCEPT_LOCK();
-	over = (head->so_qlen > 3 * head->so_qlimit / 2);
-	ACCEPT_UNLOCK();
+	over = (odp_atomic_load_u32(&head->so_qlen) >
+		3 * head->so_qlimit / 2);
 	if (over)
 		return (NULL);
 	so = soalloc();
@@ -480,18 +789,15 @@ ofp_sonewconn(struct socket *head, int connstatus)
 	so->so_rcv.sb_timeo = head->so_rcv.sb_timeo;
 	so->so_snd.sb_timeo = head->so_snd.sb_timeo;
 	so->so_rcv.sb_flags |= head->so_rcv.sb_flags & SB_AUTOSIZE;
+	so->so_rcv.sb_busy_poll = head->so_rcv.sb_busy_poll;
 	so->so_snd.sb_flags |= head->so_snd.sb_flags & SB_AUTOSIZE;
 	so->so_state |= connstatus;
 
 	so->so_sigevent = head->so_sigevent;
-	so->so_rcv.sb_socket = so;
-	so->so_snd.sb_socket = NULL;
 
-	ACCEPT_LOCK();
+	odp_rwlock_write_lock(&head->so_qlock);
 	if (connstatus) {
-		OFP_TAILQ_INSERT_TAIL(&head->so_comp, so, so_list);
-		so->so_qstate |= SQ_COMP;
-		head->so_qlen++;
+		soaccq_push(head, so);
 	} else {
 		/*
 		 * Keep removing sockets from the head until there's room for
@@ -507,15 +813,15 @@ ofp_sonewconn(struct socket *head, int connstatus)
 			head->so_incqlen--;
 			sp->so_qstate &= ~SQ_INCOMP;
 			sp->so_head = NULL;
-			ACCEPT_UNLOCK();
+			odp_rwlock_write_unlock(&head->so_qlock);
 			ofp_soabort(sp);
-			ACCEPT_LOCK();
+			odp_rwlock_write_lock(&head->so_qlock);
 		}
 		OFP_TAILQ_INSERT_TAIL(&head->so_incomp, so, so_list);
 		so->so_qstate |= SQ_INCOMP;
 		head->so_incqlen++;
 	}
-	ACCEPT_UNLOCK();
+	odp_rwlock_write_unlock(&head->so_qlock);
 	if (connstatus) {
 		sorwakeup(head);
 		ofp_wakeup_one(&head->so_timeo);
@@ -575,6 +881,86 @@ ofp_solisten_proto(struct socket *so, int backlog)
 	so->so_options |= OFP_SO_ACCEPTCONN;
 }
 
+/*
+ * Take the next complete connection off the queue of a listening
+ * socket, sleeping for one unless the socket is non-blocking or flags
+ * has OFP_MSG_DONTWAIT. The returned socket has a reference for the
+ * caller.
+ */
+int
+ofp_solisten_dequeue(struct socket *head, struct socket **ret, int flags)
+{
+	struct socket *so;
+	int error;
+
+	for (;;) {
+		odp_spinlock_lock(&head->so_acclock);
+		so = soaccq_pop(&head->so_comp);
+		odp_spinlock_unlock(&head->so_acclock);
+		if (so != NULL)
+			break;
+
+		/*
+		 * Pushes are done under so_qlock, so an empty queue seen
+		 * here stays empty until ofp_msleep() has queued us.
+		 */
+		odp_rwlock_write_lock(&head->so_qlock);
+		if (head->so_error == 0 &&
+		    odp_atomic_load_u32(&head->so_qlen) == 0) {
+			if (head->so_rcv.sb_state & SBS_CANTRCVMORE)
+				head->so_error = OFP_ECONNABORTED;
+			/*
+			 * The owner of a shard sets up the connections of
+			 * the shard itself, so it never sleeps here.
+			 */
+			else if ((head->so_state & SS_NBIO) ||
+				 (flags & OFP_MSG_DONTWAIT) ||
+				 ofp_shard_id >= 0) {
+				odp_rwlock_write_unlock(&head->so_qlock);
+				return (OFP_EWOULDBLOCK);
+			} else {
+				error = ofp_msleep(&head->so_timeo,
+						   &head->so_qlock, 0,
+						   "accept", 0);
+				if (error) {
+					odp_rwlock_write_unlock(&head->so_qlock);
+					return (error);
+				}
+			}
+		}
+		if (head->so_error) {
+			error = head->so_error;
+			head->so_error = 0;
+			odp_rwlock_write_unlock(&head->so_qlock);
+			return (error);
+		}
+		odp_rwlock_write_unlock(&head->so_qlock);
+	}
+	odp_atomic_dec_u32(&head->so_qlen);
+
+	KASSERT(!(so->so_qstate & SQ_INCOMP), ("accept1: so SQ_INCOMP"));
+	KASSERT(so->so_qstate & SQ_COMP, ("accept1: so not SQ_COMP"));
+
+	/*
+	 * Before changing the flags on the socket, we have to bump the
+	 * reference count.  Otherwise, if the protocol calls ofp_sofree(),
+	 * the socket will be released due to a zero refcount.
+	 */
+	ACCEPT_LOCK();
+	OFP_SOCK_LOCK(so);			/* soref() and so_state update */
+	soref(so);			/* file descriptor reference */
+
+	so->so_state |= (head->so_state & SS_NBIO);
+	so->so_qstate &= ~SQ_COMP;
+	so->so_head = NULL;
+
+	OFP_SOCK_UNLOCK(so);
+	ACCEPT_UNLOCK();
+
+	*ret = so;
+	return (0);
+}
+
 
 static void
 sofree_dequeue(struct socket *so)
@@ -590,17 +976,19 @@ sofree_dequeue(struct socket *so)
 		KASSERT((so->so_qstate & SQ_COMP) == 0 ||
 		    (so->so_qstate & SQ_INCOMP) == 0,
 		    ("ofp_sofree: so->so_qstate is SQ_COMP and also SQ_INCOMP"));
+		odp_rwlock_write_lock(&head->so_qlock);
 		OFP_TAILQ_REMOVE(&head->so_incomp, so, so_list);
 		head->so_incqlen--;
 		so->so_qstate &= ~SQ_INCOMP;
 		so->so_head = NULL;
+		odp_rwlock_write_unlock(&head->so_qlock);
 	}
 	KASSERT((so->so_qstate & SQ_COMP) == 0 &&
 	    (so->so_qstate & SQ_INCOMP) == 0,
 	    ("ofp_sofree: so_head == NULL, but still SQ_COMP(%d) or SQ_INCOMP(%d)",
 	    so->so_qstate & SQ_COMP, so->so_qstate & SQ_INCOMP));
 	if (so->so_options & OFP_SO_ACCEPTCONN) {
-		KASSERT((OFP_TAILQ_EMPTY(&so->so_comp)), ("ofp_sofree: so_comp populated"));
+		KASSERT(odp_atomic_load_u32(&so->so_qlen) == 0, ("ofp_sofree: so_comp populated"));
 		KASSERT((OFP_TAILQ_EMPTY(&so->so_incomp)), ("ofp_sofree: so_comp populated"));
 	}
 }
@@ -704,6 +1092,9 @@ ofp_soclose(struct socket *so)
 
 	KASSERT(!(so->so_state & SS_NOFDREF), ("ofp_soclose: SS_NOFDREF on enter"));
 
+	ofp_epoll_close(so);
+	ofp_aio_close(so);
+
 	//funsetown(&so->so_sigio);
 	if (so->so_state & SS_ISCONNECTED) {
 		if ((so->so_state & SS_ISDISCONNECTING) == 0) {
@@ -715,8 +1106,13 @@ ofp_soclose(struct socket *so)
 			}
 		}
 		if (so->so_options & OFP_SO_LINGER) {
+			/*
+			 * Only the owner, the caller, runs the input that
+			 * ends a sharded connection.
+			 */
 			if ((so->so_state & SS_ISDISCONNECTING) &&
-			    (so->so_state & SS_NBIO))
+			    ((so->so_state & SS_NBIO) ||
+			     (so->so_rcv.sb_flags & SB_SHARDED)))
 				goto drop;
 
 			while (so->so_state & SS_ISCONNECTED) {
@@ -734,26 +1130,32 @@ drop:
 		(*so->so_proto->pr_usrreqs->pru_close)(so);
 	if (so->so_options & OFP_SO_ACCEPTCONN) {
 		struct socket *sp;
-		ACCEPT_LOCK();
+		odp_rwlock_write_lock(&so->so_qlock);
 		while ((sp = OFP_TAILQ_FIRST(&so->so_incomp)) != NULL) {
 			OFP_TAILQ_REMOVE(&so->so_incomp, sp, so_list);
 			so->so_incqlen--;
 			sp->so_qstate &= ~SQ_INCOMP;
 			sp->so_head = NULL;
-			ACCEPT_UNLOCK();
+			odp_rwlock_write_unlock(&so->so_qlock);
 			ofp_soabort(sp);
-			ACCEPT_LOCK();
+			odp_rwlock_write_lock(&so->so_qlock);
 		}
-		while ((sp = OFP_TAILQ_FIRST(&so->so_comp)) != NULL) {
-			OFP_TAILQ_REMOVE(&so->so_comp, sp, so_list);
-			so->so_qlen--;
+		for (;;) {
+			odp_spinlock_lock(&so->so_acclock);
+			sp = soaccq_pop(&so->so_comp);
+			odp_spinlock_unlock(&so->so_acclock);
+			if (sp == NULL)
+				break;
+			odp_atomic_dec_u32(&so->so_qlen);
+			odp_rwlock_write_unlock(&so->so_qlock);
+			ACCEPT_LOCK();
 			sp->so_qstate &= ~SQ_COMP;
 			sp->so_head = NULL;
 			ACCEPT_UNLOCK();
 			ofp_soabort(sp);
-			ACCEPT_LOCK();
+			odp_rwlock_write_lock(&so->so_qlock);
 		}
-		ACCEPT_UNLOCK();
+		odp_rwlock_write_unlock(&so->so_qlock);
 	}
 	ACCEPT_LOCK();
 	OFP_SOCK_LOCK(so);
@@ -788,14 +1190,21 @@ sorflush(struct socket *so)
 
 	/*
 	 * Invalidate/clear most of the sockbuf structure, but leave selinfo
-	 * and mutex data unchanged.
+	 * and mutex data unchanged. The queued packets are freed first,
+	 * which also gives a larger ring back: the copy may share the ring
+	 * of the socket, which input can still append to once the lock is
+	 * dropped.
 	 */
 	SOCKBUF_LOCK(sb);
+	ofp_sbflush_locked(sb);
 	bzero(&asb, offsetof(struct sockbuf, sb_startzero));
 	bcopy(&sb->sb_startzero, &asb.sb_startzero,
 			sizeof(*sb) - offsetof(struct sockbuf, sb_startzero));
 	bzero(&sb->sb_startzero,
 			sizeof(*sb) - offsetof(struct sockbuf, sb_startzero));
+	sb->sb_socket = so;
+	asb.sb_mb = sb->sb_mb;
+	asb.sb_len = sb->sb_len;
 	SOCKBUF_UNLOCK(sb);
 	ofp_sbunlock(sb);
 
@@ -994,7 +1403,6 @@ ofp_sosend_dgram(struct socket *so, struct ofp_sockaddr *addr, struct uio *uio,
 	SOCKBUF_UNLOCK(&so->so_snd);
 
 	if (uio != NULL) {
-		uint8_t *p;
 		error = OFP_ENOBUFS;
 
 		top = ofp_socket_packet_alloc(resid);
@@ -1006,9 +1414,8 @@ ofp_sosend_dgram(struct socket *so, struct ofp_sockaddr *addr, struct uio *uio,
 
 		error = 0;
 
-		p = odp_packet_data(top);
-
-		memcpy(p, data, resid);
+		/* A datagram to be segmented may span packet segments */
+		odp_packet_copy_from_mem(top, 0, resid, data);
 /*Bogdan: ToDo chain of buffers for multiple uio_iov*/
 	}
 
@@ -1215,6 +1622,9 @@ restart:
 					cancopy = global_param->pkt_pool.buffer_size;
 				if (cancopy > space)
 					cancopy = space;
+				if (so->so_snd.sb_segsize &&
+				    cancopy > (long)so->so_snd.sb_segsize)
+					cancopy = so->so_snd.sb_segsize;
 				odp_packet_reset(top, cancopy);
 				odp_packet_user_ptr_set(top, NULL);
 				uint8_t *p = odp_packet_data(top);
@@ -1265,7 +1675,8 @@ restart:
 			if (error)
 				goto release;
 
-			uio->uio_resid -= cancopy;
+			if (uio != NULL)
+				uio->uio_resid -= cancopy;
 		} while (resid && space > 0);
 	} while (resid);
 
@@ -1828,6 +2239,48 @@ release:
 	return (error);
 }
 
+/*
+ * Loop blocking while waiting for a datagram. Returns 0 with the receive
+ * buffer locked when there is one. Otherwise the buffer is unlocked and
+ * an error, or -1 when there is nothing more to receive, is returned.
+ */
+static int
+soreceive_dgram_wait(struct socket *so, int flags, ofp_ssize_t resid)
+{
+	int error;
+
+	SOCKBUF_LOCK(&so->so_rcv);
+	while (so->so_rcv.sb_put == so->so_rcv.sb_get) {
+		KASSERT(so->so_rcv.sb_cc == 0,
+			("ofp_soreceive_dgram: sb_mb NULL but sb_cc %u",
+			 so->so_rcv.sb_cc));
+		if (so->so_error) {
+			error = so->so_error;
+			so->so_error = 0;
+			SOCKBUF_UNLOCK(&so->so_rcv);
+			return (error);
+		}
+		if ((so->so_rcv.sb_state & SBS_CANTRCVMORE) || resid == 0) {
+			SOCKBUF_UNLOCK(&so->so_rcv);
+			return (-1);
+		}
+		if ((so->so_state & SS_NBIO) ||
+		    (flags & (OFP_MSG_DONTWAIT|OFP_MSG_NBIO))) {
+			SOCKBUF_UNLOCK(&so->so_rcv);
+			return (OFP_EWOULDBLOCK);
+		}
+		SBLASTRECORDCHK(&so->so_rcv);
+		SBLASTMBUFCHK(&so->so_rcv);
+		error = ofp_sbwait(&so->so_rcv);
+		if (error) {
+			SOCKBUF_UNLOCK(&so->so_rcv);
+			return (error);
+		}
+	}
+	SOCKBUF_LOCK_ASSERT(&so->so_rcv);
+	return (0);
+}
+
 /*
  * Optimized version of ofp_soreceive() for simple datagram cases from userspace.
  * Unlike in the stream case, we're able to drop a datagram if copyout()
@@ -1875,44 +2328,15 @@ ofp_soreceive_dgram(struct socket *so, struct ofp_sockaddr **psa, struct uio *ui
 	KASSERT((so->so_proto->pr_flags & PR_CONNREQUIRED) == 0,
 		("ofp_soreceive_dgram: P_CONNREQUIRED"));
 
-	/*
-	 * Loop blocking while waiting for a datagram.
-	 */
-	SOCKBUF_LOCK(&so->so_rcv);
-	while (so->so_rcv.sb_put == so->so_rcv.sb_get) {
-		KASSERT(so->so_rcv.sb_cc == 0,
-			("ofp_soreceive_dgram: sb_mb NULL but sb_cc %u",
-			 so->so_rcv.sb_cc));
-		if (so->so_error) {
-			error = so->so_error;
-			so->so_error = 0;
-			SOCKBUF_UNLOCK(&so->so_rcv);
-			return (error);
-		}
-		if ((so->so_rcv.sb_state & SBS_CANTRCVMORE) ||
-		    uio->uio_resid == 0) {
-			SOCKBUF_UNLOCK(&so->so_rcv);
-			return (0);
-		}
-		if ((so->so_state & SS_NBIO) ||
-		    (flags & (OFP_MSG_DONTWAIT|OFP_MSG_NBIO))) {
-			SOCKBUF_UNLOCK(&so->so_rcv);
-			return (OFP_EWOULDBLOCK);
-		}
-		SBLASTRECORDCHK(&so->so_rcv);
-		SBLASTMBUFCHK(&so->so_rcv);
-		error = ofp_sbwait(&so->so_rcv);
-		if (error) {
-			SOCKBUF_UNLOCK(&so->so_rcv);
-			return (error);
-		}
-	}
-	SOCKBUF_LOCK_ASSERT(&so->so_rcv);
+	error = soreceive_dgram_wait(so, flags, uio->uio_resid);
+	if (error)
+		return (error < 0 ? 0 : error);
 
 	odp_packet_t pkt = so->so_rcv.sb_mb[so->so_rcv.sb_get];
 	sbfree(&so->so_rcv, pkt);
-	if (++so->so_rcv.sb_get >= SOCKBUF_LEN)
+	if (++so->so_rcv.sb_get >= so->so_rcv.sb_len)
 		so->so_rcv.sb_get = 0;
+	ofp_sockbuf_ring_drained(&so->so_rcv);
 
 	SOCKBUF_UNLOCK(&so->so_rcv);
 
@@ -1950,6 +2374,202 @@ ofp_soreceive_dgram(struct socket *so, struct ofp_sockaddr **psa, struct uio *ui
 	return (0);
 }
 
+/*
+ * Dequeue up to *num datagrams under one receive buffer lock. Blocks
+ * like ofp_soreceive_dgram() until there is at least one. The number
+ * dequeued is returned in *num; the packets still carry their UDP
+ * header and source address as queued by the protocol.
+ */
+int
+ofp_soreceive_dgram_burst(struct socket *so, odp_packet_t *pkts, int *num,
+			  int flags)
+{
+	int error, n = 0;
+
+	error = soreceive_dgram_wait(so, flags, *num);
+	if (error) {
+		*num = 0;
+		return (error < 0 ? 0 : error);
+	}
+
+	while (n < *num && so->so_rcv.sb_put != so->so_rcv.sb_get) {
+		pkts[n] = so->so_rcv.sb_mb[so->so_rcv.sb_get];
+		sbfree(&so->so_rcv, pkts[n]);
+		if (++so->so_rcv.sb_get >= so->so_rcv.sb_len)
+			so->so_rcv.sb_get = 0;
+		n++;
+	}
+	ofp_sockbuf_ring_drained(&so->so_rcv);
+
+	SOCKBUF_UNLOCK(&so->so_rcv);
+
+	*num = n;
+	return (0);
+}
+
+/* UDP payload length of a queued datagram, -1 if it cannot be read */
+static inline int
+dgram_payload_len(odp_packet_t pkt)
+{
+	struct ofp_udphdr *uh = (struct ofp_udphdr *)odp_packet_l4_ptr(pkt,
+									NULL);
+
+	if (!uh)
+		return -1;
+	return odp_be_to_cpu_16(uh->uh_ulen) - sizeof(*uh);
+}
+
+/*
+ * Dequeue up to *num datagrams that can be returned to the application
+ * as one buffer of at most maxlen bytes: the first one and those after
+ * it from the same sender with the same payload size, ended by a
+ * shorter one. Blocks like ofp_soreceive_dgram() until there is at
+ * least one. The number dequeued is returned in *num.
+ */
+int
+ofp_soreceive_dgram_gro(struct socket *so, odp_packet_t *pkts, int *num,
+			size_t maxlen, int flags)
+{
+	struct ofp_sockaddr *sa0 = NULL, *sa;
+	int error, len, segsize = 0, n = 0;
+	size_t total = 0;
+
+	error = soreceive_dgram_wait(so, flags, *num);
+	if (error) {
+		*num = 0;
+		return (error < 0 ? 0 : error);
+	}
+
+	while (n < *num && so->so_rcv.sb_put != so->so_rcv.sb_get) {
+		odp_packet_t pkt = so->so_rcv.sb_mb[so->so_rcv.sb_get];
+
+		len = dgram_payload_len(pkt);
+		if (n > 0) {
+			/* The sender address is saved on L2 & L3 */
+			sa = (struct ofp_sockaddr *)odp_packet_l2_ptr(pkt,
+								      NULL);
+			if (len <= 0 || len > segsize ||
+			    total + len > maxlen ||
+			    sa->sa_len != sa0->sa_len ||
+			    memcmp(sa, sa0, sa0->sa_len))
+				break;
+		} else {
+			sa0 = (struct ofp_sockaddr *)odp_packet_l2_ptr(pkt,
+								       NULL);
+			segsize = len;
+		}
+
+		pkts[n++] = pkt;
+		sbfree(&so->so_rcv, pkt);
+		if (++so->so_rcv.sb_get >= so->so_rcv.sb_len)
+			so->so_rcv.sb_get = 0;
+		total += len;
+
+		if (len <= 0 || len < segsize)
+			break;
+	}
+	ofp_sockbuf_ring_drained(&so->so_rcv);
+
+	SOCKBUF_UNLOCK(&so->so_rcv);
+
+	*num = n;
+	return (0);
+}
+
+/*
+ * Zero-copy stream receive. Hands up to *num packets from the head of
+ * the receive buffer to the caller, who becomes their owner. The packets
+ * hold payload only. Blocks like ofp_soreceive_generic() until there is
+ * data, and lets the protocol update the receive window afterwards.
+ */
+int
+ofp_soreceive_pkt(struct socket *so, odp_packet_t *pkts, int *num, int flags)
+{
+	struct protosw *pr = so->so_proto;
+	odp_packet_t m;
+	int error, n = 0;
+	uint32_t len;
+
+	error = ofp_sblock(&so->so_rcv, SBLOCKWAIT(flags));
+	if (error) {
+		*num = 0;
+		return (error);
+	}
+
+	SOCKBUF_LOCK(&so->so_rcv);
+	while ((m = ofp_sockbuf_get_first(&so->so_rcv)) == ODP_PACKET_INVALID) {
+		if (so->so_error) {
+			error = so->so_error;
+			so->so_error = 0;
+			goto out;
+		}
+		if ((so->so_rcv.sb_state & SBS_CANTRCVMORE) || *num == 0)
+			goto out;
+		if ((so->so_state & (SS_ISCONNECTED|SS_ISCONNECTING)) == 0 &&
+		    (pr->pr_flags & PR_CONNREQUIRED)) {
+			error = OFP_ENOTCONN;
+			goto out;
+		}
+		if ((so->so_state & SS_NBIO) ||
+		    (flags & (OFP_MSG_DONTWAIT|OFP_MSG_NBIO))) {
+			error = OFP_EWOULDBLOCK;
+			goto out;
+		}
+		error = ofp_sbwait(&so->so_rcv);
+		if (error)
+			goto out;
+	}
+
+	while (n < *num && m != ODP_PACKET_INVALID) {
+		len = odp_packet_len(m);
+		so->so_rcv.sb_state &= ~SBS_RCVATMARK;
+
+		/*
+		 * Stop at the out-of-band mark, see ofp_soreceive_generic().
+		 * The data up to a mark inside a packet is handed over in a
+		 * copy, the rest stays queued.
+		 */
+		if (so->so_oobmark && len > so->so_oobmark) {
+			odp_packet_t head = m;
+
+			len = so->so_oobmark;
+			m = ofp_socket_packet_alloc(len);
+			if (m == ODP_PACKET_INVALID) {
+				if (n == 0)
+					error = OFP_ENOBUFS;
+				break;
+			}
+			odp_packet_copy_from_pkt(m, 0, head, 0, len);
+			ofp_sbdrop_locked(&so->so_rcv, len);
+		} else {
+			sbfree(&so->so_rcv, m);
+			ofp_sockbuf_remove_first(&so->so_rcv);
+		}
+		pkts[n++] = m;
+
+		if (so->so_oobmark) {
+			so->so_oobmark = len < so->so_oobmark ?
+				so->so_oobmark - len : 0;
+			if (so->so_oobmark == 0) {
+				so->so_rcv.sb_state |= SBS_RCVATMARK;
+				break;
+			}
+		}
+		m = ofp_sockbuf_get_first(&so->so_rcv);
+	}
+
+	if (n && (pr->pr_flags & PR_WANTRCVD)) {
+		SOCKBUF_UNLOCK(&so->so_rcv);
+		(*pr->pr_usrreqs->pru_rcvd)(so, flags);
+		SOCKBUF_LOCK(&so->so_rcv);
+	}
+out:
+	SOCKBUF_UNLOCK(&so->so_rcv);
+	ofp_sbunlock(&so->so_rcv);
+	*num = n;
+	return (error);
+}
+
 int
 ofp_soreceive(struct socket *so, struct ofp_sockaddr **psa, struct uio *uio,
 	  odp_packet_t *mp0, odp_packet_t *controlp, int *flagsp)
@@ -2077,6 +2697,18 @@ ofp_sosetopt(struct socket *so, struct sockopt *sopt)
 			so->so_user_cookie = val32;
 			break;
 
+		case OFP_SO_BUSY_POLL:
+			error = ofp_sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				goto bad;
+			if (optval < 0) {
+				error = OFP_EINVAL;
+				goto bad;
+			}
+			so->so_rcv.sb_busy_poll = optval;
+			break;
+
 		case OFP_SO_L2INFO:
 			error = OFP_EOPNOTSUPP;
 			break;
@@ -2313,13 +2945,17 @@ integer:
 			goto integer;
 
 		case OFP_SO_LISTENQLEN:
-			optval = so->so_qlen;
+			optval = odp_atomic_load_u32(&so->so_qlen);
 			goto integer;
 
 		case OFP_SO_LISTENINCQLEN:
 			optval = so->so_incqlen;
 			goto integer;
 
+		case OFP_SO_BUSY_POLL:
+			optval = so->so_rcv.sb_busy_poll;
+			goto integer;
+
 		default:
 			error = OFP_ENOPROTOOPT;
 			break;
@@ -2376,7 +3012,6 @@ ofp_soisconnected(struct socket *so)
 {
 	struct socket *head;
 
-	ACCEPT_LOCK();
 	OFP_SOCK_LOCK(so);
 	so->so_state &= ~(SS_ISCONNECTING|SS_ISDISCONNECTING|SS_ISCONFIRMING);
 	so->so_state |= SS_ISCONNECTED;
@@ -2384,18 +3019,40 @@ ofp_soisconnected(struct socket *so)
 	if (head != NULL && (so->so_qstate & SQ_INCOMP)) {
 		if ((so->so_options & OFP_SO_ACCEPTFILTER) == 0) {
 			OFP_SOCK_UNLOCK(so);
-			OFP_TAILQ_REMOVE(&head->so_incomp, so, so_list);
-			head->so_incqlen--;
-			so->so_qstate &= ~SQ_INCOMP;
-			OFP_TAILQ_INSERT_TAIL(&head->so_comp, so, so_list);
-			head->so_qlen++;
-			so->so_qstate |= SQ_COMP;
+			/*
+			 * The listener may be closed meanwhile. The reference
+			 * keeps it from being freed, and its socket reused,
+			 * while its queue lock is taken.
+			 */
+			ACCEPT_LOCK();
+			head = so->so_head;
+			if (head == NULL) {
+				ACCEPT_UNLOCK();
+				return;
+			}
+			OFP_SOCK_LOCK(head);
+			soref(head);
+			OFP_SOCK_UNLOCK(head);
 			ACCEPT_UNLOCK();
-			ofp_send_sock_event(head, so, OFP_EVENT_ACCEPT);
-			sorwakeup(head);
-			ofp_wakeup_one(&head->so_timeo);
+
+			odp_rwlock_write_lock(&head->so_qlock);
+			if (so->so_head == head &&
+			    (so->so_qstate & SQ_INCOMP)) {
+				OFP_TAILQ_REMOVE(&head->so_incomp, so, so_list);
+				head->so_incqlen--;
+				so->so_qstate &= ~SQ_INCOMP;
+				soaccq_push(head, so);
+				odp_rwlock_write_unlock(&head->so_qlock);
+				ofp_send_sock_event(head, so, OFP_EVENT_ACCEPT);
+				sorwakeup(head);
+				ofp_wakeup_one(&head->so_timeo);
+			} else
+				odp_rwlock_write_unlock(&head->so_qlock);
+
+			ACCEPT_LOCK();
+			OFP_SOCK_LOCK(head);
+			sorele(head);
 		} else {
-			ACCEPT_UNLOCK();
 			ofp_soupcall_set(so, OFP_SO_RCV,
 			    head->so_accf->so_accept_filter->accf_callback,
 			    head->so_accf->so_accept_filter_arg);
@@ -2415,7 +3072,6 @@ ofp_soisconnected(struct socket *so)
 		return;
 	}
 	OFP_SOCK_UNLOCK(so);
-	ACCEPT_UNLOCK();
 	ofp_wakeup(&so->so_timeo);
 	sorwakeup(so);
 	sowwakeup(so);
@@ -2528,32 +3184,171 @@ ofp_sohasoutofband(struct socket *so)
 	/* HJo: FIX
 	selwakeuppri(&so->so_rcv.sb_sel, PSOCK);
 	*/
+	ofp_so_readiness_changed(so, &so->so_rcv);
+	ofp_wakeup(NULL);
 	ofp_wakeup(&so->so_rcv.sb_sel);
 }
 
-/* Emulation for BSD ofp_wakeup */
+/*
+ * Readiness generation. A readiness change of a sockbuf that a select
+ * has registered on (SB_SEL) takes a new generation number from the
+ * global counter and clears the registration. A select that slept can
+ * then re-check only the sockets stamped after it went to sleep.
+ * Sockets nobody selects on never touch the counter.
+ *
+ * The counter is bumped under so_rgen_mtx, which select holds from its
+ * last look at the counter until its sleeper is queued, so the
+ * ofp_wakeup() that follows the bump cannot miss it.
+ */
+void
+ofp_so_readiness_changed(struct socket *so, struct sockbuf *sb)
+{
+	SOCKBUF_LOCK_ASSERT(sb);
+
+	if (!(sb->sb_flags & SB_SEL))
+		return;
+
+	sb->sb_flags &= ~SB_SEL;
+	odp_rwlock_write_lock(&shm->so_rgen_mtx);
+	so->so_rgen = odp_atomic_fetch_inc_u64(&shm->so_rgen) + 1;
+	odp_rwlock_write_unlock(&shm->so_rgen_mtx);
+}
+
+uint64_t
+ofp_so_readiness_gen(void)
+{
+	return odp_atomic_load_u64(&shm->so_rgen);
+}
+
+odp_rwlock_t *
+ofp_so_readiness_mtx(void)
+{
+	return &shm->so_rgen_mtx;
+}
+
+/*
+ * Emulation for BSD ofp_wakeup
+ *
+ * Sleepers are queued on a wait queue picked by hashing the channel, so
+ * a wakeup only walks the sleepers sharing the bucket of its channel.
+ * A sleeper polls its wakeup flag sleep_spin times and then blocks on
+ * it in the kernel with futex. A busy polling sleeper first runs the
+ * dispatcher itself until it is woken or its busy poll time is up.
+ * Select sleeps on the NULL channel, which is woken by ofp_sowakeup()
+ * when a socket changes readiness.
+ */
+
+static inline struct sleep_queue *
+sleep_queue(void *channel)
+{
+	uint64_t h = (uint64_t)(uintptr_t)channel * 0x9e3779b97f4a7c15ULL;
+
+	return &shm->sleep_queues[(h >> 32) & shm->sleep_queue_mask];
+}
+
+/*
+ * A sleeper that is still spinning sees go without a system call. The
+ * sequentially consistent store and load pair with the ones of
+ * sleeper_wait(), so either the waker sees blocked or the sleeper sees
+ * go before it blocks.
+ */
+static void
+sleeper_go(struct sleeper *sleepy)
+{
+	__atomic_store_n(&sleepy->go, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleepy->blocked, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &sleepy->go, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void
+sleeper_wait(struct sleeper *sleepy, uint32_t busy_poll)
+{
+	int spin = global_param->sleep_spin;
+	odp_time_t end;
+
+	if (busy_poll) {
+		end = odp_time_sum(odp_time_local(),
+				   odp_time_local_from_ns(busy_poll *
+							  ODP_TIME_USEC_IN_NS));
+		while (!__atomic_load_n(&sleepy->go, __ATOMIC_ACQUIRE) &&
+		       odp_time_cmp(end, odp_time_local()) > 0) {
+			int num = ofp_busy_poll();
+
+			if (num < 0)
+				break;
+			if (!num)
+				odp_cpu_pause();
+		}
+		ofp_busy_poll_end();
+	}
+
+	while (!__atomic_load_n(&sleepy->go, __ATOMIC_ACQUIRE)) {
+		if (spin > 0) {
+			spin--;
+			odp_cpu_pause();
+			continue;
+		}
+		__atomic_store_n(&sleepy->blocked, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&sleepy->go, __ATOMIC_SEQ_CST))
+			break;
+		/* Returns at once if go is no longer 0 */
+		syscall(SYS_futex, &sleepy->go, FUTEX_WAIT, 0, NULL, NULL, 0);
+	}
+}
+
+/* Unlink a sleeper from its queue. Called with the queue locked. */
+static int
+sleep_queue_remove(struct sleep_queue *sq, struct sleeper *sleepy)
+{
+	struct sleeper **pp;
 
-static int _ofp_wakeup(void *channel, int one, int tmo);
+	for (pp = &sq->head; *pp; pp = &(*pp)->next)
+		if (*pp == sleepy) {
+			*pp = sleepy->next;
+			return 1;
+		}
 
-struct voidarg {
-	void *p;
+	return 0;
+}
+
+struct sleep_timeout_arg {
+	struct sleeper *sleepy;
+	void *channel;
+	uint32_t seq;
 };
 
 static void
 sleep_timeout(void *arg)
 {
-	struct voidarg *arg1 = arg;
-	_ofp_wakeup(arg1->p, 1, 1);
+	struct sleep_timeout_arg *targ = arg;
+	struct sleeper *sleepy = targ->sleepy;
+	struct sleep_queue *sq = sleep_queue(targ->channel);
+
+	odp_spinlock_lock(&sq->lock);
+	/* The sleeper may have been woken and reused meanwhile */
+	if (sleepy->seq == targ->seq && sleep_queue_remove(sq, sleepy)) {
+		sleepy->tmo = ODP_TIMER_INVALID;
+		sleepy->woke_by_timer = 1;
+		sleeper_go(sleepy);
+	}
+	odp_spinlock_unlock(&sq->lock);
 }
 
 int
 ofp_msleep(void *channel, odp_rwlock_t *mtx, int priority, const char *wmesg,
 	     uint32_t timeout)
 {
+	return ofp_msleep_busy(channel, mtx, priority, wmesg, timeout, 0);
+}
+
+int
+ofp_msleep_busy(void *channel, odp_rwlock_t *mtx, int priority,
+		const char *wmesg, uint32_t timeout, uint32_t busy_poll)
+{
+	struct sleep_queue *sq = sleep_queue(channel);
+	struct sleep_timeout_arg arg;
 	struct sleeper *sleepy;
-	struct voidarg arg;
 	int ret;
-	(void)mtx;
 	(void)priority;
 
 	odp_spinlock_lock(&shm->sleep_lock);
@@ -2564,92 +3359,88 @@ ofp_msleep(void *channel, odp_rwlock_t *mtx, int priority, const char *wmesg,
 	}
 	sleepy = shm->free_sleepers;
 	shm->free_sleepers = sleepy->next;
+	odp_spinlock_unlock(&shm->sleep_lock);
 
-	sleepy->next = shm->sleep_list;
 	sleepy->channel = channel;
 	sleepy->wmesg = wmesg;
 	sleepy->go = 0;
+	sleepy->blocked = 0;
+	sleepy->seq++;
 	sleepy->woke_by_timer = 0;
 	sleepy->tmo = ODP_TIMER_INVALID;
-	shm->sleep_list = sleepy;
+
+	odp_spinlock_lock(&sq->lock);
+	sleepy->next = sq->head;
+	sq->head = sleepy;
 	if (timeout) {
-		arg.p = channel;
-		sleepy->tmo = ofp_timer_start(timeout, sleep_timeout, &arg, sizeof(arg));
+		arg.sleepy = sleepy;
+		arg.channel = channel;
+		arg.seq = sleepy->seq;
+		sleepy->tmo = ofp_timer_start(timeout, sleep_timeout,
+					      &arg, sizeof(arg));
 	}
-	odp_spinlock_unlock(&shm->sleep_lock);
+	odp_spinlock_unlock(&sq->lock);
 
-	while (sleepy->go == 0) {
-		if (mtx) {
-			odp_rwlock_write_unlock(mtx);
-		}
-		sched_yield();
-		if (mtx) {
-			odp_rwlock_write_lock(mtx);
-		}
-	}
+	/* Queued before mtx is released, so no wakeup can be missed */
+	if (mtx)
+		odp_rwlock_write_unlock(mtx);
 
-	odp_spinlock_lock(&shm->sleep_lock);
+	sleeper_wait(sleepy, busy_poll > ofp_busy_poll_usec ?
+		     busy_poll : ofp_busy_poll_usec);
 
-	if (sleepy->tmo != ODP_TIMER_INVALID)
-		ofp_timer_cancel(sleepy->tmo);
+	if (mtx)
+		odp_rwlock_write_lock(mtx);
 
+	odp_spinlock_lock(&sq->lock);
+	if (sleepy->tmo != ODP_TIMER_INVALID) {
+		ofp_timer_cancel(sleepy->tmo);
+		sleepy->tmo = ODP_TIMER_INVALID;
+	}
 	ret = sleepy->woke_by_timer ? OFP_EWOULDBLOCK : 0;
+	odp_spinlock_unlock(&sq->lock);
 
+	odp_spinlock_lock(&shm->sleep_lock);
 	sleepy->next = shm->free_sleepers;
 	shm->free_sleepers = sleepy;
-
 	odp_spinlock_unlock(&shm->sleep_lock);
 
 	return ret;
 }
 
 static int
-_ofp_wakeup(void *channel, int one, int tmo)
+_ofp_wakeup(void *channel, int one)
 {
-	struct sleeper *p, *prev = NULL, *next;
+	struct sleep_queue *sq = sleep_queue(channel);
+	struct sleeper **pp, *p;
 
-	odp_spinlock_lock(&shm->sleep_lock);
+	odp_spinlock_lock(&sq->lock);
 
-	p = shm->sleep_list;
-	while (p) {
-		next = p->next;
-		if (channel == p->channel) {
-			if (prev)
-				prev->next = p->next;
-			else
-				shm->sleep_list = p->next;
-			if (tmo) {
-				p->tmo = ODP_TIMER_INVALID;
-				p->woke_by_timer = 1;
-			}
-			p->go = 1;
-			if (one)
-				break;
-		} else
-			prev = p;
-		p = next;
+	pp = &sq->head;
+	while ((p = *pp)) {
+		if (channel != p->channel) {
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		sleeper_go(p);
+		if (one)
+			break;
 	}
 
-	odp_spinlock_unlock(&shm->sleep_lock);
+	odp_spinlock_unlock(&sq->lock);
 	return -1;
 }
 
 int
 ofp_wakeup_one(void *channel)
 {
-	/* wake up selects */
-	if (channel)
-		_ofp_wakeup(NULL, 0, 0);
-	return _ofp_wakeup(channel, 1, 0);
+	return _ofp_wakeup(channel, 1);
 }
 
 int
 ofp_wakeup(void *channel)
 {
-	/* wake up selects */
-	if (channel)
-		_ofp_wakeup(NULL, 0, 0);
-	return _ofp_wakeup(channel, 0, 0);
+	return _ofp_wakeup(channel, 0);
 }
 
 
@@ -2835,7 +3626,15 @@ ofp_send_sock_event(struct socket *head, struct socket *so, int event)
 {
 	struct ofp_sigevent *ev = &head->so_sigevent;
 
-	if (ev->ofp_sigev_notify) {
+	if (ev->ofp_sigev_notify == OFP_SIGEV_BATCH) {
+		struct ofp_sock_sigval ss;
+
+		ss.event = event;
+		ss.sockfd = head->so_number;
+		ss.sockfd2 = so->so_number;
+		ss.pkt = ODP_PACKET_INVALID;
+		ofp_sigev_batch(ev, &ss);
+	} else if (ev->ofp_sigev_notify) {
 		union ofp_sigval sv;
 		struct ofp_sock_sigval ss;
 
@@ -2863,7 +3662,7 @@ is_accepting_socket(struct socket *so)
 static inline int
 is_accepting_socket_readable(struct socket *so)
 {
-	return !(OFP_TAILQ_EMPTY(&so->so_comp));
+	return odp_atomic_load_u32(&so->so_qlen) != 0;
 }
 
 static inline int
@@ -2882,3 +3681,23 @@ is_readable(int fd)
 
 	return is_listening_socket_readable(so);
 }
+
+int
+is_writable(int fd)
+{
+	struct socket *so = ofp_get_sock_by_fd(fd);
+
+	if (is_accepting_socket(so))
+		return 0;
+
+	return sowriteable(so);
+}
+
+int
+is_exceptional(int fd)
+{
+	struct socket *so = ofp_get_sock_by_fd(fd);
+
+	return so->so_oobmark != 0 ||
+		(so->so_rcv.sb_state & SBS_RCVATMARK) != 0;
+}
@@ -32,6 +32,7 @@ uint8_t frame[64] = {
 
 struct tstate_s {
 	volatile uint64_t packets;
+	volatile uint64_t cycles;
 	volatile odp_time_t time;
 	volatile int stop;
 } ODP_CACHE_ALIGN;
@@ -67,7 +68,7 @@ const uint8_t ether_dhost[OFP_ETHER_ADDR_LEN] = {0xa, 0xb, 0, 0, 0, 0};
 
 struct arg_s {
 	volatile uint32_t batch, dispw, interval, ivals, loglevel, masklen,
-		neighbor_bits, route_bits, verify, warmup, workers;
+		neighbor_bits, parsed, route_bits, verify, warmup, workers;
 } arg, default_arg = {
 	.batch = 64,
 	.dispw = 0,
@@ -76,6 +77,7 @@ struct arg_s {
 	.loglevel = OFP_LOG_ERROR,
 	.masklen = 24,
 	.neighbor_bits = 0,
+	.parsed = 1,
 	.route_bits = 0,
 	.verify = 0,
 	.warmup = 5,
@@ -129,6 +131,7 @@ static void *worker(void *p)
 		ip->ip_sum = ofp_cksum_buffer((uint16_t *)ip, ip->ip_hl<<2);
 		odp_packet_has_eth_set(pkt, 1);
 		odp_packet_has_ipv4_set(pkt, 1);
+		odp_packet_has_l3_set(pkt, arg.parsed);
 		odp_packet_l2_offset_set(pkt, 0);
 		odp_packet_l3_offset_set(pkt, OFP_ETHER_HDR_LEN);
 		odp_packet_l4_offset_set(pkt, OFP_ETHER_HDR_LEN + (ip->ip_hl<<2));
@@ -195,12 +198,14 @@ static void *worker(void *p)
 		}
 
 		odp_time_t start = odp_time_global();
+		uint64_t cycles = odp_cpu_cycles();
 
 		for (c = 0; c < num; c++)
 			ASSERT(ofp_packet_input(burst[c], dummyq, ofp_eth_vlan_processing) == OFP_PKT_PROCESSED);
 
 		res = ofp_send_pending_pkt();
 
+		tstate[cpuid].cycles += odp_cpu_cycles_diff(odp_cpu_cycles(), cycles);
 		tstate[cpuid].time = odp_time_sum(tstate[cpuid].time, odp_time_diff(odp_time_global(), start));
 		tstate[cpuid].packets += num;
 	}
@@ -225,6 +230,8 @@ static void usage(const char *prog)
 	printf("-m, --masklen       Route subnet mask length. (%u)\n", default_arg.masklen);
 	printf("-n, --neighbor-bits Neighbor address range in bits. Number of\n"
 	       "                    neighbors is 2**<neighbor-bits>. (%u)\n", default_arg.neighbor_bits);
+	printf("-p, --parsed        Use packet parse results as if set by the\n"
+	       "                    pktio. 0 parses headers in software. (%u)\n", default_arg.parsed);
 	printf("-r, --route-bits    Route range in bits. Number of routes is\n"
 	       "                    2**<route-bits>. (%u)\n", default_arg.route_bits);
 	printf("-v, --verify        Verify output packets. (%u)\n", default_arg.verify);
@@ -250,6 +257,7 @@ static void parse_args(int argc, char *argv[])
 			{"loglevel",      required_argument, 0, 'l'},
 			{"masklen",       required_argument, 0, 'm'},
 			{"neighbor-bits", required_argument, 0, 'n'},
+			{"parsed",        required_argument, 0, 'p'},
 			{"route-bits",    required_argument, 0, 'r'},
 			{"interval",      required_argument, 0, 't'},
 			{"warmup",        required_argument, 0, 'u'},
@@ -258,7 +266,7 @@ static void parse_args(int argc, char *argv[])
 			{0,               0,                 0,  0 }
 		};
 
-		int c = getopt_long(argc, argv, "b:d:i:l:m:n:r:t:u:v:w:",
+		int c = getopt_long(argc, argv, "b:d:i:l:m:n:p:r:t:u:v:w:",
 				    long_options, NULL);
 		if (c == -1)
 			break;
@@ -270,6 +278,7 @@ static void parse_args(int argc, char *argv[])
 		case 'l': arg.loglevel = atoi(optarg); break;
 		case 'm': arg.masklen = atoi(optarg); break;
 		case 'n': arg.neighbor_bits = atoi(optarg); break;
+		case 'p': arg.parsed = atoi(optarg); break;
 		case 'r': arg.route_bits = atoi(optarg); break;
 		case 't': arg.interval = atoi(optarg); break;
 		case 'u': arg.warmup = atoi(optarg); break;
@@ -336,6 +345,8 @@ int main(int argc, char *argv[])
 
 	ifnet = ofp_get_ifnet(C_PORT, C_VLAN);
 	ASSERT((ifnet->pkt_pool = odp_pool_lookup("packet_pool")) != ODP_POOL_INVALID);
+	ifnet->if_parse = arg.parsed ?
+		OFP_IF_PARSE_PKTIN | OFP_IF_PARSE_IPV4_CSUM : 0;
 
 	odp_queue_param_t qpar;
 	odp_queue_param_init(&qpar);
@@ -404,17 +415,19 @@ int main(int argc, char *argv[])
 		memcpy(ntstate, tstate, sizeof(tstate));
 		odp_time_t time = odp_time_diff(ntime, ltime);
 		ltime = ntime;
-		uint64_t packets = 0, tpackets = 0;
+		uint64_t packets = 0, tpackets = 0, cycles = 0;
 		odp_time_t utime = odp_time_diff(ntime, ntime);
 		for (i = 0; i < arg.workers; i++) {
 			packets += ntstate[i].packets - ltstate[i].packets;
+			cycles += ntstate[i].cycles - ltstate[i].cycles;
 			tpackets += ntstate[i].packets;
 			utime = odp_time_sum(utime, odp_time_diff(ntstate[i].time, ltstate[i].time));
 		}
 		double dtime = odp_time_to_sec(time);
 		double pps = packets / dtime;
 		double util = odp_time_to_sec(utime)/dtime/(double)arg.workers;
-		printf("pps=%g pps/worker=%g work=%.3f ", pps, pps/(double)arg.workers, util);
+		printf("pps=%g pps/worker=%g work=%.3f cycles/pkt=%.1f ", pps, pps/(double)arg.workers, util,
+		       packets ? (double)cycles/(double)packets : 0.0);
 
 		double wpps = 0, high = 0, low = 0;
 		for (i = 0; i < arg.workers; i++) {
@@ -12,8 +12,10 @@
 #include "ofp_epoll.h"
 #include "ofpi_epoll.h"
 #include <stdint.h>
+#include <stdlib.h>
 #include "ofp_errno.h"
 #include "ofpi_socketvar.h"
+#include "ofpi_shared_mem.h"
 #include "ofp_cunit_version.h"
 
 #if OFP_TESTMODE_AUTO
@@ -30,13 +32,11 @@
 #define SETUP_BLOCKING
 #endif
 
-#define LENGTH(array) \
-	sizeof(array)/sizeof(*array)
-#define FOREACH(item, array) \
-	int i, l, breaked; \
-	for (i = 0, l = LENGTH(array), breaked = 0; i < l && !breaked; ++i, breaked = !breaked) \
-		for (item = &array[i]; !breaked; breaked = !breaked)
+#define TEST_EPOLL_WATCHES 16
 
+void ofp_init_global_param_from_file(ofp_global_param_t *params, const char *filename);
+ofp_global_param_t ofp_global_param;
+extern __thread ofp_global_param_t *global_param;
 
 static const int epfd = OFP_SOCK_NUM_OFFSET;
 static const int fd = OFP_SOCK_NUM_OFFSET + 1;
@@ -196,14 +196,15 @@ static void test_add_registered_fd(void)
 	CU_ASSERT_EQUAL(ofp_errno, OFP_EEXIST);
 }
 
-static void fill_epoll_set(void);
+static int fill_epoll_set(void);
 static void test_add_past_limit(void)
 {
 	SETUP_NON_BLOCKING;
 
-	fill_epoll_set();
+	const int next_fd = fill_epoll_set();
 
-	CU_ASSERT_EQUAL(add_fd(fd), -1);
+	ofp_errno = 0;
+	CU_ASSERT_EQUAL(add_fd(next_fd), -1);
 	CU_ASSERT_EQUAL(ofp_errno, OFP_ENOSPC);
 }
 
@@ -229,11 +230,12 @@ static void test_wait_with_no_available_events(void)
 }
 
 static int fd_is_readable(int fd);
+static void make_readable(void);
 static void test_wait_with_multiple_available_events(void)
 {
 	SETUP_NON_BLOCKING;
 
-	ofp_set_is_readable_checker(fd_is_readable);
+	make_readable();
 
 	CU_ASSERT_EQUAL(epoll_wait(2), 2);
 }
@@ -266,6 +268,73 @@ static void test_wait_with_unset_events(void)
 	CU_ASSERT_EQUAL(epoll_wait(2), 0);
 }
 
+static int fd_is_writable(int fd);
+static void test_wait_with_writable_fd(void)
+{
+	SETUP_NON_BLOCKING;
+
+	ofp_set_is_readable_checker(fd_not_readable);
+	ofp_set_is_writable_checker(fd_is_writable);
+
+	CU_ASSERT_EQUAL(modify_fd(fd, OFP_EPOLLOUT), 0);
+	CU_ASSERT_EQUAL(epoll_wait(2), 1);
+	CU_ASSERT_EQUAL(events[0].events, OFP_EPOLLOUT);
+	CU_ASSERT_EQUAL(events[0].data.u32, 313);
+}
+
+static void test_wait_level_triggered(void)
+{
+	SETUP_NON_BLOCKING;
+
+	make_readable();
+
+	CU_ASSERT_EQUAL(epoll_wait(2), 2);
+	CU_ASSERT_EQUAL(epoll_wait(2), 2);
+}
+
+static void test_wait_edge_triggered(void)
+{
+	SETUP_NON_BLOCKING;
+
+	make_readable();
+	CU_ASSERT_EQUAL(modify_fd(fd, OFP_EPOLLIN | OFP_EPOLLET), 0);
+	CU_ASSERT_EQUAL(modify_fd(fd + 1, OFP_EPOLLIN | OFP_EPOLLET), 0);
+
+	CU_ASSERT_EQUAL(epoll_wait(2), 2);
+	CU_ASSERT_EQUAL(epoll_wait(2), 0);
+
+	make_readable();
+	CU_ASSERT_EQUAL(epoll_wait(2), 2);
+}
+
+static void test_wait_one_shot(void)
+{
+	SETUP_NON_BLOCKING;
+
+	make_readable();
+	CU_ASSERT_EQUAL(modify_fd(fd, OFP_EPOLLIN | OFP_EPOLLONESHOT), 0);
+	CU_ASSERT_EQUAL(modify_fd(fd + 1, 0), 0);
+
+	CU_ASSERT_EQUAL(epoll_wait(2), 1);
+	make_readable();
+	CU_ASSERT_EQUAL(epoll_wait(2), 0);
+
+	CU_ASSERT_EQUAL(modify_fd(fd, OFP_EPOLLIN | OFP_EPOLLONESHOT), 0);
+	CU_ASSERT_EQUAL(epoll_wait(2), 1);
+	CU_ASSERT_EQUAL(events[0].data.u32, 313);
+}
+
+static void test_wait_after_delete(void)
+{
+	SETUP_NON_BLOCKING;
+
+	make_readable();
+	CU_ASSERT_EQUAL(delete_fd(fd), 0);
+
+	CU_ASSERT_EQUAL(epoll_wait(2), 1);
+	CU_ASSERT_EQUAL(events[0].data.fd, fd + 1);
+}
+
 static void setup_blocking(void)
 {
 	setup_non_blocking();
@@ -296,7 +365,7 @@ static void test_wait_with_already_readable_fd(void)
 {
 	SETUP_BLOCKING;
 
-	ofp_set_is_readable_checker(fd_is_readable);
+	make_readable();
 
 	CU_ASSERT_EQUAL(epoll_wait_with_timeout(2, 1), 2);
 	CU_ASSERT_FALSE(sleeper_called);
@@ -307,8 +376,18 @@ static char *const_cast(const char *str)
 	return (char *)(uintptr_t)str;
 }
 
+static void *allocator(const char *name, uint64_t size);
+
 int main(void)
 {
+	global_param = &ofp_global_param;
+	ofp_init_global_param_from_file(global_param, "");
+	global_param->epoll_watches = TEST_EPOLL_WATCHES;
+
+	ofp_set_custom_allocator(allocator);
+	if (ofp_epoll_init_global())
+		return -1;
+
 	if (CU_initialize_registry() != CUE_SUCCESS)
 		return CU_get_error();
 
@@ -373,6 +452,16 @@ int main(void)
 		  test_modify_registered_fd },
 		{ const_cast("Wait will return zero when events bit mask is unset"),
 		  test_wait_with_unset_events },
+		{ const_cast("Wait will return writable fd"),
+		  test_wait_with_writable_fd },
+		{ const_cast("Wait will return level-triggered fd again"),
+		  test_wait_level_triggered },
+		{ const_cast("Wait will return edge-triggered fd once per wakeup"),
+		  test_wait_edge_triggered },
+		{ const_cast("Wait will return one-shot fd until re-armed"),
+		  test_wait_one_shot },
+		{ const_cast("Wait will not return deleted fd"),
+		  test_wait_after_delete },
 		CU_TEST_INFO_NULL
 	};
 
@@ -434,13 +523,11 @@ int failing_socket_creator(void)
 
 static int epoll_socket_creator(void)
 {
-	struct epoll_set *epoll_set;
+	/* Release the registrations of the previous test */
+	ofp_epoll_close(&epoll);
 
 	epoll.so_number = epfd;
-	epoll.so_type = OFP_SOCK_EPOLL;
-
-	FOREACH(epoll_set, epoll.epoll_set)
-		epoll_set->fd = -1;
+	ofp_epoll_init_socket(&epoll);
 
 	return epoll.so_number;
 }
@@ -457,13 +544,8 @@ int is_epoll_socket(struct socket *socket)
 
 int is_epoll_set_initialized(struct socket *epoll)
 {
-	struct epoll_set *epoll_set;
-
-	FOREACH(epoll_set, epoll->epoll_set)
-		if (epoll_set->fd != -1)
-			return 0;
-
-	return 1;
+	return (OFP_LIST_EMPTY(&epoll->so_epoll.items) &&
+		OFP_TAILQ_EMPTY(&epoll->so_epoll.ready));
 }
 
 struct socket *dummy_socket_getter(int fd)
@@ -508,12 +590,14 @@ int modify_fd(int fd, int events)
 	return epoll_control(OFP_EPOLL_CTL_MOD, fd);
 }
 
-void fill_epoll_set(void)
+int fill_epoll_set(void)
 {
-	struct epoll_set *epoll_set;
+	int next_fd = fd + 2;
+
+	while (add_fd(next_fd) == 0)
+		next_fd++;
 
-	FOREACH(epoll_set, epoll.epoll_set)
-		epoll_set->fd = 1;
+	return next_fd;
 }
 
 int fd_not_readable(int fd)
@@ -528,8 +612,28 @@ int fd_is_readable(int fd)
 	return 1;
 }
 
-static int sleeper_spy(int timeout)
+int fd_is_writable(int fd)
+{
+	(void)fd;
+	return 1;
+}
+
+/* Readiness is found through socket wakeups. All fds map to non_epoll. */
+void make_readable(void)
+{
+	ofp_set_is_readable_checker(fd_is_readable);
+	ofp_epoll_notify(&non_epoll);
+}
+
+void *allocator(const char *name, uint64_t size)
+{
+	(void)name;
+	return malloc(size);
+}
+
+static int sleeper_spy(struct socket *epoll, int timeout)
 {
+	(void)epoll;
 	(void)timeout;
 	sleeper_called = 1;
 	return 0;
@@ -193,6 +193,11 @@ test_two_ports_vlan(void)
 	nh = ofp_get_next_hop(vrf1, ifaddr1, NULL);
 	assert_next_hop(nh, 0, port, vlan1);
 
+	CU_ASSERT_PTR_EQUAL(ofp_get_ifnet_by_ip(ifaddr, vrf),
+			    ofp_get_ifnet(port, vlan));
+	CU_ASSERT_PTR_EQUAL(ofp_get_ifnet_by_ip(ifaddr1, vrf1), dev);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_by_ip(ifaddr, vrf1));
+
 	res = ofp_config_interface_down(port, vlan);
 	CU_ASSERT_PTR_NULL_FATAL(res);
 	res = ofp_config_interface_down(port, vlan1);
@@ -207,6 +212,52 @@ test_two_ports_vlan(void)
 	CU_ASSERT_PTR_NULL_FATAL(dev);
 	nh = ofp_get_next_hop(vrf1, ifaddr1, NULL);
 	CU_ASSERT_PTR_NULL(nh);
+
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_by_ip(ifaddr, vrf));
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_by_ip(ifaddr1, vrf1));
+}
+
+static void
+test_qinq_port(void)
+{
+	int port = 0;
+	uint16_t vlan = 200, vlan1 = 201;
+	uint16_t svlan = 10, cvlan = 20;
+	uint16_t vrf = 0;
+	uint32_t ifaddr = 0x650AA8C0; /* C0.A8.0A.65 = 192.168.10.101 */
+	int masklen = 24;
+	struct ofp_ifnet *dev;
+	const char *res;
+
+	res = ofp_config_interface_up_v4(port, vlan, vrf, ifaddr, masklen);
+	CU_ASSERT_PTR_NULL_FATAL(res);
+	res = ofp_config_interface_qinq(port, vlan, svlan, cvlan);
+	CU_ASSERT_PTR_NULL_FATAL(res);
+
+	dev = ofp_get_ifnet(port, vlan);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(dev);
+	CU_ASSERT_EQUAL(dev->qinq_svlan, svlan);
+	CU_ASSERT_EQUAL(dev->qinq_cvlan, cvlan);
+	CU_ASSERT_PTR_EQUAL(ofp_get_ifnet_qinq(port, svlan, cvlan), dev);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_qinq(port, svlan, cvlan + 1));
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_qinq(port + 1, svlan, cvlan));
+
+	/* Tags are unique per port */
+	res = ofp_config_interface_qinq(port, vlan1, svlan, cvlan);
+	CU_ASSERT_PTR_NOT_NULL(res);
+	res = ofp_config_interface_down(port, vlan1);
+	CU_ASSERT_PTR_NULL(res);
+
+	/* Retag */
+	res = ofp_config_interface_qinq(port, vlan, svlan, cvlan + 1);
+	CU_ASSERT_PTR_NULL_FATAL(res);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_qinq(port, svlan, cvlan));
+	CU_ASSERT_PTR_EQUAL(ofp_get_ifnet_qinq(port, svlan, cvlan + 1), dev);
+
+	res = ofp_config_interface_down(port, vlan);
+	CU_ASSERT_PTR_NULL_FATAL(res);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet(port, vlan));
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_qinq(port, svlan, cvlan + 1));
 }
 
 static void
@@ -252,12 +303,17 @@ test_gre_port(void)
 	nh = ofp_get_next_hop(vrf, grep2p, NULL);
 	assert_next_hop(nh, 0, GRE_PORTS, greid);
 
+	CU_ASSERT_PTR_EQUAL(ofp_get_ifnet_by_tunnel(ifaddr, ifaddr + 1, vrf),
+			    dev);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_by_tunnel(ifaddr + 1, ifaddr, vrf));
+
 	res = ofp_config_interface_down(port, vlan);
 	CU_ASSERT_PTR_NULL_FATAL(res);
 	res = ofp_config_interface_down(GRE_PORTS, greid);
 	CU_ASSERT_PTR_NULL_FATAL(res);
 	dev = ofp_get_ifnet(GRE_PORTS, greid);
 	CU_ASSERT_PTR_NULL_FATAL(dev);
+	CU_ASSERT_PTR_NULL(ofp_get_ifnet_by_tunnel(ifaddr, ifaddr + 1, vrf));
 }
 
 #define mtx_lock(mtx)
@@ -310,6 +366,7 @@ main(void)
 	CU_TestInfo tests[] = {
 		{ const_cast("Test single port"), test_single_port_basic },
 		{ const_cast("Test two vlan ports"), test_two_ports_vlan },
+		{ const_cast("Test QinQ port"), test_qinq_port },
 		{ const_cast("Test gre port"), test_gre_port },
 		{ const_cast("Test queue"), test_queue },
 		CU_TEST_INFO_NULL,
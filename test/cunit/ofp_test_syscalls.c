@@ -12,6 +12,7 @@
 #include "ofp_socket.h"
 #include "ofpi_syscalls.h"
 #include "ofpi_socketvar.h"
+#include "ofpi_sockstate.h"
 #include "ofpi_protosw.h"
 #include "ofpi_shared_mem.h"
 #include "ofp_cunit_version.h"
@@ -32,6 +33,9 @@
 
 void *shm;
 odp_pool_t ofp_packet_pool;
+void ofp_init_global_param_from_file(ofp_global_param_t *params, const char *filename);
+ofp_global_param_t ofp_global_param;
+extern __thread ofp_global_param_t *global_param;
 int (*pru_attach)(struct socket *so, int proto, struct thread *td);
 int sleeper_called;
 uint32_t sleeper_timeout;
@@ -41,6 +45,9 @@ static int init(void)
 {
 	struct protosw *prp = ofp_pffindproto(OFP_AF_INET, 0, OFP_SOCK_STREAM);
 
+	global_param = &ofp_global_param;
+	ofp_init_global_param_from_file(global_param, "");
+
 	pru_attach = prp->pr_usrreqs->pru_attach;
 	prp->pr_usrreqs->pru_attach = pru_attach_stub;
 	return 0;
@@ -93,7 +100,7 @@ static void test_add_fd_to_set(void)
 
 static void test_clear_fd_from_set(void)
 {
-	const int fd = OFP_SOCK_NUM_OFFSET + OFP_NUM_SOCKETS_MAX - 1;
+	const int fd = OFP_SOCK_NUM_OFFSET + OFP_FD_SETSIZE - 1;
 	ofp_fd_set set;
 
 	OFP_FD_ZERO(&set);
@@ -143,7 +150,7 @@ static void test_select_times_out(void)
 {
 	SETUP;
 
-	const int accepting = OFP_SOCK_NUM_OFFSET + OFP_NUM_SOCKETS_MAX - 1;
+	const int accepting = OFP_SOCK_NUM_OFFSET + global_param->socket_max - 1;
 	const int listening = OFP_SOCK_NUM_OFFSET;
 	ofp_fd_set set;
 
@@ -255,6 +262,100 @@ static void test_select_with_sleep_interrupting_fd(void)
 	TEARDOWN;
 }
 
+static int sleeper_stub(void *channel, odp_rwlock_t *mtx, int priority,
+			const char *wmesg, uint32_t timeout);
+static void test_select_with_writable_fd(void)
+{
+	SETUP;
+
+	const int fd = ofp_socket(OFP_AF_INET, OFP_SOCK_STREAM, 0);
+	ofp_fd_set rset, wset;
+
+	OFP_FD_ZERO(&rset);
+	OFP_FD_ZERO(&wset);
+	OFP_FD_SET(fd, &rset);
+	OFP_FD_SET(fd, &wset);
+
+	ofp_get_sock_by_fd(fd)->so_snd.sb_state |= SBS_CANTSENDMORE;
+
+	CU_ASSERT_EQUAL(_ofp_select(fd + 1, &rset, &wset, NULL, NULL,
+				    sleeper_stub), 1);
+	CU_ASSERT_FALSE(OFP_FD_ISSET(fd, &rset));
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd, &wset));
+
+	TEARDOWN;
+}
+
+static void test_select_with_exceptional_fd(void)
+{
+	SETUP;
+
+	const int fd = ofp_socket(OFP_AF_INET, OFP_SOCK_STREAM, 0);
+	ofp_fd_set rset, eset;
+
+	OFP_FD_ZERO(&rset);
+	OFP_FD_ZERO(&eset);
+	OFP_FD_SET(fd, &rset);
+	OFP_FD_SET(fd, &eset);
+
+	set_listening_socket_readable(fd);
+	ofp_get_sock_by_fd(fd)->so_oobmark = 1;
+
+	CU_ASSERT_EQUAL(_ofp_select(fd + 1, &rset, NULL, &eset, NULL,
+				    sleeper_stub), 2);
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd, &rset));
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd, &eset));
+
+	TEARDOWN;
+}
+
+static void test_select_across_set_words(void)
+{
+	SETUP;
+
+	const int fd1 = OFP_SOCK_NUM_OFFSET + 63;
+	const int fd2 = OFP_SOCK_NUM_OFFSET + 64;
+	const int fd3 = OFP_SOCK_NUM_OFFSET + 127;
+	ofp_fd_set set;
+
+	OFP_FD_ZERO(&set);
+	OFP_FD_SET(fd1, &set);
+	OFP_FD_SET(fd2, &set);
+	OFP_FD_SET(fd3, &set);
+
+	set_listening_socket_readable(fd1);
+	set_listening_socket_readable(fd3);
+
+	CU_ASSERT_EQUAL(select_readfds(fd3 + 1, &set), 2);
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd1, &set));
+	CU_ASSERT_FALSE(OFP_FD_ISSET(fd2, &set));
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd3, &set));
+
+	TEARDOWN;
+}
+
+static int sleeper_signalling(void *channel, odp_rwlock_t *mtx, int priority,
+			      const char *wmesg, uint32_t timeout);
+static void test_select_rechecks_only_changed_fds(void)
+{
+	SETUP;
+
+	const int fd1 = ofp_socket(OFP_AF_INET, OFP_SOCK_STREAM, 0);
+	const int fd2 = ofp_socket(OFP_AF_INET, OFP_SOCK_STREAM, 0);
+	ofp_fd_set set;
+
+	OFP_FD_ZERO(&set);
+	OFP_FD_SET(fd1, &set);
+	OFP_FD_SET(fd2, &set);
+
+	CU_ASSERT_EQUAL(_ofp_select(fd2 + 1, &set, NULL, NULL, NULL,
+				    sleeper_signalling), 1);
+	CU_ASSERT_FALSE(OFP_FD_ISSET(fd1, &set));
+	CU_ASSERT_TRUE(OFP_FD_ISSET(fd2, &set));
+
+	TEARDOWN;
+}
+
 static char *const_cast(const char *str)
 {
 	return (char *)(uintptr_t)str;
@@ -290,6 +391,14 @@ int main(void)
 		  test_select_with_already_readable_fd },
 		{ const_cast("Select returns the number of readable fds after sleep"),
 		  test_select_with_sleep_interrupting_fd },
+		{ const_cast("Select leaves the fd in write set when socket is writable"),
+		  test_select_with_writable_fd },
+		{ const_cast("Select leaves the fd in except set on out-of-band data"),
+		  test_select_with_exceptional_fd },
+		{ const_cast("Select finds fds across fd set words"),
+		  test_select_across_set_words },
+		{ const_cast("Select re-checks only the fds that changed during sleep"),
+		  test_select_rechecks_only_changed_fds },
 		CU_TEST_INFO_NULL
 	};
 
@@ -390,7 +499,7 @@ void set_accepting_socket_readable(int fd)
 {
 	struct socket *socket = ofp_get_sock_by_fd(fd);
 
-	socket->so_comp.tqh_first = (struct socket *)1;
+	odp_atomic_store_u32(&socket->so_qlen, 1);
 }
 
 void set_listening_socket_readable(int fd)
@@ -411,3 +520,18 @@ int sleeper_fake(void *channel, odp_rwlock_t *mtx, int priority,
 	set_listening_socket_readable(OFP_SOCK_NUM_OFFSET);
 	return 0;
 }
+
+int sleeper_signalling(void *channel, odp_rwlock_t *mtx, int priority,
+		       const char *wmesg, uint32_t timeout)
+{
+	(void)channel;
+	(void)mtx;
+	(void)priority;
+	(void)wmesg;
+	(void)timeout;
+	/* Both become readable, only the second one is signalled */
+	set_listening_socket_readable(OFP_SOCK_NUM_OFFSET);
+	set_listening_socket_readable(OFP_SOCK_NUM_OFFSET + 1);
+	ofp_so_readiness_changed(ofp_get_sock_by_fd(OFP_SOCK_NUM_OFFSET + 1));
+	return 0;
+}